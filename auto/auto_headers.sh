@@ -45,6 +45,15 @@ else
     echo "#undef NI_LOG_SSIM_AT_INFO" >> $XCODER_AUTO_HEADERS_H
 fi
 
+case "$XCODER_LOG_LEVEL_FLOOR" in
+    none)  echo "#define NI_LOG_LEVEL_FLOOR 0" >> $XCODER_AUTO_HEADERS_H;;
+    fatal) echo "#define NI_LOG_LEVEL_FLOOR 1" >> $XCODER_AUTO_HEADERS_H;;
+    error) echo "#define NI_LOG_LEVEL_FLOOR 2" >> $XCODER_AUTO_HEADERS_H;;
+    info)  echo "#define NI_LOG_LEVEL_FLOOR 3" >> $XCODER_AUTO_HEADERS_H;;
+    debug) echo "#define NI_LOG_LEVEL_FLOOR 4" >> $XCODER_AUTO_HEADERS_H;;
+    *)     echo "#define NI_LOG_LEVEL_FLOOR 5" >> $XCODER_AUTO_HEADERS_H;;
+esac
+
 if [ $XCODER_SELF_KILL_ERR = YES ]; then
     echo "#define XCODER_SELF_KILL_ERR" >> $XCODER_AUTO_HEADERS_H
 else
@@ -17,6 +17,7 @@ XCODER_INCLUDEDIR=NO
 XCODER_SHAREDDIR=NO
 XCODER_DISABLE_BACKTRACE_PRINT=NO
 XCODER_SSIM_INFO_LEVEL_LOGGING=NO
+XCODER_LOG_LEVEL_FLOOR=trace
 
 #####################################################################################
 # menu
@@ -54,6 +55,10 @@ Options:
   --with-backtrace-print          enable print backtrace (default)
   --without-backtrace-print       disable print backtrace
 
+  --log-level-floor               Most verbose log level compiled into library call sites, messages
+                                  above it are removed at build time. One of: none, fatal, error,
+                                  info, debug, trace (default: trace)
+
   --prefix                        Set custom install location preix
                                   (default: /usr/local/)
   --libdir                        Set custom install location for libxcoder.so and pkgconfig files
@@ -116,6 +121,11 @@ function parse_user_option() {
             --without-backtrace-print)  XCODER_DISABLE_BACKTRACE_PRINT=YES;;
             --with-info-level-ssim-log)     XCODER_SSIM_INFO_LEVEL_LOGGING=YES;;
             --without-info-level-ssim-log)  XCODER_SSIM_INFO_LEVEL_LOGGING=NO;;
+            --log-level-floor*)         extract_arg "\-\-log-level-floor" $1 $2; eprc=$?;
+                                        if [ "$eprc" -eq 1 ]; then
+                                            shift;
+                                        fi
+                                        XCODER_LOG_LEVEL_FLOOR=$extract_arg_ret;;
             --prefix*)                  extract_arg "\-\-prefix" $1 $2; eprc=$?;
                                         if [ "$eprc" -eq 1 ]; then
                                             shift;
@@ -165,6 +175,7 @@ function regenerate_options() {
     if [ "$XCODER_LINUX_VIRT_IO_DRIVER" = YES ]; then XCODER_AUTO_CONFIGURE="${XCODER_AUTO_CONFIGURE} --with-linux-virt-io-driver"; else XCODER_AUTO_CONFIGURE="${XCODER_AUTO_CONFIGURE} --without-linux-virt-io-driver"; fi
     if [ "$XCODER_DISABLE_BACKTRACE_PRINT" = YES ]; then XCODER_AUTO_CONFIGURE="${XCODER_AUTO_CONFIGURE} --without-backtrace-print"; else XCODER_AUTO_CONFIGURE="${XCODER_AUTO_CONFIGURE} --with-backtrace-print"; fi
     if [ "$XCODER_SSIM_INFO_LEVEL_LOGGING" = YES ]; then XCODER_AUTO_CONFIGURE="${XCODER_AUTO_CONFIGURE} --with-info-level-ssim-log"; else XCODER_AUTO_CONFIGURE="${XCODER_AUTO_CONFIGURE} --without-info-level-ssim-log"; fi
+    XCODER_AUTO_CONFIGURE="${XCODER_AUTO_CONFIGURE} --log-level-floor=${XCODER_LOG_LEVEL_FLOOR}"
     echo "regenerate config: ${XCODER_AUTO_CONFIGURE}"
 }
 
@@ -182,6 +193,10 @@ function check_option_conflicts() {
     if [ "$XCODER_LINUX_VIRT_IO_DRIVER" = RESERVED ]; then echo "you must specify for the vm linux virt-io driver, see: ./configure --help"; __check_ok=NO; fi
     if [ "$XCODER_DUMP_DATA" = RESERVED ]; then echo "you must specify whether to compile data-dump macro, see: ./configure --help"; __check_ok=NO; fi
     if [ "$XCODER_DISABLE_BACKTRACE_PRINT" = RESERVED ]; then echo "you must specify whether to compile with print backtrace, see: ./configure --help"; __check_ok=NO; fi
+    case "$XCODER_LOG_LEVEL_FLOOR" in
+        none|fatal|error|info|debug|trace) ;;
+        *) echo "invalid --log-level-floor '${XCODER_LOG_LEVEL_FLOOR}', see: ./configure --help"; exit 1;;
+    esac
 }
 
 #####################################################################################
@@ -13,6 +13,7 @@ secure_compile=false;
 build_doxygen=false;
 disable_backtrace_print=false;
 info_level_ssim_log=false;
+log_level_floor="";
 RC=0
 
 while [ "$1" != "" ]; do
@@ -35,6 +36,7 @@ while [ "$1" != "" ]; do
                          echo "-b, --disable-backtrace-print    complie without print backtrace"
                          echo "-s, --secure-compile         compile with more foritication such as strong stack protection and RELRO";
                          echo "-m, --with-info-level-ssim-log   compile with SSIM logging at info level. Default is at debug level";
+                         echo "-f, --log-level-floor LEVEL     compile out log call sites above LEVEL (none, fatal, error, info, debug, trace). Default is trace";
                          echo "--doxygen                        compile Doxygen (does not compile libxcoder)"; exit 0
         ;;
         -w | windows)                   target_windows=true
@@ -61,6 +63,10 @@ while [ "$1" != "" ]; do
         ;;
         -m | --with-info-level-ssim-log)     info_level_ssim_log=true
         ;;
+        -f | --log-level-floor)         log_level_floor=$2; shift
+        ;;
+        --log-level-floor=*)            log_level_floor="${1#*=}"
+        ;;
         --doxygen)                      build_doxygen=true
         ;;
         *)               echo "Usage: ./build.sh [OPTION]..."; echo "Try './build.sh --help' for more information"; exit 1
@@ -116,6 +122,10 @@ if $info_level_ssim_log; then
     extra_config_flags="${extra_config_flags} --with-info-level-ssim-log"
 fi
 
+if [ -n "$log_level_floor" ]; then
+    extra_config_flags="${extra_config_flags} --log-level-floor=${log_level_floor}"
+fi
+
 if $dump_data; then
     extra_config_flags="${extra_config_flags} --with-data-dump"
 fi
@@ -31,6 +31,7 @@
 
 #if __linux__ || __APPLE__
 #include <unistd.h>
+#include <signal.h>
 #include <sys/types.h>
 #elif _WIN32
 #include "ni_getopt.h"
@@ -41,15 +42,28 @@
 #include "ni_rsrc_api.h"
 #include "ni_rsrc_priv.h"
 
+#if __linux__ || __APPLE__
+static void broker_sig_handler(int sig)
+{
+    (void)sig;
+    g_xcoder_stop_process = 1;
+}
+#endif
+
 int main(int argc, char *argv[])
 {
     int should_match_rev = 1;
     int opt;
     int timeout_seconds = 0;
+    int run_broker = 0;
+    int poll_interval_ms = NI_RSRC_BROKER_POLL_MS;
     ni_log_level_t log_level = NI_LOG_INFO;
+#if __linux__ || __APPLE__
+    int ret;
+#endif
 
     // arg handling
-    while ((opt = getopt(argc, argv, "hrt:l:v")) != -1)
+    while ((opt = getopt(argc, argv, "hrt:l:vbp:")) != -1)
     {
         switch (opt)
         {
@@ -66,10 +80,21 @@ int main(int argc, char *argv[])
                        "-l  Set loglevel of libxcoder API.\n"
                        "    [none, fatal, error, info, debug, trace]\n"
                        "    Default: info\n"
+                       "-b  Stay running as the local resource broker after initialization. \n"
+                       "    ni_rsrc_allocate_auto() then gets its device from the broker instead \n"
+                       "    of querying every device itself.\n"
+                       "-p  Broker load poll interval in milliseconds, 0 to never query the \n"
+                       "    devices. Default: %d\n"
                        "-h  Display this help and exit.\n"
                        "-v  Print version info.\n",
-                       NI_XCODER_REVISION);
+                       NI_XCODER_REVISION, NI_RSRC_BROKER_POLL_MS);
                 return 0;
+            case 'b':
+                run_broker = 1;
+                break;
+            case 'p':
+                poll_interval_ms = atoi(optarg);
+                break;
             case 'r':
                 should_match_rev = 0;
                 break;
@@ -103,8 +128,27 @@ int main(int argc, char *argv[])
   }
 
 #if __linux__ || __APPLE__
-  return ni_rsrc_init(should_match_rev, timeout_seconds);
+  ret = ni_rsrc_init(should_match_rev, timeout_seconds);
+  if (ret || !run_broker)
+  {
+    return ret;
+  }
+
+  if (signal(SIGTERM, broker_sig_handler) == SIG_ERR ||
+      signal(SIGHUP, broker_sig_handler) == SIG_ERR ||
+      signal(SIGINT, broker_sig_handler) == SIG_ERR)
+  {
+    perror("ERROR: signal handler setup");
+  }
+  return ni_rsrc_broker_run(poll_interval_ms) ? 1 : 0;
 #elif _WIN32
+  if (run_broker)
+  {
+    fprintf(stderr, "FATAL: resource broker is not supported on Windows\n");
+    return 1;
+  }
+  (void)poll_interval_ms;
+
   ni_retcode_t retval = ni_rsrc_init(should_match_rev, timeout_seconds);
   if (NI_RETCODE_SUCCESS == retval)
   {
@@ -25,6 +25,8 @@
  *  \brief  Audio/video related utility definitions
  ******************************************************************************/
 
+#define NI_LOG_MODULE NI_LOG_MODULE_AV_CODEC
+
 #ifdef _WIN32
 #include <winsock2.h>
 #else
@@ -730,10 +732,20 @@ static int set_roi_map(ni_session_context_t *p_enc_ctx,
     uint32_t customMapSize = ((block_size + 63) & (~63));
     if (!p_enc_ctx->roi_map)
     {
+        // uncharged in ni_device_session_close()
+        if (ni_mem_account_charge(
+                (ni_mem_account_t *)p_enc_ctx->p_mem_account, NI_MEM_CAT_ROI,
+                customMapSize))
+        {
+            return -1;
+        }
         p_enc_ctx->roi_map =
             (ni_enc_quad_roi_custom_map *)calloc(1, customMapSize);
         if (!p_enc_ctx->roi_map)
         {
+            ni_mem_account_uncharge(
+                (ni_mem_account_t *)p_enc_ctx->p_mem_account, NI_MEM_CAT_ROI,
+                customMapSize);
             return -1;
         }
     }
@@ -1590,11 +1602,29 @@ void ni_enc_prep_aux_data(ni_session_context_t *p_enc_ctx,
                 p_enc_ctx->roi_side_data_size != aux_data->size ||
                 memcmp(p_enc_ctx->av_rois, aux_data->data, aux_data->size) != 0)
             {
+                if (p_enc_ctx->av_rois)
+                {
+                    ni_mem_account_uncharge(
+                        (ni_mem_account_t *)p_enc_ctx->p_mem_account,
+                        NI_MEM_CAT_ROI, p_enc_ctx->roi_side_data_size);
+                }
                 p_enc_ctx->roi_side_data_size = aux_data->size;
                 p_enc_ctx->nb_rois = nb_roi;
 
                 free(p_enc_ctx->av_rois);
-                p_enc_ctx->av_rois = malloc(aux_data->size);
+                p_enc_ctx->av_rois = NULL;
+                if (!ni_mem_account_charge(
+                        (ni_mem_account_t *)p_enc_ctx->p_mem_account,
+                        NI_MEM_CAT_ROI, aux_data->size))
+                {
+                    p_enc_ctx->av_rois = malloc(aux_data->size);
+                    if (!p_enc_ctx->av_rois)
+                    {
+                        ni_mem_account_uncharge(
+                            (ni_mem_account_t *)p_enc_ctx->p_mem_account,
+                            NI_MEM_CAT_ROI, aux_data->size);
+                    }
+                }
                 if (!p_enc_ctx->av_rois)
                 {
                     ni_log2(p_enc_ctx, NI_LOG_ERROR,  "malloc ROI aux_data failed.\n");
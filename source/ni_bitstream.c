@@ -36,6 +36,8 @@
  *  \brief  Utility definitions to operate on bits in a bitstream
  ******************************************************************************/
 
+#define NI_LOG_MODULE NI_LOG_MODULE_AV_CODEC
+
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
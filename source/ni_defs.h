@@ -94,10 +94,12 @@ extern "C"
 // LIBXCODER_API_VERSION can be read to determine libxcoder to linked apps/APIs
 // compatibility. Recommend using ni_get_*_ver() functions in ni_util.h to
 // read correct version numbers if updating libxcoder but not linked apps.
+// The major version changes with the layout of public structs (ABI) and is
+// part of the shared library soname, apps must be rebuilt against it.
 #define MACRO_TO_STR(s) #s
 #define MACROS_TO_VER_STR(a, b) MACRO_TO_STR(a.b)
-#define LIBXCODER_API_VERSION_MAJOR 2   // Libxcoder API semantic major version
-#define LIBXCODER_API_VERSION_MINOR 64  // Libxcoder API semantic minor version
+#define LIBXCODER_API_VERSION_MAJOR 3   // Libxcoder API semantic major version
+#define LIBXCODER_API_VERSION_MINOR 0   // Libxcoder API semantic minor version
 #define LIBXCODER_API_VERSION MACROS_TO_VER_STR(LIBXCODER_API_VERSION_MAJOR, \
                                                 LIBXCODER_API_VERSION_MINOR)
 
@@ -238,6 +240,7 @@ typedef int32_t  ni_lock_handle_t;
 #define NI_MAX_TX_SZ 0xA00000
 
 #define NI_MEM_PAGE_ALIGNMENT 0x1000
+#define NI_CACHE_LINE_SIZE 64
 
 #define NI_MAX_DR_HWDESC_FRAME_INDEX 5363
 #define NI_MAX_DR_HWDESC_FRAME_INDEX_2 4993
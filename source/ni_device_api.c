@@ -26,6 +26,8 @@
  *          video processing
  ******************************************************************************/
 
+#define NI_LOG_MODULE NI_LOG_MODULE_DEVICE_API
+
 #if __linux__ || __APPLE__
 #define _GNU_SOURCE //O_DIRECT is Linux-specific.  One must define _GNU_SOURCE to obtain its definitions
 #if __linux__
@@ -99,9 +101,11 @@ ni_session_context_t *ni_device_session_context_alloc_init(void)
 {
     ni_session_context_t *p_ctx = NULL;
 
-    p_ctx = malloc(sizeof(ni_session_context_t));
-    if (!p_ctx)
+    // cache line aligned, see the per frame state at the start of the context
+    if (ni_posix_memalign((void **)&p_ctx, NI_CACHE_LINE_SIZE,
+                          sizeof(ni_session_context_t)))
     {
+        p_ctx = NULL;
         ni_log(NI_LOG_ERROR,
                "ERROR: %s() Failed to allocate memory for session context\n",
                __func__);
@@ -138,12 +142,15 @@ void ni_device_session_context_free(ni_session_context_t *p_ctx)
             ni_lat_meas_q_destroy(p_ctx->frame_time_q);
         }
 #endif
-        free(p_ctx);
+        ni_aligned_free(p_ctx);
     }
 }
 
 /*!*****************************************************************************
- *  \brief  Initialize already allocated session context to a known state
+ *  \brief  Initialize already allocated session context to a known state.
+ *          Memory a context initialized before still holds is freed first,
+ *          as by ni_device_session_context_clear(), except across a
+ *          sequence change.
  *
  *  \param[in]  p_ctx Pointer to an already allocated ni_session_context_t
  *              struct
@@ -158,6 +165,18 @@ ni_retcode_t ni_device_session_context_init(ni_session_context_t *p_ctx)
     int bitrate = 0;
     int framerate_num = 0;
     int framerate_denom = 0;
+    int numa_bind_buffers = 0;
+    void *lat_stats = NULL;
+    int pipeline_timing = 0;
+    void *p_pipeline_timing = NULL;
+    int session_stats = 0;
+    void *p_session_stats = NULL;
+    uint64_t dec_fme_buf_pool_budget = 0;
+    ni_dec_buffer_allocator_t dec_buffer_allocator = {0};
+    void *p_enc_aux_slab = NULL;
+    void *p_dec_pkt_fifo = NULL;
+    uint64_t mem_cap = 0;
+    void *p_mem_account = NULL;
 
     if (!p_ctx)
     {
@@ -170,6 +189,25 @@ ni_retcode_t ni_device_session_context_init(ni_session_context_t *p_ctx)
         bitrate = p_ctx->last_bitrate;
         framerate_num = p_ctx->last_framerate.framerate_num;
         framerate_denom = p_ctx->last_framerate.framerate_denom;
+        numa_bind_buffers = p_ctx->numa_bind_buffers;
+        // keep latency statistics across the sequence change
+        lat_stats = p_ctx->lat_stats;
+        pipeline_timing = p_ctx->pipeline_timing;
+        p_pipeline_timing = p_ctx->p_pipeline_timing;
+        session_stats = p_ctx->session_stats;
+        p_session_stats = p_ctx->p_session_stats;
+        dec_fme_buf_pool_budget = p_ctx->dec_fme_buf_pool_budget;
+        dec_buffer_allocator = p_ctx->dec_buffer_allocator;
+        p_enc_aux_slab = p_ctx->p_enc_aux_slab;
+        p_dec_pkt_fifo = p_ctx->p_dec_pkt_fifo;
+        mem_cap = p_ctx->mem_cap;
+        p_mem_account = p_ctx->p_mem_account;
+        // registered buffer layouts do not survive a resolution change
+        ni_enc_reg_bufs_destroy((ni_enc_reg_bufs_t *)p_ctx->p_enc_reg_bufs);
+    } else if (p_ctx->p_self == p_ctx)
+    {
+        // initialized before and not cleared: do not leak what it holds
+        ni_device_session_context_clear(p_ctx);
     }
 
     memset(p_ctx, 0, sizeof(ni_session_context_t));
@@ -177,6 +215,18 @@ ni_retcode_t ni_device_session_context_init(ni_session_context_t *p_ctx)
     p_ctx->last_bitrate = bitrate;
     p_ctx->last_framerate.framerate_num = framerate_num;
     p_ctx->last_framerate.framerate_denom = framerate_denom;
+    p_ctx->numa_bind_buffers = numa_bind_buffers;
+    p_ctx->lat_stats = lat_stats;
+    p_ctx->pipeline_timing = pipeline_timing;
+    p_ctx->p_pipeline_timing = p_pipeline_timing;
+    p_ctx->session_stats = session_stats;
+    p_ctx->p_session_stats = p_session_stats;
+    p_ctx->dec_fme_buf_pool_budget = dec_fme_buf_pool_budget;
+    p_ctx->dec_buffer_allocator = dec_buffer_allocator;
+    p_ctx->p_enc_aux_slab = p_enc_aux_slab;
+    ni_dec_pkt_fifo_set(p_ctx, (ni_dec_pkt_fifo_t *)p_dec_pkt_fifo);
+    p_ctx->mem_cap = mem_cap;
+    p_ctx->p_mem_account = p_mem_account;
 
     // Xcoder thread mutex init
     if (ni_pthread_mutex_init(&p_ctx->mutex))
@@ -204,6 +254,7 @@ ni_retcode_t ni_device_session_context_init(ni_session_context_t *p_ctx)
     }
     
     p_ctx->mutex_initialized = true;
+    p_ctx->p_self = p_ctx;
 
     // Init the max IO size to be invalid
     p_ctx->max_nvme_io_size = NI_INVALID_IO_SIZE;
@@ -222,6 +273,7 @@ ni_retcode_t ni_device_session_context_init(ni_session_context_t *p_ctx)
     p_ctx->low_delay_sync_flag = 0;
     p_ctx->async_mode = 0;
     p_ctx->pixel_format = NI_PIX_FMT_YUV420P;
+    p_ctx->numa_node = -1;
     // by default, select the least model load card
     strncpy(p_ctx->dev_xcoder_name, NI_BEST_MODEL_LOAD_STR,
             MAX_CHAR_IN_DEVICE_NAME);
@@ -247,6 +299,44 @@ ni_retcode_t ni_device_session_context_init(ni_session_context_t *p_ctx)
  ******************************************************************************/
 void ni_device_session_context_clear(ni_session_context_t *p_ctx)
 {
+    if (p_ctx->lat_stats)
+    {
+        ni_lat_stats_destroy((ni_lat_stats_t *)p_ctx->lat_stats);
+        p_ctx->lat_stats = NULL;
+    }
+    if (p_ctx->p_pipeline_timing)
+    {
+        ni_pipeline_timing_destroy(
+            (ni_pipeline_timing_t *)p_ctx->p_pipeline_timing);
+        p_ctx->p_pipeline_timing = NULL;
+    }
+    if (p_ctx->p_session_stats)
+    {
+        ni_session_rate_stats_destroy(
+            (ni_session_rate_stats_t *)p_ctx->p_session_stats);
+        p_ctx->p_session_stats = NULL;
+    }
+    if (p_ctx->p_enc_reg_bufs)
+    {
+        ni_enc_reg_bufs_destroy((ni_enc_reg_bufs_t *)p_ctx->p_enc_reg_bufs);
+        p_ctx->p_enc_reg_bufs = NULL;
+    }
+    if (p_ctx->p_enc_aux_slab)
+    {
+        // frames still holding slab buffers keep it alive
+        ni_enc_aux_slab_release((ni_enc_aux_slab_t *)p_ctx->p_enc_aux_slab);
+        p_ctx->p_enc_aux_slab = NULL;
+    }
+    ni_dec_pkt_fifo_free(p_ctx);
+    ni_input_frame_fifo_free(p_ctx);
+    if (p_ctx->p_mem_account)
+    {
+        // buffer pools and slabs outliving the session hold their own
+        // references
+        ni_mem_account_unref((ni_mem_account_t *)p_ctx->p_mem_account);
+        p_ctx->p_mem_account = NULL;
+    }
+
     if(p_ctx->mutex_initialized)
     {
         p_ctx->mutex_initialized = false;
@@ -254,6 +344,7 @@ void ni_device_session_context_clear(ni_session_context_t *p_ctx)
         ni_pthread_mutex_destroy(&p_ctx->low_delay_sync_mutex);
         ni_pthread_cond_destroy(&p_ctx->low_delay_sync_cond);
     }
+    p_ctx->p_self = NULL;
 }
 
 /*!*****************************************************************************
@@ -651,6 +742,8 @@ ni_retcode_t ni_device_session_open(ni_session_context_t *p_ctx,
   ni_device_context_t *p_device_context = NULL;
   ni_device_info_t *p_dev_info = NULL;
   ni_device_info_t dev_info = { 0 };
+  ni_device_load_table_t *p_load_table = NULL;
+  ni_device_load_t dev_load;
   /*! resource management context */
   ni_device_context_t *rsrc_ctx = NULL;
   int i = 0;
@@ -700,6 +793,34 @@ ni_retcode_t ni_device_session_open(ni_session_context_t *p_ctx,
       LRETURN;
   }
 
+  if (!p_ctx->lat_stats)
+  {
+      // freed by ni_device_session_context_clear
+      p_ctx->lat_stats = ni_lat_stats_create();
+  }
+  if (p_ctx->pipeline_timing && !p_ctx->p_pipeline_timing)
+  {
+      // freed by ni_device_session_context_clear
+      p_ctx->p_pipeline_timing = ni_pipeline_timing_create();
+  }
+  if (p_ctx->session_stats && !p_ctx->p_session_stats)
+  {
+      // freed by ni_device_session_context_clear
+      p_ctx->p_session_stats = ni_session_rate_stats_create();
+  }
+  if (!p_ctx->p_mem_account)
+  {
+      // freed by ni_device_session_context_clear
+      p_ctx->p_mem_account = ni_mem_account_create(p_ctx->mem_cap);
+      if (!p_ctx->p_mem_account)
+      {
+          ni_log2(p_ctx, NI_LOG_ERROR, "ERROR: %s() mem account allocation "
+                  "failed\n", __func__);
+          retval = NI_RETCODE_ERROR_MEM_ALOC;
+          LRETURN;
+      }
+  }
+
   p_ctx->p_hdr_buf = NULL;
   p_ctx->hdr_buf_size = 0;
 
@@ -745,11 +866,8 @@ ni_retcode_t ni_device_session_open(ni_session_context_t *p_ctx,
   p_ctx->reconfig_intra_period = -1;
   p_ctx->reconfig_slice_arg = 0;
 
-  memset(p_ctx->input_frame_fifo, 0, sizeof(ni_input_frame) * 120);
-  for (i = 0; i < 120; i++)
-  {
-    p_ctx->input_frame_fifo[i].usable = -1;
-  }
+  // allocated again by the first encoder input frame kept for PSNR
+  ni_input_frame_fifo_free(p_ctx);
 
   handle = p_ctx->device_handle;
   handle1 = p_ctx->blk_io_handle;
@@ -891,6 +1009,7 @@ ni_retcode_t ni_device_session_open(ni_session_context_t *p_ctx,
             LRETURN;
         }
 
+        p_load_table = ni_rsrc_get_load_table();
         for (i = 0; i < num_coders; i++)
         {
             tmp_id = p_device_pool->p_device_queue->xcoders[query_type][i];
@@ -935,6 +1054,7 @@ ni_retcode_t ni_device_session_open(ni_session_context_t *p_ctx,
             }
             ni_rsrc_update_record(p_device_context, &p_session_context);
             p_dev_info = p_device_context->p_device_info;
+            ni_rsrc_get_device_load(p_load_table, p_dev_info, &dev_load);
 
             // here we select the best load
             // for decoder/encoder: check the model_load/real_load
@@ -951,19 +1071,19 @@ ni_retcode_t ni_device_session_open(ni_session_context_t *p_ctx,
             {
                 if (use_model_load)
                 {
-                    curr_load = p_dev_info->model_load;
+                    curr_load = dev_load.model_load;
                 } else
                 {
-                    curr_load = p_dev_info->load;
+                    curr_load = dev_load.load;
                 }
 
                 if (i == 0 || curr_load < least_load ||
                     (curr_load == least_load &&
-                     p_dev_info->active_num_inst < num_sw_instances))
+                     dev_load.active_num_inst < num_sw_instances))
                 {
                     guid = tmp_id;
                     least_load = curr_load;
-                    num_sw_instances = p_dev_info->active_num_inst;
+                    num_sw_instances = dev_load.active_num_inst;
                     memcpy(&dev_info, p_dev_info, sizeof(ni_device_info_t));
                 }
             }
@@ -1061,6 +1181,7 @@ ni_retcode_t ni_device_session_open(ni_session_context_t *p_ctx,
   }
 
   memcpy(p_ctx->fw_rev , p_device_context->p_device_info->fw_rev, 8);
+  p_ctx->numa_node = ni_rsrc_get_numa_node(p_device_context->p_device_info);
 
   ni_rsrc_free_device_context(p_device_context);
 
@@ -1219,9 +1340,21 @@ ni_retcode_t ni_device_session_open(ni_session_context_t *p_ctx,
     }
   }
 
+  if (ni_mem_account_charge((ni_mem_account_t *)p_ctx->p_mem_account,
+                            NI_MEM_CAT_KEEP_ALIVE,
+                            sizeof(ni_thread_arg_struct_t) + NI_DATA_BUFFER_LEN))
+  {
+    ni_log2(p_ctx, NI_LOG_ERROR,  "ERROR: keep alive above session memory cap\n");
+    ni_device_session_close(p_ctx, 0, device_type);
+    retval = NI_RETCODE_ERROR_MEM_ALOC;
+    LRETURN;
+  }
   p_ctx->keep_alive_thread_args = (ni_thread_arg_struct_t *) malloc(sizeof(ni_thread_arg_struct_t));
   if (!p_ctx->keep_alive_thread_args)
   {
+    ni_mem_account_uncharge((ni_mem_account_t *)p_ctx->p_mem_account,
+                            NI_MEM_CAT_KEEP_ALIVE,
+                            sizeof(ni_thread_arg_struct_t) + NI_DATA_BUFFER_LEN);
     ni_log2(p_ctx, NI_LOG_ERROR,  "ERROR: thread_args allocation failed!\n");
     ni_device_session_close(p_ctx, 0, device_type);
     retval = NI_RETCODE_ERROR_MEM_ALOC;
@@ -1244,6 +1377,10 @@ ni_retcode_t ni_device_session_open(ni_session_context_t *p_ctx,
                         sysconf(_SC_PAGESIZE), NI_DATA_BUFFER_LEN))
   {
       ni_log2(p_ctx, NI_LOG_ERROR,  "ERROR: keep alive p_buffer allocation failed!\n");
+      ni_memfree(p_ctx->keep_alive_thread_args);
+      ni_mem_account_uncharge((ni_mem_account_t *)p_ctx->p_mem_account,
+                              NI_MEM_CAT_KEEP_ALIVE,
+                              sizeof(ni_thread_arg_struct_t) + NI_DATA_BUFFER_LEN);
       ni_device_session_close(p_ctx, 0, device_type);
       retval = NI_RETCODE_ERROR_MEM_ALOC;
       LRETURN;
@@ -1259,6 +1396,9 @@ ni_retcode_t ni_device_session_open(ni_session_context_t *p_ctx,
     p_ctx->keep_alive_thread = (ni_pthread_t){0};
     ni_aligned_free(p_ctx->keep_alive_thread_args->p_buffer);
     ni_memfree(p_ctx->keep_alive_thread_args);
+    ni_mem_account_uncharge((ni_mem_account_t *)p_ctx->p_mem_account,
+                            NI_MEM_CAT_KEEP_ALIVE,
+                            sizeof(ni_thread_arg_struct_t) + NI_DATA_BUFFER_LEN);
     ni_device_session_close(p_ctx, 0, device_type);
     retval = NI_RETCODE_ERROR_MEM_ALOC;
     LRETURN;
@@ -1344,6 +1484,10 @@ ni_retcode_t ni_device_session_close(ni_session_context_t *p_ctx,
         }
         ni_aligned_free(p_ctx->keep_alive_thread_args->p_buffer);
         ni_memfree(p_ctx->keep_alive_thread_args);
+        ni_mem_account_uncharge((ni_mem_account_t *)p_ctx->p_mem_account,
+                                NI_MEM_CAT_KEEP_ALIVE,
+                                sizeof(ni_thread_arg_struct_t) +
+                                    NI_DATA_BUFFER_LEN);
     } else
     {
         ni_log2(p_ctx, NI_LOG_ERROR,  "invalid keep alive thread: %u\n",
@@ -1398,6 +1542,8 @@ ni_retcode_t ni_device_session_close(ni_session_context_t *p_ctx,
     ni_memfree(p_ctx->hevc_sub_ctu_roi_buf);
     ni_memfree(p_ctx->p_master_display_meta_data);
     ni_memfree(p_ctx->enc_change_params);
+    ni_mem_account_uncharge_all((ni_mem_account_t *)p_ctx->p_mem_account,
+                                NI_MEM_CAT_ROI);
     p_ctx->hdr_buf_size = 0;
     p_ctx->roi_side_data_size = 0;
     p_ctx->nb_rois = 0;
@@ -1635,6 +1781,8 @@ int ni_device_session_write(ni_session_context_t *p_ctx, ni_session_data_io_t *p
   }
   p_ctx->xcoder_state |= NI_XCODER_WRITE_STATE;
   ni_pthread_mutex_unlock(&p_ctx->mutex);
+  ni_pipeline_timing_call_begin(
+      (ni_pipeline_timing_t *)p_ctx->p_pipeline_timing, NI_PIPELINE_DIR_WRITE);
 
   switch (device_type)
   {
@@ -1662,6 +1810,10 @@ int ni_device_session_write(ni_session_context_t *p_ctx, ni_session_data_io_t *p
     }
   }
 
+  ni_pipeline_timing_call_end(
+      (ni_pipeline_timing_t *)p_ctx->p_pipeline_timing, NI_PIPELINE_DIR_WRITE);
+  ni_session_rate_stats_call((ni_session_rate_stats_t *)p_ctx->p_session_stats,
+                             NI_PIPELINE_DIR_WRITE, retval);
   ni_pthread_mutex_lock(&p_ctx->mutex);
   p_ctx->xcoder_state &= ~NI_XCODER_WRITE_STATE;
   ni_pthread_mutex_unlock(&p_ctx->mutex);
@@ -1735,6 +1887,8 @@ int ni_device_session_read(ni_session_context_t *p_ctx, ni_session_data_io_t *p_
   }
   p_ctx->xcoder_state |= NI_XCODER_READ_STATE;
   ni_pthread_mutex_unlock(&p_ctx->mutex);
+  ni_pipeline_timing_call_begin(
+      (ni_pipeline_timing_t *)p_ctx->p_pipeline_timing, NI_PIPELINE_DIR_READ);
 
   switch (device_type)
   {
@@ -1823,6 +1977,10 @@ int ni_device_session_read(ni_session_context_t *p_ctx, ni_session_data_io_t *p_
     }
   }
 
+  ni_pipeline_timing_call_end(
+      (ni_pipeline_timing_t *)p_ctx->p_pipeline_timing, NI_PIPELINE_DIR_READ);
+  ni_session_rate_stats_call((ni_session_rate_stats_t *)p_ctx->p_session_stats,
+                             NI_PIPELINE_DIR_READ, retval);
   ni_pthread_mutex_lock(&p_ctx->mutex);
   p_ctx->xcoder_state &= ~NI_XCODER_READ_STATE;
   ni_pthread_mutex_unlock(&p_ctx->mutex);
@@ -1952,6 +2110,142 @@ ni_retcode_t ni_device_session_query_detail_v1(ni_session_context_t* p_ctx, ni_d
   return retval;
 }
 
+/*!*****************************************************************************
+ *  \brief  Get the latency distribution of a session for one processing stage
+ *
+ *  \param[in]  p_ctx    Pointer to a caller allocated ni_session_context_t
+ *  \param[in]  stage    processing stage
+ *  \param[out] p_stats  latency statistics, all zero if no sample recorded
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+ni_retcode_t ni_device_session_get_latency_stats(ni_session_context_t *p_ctx,
+                                                 ni_latency_stage_t stage,
+                                                 ni_latency_stats_t *p_stats)
+{
+    if (!p_ctx || !p_stats || stage < NI_LATENCY_STAGE_ENCODE ||
+        stage >= NI_LATENCY_STAGE_MAX)
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s passed parameters are invalid, return\n",
+               __func__);
+        return NI_RETCODE_INVALID_PARAM;
+    }
+
+    if (p_ctx->lat_stats)
+    {
+        ni_lat_stats_get((ni_lat_stats_t *)p_ctx->lat_stats, stage, p_stats);
+    } else
+    {
+        memset(p_stats, 0, sizeof(*p_stats));
+    }
+    return NI_RETCODE_SUCCESS;
+}
+
+/*!*****************************************************************************
+ *  \brief  Clear the latency histograms of a session for all stages
+ *
+ *  \param[in]  p_ctx    Pointer to a caller allocated ni_session_context_t
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+ni_retcode_t ni_device_session_reset_latency_stats(ni_session_context_t *p_ctx)
+{
+    if (!p_ctx)
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s passed parameters are null, return\n",
+               __func__);
+        return NI_RETCODE_INVALID_PARAM;
+    }
+
+    if (p_ctx->lat_stats)
+    {
+        ni_lat_stats_reset((ni_lat_stats_t *)p_ctx->lat_stats);
+    }
+    return NI_RETCODE_SUCCESS;
+}
+
+/*!*****************************************************************************
+ *  \brief  Get the per stage timing of the write/read calls of a session
+ *
+ *  \param[in]  p_ctx    Pointer to a caller allocated ni_session_context_t
+ *  \param[out] p_stats  timing statistics, all zero if not enabled
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+ni_retcode_t ni_device_session_get_pipeline_timing(ni_session_context_t *p_ctx,
+                                                   ni_pipeline_timing_stats_t *p_stats)
+{
+    if (!p_ctx || !p_stats)
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s passed parameters are null, return\n",
+               __func__);
+        return NI_RETCODE_INVALID_PARAM;
+    }
+
+    ni_pipeline_timing_get((ni_pipeline_timing_t *)p_ctx->p_pipeline_timing,
+                           p_stats);
+    return NI_RETCODE_SUCCESS;
+}
+
+/*!*****************************************************************************
+ *  \brief  Clear the per stage timing of a session
+ *
+ *  \param[in]  p_ctx    Pointer to a caller allocated ni_session_context_t
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+ni_retcode_t ni_device_session_reset_pipeline_timing(ni_session_context_t *p_ctx)
+{
+    if (!p_ctx)
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s passed parameters are null, return\n",
+               __func__);
+        return NI_RETCODE_INVALID_PARAM;
+    }
+
+    ni_pipeline_timing_reset((ni_pipeline_timing_t *)p_ctx->p_pipeline_timing);
+    return NI_RETCODE_SUCCESS;
+}
+
+/*!*****************************************************************************
+ *  \brief  Get the stats of a session with rates over sliding windows, without
+ *          device I/O
+ *
+ *  \param[in]  p_ctx       Pointer to a caller allocated ni_session_context_t
+ *  \param[out] p_snapshot  session stats, all zero if not enabled
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+ni_retcode_t ni_device_session_get_stats_snapshot(ni_session_context_t *p_ctx,
+                                                 ni_session_stats_snapshot_t *p_snapshot)
+{
+    if (!p_ctx || !p_snapshot)
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s passed parameters are null, return\n",
+               __func__);
+        return NI_RETCODE_INVALID_PARAM;
+    }
+
+    ni_session_rate_stats_get((ni_session_rate_stats_t *)p_ctx->p_session_stats,
+                              p_snapshot);
+    return NI_RETCODE_SUCCESS;
+}
+
 /*!*****************************************************************************
  *  \brief  Send namespace num and SRIOv index to the device with specified logic block
  *          address.
@@ -2160,7 +2454,7 @@ ni_retcode_t ni_frame_buffer_alloc(ni_frame_t *p_frame, int video_width,
   //Check if need to realocate
   if (p_frame->buffer_size != buffer_size)
   {
-      if (ni_posix_memalign(&p_buffer, sysconf(_SC_PAGESIZE), buffer_size))
+      if (ni_mem_pool_alloc(&p_buffer, buffer_size))
       {
           ni_log(NI_LOG_ERROR, "ERROR %d: %s() Cannot allocate p_frame buffer.\n",
                  NI_ERRNO, __func__);
@@ -2172,6 +2466,7 @@ ni_retcode_t ni_frame_buffer_alloc(ni_frame_t *p_frame, int video_width,
     //memset(p_buffer, 0, buffer_size);
     p_frame->buffer_size = buffer_size;
     p_frame->p_buffer = p_buffer;
+    p_frame->p_pool_buffer = p_buffer;
 
     ni_log(NI_LOG_DEBUG, "%s: Allocate new p_frame buffer\n", __func__);
   }
@@ -2442,7 +2737,7 @@ ni_retcode_t ni_frame_buffer_alloc_dl(ni_frame_t *p_frame, int video_width,
     if (p_frame->buffer_size != buffer_size)
     {
         ni_log(NI_LOG_DEBUG, "%s: Allocate new p_frame buffer\n", __func__);
-        if (ni_posix_memalign(&p_buffer, sysconf(_SC_PAGESIZE), buffer_size))
+        if (ni_mem_pool_alloc(&p_buffer, buffer_size))
         {
             ni_log(NI_LOG_ERROR,
                    "ERROR %d: %s() Cannot allocate p_frame buffer.\n", NI_ERRNO,
@@ -2450,6 +2745,7 @@ ni_retcode_t ni_frame_buffer_alloc_dl(ni_frame_t *p_frame, int video_width,
             retval = NI_RETCODE_ERROR_MEM_ALOC;
             LRETURN;
         }
+        p_frame->p_pool_buffer = p_buffer;
     } else
     {
         ni_log(NI_LOG_DEBUG, "%s: reuse p_frame buffer\n", __func__);
@@ -2509,6 +2805,9 @@ END:
  *
  *  \return On success
  *                          NI_RETCODE_SUCCESS
+ *          When all buffers the pool's budget allows are in use, or the
+ *          caller allocator has none
+ *                          NI_RETCODE_EAGAIN
  *          On failure
  *                          NI_RETCODE_INVALID_PARAM
  *                          NI_RETCODE_ERROR_MEM_ALOC
@@ -2594,17 +2893,46 @@ ni_retcode_t ni_decoder_frame_buffer_alloc(ni_buf_pool_t *p_pool,
         LRETURN;
     }
 
-    p_frame->dec_buf = ni_buf_pool_get_buffer(p_pool);
-    if (! p_frame->dec_buf)
+    if (p_pool->allocator.alloc_buffer)
     {
-      retval = NI_RETCODE_ERROR_MEM_ALOC;
-      LRETURN;
+      p_frame->dec_buf = NULL;
+      p_frame->p_buffer = (uint8_t *)p_pool->allocator.alloc_buffer(
+          p_pool->allocator.p_user, (uint32_t)buffer_size,
+          &p_frame->p_dec_alloc_opaque);
+      if (! p_frame->p_buffer)
+      {
+        // the caller is out of buffers until it releases frames
+        retval = NI_RETCODE_EAGAIN;
+        LRETURN;
+      }
+      p_frame->dec_allocator = p_pool->allocator;
+      if ((uintptr_t)p_frame->p_buffer % NI_MEM_PAGE_ALIGNMENT)
+      {
+        ni_log(NI_LOG_ERROR, "ERROR %s: caller buffer %p not page aligned\n",
+               __func__, p_frame->p_buffer);
+        ni_decoder_frame_buffer_free(p_frame);
+        retval = NI_RETCODE_INVALID_PARAM;
+        LRETURN;
+      }
+      ni_log(NI_LOG_DEBUG, "%s: got caller frame buffer %p\n", __func__,
+             p_frame->p_buffer);
     }
+    else
+    {
+      p_frame->dec_buf = ni_buf_pool_get_buffer(p_pool);
+      if (! p_frame->dec_buf)
+      {
+        // backpressure: the pool is at its budget until frames are freed
+        retval = ni_buf_pool_at_cap(p_pool) ? NI_RETCODE_EAGAIN :
+                                              NI_RETCODE_ERROR_MEM_ALOC;
+        LRETURN;
+      }
 
-    p_frame->p_buffer = p_frame->dec_buf->buf;
+      p_frame->p_buffer = p_frame->dec_buf->buf;
 
-    ni_log(NI_LOG_DEBUG, "%s: got new frame ptr %p buffer %p\n", __func__,
-           p_frame->p_buffer, p_frame->dec_buf);
+      ni_log(NI_LOG_DEBUG, "%s: got new frame ptr %p buffer %p\n", __func__,
+             p_frame->p_buffer, p_frame->dec_buf);
+    }
   }
   else
   {
@@ -2830,8 +3158,16 @@ ni_retcode_t ni_encoder_frame_zerocopy_buffer_alloc(ni_frame_t *p_frame,
 
   if (p_frame->buffer_size)
   {
+      // also free the temp p_buffer allocated for niFrameSurface1_t in encoder init stage
+      if (p_frame->p_buffer == p_frame->p_pool_buffer)
+      {
+          ni_mem_pool_free(p_frame->p_buffer, p_frame->buffer_size);
+      } else
+      {
+          ni_aligned_free(p_frame->p_buffer);
+      }
+      p_frame->p_pool_buffer = NULL;
       p_frame->buffer_size = 0;  //notify p_frame->p_buffer is not allocated
-      ni_aligned_free(p_frame->p_buffer); // also free the temp p_buffer allocated for niFrameSurface1_t in encoder init stage
   }
 
   p_frame->p_buffer = (uint8_t *)data[0];
@@ -2936,6 +3272,367 @@ END:
     return retval;
 }
 
+/*!*****************************************************************************
+ *  \brief  Register a caller owned YUV/RGBA buffer as encoder input, to be
+ *          used with ni_encoder_frame_registered_buffer_alloc for every frame
+ *          written from it. The layout is checked once against the session's
+ *          zero copy linesizes (see ni_encoder_frame_zerocopy_check): planes
+ *          with the same linesize are sent to the device from the buffer
+ *          directly, only the others are copied, into a staging buffer
+ *          allocated here.
+ *
+ *  \param[in]  p_enc_ctx  encoder session context, with p_session_config set
+ *  \param[in]  width      picture width
+ *  \param[in]  height     picture height
+ *  \param[in]  data       plane pointers (for each of YUV planes), must stay
+ *                         valid until unregistered
+ *  \param[in]  linesize   plane linesizes
+ *  \param[out] p_handle   handle of the registered buffer
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ *                          NI_RETCODE_ERROR_UNSUPPORTED_FEATURE (session
+ *                          has no zero copy linesizes)
+ *                          NI_RETCODE_ERROR_MEM_ALOC (also when
+ *                          NI_ENC_MAX_REGISTERED_BUFFERS are registered)
+ ******************************************************************************/
+ni_retcode_t ni_encoder_frame_buffer_register(ni_session_context_t *p_enc_ctx,
+                                              int width, int height,
+                                              const uint8_t *data[],
+                                              const int linesize[],
+                                              int *p_handle)
+{
+    ni_xcoder_params_t *p_param;
+    ni_enc_reg_bufs_t *p_bufs;
+    ni_enc_reg_buf_t *p_reg;
+    int session_linesize[NI_MAX_NUM_SW_FRAME_DATA_POINTERS] = {0};
+    int row_bytes[NI_MAX_NUM_SW_FRAME_DATA_POINTERS] = {0};
+    int rows[NI_MAX_NUM_SW_FRAME_DATA_POINTERS];
+    uint32_t plane_size[NI_MAX_NUM_SW_FRAME_DATA_POINTERS] = {0};
+    uint32_t staging_size = 0;
+    int num_planes;
+    int handle;
+    int i;
+
+    if (!p_enc_ctx || !data || !linesize || !p_handle || !data[0] ||
+        width > NI_MAX_RESOLUTION_WIDTH || width <= 0 ||
+        height > NI_MAX_RESOLUTION_HEIGHT || height <= 0)
+    {
+        ni_log2(p_enc_ctx, NI_LOG_ERROR, "ERROR: %s passed parameters are "
+                "null or not supported, width %d, height %d\n", __func__,
+                width, height);
+        return NI_RETCODE_INVALID_PARAM;
+    }
+    p_param = (ni_xcoder_params_t *)p_enc_ctx->p_session_config;
+    if (!p_param)
+    {
+        ni_log2(p_enc_ctx, NI_LOG_ERROR, "ERROR: %s no session config\n",
+                __func__);
+        return NI_RETCODE_INVALID_PARAM;
+    }
+    // the device only takes unpadded frames at the linesizes it was opened
+    // with, other layouts go through ni_encoder_sw_frame_buffer_alloc
+    if (!p_param->luma_linesize)
+    {
+        ni_log2(p_enc_ctx, NI_LOG_DEBUG, "%s: session has no zero copy "
+                "linesizes\n", __func__);
+        return NI_RETCODE_ERROR_UNSUPPORTED_FEATURE;
+    }
+
+    switch (p_enc_ctx->pixel_format)
+    {
+        case NI_PIX_FMT_YUV420P:
+        case NI_PIX_FMT_YUV420P10LE:
+            num_planes = 3;
+            row_bytes[0] = width *
+                (p_enc_ctx->pixel_format == NI_PIX_FMT_YUV420P10LE ? 2 : 1);
+            row_bytes[1] = row_bytes[2] = row_bytes[0] / 2;
+            break;
+        case NI_PIX_FMT_NV12:
+        case NI_PIX_FMT_P010LE:
+            num_planes = 2;
+            row_bytes[0] = row_bytes[1] =
+                width * (p_enc_ctx->pixel_format == NI_PIX_FMT_P010LE ? 2 : 1);
+            break;
+        case NI_PIX_FMT_ABGR:
+        case NI_PIX_FMT_ARGB:
+        case NI_PIX_FMT_RGBA:
+        case NI_PIX_FMT_BGRA:
+            num_planes = 1;
+            row_bytes[0] = width * 4;
+            break;
+        default:
+            ni_log2(p_enc_ctx, NI_LOG_ERROR, "ERROR: %s pixel_format %d not "
+                    "supported\n", __func__, p_enc_ctx->pixel_format);
+            return NI_RETCODE_ERROR_UNSUPPORTED_FEATURE;
+    }
+    session_linesize[0] = p_param->luma_linesize;
+    session_linesize[1] = session_linesize[2] = p_param->chroma_linesize;
+    rows[0] = height;
+    rows[1] = rows[2] = height / 2;
+
+    for (i = 0; i < num_planes; i++)
+    {
+        if (!data[i] || linesize[i] < row_bytes[i] ||
+            session_linesize[i] < row_bytes[i])
+        {
+            ni_log2(p_enc_ctx, NI_LOG_ERROR, "ERROR: %s plane %d data %p "
+                    "linesize %d session linesize %d, %d bytes per row\n",
+                    __func__, i, data[i], linesize[i], session_linesize[i],
+                    row_bytes[i]);
+            return NI_RETCODE_INVALID_PARAM;
+        }
+        if (linesize[i] != session_linesize[i])
+        {
+            // page aligned staging planes need no start buffer copy
+            plane_size[i] = ni_round_up(
+                (uint32_t)(session_linesize[i] * rows[i]), NI_MEM_PAGE_ALIGNMENT);
+            staging_size += plane_size[i];
+        }
+    }
+
+    p_bufs = (ni_enc_reg_bufs_t *)p_enc_ctx->p_enc_reg_bufs;
+    if (!p_bufs)
+    {
+        p_bufs = (ni_enc_reg_bufs_t *)calloc(1, sizeof(ni_enc_reg_bufs_t));
+        if (!p_bufs)
+        {
+            return NI_RETCODE_ERROR_MEM_ALOC;
+        }
+        p_bufs->p_mem_account = (ni_mem_account_t *)p_enc_ctx->p_mem_account;
+        ni_mem_account_ref(p_bufs->p_mem_account);
+        p_enc_ctx->p_enc_reg_bufs = p_bufs;
+    }
+    for (handle = 0; handle < NI_ENC_MAX_REGISTERED_BUFFERS; handle++)
+    {
+        if (!p_bufs->buf[handle].registered)
+        {
+            break;
+        }
+    }
+    if (handle == NI_ENC_MAX_REGISTERED_BUFFERS)
+    {
+        ni_log2(p_enc_ctx, NI_LOG_ERROR, "ERROR: %s %d buffers registered "
+                "already\n", __func__, NI_ENC_MAX_REGISTERED_BUFFERS);
+        return NI_RETCODE_ERROR_MEM_ALOC;
+    }
+    p_reg = &p_bufs->buf[handle];
+
+    if (staging_size &&
+        ni_mem_account_charge(p_bufs->p_mem_account, NI_MEM_CAT_ENC_INPUT,
+                              staging_size))
+    {
+        ni_log2(p_enc_ctx, NI_LOG_ERROR, "ERROR: %s %u bytes staging buffer "
+                "above session memory cap\n", __func__, staging_size);
+        return NI_RETCODE_ERROR_MEM_ALOC;
+    }
+    if (staging_size &&
+        ni_mem_pool_alloc((void **)&p_reg->p_staging, staging_size))
+    {
+        ni_log2(p_enc_ctx, NI_LOG_ERROR, "ERROR: %s cannot allocate %u bytes "
+                "staging buffer\n", __func__, staging_size);
+        ni_mem_account_uncharge(p_bufs->p_mem_account, NI_MEM_CAT_ENC_INPUT,
+                                staging_size);
+        return NI_RETCODE_ERROR_MEM_ALOC;
+    }
+    p_reg->staging_size = staging_size;
+    p_reg->width = width;
+    p_reg->height = height;
+    staging_size = 0;
+    for (i = 0; i < num_planes; i++)
+    {
+        p_reg->p_data[i] = data[i];
+        p_reg->linesize[i] = linesize[i];
+        p_reg->session_linesize[i] = session_linesize[i];
+        if (plane_size[i])
+        {
+            p_reg->copy_row_bytes[i] = row_bytes[i];
+            p_reg->p_staging_plane[i] = p_reg->p_staging + staging_size;
+            staging_size += plane_size[i];
+        }
+    }
+    p_reg->registered = 1;
+    *p_handle = handle;
+
+    ni_log2(p_enc_ctx, NI_LOG_DEBUG, "%s: handle %d %dx%d linesize %d/%d/%d, "
+            "copied planes %s%s%s\n", __func__, handle, width, height,
+            linesize[0], num_planes > 1 ? linesize[1] : 0,
+            num_planes > 2 ? linesize[2] : 0,
+            p_reg->copy_row_bytes[0] ? "0 " : "",
+            p_reg->copy_row_bytes[1] ? "1 " : "",
+            p_reg->copy_row_bytes[2] ? "2" : "");
+    return NI_RETCODE_SUCCESS;
+}
+
+/*!*****************************************************************************
+ *  \brief  Unregister a buffer registered with
+ *          ni_encoder_frame_buffer_register
+ *
+ *  \param[in] p_enc_ctx  encoder session context
+ *  \param[in] handle     handle of the registered buffer
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+ni_retcode_t ni_encoder_frame_buffer_unregister(ni_session_context_t *p_enc_ctx,
+                                                int handle)
+{
+    ni_enc_reg_bufs_t *p_bufs;
+
+    if (!p_enc_ctx || handle < 0 || handle >= NI_ENC_MAX_REGISTERED_BUFFERS ||
+        !p_enc_ctx->p_enc_reg_bufs)
+    {
+        return NI_RETCODE_INVALID_PARAM;
+    }
+    p_bufs = (ni_enc_reg_bufs_t *)p_enc_ctx->p_enc_reg_bufs;
+    if (!p_bufs->buf[handle].registered)
+    {
+        return NI_RETCODE_INVALID_PARAM;
+    }
+    ni_enc_reg_buf_release(p_bufs, &p_bufs->buf[handle]);
+    return NI_RETCODE_SUCCESS;
+}
+
+/*!*****************************************************************************
+ *  \brief  Set up a frame to encode from a registered buffer, copying the
+ *          planes whose layout differs from the session's
+ *
+ *  \param[in] p_enc_ctx  encoder session context
+ *  \param[in] p_frame    Pointer to a caller allocated ni_frame_t struct
+ *  \param[in] handle     handle of the registered buffer
+ *  \param[in] extra_len  Extra data size (incl. meta data)
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ *                          NI_RETCODE_ERROR_MEM_ALOC
+ ******************************************************************************/
+ni_retcode_t ni_encoder_frame_registered_buffer_alloc(
+    ni_session_context_t *p_enc_ctx, ni_frame_t *p_frame, int handle,
+    int extra_len)
+{
+    ni_enc_reg_bufs_t *p_bufs;
+    ni_enc_reg_buf_t *p_reg;
+    const uint8_t *data[NI_MAX_NUM_SW_FRAME_DATA_POINTERS];
+    int linesize[NI_MAX_NUM_SW_FRAME_DATA_POINTERS];
+    const uint8_t *p_src;
+    uint8_t *p_dst;
+    int rows;
+    int i, j;
+
+    if (!p_enc_ctx || !p_frame || handle < 0 ||
+        handle >= NI_ENC_MAX_REGISTERED_BUFFERS || !p_enc_ctx->p_enc_reg_bufs)
+    {
+        return NI_RETCODE_INVALID_PARAM;
+    }
+    p_bufs = (ni_enc_reg_bufs_t *)p_enc_ctx->p_enc_reg_bufs;
+    p_reg = &p_bufs->buf[handle];
+    if (!p_reg->registered)
+    {
+        ni_log2(p_enc_ctx, NI_LOG_ERROR, "ERROR: %s handle %d not "
+                "registered\n", __func__, handle);
+        return NI_RETCODE_INVALID_PARAM;
+    }
+
+    for (i = 0; i < NI_MAX_NUM_SW_FRAME_DATA_POINTERS; i++)
+    {
+        if (!p_reg->copy_row_bytes[i])
+        {
+            data[i] = p_reg->p_data[i];
+            linesize[i] = p_reg->linesize[i];
+            continue;
+        }
+        rows = i ? p_reg->height / 2 : p_reg->height;
+        p_src = p_reg->p_data[i];
+        p_dst = p_reg->p_staging_plane[i];
+        for (j = 0; j < rows; j++)
+        {
+            memcpy(p_dst, p_src, p_reg->copy_row_bytes[i]);
+            p_src += p_reg->linesize[i];
+            p_dst += p_reg->session_linesize[i];
+        }
+        data[i] = p_reg->p_staging_plane[i];
+        linesize[i] = p_reg->session_linesize[i];
+    }
+
+    if (ni_encoder_frame_aux_buffers_borrow(p_enc_ctx, p_frame, 0))
+    {
+        return NI_RETCODE_ERROR_MEM_ALOC;
+    }
+    return ni_encoder_frame_zerocopy_buffer_alloc(
+        p_frame, p_reg->width, p_reg->height, linesize, data, extra_len);
+}
+
+/*!*****************************************************************************
+ *  \brief  Borrow the encoder metadata buffer (and start buffer, see
+ *          ni_encoder_frame_zerocopy_buffer_alloc) of a frame from a per
+ *          session slab of page aligned chunks. The frame stays attached to
+ *          the slab: ni_encoder_frame_zerocopy_buffer_alloc keeps taking its
+ *          buffers from it, and ni_encoder_frame_aux_buffers_return or
+ *          ni_frame_buffer_free gives them back for the next frame instead of
+ *          freeing them. The slab is freed once the session is closed and
+ *          every frame has returned its buffers.
+ *
+ *  \param[in] p_enc_ctx  encoder session context
+ *  \param[in] p_frame    Pointer to a caller allocated ni_frame_t struct
+ *  \param[in] extra_len  Extra data size (incl. meta data), 0 to only attach
+ *                        the frame
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ *                          NI_RETCODE_ERROR_MEM_ALOC
+ ******************************************************************************/
+ni_retcode_t ni_encoder_frame_aux_buffers_borrow(
+    ni_session_context_t *p_enc_ctx, ni_frame_t *p_frame, int extra_len)
+{
+    if (!p_enc_ctx || !p_frame || extra_len < 0)
+    {
+        return NI_RETCODE_INVALID_PARAM;
+    }
+    if (!p_enc_ctx->p_enc_aux_slab)
+    {
+        p_enc_ctx->p_enc_aux_slab = ni_enc_aux_slab_create(
+            (ni_mem_account_t *)p_enc_ctx->p_mem_account);
+        if (!p_enc_ctx->p_enc_aux_slab)
+        {
+            return NI_RETCODE_ERROR_MEM_ALOC;
+        }
+    }
+    ni_enc_aux_slab_attach((ni_enc_aux_slab_t *)p_enc_ctx->p_enc_aux_slab,
+                           p_frame);
+    if (extra_len)
+    {
+        return ni_encoder_metadata_buffer_alloc(p_frame, extra_len);
+    }
+    return NI_RETCODE_SUCCESS;
+}
+
+/*!*****************************************************************************
+ *  \brief  Return the metadata and start buffers of a frame to the session
+ *          slab they were borrowed from and detach the frame from it. Frames
+ *          not attached to a slab have the buffers freed.
+ *
+ *  \param[in] p_frame  Pointer to a caller allocated ni_frame_t struct
+ *
+ *  \return none
+ ******************************************************************************/
+void ni_encoder_frame_aux_buffers_return(ni_frame_t *p_frame)
+{
+    if (p_frame)
+    {
+        ni_enc_aux_buffers_free(p_frame);
+        p_frame->separate_metadata = 0;
+        p_frame->separate_start = 0;
+    }
+}
+
 
 /*!*****************************************************************************
  *  \brief  Check if incoming frame is hwupload zero copy compatible or not
@@ -3167,7 +3864,7 @@ ni_retcode_t ni_encoder_frame_buffer_alloc(ni_frame_t *p_frame, int video_width,
       //Check if need to realocate
       if (p_frame->buffer_size != buffer_size)
       {
-          if (ni_posix_memalign(&p_buffer, sysconf(_SC_PAGESIZE), buffer_size))
+          if (ni_mem_pool_alloc(&p_buffer, buffer_size))
           {
               ni_log(NI_LOG_ERROR, "ERROR %d: %s() Cannot allocate p_frame buffer.\n",
                      NI_ERRNO, __func__);
@@ -3179,6 +3876,7 @@ ni_retcode_t ni_encoder_frame_buffer_alloc(ni_frame_t *p_frame, int video_width,
           memset(p_buffer, 0, buffer_size);
           p_frame->buffer_size = buffer_size;
           p_frame->p_buffer = p_buffer;
+          p_frame->p_pool_buffer = p_buffer;
 
           ni_log(NI_LOG_DEBUG, "%s: allocated new p_frame buffer\n", __func__);
       }
@@ -3379,7 +4077,7 @@ ni_retcode_t ni_frame_buffer_alloc_nv(ni_frame_t *p_frame, int video_width,
       //Check if need to realocate
       if (p_frame->buffer_size != buffer_size)
       {
-          if (ni_posix_memalign(&p_buffer, sysconf(_SC_PAGESIZE), buffer_size))
+          if (ni_mem_pool_alloc(&p_buffer, buffer_size))
           {
               ni_log(NI_LOG_ERROR, "ERROR %d: %s() Cannot allocate p_frame buffer.\n",
                      NI_ERRNO, __func__);
@@ -3391,6 +4089,7 @@ ni_retcode_t ni_frame_buffer_alloc_nv(ni_frame_t *p_frame, int video_width,
           memset(p_buffer, 0, buffer_size);
           p_frame->buffer_size = buffer_size;
           p_frame->p_buffer = p_buffer;
+          p_frame->p_pool_buffer = p_buffer;
           
           ni_log(NI_LOG_DEBUG, "%s: allocated new p_frame buffer\n", __func__);
       }
@@ -3526,9 +4225,17 @@ ni_retcode_t ni_frame_buffer_free(ni_frame_t* p_frame)
 
   if (p_frame->buffer_size)
   {
+      if (p_frame->p_buffer == p_frame->p_pool_buffer)
+      {
+          ni_mem_pool_free(p_frame->p_buffer, p_frame->buffer_size);
+          p_frame->p_buffer = NULL;
+      } else
+      {
+          ni_aligned_free(p_frame->p_buffer);
+      }
       p_frame->buffer_size = 0;
-      ni_aligned_free(p_frame->p_buffer);
   }
+  p_frame->p_pool_buffer = NULL;
   
   for (i = 0; i < NI_MAX_NUM_DATA_POINTERS; i++)
   {
@@ -3538,18 +4245,9 @@ ni_retcode_t ni_frame_buffer_free(ni_frame_t* p_frame)
   
   ni_frame_wipe_aux_data(p_frame);
   
-  if (p_frame->metadata_buffer_size)
-  {
-      p_frame->metadata_buffer_size = 0;
-      ni_aligned_free(p_frame->p_metadata_buffer);
-  }
+  // metadata and start buffers borrowed from a session slab go back to it
+  ni_enc_aux_buffers_free(p_frame);
   p_frame->separate_metadata = 0;
-
-  if (p_frame->start_buffer_size)
-  {
-      p_frame->start_buffer_size = 0;
-      ni_aligned_free(p_frame->p_start_buffer);
-  }
   p_frame->separate_start = 0;
   memset(p_frame->start_len, 0, sizeof(p_frame->start_len));
   p_frame->total_start_len = 0;
@@ -3591,6 +4289,14 @@ ni_retcode_t ni_decoder_frame_buffer_free(ni_frame_t *p_frame)
     ni_log(NI_LOG_DEBUG, "%s(): Mem buf returned ptr %p buf %p !\n", __func__,
            p_frame->dec_buf->buf, p_frame->dec_buf);
   }
+  else if (p_frame->dec_allocator.free_buffer && p_frame->p_buffer)
+  {
+      p_frame->dec_allocator.free_buffer(p_frame->dec_allocator.p_user,
+                                         p_frame->p_buffer,
+                                         p_frame->p_dec_alloc_opaque);
+      ni_log(NI_LOG_DEBUG, "%s(): caller buf %p released\n", __func__,
+             p_frame->p_buffer);
+  }
   else
   {
       ni_log(NI_LOG_DEBUG, "%s(): NO mem buf returned !\n", __func__);
@@ -3599,6 +4305,8 @@ ni_retcode_t ni_decoder_frame_buffer_free(ni_frame_t *p_frame)
   p_frame->dec_buf = NULL;
   p_frame->p_buffer = NULL;
   p_frame->buffer_size = 0;
+  memset(&p_frame->dec_allocator, 0, sizeof(p_frame->dec_allocator));
+  p_frame->p_dec_alloc_opaque = NULL;
   for (i = 0; i < NI_MAX_NUM_DATA_POINTERS; i++)
   {
     p_frame->data_len[i] = 0;
@@ -3627,6 +4335,45 @@ void ni_decoder_frame_buffer_pool_return_buf(ni_buf_t *buf,
   ni_buf_pool_return_buffer(buf, p_buffer_pool);
 }
 
+/*!*****************************************************************************
+ *  \brief  Have decoded frames read into caller memory: buffers for
+ *          ni_decoder_frame_buffer_alloc come from p_allocator instead of the
+ *          decoder frame buffer pool, and are given back by
+ *          ni_decoder_frame_buffer_free
+ *
+ *  \param[in] p_ctx        decoder session context
+ *  \param[in] p_allocator  callbacks, copied; NULL to use the pool again
+ *
+ *  \return On success    NI_RETCODE_SUCCESS
+ *          On failure    NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+ni_retcode_t ni_decoder_set_buffer_allocator(
+    ni_session_context_t *p_ctx, const ni_dec_buffer_allocator_t *p_allocator)
+{
+    if (!p_ctx ||
+        (p_allocator && (!p_allocator->alloc_buffer || !p_allocator->free_buffer)))
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s passed parameters are null or not "
+               "supported\n", __func__);
+        return NI_RETCODE_INVALID_PARAM;
+    }
+
+    if (p_allocator)
+    {
+        p_ctx->dec_buffer_allocator = *p_allocator;
+    } else
+    {
+        memset(&p_ctx->dec_buffer_allocator, 0,
+               sizeof(p_ctx->dec_buffer_allocator));
+    }
+    // frames already handed out keep their own copy of the allocator
+    if (p_ctx->dec_fme_buf_pool)
+    {
+        p_ctx->dec_fme_buf_pool->allocator = p_ctx->dec_buffer_allocator;
+    }
+    return NI_RETCODE_SUCCESS;
+}
+
 /*!*****************************************************************************
  *  \brief  Allocate memory for the packet buffer based on provided packet size
  *
@@ -3685,7 +4432,7 @@ ni_retcode_t ni_packet_buffer_alloc(ni_packet_t* p_packet, int packet_size)
   ni_log(NI_LOG_DEBUG, "%s: Allocating p_frame buffer, buffer_size=%d\n",
          __func__, buffer_size);
 
-  if (ni_posix_memalign(&p_buffer, sysconf(_SC_PAGESIZE), buffer_size))
+  if (ni_mem_pool_alloc(&p_buffer, buffer_size))
   {
       ni_log(NI_LOG_ERROR, "ERROR %d: %s() Cannot allocate p_packet buffer.\n",
              NI_ERRNO, __func__);
@@ -3696,6 +4443,7 @@ ni_retcode_t ni_packet_buffer_alloc(ni_packet_t* p_packet, int packet_size)
 
   p_packet->buffer_size = buffer_size;
   p_packet->p_buffer = p_buffer;
+  p_packet->p_pool_buffer = p_buffer;
   p_packet->p_data = p_packet->p_buffer;
 
   ni_log(NI_LOG_TRACE, "%s: exit: p_packet->buffer_size=%u\n", __func__,
@@ -3754,6 +4502,7 @@ ni_retcode_t ni_custom_packet_buffer_alloc(void *p_buffer,
 
     p_packet->buffer_size = buffer_size;
     p_packet->p_buffer = p_buffer;
+    p_packet->p_pool_buffer = NULL;
     p_packet->p_data = p_packet->p_buffer;
 
     ni_log(NI_LOG_TRACE, "%s: exit: \n", __func__);
@@ -3789,8 +4538,15 @@ ni_retcode_t ni_packet_buffer_free(ni_packet_t* p_packet)
       LRETURN;
   }
 
-  ni_aligned_free(p_packet->p_buffer);
+  if (p_packet->p_buffer == p_packet->p_pool_buffer)
+  {
+      ni_mem_pool_free(p_packet->p_buffer, p_packet->buffer_size);
+  } else
+  {
+      ni_aligned_free(p_packet->p_buffer);
+  }
   p_packet->p_buffer = NULL;
+  p_packet->p_pool_buffer = NULL;
   p_packet->buffer_size = 0;
   p_packet->data_len = 0;
   p_packet->p_data = NULL;
@@ -7733,6 +8489,8 @@ int ni_device_session_read_hwdesc(ni_session_context_t *p_ctx, ni_session_data_i
   }
   p_ctx->xcoder_state |= NI_XCODER_READ_DESC_STATE;
   ni_pthread_mutex_unlock(&p_ctx->mutex);
+  ni_pipeline_timing_call_begin(
+      (ni_pipeline_timing_t *)p_ctx->p_pipeline_timing, NI_PIPELINE_DIR_READ);
 
   switch (device_type)
   {
@@ -7838,6 +8596,8 @@ int ni_device_session_read_hwdesc(ni_session_context_t *p_ctx, ni_session_data_i
   }
   }
 
+  ni_pipeline_timing_call_end(
+      (ni_pipeline_timing_t *)p_ctx->p_pipeline_timing, NI_PIPELINE_DIR_READ);
   ni_pthread_mutex_lock(&p_ctx->mutex);
   p_ctx->xcoder_state &= ~NI_XCODER_READ_DESC_STATE;
   ni_pthread_mutex_unlock(&p_ctx->mutex);
@@ -7961,9 +8721,13 @@ int ni_device_session_hwup(ni_session_context_t* p_ctx, ni_session_data_io_t *p_
   }
   ni_pthread_mutex_lock(&p_ctx->mutex);
   p_ctx->xcoder_state |= NI_XCODER_HWUP_STATE;
+  ni_pipeline_timing_call_begin(
+      (ni_pipeline_timing_t *)p_ctx->p_pipeline_timing, NI_PIPELINE_DIR_WRITE);
 
   retval = ni_hwupload_session_write(p_ctx, &p_src_data->data.frame, hwdesc);
 
+  ni_pipeline_timing_call_end(
+      (ni_pipeline_timing_t *)p_ctx->p_pipeline_timing, NI_PIPELINE_DIR_WRITE);
   p_ctx->xcoder_state &= ~NI_XCODER_HWUP_STATE;
   ni_pthread_mutex_unlock(&p_ctx->mutex);
 
@@ -8017,7 +8781,7 @@ ni_retcode_t ni_frame_buffer_alloc_hwenc(ni_frame_t* p_frame, int video_width,
   //Check if need to realocate
   if (p_frame->buffer_size != buffer_size)
   {
-      if (ni_posix_memalign(&p_buffer, sysconf(_SC_PAGESIZE), buffer_size))
+      if (ni_mem_pool_alloc(&p_buffer, buffer_size))
       {
           ni_log(NI_LOG_ERROR, "ERROR %d: %s() Cannot allocate p_frame buffer.\n",
                  NI_ERRNO, __func__);
@@ -8029,6 +8793,7 @@ ni_retcode_t ni_frame_buffer_alloc_hwenc(ni_frame_t* p_frame, int video_width,
     memset(p_buffer, 0, buffer_size);
     p_frame->buffer_size = buffer_size;
     p_frame->p_buffer = p_buffer;
+    p_frame->p_pool_buffer = p_buffer;
 
     ni_log(NI_LOG_DEBUG, "%s: allocated new p_frame buffer\n", __func__);
   }
@@ -8481,6 +9246,7 @@ ni_retcode_t ni_device_alloc_frame(ni_session_context_t* p_ctx,
                                    ni_device_type_t device_type)
 {
   ni_retcode_t retval = NI_RETCODE_SUCCESS;
+  uint64_t start_time;
 
   if (!p_ctx)
   {
@@ -8490,6 +9256,7 @@ ni_retcode_t ni_device_alloc_frame(ni_session_context_t* p_ctx,
   }
   ni_pthread_mutex_lock(&p_ctx->mutex);
   p_ctx->xcoder_state |= NI_XCODER_GENERAL_STATE;
+  start_time = ni_gettime_ns();
 
   switch (device_type)
   {
@@ -8515,6 +9282,13 @@ ni_retcode_t ni_device_alloc_frame(ni_session_context_t* p_ctx,
       break;
     }
 
+    if (retval == NI_RETCODE_SUCCESS && p_ctx->lat_stats)
+    {
+        ni_lat_stats_record((ni_lat_stats_t *)p_ctx->lat_stats,
+                            NI_LATENCY_STAGE_SCALE,
+                            ni_gettime_ns() - start_time);
+    }
+
     p_ctx->xcoder_state &= ~NI_XCODER_GENERAL_STATE;
     ni_pthread_mutex_unlock(&p_ctx->mutex);
 
@@ -8688,6 +9462,7 @@ ni_retcode_t ni_device_multi_config_frame(ni_session_context_t *p_ctx,
                                           ni_frame_config_t *p_cfg_out)
 {
     ni_retcode_t retval = NI_RETCODE_SUCCESS;
+    uint64_t start_time;
 
     if (!p_ctx || !p_cfg_in)
     {
@@ -8698,6 +9473,7 @@ ni_retcode_t ni_device_multi_config_frame(ni_session_context_t *p_ctx,
 
     ni_pthread_mutex_lock(&p_ctx->mutex);
     p_ctx->xcoder_state |= NI_XCODER_GENERAL_STATE;
+    start_time = ni_gettime_ns();
 
     switch (p_ctx->device_type)
     {
@@ -8715,6 +9491,13 @@ ni_retcode_t ni_device_multi_config_frame(ni_session_context_t *p_ctx,
             break;
     }
 
+    if (retval == NI_RETCODE_SUCCESS && p_ctx->lat_stats)
+    {
+        ni_lat_stats_record((ni_lat_stats_t *)p_ctx->lat_stats,
+                            NI_LATENCY_STAGE_SCALE,
+                            ni_gettime_ns() - start_time);
+    }
+
     p_ctx->xcoder_state &= ~NI_XCODER_GENERAL_STATE;
     ni_pthread_mutex_unlock(&p_ctx->mutex);
 
@@ -9012,7 +9795,7 @@ ni_retcode_t ni_frame_buffer_alloc_pixfmt(ni_frame_t *p_frame, int pixel_format,
 
   if (p_frame->buffer_size != buffer_size)
   {
-      if (ni_posix_memalign(&p_buffer, sysconf(_SC_PAGESIZE), buffer_size))
+      if (ni_mem_pool_alloc(&p_buffer, buffer_size))
       {
           ni_log(NI_LOG_ERROR, "Error: Cannot allocate p_frame\n");
           retval = NI_RETCODE_ERROR_MEM_ALOC;
@@ -9022,6 +9805,7 @@ ni_retcode_t ni_frame_buffer_alloc_pixfmt(ni_frame_t *p_frame, int pixel_format,
     memset(p_buffer, 0, buffer_size);
     p_frame->buffer_size = buffer_size;
     p_frame->p_buffer = p_buffer;
+    p_frame->p_pool_buffer = p_buffer;
     ni_log(NI_LOG_DEBUG, "%s: allocated new p_frame buffer\n", __func__);
   }
   else
@@ -9285,7 +10069,7 @@ ni_retcode_t ni_ai_frame_buffer_alloc(ni_frame_t *p_frame,
 
     if (p_frame->buffer_size != buffer_size)
     {
-        if (ni_posix_memalign(&p_buffer, sysconf(_SC_PAGESIZE), buffer_size))
+        if (ni_mem_pool_alloc(&p_buffer, buffer_size))
         {
             ni_log(NI_LOG_ERROR, "Error: Cannot allocate p_frame\n");
             retval = NI_RETCODE_ERROR_MEM_ALOC;
@@ -9295,6 +10079,7 @@ ni_retcode_t ni_ai_frame_buffer_alloc(ni_frame_t *p_frame,
         //    memset(p_buffer, 0, buffer_size);
         p_frame->buffer_size = buffer_size;
         p_frame->p_buffer = p_buffer;
+        p_frame->p_pool_buffer = p_buffer;
         ni_log(NI_LOG_DEBUG, "%s(): allocated new p_frame buffer\n", __func__);
     } else
     {
@@ -9374,7 +10159,7 @@ ni_retcode_t ni_ai_packet_buffer_alloc(ni_packet_t *p_packet,
     ni_log(NI_LOG_DEBUG, "%s(): Allocating p_packet buffer, buffer_size=%u\n",
            __func__, buffer_size);
 
-    if (ni_posix_memalign(&p_buffer, sysconf(_SC_PAGESIZE), buffer_size))
+    if (ni_mem_pool_alloc(&p_buffer, buffer_size))
     {
         ni_log(NI_LOG_ERROR, "ERROR %d: %s() Cannot allocate p_packet buffer.\n",
                NI_ERRNO, __func__);
@@ -9384,6 +10169,7 @@ ni_retcode_t ni_ai_packet_buffer_alloc(ni_packet_t *p_packet,
 
     p_packet->buffer_size = buffer_size;
     p_packet->p_buffer = p_buffer;
+    p_packet->p_pool_buffer = p_buffer;
     p_packet->p_data = p_packet->p_buffer;
     p_packet->data_len = data_size;
 
@@ -11268,6 +12054,106 @@ ni_retcode_t ni_device_alloc_and_get_firmware_logs(ni_session_context_t *p_ctx,
     return retval;
 }
 
+/*!*****************************************************************************
+ *  \brief  Set up an incremental firmware log reader
+ *
+ *  \param[in] p_stream     Pointer to a caller allocated ni_fw_log_stream_t
+ *  \param[in] p_ctx        Session context with an open device
+ *  \param[in] max_pages    4 KiB log pages read per core per call, 0 for
+ *                          NI_FW_LOG_STREAM_DEFAULT_PAGES
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ *                          NI_RETCODE_ERROR_MEM_ALOC
+ ******************************************************************************/
+ni_retcode_t ni_device_fw_log_stream_init(ni_fw_log_stream_t *p_stream,
+                                          ni_session_context_t *p_ctx,
+                                          uint32_t max_pages)
+{
+    if (!p_stream || !p_ctx)
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s() passed parameters are null\n",
+               __func__);
+        return NI_RETCODE_INVALID_PARAM;
+    }
+    if (p_ctx->blk_io_handle == NI_INVALID_DEVICE_HANDLE)
+    {
+        ni_log2(p_ctx, NI_LOG_ERROR, "ERROR: %s() device not opened\n",
+                __func__);
+        return NI_RETCODE_INVALID_PARAM;
+    }
+    return ni_fw_log_stream_init(p_stream, p_ctx, max_pages);
+}
+
+/*!*****************************************************************************
+ *  \brief  Append the firmware log bytes of a core written since the last
+ *          call to a ring
+ *
+ *  \param[in] p_stream     Stream set up by ni_device_fw_log_stream_init
+ *  \param[in] core         NVME_CORE, EP_CORE, DP_CORE, TP_CORE or FP_CORE
+ *  \param[in] p_ring       Ring receiving the new log bytes
+ *
+ *  \return On success
+ *                          Number of bytes appended to the ring
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ *                          NI_RETCODE_ERROR_MEM_ALOC
+ *                          NI_RETCODE_ERROR_NVME_CMD_FAILED
+ ******************************************************************************/
+int ni_device_fw_log_stream_read(ni_fw_log_stream_t *p_stream,
+                                 ni_core_type_t core, ni_fw_log_ring_t *p_ring)
+{
+    return ni_fw_log_stream_read(p_stream, core, p_ring);
+}
+
+/*!*****************************************************************************
+ *  \brief  Start tailing the firmware logs of all cores into the host log
+ *          from a background thread
+ *
+ *  \param[in] p_stream           Stream set up by ni_device_fw_log_stream_init
+ *  \param[in] interval_ms        Polling interval
+ *  \param[in] max_bytes_per_sec  Log bytes forwarded per second at most
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ *                          NI_RETCODE_ERROR_MEM_ALOC
+ *                          NI_RETCODE_FAILURE
+ ******************************************************************************/
+ni_retcode_t ni_device_fw_log_stream_start(ni_fw_log_stream_t *p_stream,
+                                           uint32_t interval_ms,
+                                           uint32_t max_bytes_per_sec)
+{
+    return ni_fw_log_stream_start(p_stream, interval_ms, max_bytes_per_sec);
+}
+
+/*!*****************************************************************************
+ *  \brief  Stop the background thread of a firmware log stream, if running
+ *
+ *  \param[in] p_stream     Stream set up by ni_device_fw_log_stream_init
+ *
+ *  \return none
+ ******************************************************************************/
+void ni_device_fw_log_stream_stop(ni_fw_log_stream_t *p_stream)
+{
+    ni_fw_log_stream_stop(p_stream);
+}
+
+/*!*****************************************************************************
+ *  \brief  Stop and free a firmware log stream
+ *
+ *  \param[in] p_stream     Stream set up by ni_device_fw_log_stream_init
+ *
+ *  \return none
+ ******************************************************************************/
+void ni_device_fw_log_stream_close(ni_fw_log_stream_t *p_stream)
+{
+    ni_fw_log_stream_close(p_stream);
+}
+
 /*!*****************************************************************************
  *  \brief  Set up hard coded demo ROI map
  *
@@ -11320,10 +12206,18 @@ ni_retcode_t ni_set_demo_roi_map(ni_session_context_t *p_enc_ctx)
 
     // need to align to 64 bytes
     customMapSize = ((block_size + 63) & (~63));
-    if (!p_enc_ctx->roi_map)
+    if (!p_enc_ctx->roi_map &&
+        !ni_mem_account_charge((ni_mem_account_t *)p_enc_ctx->p_mem_account,
+                               NI_MEM_CAT_ROI, customMapSize))
     {
+      // uncharged in ni_device_session_close()
       p_enc_ctx->roi_map =
           (ni_enc_quad_roi_custom_map *)calloc(1, customMapSize);
+      if (!p_enc_ctx->roi_map)
+      {
+        ni_mem_account_uncharge((ni_mem_account_t *)p_enc_ctx->p_mem_account,
+                                NI_MEM_CAT_ROI, customMapSize);
+      }
     }
     if (!p_enc_ctx->roi_map)
     {
@@ -1220,53 +1220,97 @@ typedef struct _ni_thread_arg_struct_t
   volatile uint64_t *plast_access_time;   // shared variable for main thread to verify timeout. Keep alive thread will update last_access_time
 } ni_thread_arg_struct_t;
 
+// Caller supplied memory for decoded frames, set with
+// ni_decoder_set_buffer_allocator: frames are read from the device straight
+// into it instead of into the decoder frame buffer pool
+typedef struct _ni_dec_buffer_allocator
+{
+    // return a buffer of at least size bytes aligned to NI_MEM_PAGE_ALIGNMENT
+    // (the planes at p_frame->p_data, followed by metadata scratch space), or
+    // NULL if none is free; *pp_opaque is passed back to free_buffer
+    void *(*alloc_buffer)(void *p_user, uint32_t size, void **pp_opaque);
+    // called by ni_decoder_frame_buffer_free once libxcoder is done with a
+    // buffer; keep a reference to it beforehand to keep using the frame
+    void (*free_buffer)(void *p_user, void *p_buf, void *opaque);
+    void *p_user;
+} ni_dec_buffer_allocator_t;
+
+#define NI_BUF_POOL_MAX_BUFFERS 1024
+
 typedef struct _ni_buf_t
 {
   void* buf;
   struct _ni_buf_pool_t* pool;
-  struct  _ni_buf_t *p_prev;
-  struct  _ni_buf_t *p_next;
-  struct  _ni_buf_t *p_previous_buffer;
-  struct  _ni_buf_t *p_next_buffer;
+  uint32_t size;                  // allocated size of buf
+  uint32_t index;                 // position in pool->p_bufs
+  volatile uint32_t next_free;    // index + 1 of the next free buffer, 0: none
+  volatile int32_t in_use;        // handed out by ni_buf_pool_get_buffer
+  void *p_mem_account;            // ni_mem_account_t charged for buf
 } ni_buf_t;
 
 typedef struct _ni_buf_pool_t
 {
-    ni_pthread_mutex_t mutex;
+    ni_pthread_mutex_t mutex;     // taken only to grow or free the pool
     uint32_t number_of_buffers;
     uint32_t buf_size;
-    ni_buf_t *p_free_head;
-    ni_buf_t *p_free_tail;
-    ni_buf_t *p_used_head;
-    ni_buf_t *p_used_tail;
+    // lock-free stack of free buffers: ABA tag << 32 | (index + 1)
+    volatile uint64_t free_top;
+    ni_buf_t *p_bufs[NI_BUF_POOL_MAX_BUFFERS];  // every buffer, by index
+    int numa_node; // NUMA node buffers are bound to, -1 for no binding
+    // caller allocator the frames of this pool come from instead, if set
+    ni_dec_buffer_allocator_t allocator;
+
+    // growth policy: at most max_buffers buffers (from the session's pool
+    // budget); when most are in use the grow worker shared by all pools
+    // pre-allocates half the pool size again, and at the cap getting a buffer
+    // fails instead
+    uint32_t max_buffers;
+    volatile uint32_t in_use_count;   // buffers handed out now
+    volatile uint32_t high_water;     // most buffers handed out at once
+    volatile uint32_t backpressure_count;  // gets refused at the cap
+    // background pre-allocation, fields below are protected by mutex
+    int grow_request;
+    int grow_stop;
+    uint32_t grow_pending;        // buffers being allocated, count to the cap
+    // grow worker queue link, protected by the worker's mutex
+    struct _ni_buf_pool_t *grow_next;
+    int grow_queued;
+    // ni_mem_account_t of the session, referenced until the pool and every
+    // buffer left in use at pool free time are gone
+    void *p_mem_account;
 } ni_buf_pool_t;
 
+// Timestamp queue nodes of a session live in one array owned by its
+// ni_queue_buffer_pool_t. Links are node index + 1, 0 for none, so a zeroed
+// queue is empty and the array can be reallocated to grow.
 typedef struct _ni_queue_node_t
 {
     uint64_t timestamp;
     uint64_t frame_info;
     time_t   checkout_timestamp;
-    struct _ni_queue_node_t *p_prev;
-    struct _ni_queue_node_t *p_next;
-    struct _ni_queue_node_t *p_previous_buffer;
-    struct _ni_queue_node_t *p_next_buffer;
+    uint32_t prev;
+    uint32_t next;              // next in its queue, or on the free list
 } ni_queue_node_t;
 
+#define NI_QUEUE_NODE(p_pool, link) \
+    ((link) ? &(p_pool)->p_nodes[(link) - 1] : NULL)
+#define NI_QUEUE_LINK(p_pool, p_node) \
+    ((uint32_t)((p_node) - (p_pool)->p_nodes) + 1)
+
 typedef struct _ni_queue_buffer_pool_t
 {
     uint32_t number_of_buffers; // total number of buffers
-    ni_queue_node_t *p_free_head;
-    ni_queue_node_t *p_free_tail;
-    ni_queue_node_t *p_used_head;
-    ni_queue_node_t *p_used_tail;
+    uint32_t free_head;         // link of the first free node
+    ni_queue_node_t *p_nodes;   // number_of_buffers nodes
+    void *p_mem_account;        // ni_mem_account_t of the session
 } ni_queue_buffer_pool_t;
 
 typedef struct _ni_queue_t
 {
     char name[32];
     uint32_t count;
-    ni_queue_node_t *p_first;
-    ni_queue_node_t *p_last;
+    uint32_t first;             // links into the pool's p_nodes
+    uint32_t last;
 } ni_queue_t;
 
 typedef struct _ni_timestamp_table_t
@@ -1344,6 +1388,9 @@ typedef struct _ni_network_perf_metrics
     uint64_t ddr_write_bw;
 } ni_network_perf_metrics_t;
 
+// encoder input frames kept for PSNR calculation
+#define NI_INPUT_FRAME_FIFO_SZ 120
+
 typedef struct _ni_input_frame
 {
   uint8_t  *p_input_buffer;
@@ -1358,6 +1405,45 @@ typedef struct _ni_input_frame
 
 typedef struct _ni_session_context
 {
+    /*! Per frame state read by every session read/write call, kept together
+     *  at the start of the context so that it spans as few cache lines as
+     *  possible (cache line aligned when allocated with
+     *  ni_device_session_context_alloc_init) */
+    /*! Session ID */
+    uint32_t session_id;
+    /*! Device Card ID */
+    ni_device_handle_t device_handle;
+    /*! block device fd */
+    ni_device_handle_t blk_io_handle;
+    /*! Device Type, Either NI_DEVICE_TYPE_DECODER or NI_DEVICE_TYPE_ENCODER */
+    uint32_t device_type;
+    /*! Device Type, Either NI_CODEC_FORMAT_H264 or NI_CODEC_FORMAT_H265 */
+    uint32_t codec_format;
+    /*! Codec ID */
+    int hw_id;
+    // Xcoder running state
+    uint32_t xcoder_state;
+    // session running state
+    ni_session_run_state_t session_run_state;
+    // decoder low delay send/recv sync; async_mode = 0 by default, i.e.
+    // codec send-to/recv-from FW is in synchrounous mode by default.
+    int async_mode;
+    uint32_t ready_to_close;   //flag to indicate we are ready to close session
+    /*! Max Linux NVME IO Size */
+    uint32_t max_nvme_io_size;
+    /*! keep alive timeout */
+    uint32_t keep_alive_timeout;
+    uint64_t frame_num;
+    uint64_t pkt_num;
+    //shared variable for main thread to read and keepalive thread to update
+    volatile uint64_t last_access_time;
+    void *p_session_config;
+    // muxtex default from source session
+    // required pointer to external if used by hwdl
+    ni_pthread_mutex_t* pext_mutex;
+    // a muxter for Xcoder API, to keep the thread-safety.
+    ni_pthread_mutex_t mutex;
+
     /*! MEASURE_LATENCY queue */
     /* frame_time_q is pointer to ni_lat_meas_q_t but reserved as void pointer
        here as ni_lat_meas_q_t is part of private API */
@@ -1387,7 +1473,6 @@ typedef struct _ni_session_context
     int is_first_frame;
     int64_t last_pts;
     int64_t last_dts;
-    int64_t enc_pts_list[NI_FIFO_SZ];
     int64_t enc_pts_r_idx;
     int64_t enc_pts_w_idx;
     int pts_correction_num_faulty_dts;
@@ -1396,45 +1481,29 @@ typedef struct _ni_session_context
     int64_t pts_correction_last_pts;
     NI_DEPRECATED int64_t start_dts_offset;
 
-    /* store pts values to create an accurate pts offset */
-    int64_t pts_offsets[NI_FIFO_SZ];
+    /* store pts values to create an accurate pts offset; for decoder, the
+       NI_FIFO_SZ entry arrays are allocated at session open (p_dec_pkt_fifo) */
+    int64_t *pts_offsets;
     int pkt_index;
-    uint64_t pkt_offsets_index[NI_FIFO_SZ];
-    uint64_t pkt_offsets_index_min[NI_FIFO_SZ];
-    uint64_t pkt_pos[NI_FIFO_SZ];
+    uint64_t *pkt_offsets_index;
+    uint64_t *pkt_offsets_index_min;
+    uint64_t *pkt_pos;
     uint64_t last_pkt_pos;
     uint64_t last_frame_offset;
-    ni_custom_sei_set_t *pkt_custom_sei_set[NI_FIFO_SZ];
+    ni_custom_sei_set_t **pkt_custom_sei_set;
 
     /*! if session is on a decoder handling incoming pkt 512-aligned */
     int is_dec_pkt_512_aligned;
 
-    /*! Device Card ID */
-    ni_device_handle_t device_handle;
-
-    /*! block device fd */
-    ni_device_handle_t blk_io_handle;
-
     /*! Sender information*/
     ni_device_handle_t sender_handle;
     ni_device_handle_t auto_dl_handle;
     uint8_t is_auto_dl;
 
     uint32_t template_config_id;
-    void *p_session_config;
 
-    /*! Max Linux NVME IO Size */
-    uint32_t max_nvme_io_size;
-    /*! Codec ID */
-    int hw_id;
-    /*! Session ID */
-    uint32_t session_id;
     /*! Session Start Timestamp */
     uint64_t session_timestamp;
-    /*! Device Type, Either NI_DEVICE_TYPE_DECODER or NI_DEVICE_TYPE_ENCODER */
-    uint32_t device_type;
-    /*! Device Type, Either NI_CODEC_FORMAT_H264 or NI_CODEC_FORMAT_H265 */
-    uint32_t codec_format;
     /*! the device name that opened*/
     char dev_xcoder_name[MAX_CHAR_IN_DEVICE_NAME];
     /*! the block name that opened */
@@ -1468,9 +1537,6 @@ typedef struct _ni_session_context
     /*! DTS Queue */
     ni_timestamp_table_t *dts_queue;
 
-    /*! keep alive timeout */
-    uint32_t keep_alive_timeout;
-
     /*! Other */
     int status;
     int key_frame_type;
@@ -1479,8 +1545,6 @@ typedef struct _ni_session_context
     char param_err_msg[512];
 
     int keyframe_factor;
-    uint64_t frame_num;
-    uint64_t pkt_num;
     int rc_error_count; // Unused
 
     uint32_t hwd_Frame_Idx;
@@ -1492,10 +1556,6 @@ typedef struct _ni_session_context
     // frame forcing: for encoding
     int force_frame_type;
 
-    uint32_t ready_to_close;   //flag to indicate we are ready to close session
-
-    // session running state
-    ni_session_run_state_t session_run_state;
     //Current video width. this is used to do sequence change
     uint32_t active_video_width;
     //Current video height ,this is used to do sequence change
@@ -1512,12 +1572,6 @@ typedef struct _ni_session_context
     // original resolution this stream started with, this is used by encoder sequence change
     int ori_width, ori_height, ori_bit_depth_factor, ori_pix_fmt;
 
-    // a muxter for Xcoder API, to keep the thread-safety.
-    ni_pthread_mutex_t mutex;
-
-    // Xcoder running state
-    uint32_t xcoder_state;
-
     // only be used when regular-io
     void *p_all_zero_buf;   //This is for sos, eos, flush and keep alive request
 
@@ -1592,7 +1646,7 @@ typedef struct _ni_session_context
     int pic_reorder_delay;
 
     // flags_array to save packet flags
-    int flags_array[NI_FIFO_SZ];
+    int *flags_array;
 
     // for decoder: store currently returned decoded frame's pkt offset
     uint64_t frame_pkt_offset;
@@ -1609,16 +1663,10 @@ typedef struct _ni_session_context
     // device has priority over hw_id which is device specified by index.
     char blk_dev_name[NI_MAX_DEVICE_NAME_LEN];
 
-    // decoder low delay send/recv sync; async_mode = 0 by default, i.e.
-    // codec send-to/recv-from FW is in synchrounous mode by default.
-    int async_mode;
     int low_delay_sync_flag;
     ni_pthread_mutex_t low_delay_sync_mutex;
     ni_pthread_cond_t low_delay_sync_cond;
     
-    // muxtex default from source session
-    // required pointer to external if used by hwdl
-    ni_pthread_mutex_t* pext_mutex;
     bool mutex_initialized;
 
     // required parameters for slow sequence change
@@ -1630,8 +1678,6 @@ typedef struct _ni_session_context
 
     int ori_luma_linesize;
     int ori_chroma_linesize;
-    //shared variable for main thread to read and keepalive thread to update
-    volatile uint64_t last_access_time;
 
     int reconfig_crf;   // crf value to reconfig (range in [0..51]), -1 if inactive
     int reconfig_crf_decimal;   // crf decimal fration value to reconfig
@@ -1657,12 +1703,70 @@ typedef struct _ni_session_context
     int16_t reconfig_slice_arg;
 
     ///encoder:calculate PSNR start
-    ni_input_frame input_frame_fifo[120];
+    // NI_INPUT_FRAME_FIFO_SZ entries, allocated on first use
+    ni_input_frame *input_frame_fifo;
     double psnr_y;
     double psnr_u;
     double psnr_v;
     double average_psnr;
     ///encoder:calculate PSNR end 
+
+    // NUMA node of the device this session runs on, -1 if unknown; set by
+    // ni_device_session_open
+    int numa_node;
+    // set to 1 before session open to bind session host buffers (e.g. decoder
+    // frame buffer pool) to the device's NUMA node
+    int numa_bind_buffers;
+
+    // per stage latency histograms, pointer to ni_lat_stats_t which is part of
+    // private API; read with ni_device_session_get_latency_stats
+    void *lat_stats;
+
+    // set to 1 before session open to record where the time of each
+    // write/read call goes; read with ni_device_session_get_pipeline_timing
+    int pipeline_timing;
+    // pointer to ni_pipeline_timing_t which is part of private API
+    void *p_pipeline_timing;
+
+    // set to 1 before session open to keep windowed rates of the session;
+    // read with ni_device_session_get_stats_snapshot
+    int session_stats;
+    // pointer to ni_session_rate_stats_t which is part of private API
+    void *p_session_stats;
+
+    // set before session open to cap the decoder frame buffer pool, in bytes;
+    // 0: limited only by NI_BUF_POOL_MAX_BUFFERS. At the cap
+    // ni_decoder_frame_buffer_alloc returns NI_RETCODE_EAGAIN until frames
+    // are freed
+    uint64_t dec_fme_buf_pool_budget;
+
+    // pointer to ni_enc_reg_bufs_t which is part of private API, encoder
+    // input buffers registered with ni_encoder_frame_buffer_register
+    void *p_enc_reg_bufs;
+
+    // decoded frame memory from the caller, see
+    // ni_decoder_set_buffer_allocator
+    ni_dec_buffer_allocator_t dec_buffer_allocator;
+
+    // pointer to ni_enc_aux_slab_t which is part of private API, see
+    // ni_encoder_frame_aux_buffers_borrow
+    void *p_enc_aux_slab;
+
+    // pointer to ni_dec_pkt_fifo_t which is part of private API, storage of
+    // pts_offsets, pkt_offsets_index, pkt_offsets_index_min, pkt_pos,
+    // pkt_custom_sei_set and flags_array
+    void *p_dec_pkt_fifo;
+
+    // set before session open to cap the host memory libxcoder allocates for
+    // the session (see ni_mem_category_t), in bytes; 0: no cap. Allocations
+    // above the cap fail, decoded frames with NI_RETCODE_EAGAIN
+    uint64_t mem_cap;
+    // pointer to ni_mem_account_t, read with ni_device_session_get_mem_usage
+    void *p_mem_account;
+
+    // the context itself once initialized, NULL once cleared: tells
+    // ni_device_session_context_init the pointers above are its own
+    void *p_self;
 } ni_session_context_t;
 
 typedef struct _ni_split_context_t
@@ -2603,6 +2707,18 @@ typedef struct _ni_frame
     uint8_t separate_start;
     uint8_t inconsecutive_transfer;
     long long orignal_pts;
+
+    // p_buffer as allocated from the size-class pool (ni_mem_pool_alloc);
+    // p_buffer is returned to the pool on free only while it matches
+    uint8_t *p_pool_buffer;
+
+    // for decoder: allocator p_buffer came from, instead of dec_buf
+    ni_dec_buffer_allocator_t dec_allocator;
+    void *p_dec_alloc_opaque;
+
+    // for encoder: pointer to ni_enc_aux_slab_t which is part of private
+    // API, session slab p_metadata_buffer and p_start_buffer came from
+    void *p_enc_aux_slab;
 } ni_frame_t;
 
 typedef struct _ni_xcoder_params
@@ -2745,6 +2861,9 @@ typedef struct _ni_packet
   int flags;   // flags of demuxed packet
 
   ni_custom_sei_set_t *p_custom_sei_set;
+
+  // p_buffer as allocated from the size-class pool (ni_mem_pool_alloc)
+  void *p_pool_buffer;
 } ni_packet_t;
 
 typedef struct _ni_session_data_io
@@ -2783,7 +2902,10 @@ extern LIB_API const char* const g_xcoder_log_names[NI_XCODER_LOG_NAMES_ARRAY_LE
 LIB_API ni_session_context_t *ni_device_session_context_alloc_init(void);
 
 /*!*****************************************************************************
- *  \brief  Initialize already allocated session context to a known state
+ *  \brief  Initialize already allocated session context to a known state.
+ *          Memory a context initialized before still holds is freed first,
+ *          as by ni_device_session_context_clear(), except across a
+ *          sequence change.
  *
  *  \param[in]  p_ctx Pointer to an already allocated ni_session_context_t
  *              struct
@@ -3097,6 +3219,209 @@ LIB_API ni_retcode_t ni_device_session_query(ni_session_context_t *p_ctx,
  ******************************************************************************/
 LIB_API ni_retcode_t ni_device_session_query_detail_v1(ni_session_context_t* p_ctx, ni_device_type_t device_type, ni_instance_mgr_detail_status_v1_t *detail_data);
 
+typedef enum _ni_latency_stage
+{
+    NI_LATENCY_STAGE_ENCODE = 0, // frame written to packet read, matched by dts
+    NI_LATENCY_STAGE_DECODE,     // packet written to frame read, matched by dts
+    NI_LATENCY_STAGE_UPLOAD,     // frame written to hw frame read, matched by pts
+    NI_LATENCY_STAGE_SCALE,      // duration of scaler/AI frame allocation calls
+    NI_LATENCY_STAGE_MAX,
+} ni_latency_stage_t;
+
+typedef struct _ni_latency_stats
+{
+    uint64_t count;   // number of samples recorded
+    uint64_t min_us;
+    uint64_t max_us;
+    uint64_t mean_us;
+    uint64_t p50_us;  // percentiles are accurate to within about 3%
+    uint64_t p90_us;
+    uint64_t p99_us;
+    uint64_t p999_us;
+} ni_latency_stats_t;
+
+/*!*****************************************************************************
+ *  \brief  Get the latency distribution of a session for one processing stage.
+ *          Latencies are recorded into a log-linear histogram for every
+ *          frame/packet of the session, independent of MEASURE_LATENCY.
+ *
+ *  \param[in]  p_ctx    Pointer to a caller allocated ni_session_context_t
+ *  \param[in]  stage    processing stage
+ *  \param[out] p_stats  latency statistics, all zero if no sample recorded
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+LIB_API ni_retcode_t ni_device_session_get_latency_stats(ni_session_context_t *p_ctx,
+                                                         ni_latency_stage_t stage,
+                                                         ni_latency_stats_t *p_stats);
+
+/*!*****************************************************************************
+ *  \brief  Clear the latency histograms of a session for all stages
+ *
+ *  \param[in]  p_ctx    Pointer to a caller allocated ni_session_context_t
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+LIB_API ni_retcode_t ni_device_session_reset_latency_stats(ni_session_context_t *p_ctx);
+
+typedef enum _ni_pipeline_stage
+{
+    NI_PIPELINE_STAGE_WRITE_TOTAL = 0,  // session write call, entry to return
+    NI_PIPELINE_STAGE_LOW_DELAY_WAIT,   // write waiting for the read thread in
+                                        // low delay mode
+    NI_PIPELINE_STAGE_WRITE_BUF_WAIT,   // querying until the device has room
+                                        // for the frame/packet
+    NI_PIPELINE_STAGE_WRITE_SEND,       // room available to write return, i.e.
+                                        // NVMe data write and bookkeeping
+    NI_PIPELINE_STAGE_READ_TOTAL,       // session read call, entry to return
+    NI_PIPELINE_STAGE_READ_QUERY,       // querying until output is available
+    NI_PIPELINE_STAGE_READ_RECEIVE,     // output available to read return, i.e.
+                                        // NVMe data read and bookkeeping
+    NI_PIPELINE_STAGE_QUERY_SLEEP_WRITE,// query_sleep in async mode, part of
+                                        // WRITE_BUF_WAIT
+    NI_PIPELINE_STAGE_QUERY_SLEEP_READ, // query_sleep in async mode, part of
+                                        // READ_QUERY
+    NI_PIPELINE_STAGE_MAX,
+} ni_pipeline_stage_t;
+
+typedef enum _ni_pipeline_timestamp
+{
+    NI_PIPELINE_TS_WRITE_ENTRY = 0,
+    NI_PIPELINE_TS_WRITE_BUF_READY,     // buffer query succeeded
+    NI_PIPELINE_TS_WRITE_RETURN,
+    NI_PIPELINE_TS_READ_ENTRY,
+    NI_PIPELINE_TS_READ_READY,          // first successful read query
+    NI_PIPELINE_TS_READ_RETURN,
+    NI_PIPELINE_TS_MAX,
+} ni_pipeline_timestamp_t;
+
+typedef struct _ni_pipeline_stage_stats
+{
+    uint64_t count;     // number of times the stage was entered
+    uint64_t total_ns;
+    uint64_t max_ns;
+} ni_pipeline_stage_stats_t;
+
+typedef struct _ni_pipeline_timing_stats
+{
+    ni_pipeline_stage_stats_t stage[NI_PIPELINE_STAGE_MAX];
+    uint64_t write_queries;  // buffer queries issued by write calls
+    uint64_t write_retries;  // buffer queries beyond the first of a call
+    uint64_t read_queries;   // output queries issued by read calls
+    uint64_t read_retries;   // output queries beyond the first of a call
+    // ni_gettime_ns() stamps of the most recent write and read call, 0 if the
+    // point was not reached in that call
+    uint64_t last_ts[NI_PIPELINE_TS_MAX];
+} ni_pipeline_timing_stats_t;
+
+/*!*****************************************************************************
+ *  \brief  Get the per stage timing of the write/read calls of a session.
+ *          Recorded only if p_ctx->pipeline_timing was set to 1 before the
+ *          session was opened. Time spent in the buffer/output query loops is
+ *          device side latency, the remainder of the call totals is library
+ *          and NVMe transfer overhead.
+ *
+ *  \param[in]  p_ctx    Pointer to a caller allocated ni_session_context_t
+ *  \param[out] p_stats  timing statistics, all zero if not enabled
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+LIB_API ni_retcode_t ni_device_session_get_pipeline_timing(ni_session_context_t *p_ctx,
+                                                           ni_pipeline_timing_stats_t *p_stats);
+
+/*!*****************************************************************************
+ *  \brief  Clear the per stage timing of a session
+ *
+ *  \param[in]  p_ctx    Pointer to a caller allocated ni_session_context_t
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+LIB_API ni_retcode_t ni_device_session_reset_pipeline_timing(ni_session_context_t *p_ctx);
+
+// sliding windows of a session stats snapshot
+typedef enum _ni_session_stats_window
+{
+    NI_SESSION_STATS_WINDOW_1S = 0,
+    NI_SESSION_STATS_WINDOW_10S,
+    NI_SESSION_STATS_WINDOW_MAX,
+} ni_session_stats_window_t;
+
+typedef struct _ni_session_rates
+{
+    double window_s;            // time covered, less than the window length
+                                // early in the session
+    double write_fps;           // frames/packets written per second
+    double read_fps;            // frames/packets read per second
+    double write_bitrate;       // bits written per second
+    double read_bitrate;        // bits read per second
+    double avg_write_size;      // average bytes per frame/packet written
+    double avg_read_size;       // average bytes per frame/packet read
+    double write_buf_occupancy; // average device write buffer occupancy in
+                                // percent, -1 if not sampled in the window
+    double write_retry_rate;    // buffer query retries per write call
+    double read_retry_rate;     // output query retries per read call
+} ni_session_rates_t;
+
+typedef struct _ni_session_stats_snapshot
+{
+    uint64_t timestamp;         // ni_gettime_ns() of the snapshot
+    uint64_t start_time;        // ni_gettime_ns() of the session open
+    // totals since session open
+    uint64_t write_calls;
+    uint64_t read_calls;
+    uint64_t frames_written;    // write calls that sent data
+    uint64_t frames_read;       // read calls that returned data
+    uint64_t bytes_written;
+    uint64_t bytes_read;
+    uint64_t write_retries;
+    uint64_t read_retries;
+    // most recent session statistic the data path got from the device,
+    // fw_timestamp is 0 if none was received yet
+    uint64_t fw_timestamp;
+    uint32_t fw_frames_input;
+    uint32_t fw_frames_buffered;
+    uint32_t fw_frames_completed;
+    uint32_t fw_frames_output;
+    uint32_t fw_frames_dropped;
+    uint32_t fw_inst_errors;
+    uint32_t write_buf_avail;   // bytes available in the device write buffer
+    uint32_t write_buf_size;    // largest write_buf_avail seen, i.e. the size
+                                // of the empty buffer
+    ni_session_rates_t rates[NI_SESSION_STATS_WINDOW_MAX];
+} ni_session_stats_snapshot_t;
+
+/*!*****************************************************************************
+ *  \brief  Get the stats of a session with fps, bitrate, average frame size,
+ *          write buffer occupancy and query retry rates over sliding windows.
+ *          The stats are sampled from the session write/read calls and the
+ *          session statistics they already query, so this call does no
+ *          device I/O and may be polled freely from any thread. Recorded
+ *          only if p_ctx->session_stats was set to 1 before the session was
+ *          opened.
+ *
+ *  \param[in]  p_ctx       Pointer to a caller allocated ni_session_context_t
+ *  \param[out] p_snapshot  session stats, all zero if not enabled
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+LIB_API ni_retcode_t ni_device_session_get_stats_snapshot(ni_session_context_t *p_ctx,
+                                                         ni_session_stats_snapshot_t *p_snapshot);
+
 /*!*****************************************************************************
  *  \brief  Send namespace num and SRIOv index to the device with specified logic block
  *          address.
@@ -3229,6 +3554,11 @@ LIB_API ni_retcode_t ni_frame_buffer_alloc_dl(ni_frame_t *p_frame,
  *
  *  \return On success
  *                          NI_RETCODE_SUCCESS
+ *          When all buffers the pool's budget allows are in use (see
+ *          dec_fme_buf_pool_budget), or the caller allocator (see
+ *          ni_decoder_set_buffer_allocator) has none; free decoded frames
+ *          and retry
+ *                          NI_RETCODE_EAGAIN
  *          On failure
  *                          NI_RETCODE_INVALID_PARAM
  *                          NI_RETCODE_ERROR_MEM_ALOC
@@ -3371,6 +3701,25 @@ LIB_API void
 ni_decoder_frame_buffer_pool_return_buf(ni_buf_t *buf,
                                         ni_buf_pool_t *p_buffer_pool);
 
+/*!*****************************************************************************
+ *  \brief  Have decoded frames read into caller memory: buffers for
+ *          ni_decoder_frame_buffer_alloc (including the ones the decoder
+ *          allocates itself) come from p_allocator instead of the decoder
+ *          frame buffer pool, and are given back by
+ *          ni_decoder_frame_buffer_free. The frame planes are at the
+ *          p_data/data_len the library sets up, so the caller can wrap the
+ *          buffer in its own frame object without copying. Best set before
+ *          the session is opened; kept across a sequence change.
+ *
+ *  \param[in] p_ctx        decoder session context
+ *  \param[in] p_allocator  callbacks, copied; NULL to use the pool again
+ *
+ *  \return On success    NI_RETCODE_SUCCESS
+ *          On failure    NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+LIB_API ni_retcode_t ni_decoder_set_buffer_allocator(
+    ni_session_context_t *p_ctx, const ni_dec_buffer_allocator_t *p_allocator);
+
 /*!*****************************************************************************
  *  \brief  Allocate memory for the packet buffer based on provided packet size
  *
@@ -4536,6 +4885,111 @@ LIB_API ni_retcode_t ni_encoder_frame_zerocopy_buffer_alloc(ni_frame_t *p_frame,
                                            const int linesize[], const uint8_t *data[],
                                            int extra_len);
 
+#define NI_ENC_MAX_REGISTERED_BUFFERS 64
+
+/*!*****************************************************************************
+ *  \brief  Register a caller owned YUV/RGBA buffer as encoder input, to be
+ *          used with ni_encoder_frame_registered_buffer_alloc for every frame
+ *          written from it. The layout is checked once against the session's
+ *          zero copy linesizes (see ni_encoder_frame_zerocopy_check): planes
+ *          with the same linesize are sent to the device from the buffer
+ *          directly, only the others are copied, into a staging buffer
+ *          allocated here.
+ *
+ *  \param[in]  p_enc_ctx  encoder session context, with p_session_config set
+ *  \param[in]  width      picture width
+ *  \param[in]  height     picture height
+ *  \param[in]  data       plane pointers (for each of YUV planes), must stay
+ *                         valid until unregistered
+ *  \param[in]  linesize   plane linesizes
+ *  \param[out] p_handle   handle of the registered buffer
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ *                          NI_RETCODE_ERROR_UNSUPPORTED_FEATURE (session
+ *                          has no zero copy linesizes)
+ *                          NI_RETCODE_ERROR_MEM_ALOC (also when
+ *                          NI_ENC_MAX_REGISTERED_BUFFERS are registered)
+ ******************************************************************************/
+LIB_API ni_retcode_t ni_encoder_frame_buffer_register(
+    ni_session_context_t *p_enc_ctx, int width, int height,
+    const uint8_t *data[], const int linesize[], int *p_handle);
+
+/*!*****************************************************************************
+ *  \brief  Unregister a buffer registered with
+ *          ni_encoder_frame_buffer_register. Buffers still registered are
+ *          released by ni_device_session_context_clear.
+ *
+ *  \param[in] p_enc_ctx  encoder session context
+ *  \param[in] handle     handle of the registered buffer
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+LIB_API ni_retcode_t ni_encoder_frame_buffer_unregister(
+    ni_session_context_t *p_enc_ctx, int handle);
+
+/*!*****************************************************************************
+ *  \brief  Set up a frame to encode from a registered buffer, as
+ *          ni_encoder_frame_zerocopy_buffer_alloc does for a zero copy
+ *          compatible buffer; planes whose layout differs from the
+ *          session's are copied first. As with zero copy, clear p_buffer,
+ *          p_data and data_len of the frame after it is written.
+ *
+ *  \param[in] p_enc_ctx  encoder session context
+ *  \param[in] p_frame    Pointer to a caller allocated ni_frame_t struct
+ *  \param[in] handle     handle of the registered buffer
+ *  \param[in] extra_len  Extra data size (incl. meta data)
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ *                          NI_RETCODE_ERROR_MEM_ALOC
+ ******************************************************************************/
+LIB_API ni_retcode_t ni_encoder_frame_registered_buffer_alloc(
+    ni_session_context_t *p_enc_ctx, ni_frame_t *p_frame, int handle,
+    int extra_len);
+
+/*!*****************************************************************************
+ *  \brief  Borrow the encoder metadata buffer (and start buffer, see
+ *          ni_encoder_frame_zerocopy_buffer_alloc) of a frame from a per
+ *          session slab of page aligned chunks. The frame stays attached to
+ *          the slab: ni_encoder_frame_zerocopy_buffer_alloc keeps taking its
+ *          buffers from it, and ni_encoder_frame_aux_buffers_return or
+ *          ni_frame_buffer_free gives them back for the next frame instead of
+ *          freeing them. The slab is freed once the session is closed and
+ *          every frame has returned its buffers.
+ *
+ *  \param[in] p_enc_ctx  encoder session context
+ *  \param[in] p_frame    Pointer to a caller allocated ni_frame_t struct
+ *  \param[in] extra_len  Extra data size (incl. meta data), 0 to only attach
+ *                        the frame
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ *                          NI_RETCODE_ERROR_MEM_ALOC
+ ******************************************************************************/
+LIB_API ni_retcode_t ni_encoder_frame_aux_buffers_borrow(
+    ni_session_context_t *p_enc_ctx, ni_frame_t *p_frame, int extra_len);
+
+/*!*****************************************************************************
+ *  \brief  Return the metadata and start buffers of a frame to the session
+ *          slab they were borrowed from and detach the frame from it. Frames
+ *          not attached to a slab have the buffers freed.
+ *
+ *  \param[in] p_frame  Pointer to a caller allocated ni_frame_t struct
+ *
+ *  \return none
+ ******************************************************************************/
+LIB_API void ni_encoder_frame_aux_buffers_return(ni_frame_t *p_frame);
+
 /*!*****************************************************************************
  *  \brief  Check if incoming frame is hwupload zero copy compatible or not
  *
@@ -4578,6 +5032,112 @@ LIB_API ni_retcode_t ni_uploader_frame_zerocopy_check(ni_session_context_t *p_up
 *******************************************************************************/
 LIB_API ni_retcode_t ni_device_alloc_and_get_firmware_logs(ni_session_context_t *p_ctx, void** p_log_buffer, bool gen_log_file);
 
+// default number of 4 KiB log pages a firmware log stream reads per core per
+// call
+#define NI_FW_LOG_STREAM_DEFAULT_PAGES 4
+
+// caller provided ring receiving new firmware log bytes; positions are byte
+// counts since the ring was set up, the data of position pos is at
+// p_buf[pos % size]
+typedef struct _ni_fw_log_ring
+{
+    uint8_t *p_buf;
+    uint32_t size;
+    uint64_t write_pos;     // advanced by ni_device_fw_log_stream_read
+    uint64_t read_pos;      // advanced by the caller as it consumes
+    uint64_t dropped;       // new log bytes lost because the ring was full
+} ni_fw_log_ring_t;
+
+typedef struct _ni_fw_log_stream
+{
+    ni_session_context_t *p_ctx;    // device to read through blk_io_handle
+    uint32_t max_pages;             // log pages read per core per call
+    uint64_t rate_dropped;          // background mode: bytes over the rate
+    void *p_priv;                   // part of private API
+} ni_fw_log_stream_t;
+
+/*!*****************************************************************************
+ *  \brief  Set up an incremental firmware log reader. Unlike
+ *          ni_device_alloc_and_get_firmware_logs, which reads the whole log
+ *          buffer of every core, the stream keeps a copy of each core's log
+ *          and the page the firmware writes next, then reads only a few
+ *          pages per call and returns the bytes that changed.
+ *
+ *  \param[in] p_stream     Pointer to a caller allocated ni_fw_log_stream_t
+ *  \param[in] p_ctx        Session context with an open device, must stay
+ *                          valid until the stream is closed
+ *  \param[in] max_pages    4 KiB log pages read per core per call, 0 for
+ *                          NI_FW_LOG_STREAM_DEFAULT_PAGES
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ *                          NI_RETCODE_ERROR_MEM_ALOC
+ ******************************************************************************/
+LIB_API ni_retcode_t ni_device_fw_log_stream_init(ni_fw_log_stream_t *p_stream,
+                                                  ni_session_context_t *p_ctx,
+                                                  uint32_t max_pages);
+
+/*!*****************************************************************************
+ *  \brief  Append the firmware log bytes of a core written since the last
+ *          call to a ring. The first calls for a core only read its current
+ *          log, which is not returned, max_pages pages at a time.
+ *
+ *  \param[in] p_stream     Stream set up by ni_device_fw_log_stream_init
+ *  \param[in] core         NVME_CORE, EP_CORE, DP_CORE, TP_CORE or FP_CORE
+ *  \param[in] p_ring       Ring receiving the new log bytes
+ *
+ *  \return On success
+ *                          Number of bytes appended to the ring
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ *                          NI_RETCODE_ERROR_MEM_ALOC
+ *                          NI_RETCODE_ERROR_NVME_CMD_FAILED
+ ******************************************************************************/
+LIB_API int ni_device_fw_log_stream_read(ni_fw_log_stream_t *p_stream,
+                                         ni_core_type_t core,
+                                         ni_fw_log_ring_t *p_ring);
+
+/*!*****************************************************************************
+ *  \brief  Start tailing the firmware logs of all cores into the host log
+ *          (ni_log at NI_LOG_INFO, one line per firmware log line) from a
+ *          background thread. Lines beyond max_bytes_per_sec are dropped and
+ *          counted in p_stream->rate_dropped.
+ *
+ *  \param[in] p_stream           Stream set up by ni_device_fw_log_stream_init
+ *  \param[in] interval_ms        Polling interval
+ *  \param[in] max_bytes_per_sec  Log bytes forwarded per second at most
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ *                          NI_RETCODE_ERROR_MEM_ALOC
+ *                          NI_RETCODE_FAILURE
+ ******************************************************************************/
+LIB_API ni_retcode_t ni_device_fw_log_stream_start(ni_fw_log_stream_t *p_stream,
+                                                   uint32_t interval_ms,
+                                                   uint32_t max_bytes_per_sec);
+
+/*!*****************************************************************************
+ *  \brief  Stop the background thread of a firmware log stream, if running
+ *
+ *  \param[in] p_stream     Stream set up by ni_device_fw_log_stream_init
+ *
+ *  \return none
+ ******************************************************************************/
+LIB_API void ni_device_fw_log_stream_stop(ni_fw_log_stream_t *p_stream);
+
+/*!*****************************************************************************
+ *  \brief  Stop and free a firmware log stream
+ *
+ *  \param[in] p_stream     Stream set up by ni_device_fw_log_stream_init
+ *
+ *  \return none
+ ******************************************************************************/
+LIB_API void ni_device_fw_log_stream_close(ni_fw_log_stream_t *p_stream);
+
 /*!*****************************************************************************
  *  \brief  Set up hard coded demo ROI map
  *
@@ -26,6 +26,8 @@
  *          tasks
  ******************************************************************************/
 
+#define NI_LOG_MODULE NI_LOG_MODULE_DEVICE_API_PRIV
+
 #ifdef _WIN32
 #include <windows.h>
 #elif __linux__ || __APPLE__
@@ -83,6 +85,12 @@ static const int g_map_preset_to_gopsize[2][18] = {{8, 0,  1, -1,  1, 2, 4, -1,
                                             {8, 0, -1, -1, -1, 2, 4, -1, -1, 8, 1, -1, -1, -1, -1, -1, -1}};
 #define MAGIC_P2P_VALUE "p2p"
 
+#ifdef NI_LOG_SSIM_AT_INFO
+#define NI_LOG_SSIM_LEVEL NI_LOG_INFO
+#else
+#define NI_LOG_SSIM_LEVEL NI_LOG_DEBUG
+#endif
+
 typedef enum _ni_t35_sei_mesg_type
 {
     NI_T35_SEI_CLOSED_CAPTION = 0,
@@ -544,7 +552,7 @@ void calculate_psnr(ni_session_context_t *p_ctx, ni_packet_t *p_packet)
           uint8_t *p_y_src_buf = NULL;
           uint8_t *p_u_src_buf = NULL;
           uint8_t *p_v_src_buf = NULL;
-          for (int i = 0; i < 120; i++)
+          for (int i = 0; p_ctx->input_frame_fifo && i < NI_INPUT_FRAME_FIFO_SZ; i++)
           {
             if (p_ctx->input_frame_fifo[i].p_input_buffer != NULL &&
                 p_ctx->input_frame_fifo[i].pts == p_meta->frame_tstamp)
@@ -724,11 +732,12 @@ static void low_delay_wait(ni_session_context_t* p_ctx)
   {
     int ret;
     uint64_t abs_time_ns;
+    uint64_t start_time_ns;
     struct timespec ts;
 
     ni_log2(p_ctx, NI_LOG_DEBUG,  "%s waiting for %s recv thread\n", __FUNCTION__, name);
 
-    abs_time_ns = ni_gettime_ns();
+    abs_time_ns = start_time_ns = ni_gettime_ns();
     abs_time_ns += p_ctx->decoder_low_delay * 1000000LL;
     ts.tv_sec = abs_time_ns / 1000000000LL;
     ts.tv_nsec = abs_time_ns % 1000000000LL;
@@ -747,6 +756,8 @@ static void low_delay_wait(ni_session_context_t* p_ctx)
       }
     }
     ni_pthread_mutex_unlock(&p_ctx->low_delay_sync_mutex);
+    ni_pipeline_timing_add((ni_pipeline_timing_t *)p_ctx->p_pipeline_timing,
+                           NI_PIPELINE_STAGE_LOW_DELAY_WAIT, start_time_ns);
   }
 }
 
@@ -764,17 +775,41 @@ static void low_delay_signal(ni_session_context_t* p_ctx)
   }
 }
 
-static void query_sleep(ni_session_context_t* p_ctx)
+// called once per iteration of every buffer/output query loop, direction is
+// NI_PIPELINE_DIR_WRITE or NI_PIPELINE_DIR_READ for pipeline timing
+static void query_sleep(ni_session_context_t* p_ctx, int direction)
 {
+  uint64_t start_time_ns = ni_pipeline_timing_query(
+      (ni_pipeline_timing_t *)p_ctx->p_pipeline_timing, direction);
+
+  ni_perf_count(NI_PERF_CTR_QUERIES, 1);
+  ni_session_rate_stats_query((ni_session_rate_stats_t *)p_ctx->p_session_stats,
+                              direction, 0);
+
   if (p_ctx->async_mode)
   {
     // To avoid IO spam on NP core from queries and high volumens on latency.
     ni_pthread_mutex_unlock(&p_ctx->mutex);
     ni_usleep(NI_RETRY_INTERVAL_100US);
     ni_pthread_mutex_lock(&p_ctx->mutex);
+    ni_pipeline_timing_add((ni_pipeline_timing_t *)p_ctx->p_pipeline_timing,
+                           direction == NI_PIPELINE_DIR_WRITE ?
+                           NI_PIPELINE_STAGE_QUERY_SLEEP_WRITE :
+                           NI_PIPELINE_STAGE_QUERY_SLEEP_READ,
+                           start_time_ns);
   }
 }
 
+// called when a buffer/output query loop found the device ready
+static void query_done(ni_session_context_t* p_ctx, int direction)
+{
+  ni_pipeline_timing_query_done(
+      (ni_pipeline_timing_t *)p_ctx->p_pipeline_timing, direction);
+  ni_perf_count(NI_PERF_CTR_QUERY_HITS, 1);
+  ni_session_rate_stats_query((ni_session_rate_stats_t *)p_ctx->p_session_stats,
+                              direction, 1);
+}
+
 // create folder bearing the card name (nvmeX) if not existing
 // start working inside this folder: nvmeX
 // find the earliest saved and/or non-existing stream folder and use it as
@@ -1139,6 +1174,14 @@ ni_retcode_t ni_decoder_session_open(ni_session_context_t* p_ctx)
     p_ctx->p_all_zero_buf = NULL;
     p_ctx->last_pkt_pos = 0;
     p_ctx->last_frame_offset = 0;
+    if (ni_dec_pkt_fifo_alloc(p_ctx))
+    {
+        ni_log2(p_ctx, NI_LOG_ERROR,
+               "ERROR %d: %s() alloc decoder packet fifo failed\n",
+               NI_ERRNO, __func__);
+        retval = NI_RETCODE_ERROR_MEM_ALOC;
+        LRETURN;
+    }
     memset(p_ctx->pkt_custom_sei_set, 0, NI_FIFO_SZ * sizeof(ni_custom_sei_set_t *));
 
     //malloc zero data buffer
@@ -1535,7 +1578,6 @@ ni_retcode_t ni_decoder_session_close(ni_session_context_t* p_ctx, int eos_recie
   ni_retcode_t retval = NI_RETCODE_SUCCESS;
   void* p_buffer = NULL;
   uint32_t ui32LBA = 0;
-  int i;
   ni_xcoder_params_t *p_param = NULL;
 
   ni_log2(p_ctx, NI_LOG_TRACE,  "%s(): enter\n", __func__);
@@ -1671,10 +1713,7 @@ END:
     p_ctx->buffer_pool = NULL;
     p_ctx->dec_fme_buf_pool = NULL;
 
-    for (i = 0; i < NI_FIFO_SZ; i++)
-    {
-        ni_memfree(p_ctx->pkt_custom_sei_set[i]);
-    }
+    ni_dec_pkt_fifo_free_sei(p_ctx);
 
     ni_log2(p_ctx, NI_LOG_DEBUG,  "%s():  CTX[Card:%" PRIx64 " / HW:%d / INST:%d]\n",
            __func__, (int64_t)p_ctx->device_handle, p_ctx->hw_id,
@@ -1728,6 +1767,12 @@ int ni_decoder_session_write(ni_session_context_t* p_ctx, ni_packet_t* p_packet)
 
   low_delay_wait(p_ctx);
 
+  if ((p_packet->dts != NI_NOPTS_VALUE) && p_ctx->lat_stats)
+  {
+      ni_lat_stats_start((ni_lat_stats_t *)p_ctx->lat_stats, ni_gettime_ns(),
+                         p_packet->dts);
+  }
+
 #ifdef MEASURE_LATENCY
   if ((p_packet->dts != NI_NOPTS_VALUE) && (p_ctx->frame_time_q != NULL))
   {
@@ -1751,7 +1796,7 @@ int ni_decoder_session_write(ni_session_context_t* p_ctx, ni_packet_t* p_packet)
 
   for (;;)
   {
-    query_sleep(p_ctx);
+    query_sleep(p_ctx, NI_PIPELINE_DIR_WRITE);
 
     query_retry++;
 
@@ -1830,6 +1875,7 @@ int ni_decoder_session_write(ni_session_context_t* p_ctx, ni_packet_t* p_packet)
 #endif
         {
             p_ctx->status = NI_RETCODE_NVME_SC_WRITE_BUFFER_FULL;
+            ni_perf_count(NI_PERF_CTR_WRITE_BUFFER_FULL, 1);
             p_ctx->max_retry_fail_count[0]++;
             retval = (p_ctx->max_retry_fail_count[0] >= NI_XCODER_FAILURES_MAX) ? NI_RETCODE_FAILURE : NI_RETCODE_SUCCESS;
             LRETURN;
@@ -1847,6 +1893,7 @@ int ni_decoder_session_write(ni_session_context_t* p_ctx, ni_packet_t* p_packet)
       break;
     }
   }
+  query_done(p_ctx, NI_PIPELINE_DIR_WRITE);
 
   //Configure write size for the buffer
   retval = ni_config_instance_set_write_len(p_ctx, NI_DEVICE_TYPE_DECODER,
@@ -2039,11 +2086,28 @@ int ni_decoder_session_write(ni_session_context_t* p_ctx, ni_packet_t* p_packet)
     }
 
     /* if this wrap-around pkt_offset_index spot is about to be overwritten, free the previous one. */
-    free(p_ctx->pkt_custom_sei_set[p_ctx->pkt_index % NI_FIFO_SZ]);
+    if (p_ctx->pkt_custom_sei_set[p_ctx->pkt_index % NI_FIFO_SZ])
+    {
+      free(p_ctx->pkt_custom_sei_set[p_ctx->pkt_index % NI_FIFO_SZ]);
+      ni_mem_account_uncharge((ni_mem_account_t *)p_ctx->p_mem_account,
+                              NI_MEM_CAT_CUSTOM_SEI, sizeof(ni_custom_sei_set_t));
+    }
 
     if (p_packet->p_custom_sei_set)
     {
-      p_ctx->pkt_custom_sei_set[p_ctx->pkt_index % NI_FIFO_SZ] = malloc(sizeof(ni_custom_sei_set_t));
+      p_ctx->pkt_custom_sei_set[p_ctx->pkt_index % NI_FIFO_SZ] = NULL;
+      if (!ni_mem_account_charge((ni_mem_account_t *)p_ctx->p_mem_account,
+                                 NI_MEM_CAT_CUSTOM_SEI,
+                                 sizeof(ni_custom_sei_set_t)))
+      {
+        p_ctx->pkt_custom_sei_set[p_ctx->pkt_index % NI_FIFO_SZ] = malloc(sizeof(ni_custom_sei_set_t));
+        if (!p_ctx->pkt_custom_sei_set[p_ctx->pkt_index % NI_FIFO_SZ])
+        {
+          ni_mem_account_uncharge((ni_mem_account_t *)p_ctx->p_mem_account,
+                                  NI_MEM_CAT_CUSTOM_SEI,
+                                  sizeof(ni_custom_sei_set_t));
+        }
+      }
       if (p_ctx->pkt_custom_sei_set[p_ctx->pkt_index % NI_FIFO_SZ])
       {
         ni_custom_sei_set_t *p_custom_sei_set = p_ctx->pkt_custom_sei_set[p_ctx->pkt_index % NI_FIFO_SZ];
@@ -2279,7 +2343,7 @@ start:
   }
   for (;;)
   {
-    query_sleep(p_ctx);
+    query_sleep(p_ctx, NI_PIPELINE_DIR_READ);
 
     query_retry++;
 
@@ -2526,6 +2590,14 @@ start:
             p_ctx->codec_format == NI_CODEC_FORMAT_H264,
             p_ctx->bit_depth_factor, is_planar);
 
+        if (NI_RETCODE_EAGAIN == retval)
+        {
+          // pool at its budget: nothing read yet, redo the first frame set
+          // up on the next read once the caller has freed frames
+          p_ctx->active_video_width = 0;
+          p_ctx->active_video_height = 0;
+          LRETURN;
+        }
         if (NI_RETCODE_SUCCESS != retval)
         {
           LRETURN;
@@ -2542,6 +2614,7 @@ start:
       break;
     }
   }
+  query_done(p_ctx, NI_PIPELINE_DIR_READ);
 
   ni_log2(p_ctx, NI_LOG_DEBUG,  "total_bytes_to_read %u max_nvme_io_size %u ylen %u cr len "
                  "%u cb len %u hdr %d\n",
@@ -2856,6 +2929,13 @@ start:
                    p_ctx->pkt_pos[i]);
 
             p_frame->p_custom_sei_set = p_ctx->pkt_custom_sei_set[i];
+            if (p_ctx->pkt_custom_sei_set[i])
+            {
+                // owned by the frame now
+                ni_mem_account_uncharge(
+                    (ni_mem_account_t *)p_ctx->p_mem_account,
+                    NI_MEM_CAT_CUSTOM_SEI, sizeof(ni_custom_sei_set_t));
+            }
             p_ctx->pkt_custom_sei_set[i] = NULL;
         } else
         {
@@ -2934,6 +3014,12 @@ start:
                                 p_ctx->buffer_pool);
   }
 
+  if ((p_frame->dts != NI_NOPTS_VALUE) && p_ctx->lat_stats)
+  {
+    ni_lat_stats_end((ni_lat_stats_t *)p_ctx->lat_stats,
+                     NI_LATENCY_STAGE_DECODE, ni_gettime_ns(), p_frame->dts);
+  }
+
 #ifdef MEASURE_LATENCY
   if ((p_frame->dts != NI_NOPTS_VALUE) && (p_ctx->frame_time_q != NULL))
   {
@@ -3198,7 +3284,10 @@ ni_retcode_t ni_encoder_session_open(ni_session_context_t* p_ctx)
     p_ctx->enc_pts_w_idx = 0;
     p_ctx->enc_pts_r_idx = 0;
     p_ctx->session_timestamp = 0;
-    memset(p_ctx->pkt_custom_sei_set, 0, NI_FIFO_SZ * sizeof(ni_custom_sei_set_t *));
+    if (p_ctx->pkt_custom_sei_set)
+    {
+        memset(p_ctx->pkt_custom_sei_set, 0, NI_FIFO_SZ * sizeof(ni_custom_sei_set_t *));
+    }
     memset(&(p_ctx->param_err_msg[0]), 0, sizeof(p_ctx->param_err_msg));
     if (p_ctx->session_run_state != SESSION_RUN_STATE_SEQ_CHANGE_DRAINING)
     {
@@ -3682,7 +3771,6 @@ ni_retcode_t ni_encoder_session_close(ni_session_context_t* p_ctx, int eos_recie
   ni_retcode_t retval = NI_RETCODE_SUCCESS;
   void* p_buffer = NULL;
   uint32_t ui32LBA = 0;
-  int i = 0;
   ni_xcoder_params_t *p_param = NULL;
 
   ni_log2(p_ctx, NI_LOG_TRACE,  "%s(): enter\n", __func__);
@@ -3811,19 +3899,9 @@ END:
     ni_buffer_pool_free(p_ctx->buffer_pool);
     p_ctx->buffer_pool = NULL;
 
-    for (i = 0; i < NI_FIFO_SZ; i++)
-    {
-        ni_memfree(p_ctx->pkt_custom_sei_set[i]);
-    }
+    ni_dec_pkt_fifo_free_sei(p_ctx);
 
-    for (i = 0; i < 120 ; i++)
-    {
-      if (p_ctx->input_frame_fifo[i].p_input_buffer != NULL)
-      {
-        free(p_ctx->input_frame_fifo[i].p_input_buffer);
-        p_ctx->input_frame_fifo[i].p_input_buffer = NULL;
-      }
-    }
+    ni_input_frame_fifo_free(p_ctx);
 
     ni_log2(p_ctx, NI_LOG_DEBUG,  "%s(): CTX[Card:%" PRIx64 " / HW:%d / INST:%d]\n",
            __func__, (int64_t)p_ctx->device_handle, p_ctx->hw_id,
@@ -3862,7 +3940,23 @@ void enqueue_ni_frame(ni_session_context_t *p_ctx, ni_frame_t *ni_frame)
                           width_stride, height_stride);
   }
 
-  for (int i = 0; i < 120; i++)
+  if (!p_ctx->input_frame_fifo)
+  {
+    p_ctx->input_frame_fifo = (ni_input_frame *)calloc(
+        NI_INPUT_FRAME_FIFO_SZ, sizeof(ni_input_frame));
+    if (!p_ctx->input_frame_fifo)
+    {
+      ni_log2(p_ctx, NI_LOG_ERROR, "ERROR %s(): alloc input frame fifo failed\n",
+             __func__);
+      return;
+    }
+    for (int i = 0; i < NI_INPUT_FRAME_FIFO_SZ; i++)
+    {
+      p_ctx->input_frame_fifo[i].usable = -1;
+    }
+  }
+
+  for (int i = 0; i < NI_INPUT_FRAME_FIFO_SZ; i++)
   {
     // ni_log2(p_ctx, NI_LOG_ERROR, "%s %d i %d frame_num %d p_input_buffer %p data_len[0:2] %d %d %d p_data[0:2] %p %p %p video_width %d video_height %d\n",
       // __FUNCTION__, __LINE__, i, p_ctx->frame_num, p_ctx->input_frame_fifo[i].p_input_buffer,
@@ -4002,6 +4096,12 @@ int ni_encoder_session_write(ni_session_context_t* p_ctx, ni_frame_t* p_frame)
 
   low_delay_wait(p_ctx);
 
+  if ((p_frame->dts != NI_NOPTS_VALUE) && p_ctx->lat_stats)
+  {
+      ni_lat_stats_start((ni_lat_stats_t *)p_ctx->lat_stats, ni_gettime_ns(),
+                         p_frame->dts);
+  }
+
 #ifdef MEASURE_LATENCY
   if ((p_frame->dts != NI_NOPTS_VALUE) && (p_ctx->frame_time_q != NULL))
   {
@@ -4051,7 +4151,7 @@ int ni_encoder_session_write(ni_session_context_t* p_ctx, ni_frame_t* p_frame)
   {
       for (;;)
       {
-          query_sleep(p_ctx);
+          query_sleep(p_ctx, NI_PIPELINE_DIR_WRITE);
 
           if (ni_cmp_fw_api_ver((char*) &p_ctx->fw_rev[NI_XCODER_REVISION_API_MAJOR_VER_IDX],
                                 "65") >= 0)
@@ -4106,6 +4206,7 @@ int ni_encoder_session_write(ni_session_context_t* p_ctx, ni_frame_t* p_frame)
                          NI_MAX_ENCODER_QUERY_RETRIES, retval_backup,
                          buf_info.buf_avail_size, frame_size_bytes);
                   p_ctx->status = NI_RETCODE_NVME_SC_WRITE_BUFFER_FULL;
+                  ni_perf_count(NI_PERF_CTR_WRITE_BUFFER_FULL, 1);
 
                   LRETURN;
               }
@@ -4122,6 +4223,7 @@ int ni_encoder_session_write(ni_session_context_t* p_ctx, ni_frame_t* p_frame)
               break;
           }
     }
+      query_done(p_ctx, NI_PIPELINE_DIR_WRITE);
   }
 
   // fill in metadata such as timestamp
@@ -4516,7 +4618,7 @@ int ni_encoder_session_read(ni_session_context_t* p_ctx, ni_packet_t* p_packet)
   }
   for (;;)
   {
-      query_sleep(p_ctx);
+      query_sleep(p_ctx, NI_PIPELINE_DIR_READ);
 
       query_retry++;
 
@@ -4632,6 +4734,7 @@ int ni_encoder_session_read(ni_session_context_t* p_ctx, ni_packet_t* p_packet)
         break;
     }
   }
+  query_done(p_ctx, NI_PIPELINE_DIR_READ);
   ni_log2(p_ctx, NI_LOG_DEBUG,  "Encoder read buf_avail_size %u\n", buf_info.buf_avail_size);
 
   to_read_size = buf_info.buf_avail_size;
@@ -4728,13 +4831,7 @@ int ni_encoder_session_read(ni_session_context_t* p_ctx, ni_packet_t* p_packet)
       {
           // The SSIM Y, U, V values returned by FW are 4 decimal places multiplied by 10000.
 	  //Divide by 10000 to get the original value.
-          ni_log2(p_ctx, 
-#ifdef NI_LOG_SSIM_AT_INFO
-          NI_LOG_INFO, 
-#else
-          NI_LOG_DEBUG,
-#endif
-          "%s: pkt #%" PRId64 " pts %" PRId64 " ssim "
+          ni_log2(p_ctx, NI_LOG_SSIM_LEVEL, "%s: pkt #%" PRId64 " pts %" PRId64 " ssim "
                  "Y %.4f U %.4f V %.4f\n", __FUNCTION__, p_ctx->pkt_num,
                  p_packet->pts, (float)p_meta->ssimY/10000,
                  (float)p_meta->ssimU/10000, (float)p_meta->ssimV/10000);
@@ -4832,6 +4929,13 @@ int ni_encoder_session_read(ni_session_context_t* p_ctx, ni_packet_t* p_packet)
 
   retval = size;
 
+  if ((p_packet->dts != NI_NOPTS_VALUE) && p_ctx->lat_stats && (p_ctx->pkt_num > 0) &&
+      (NI_CODEC_FORMAT_AV1 != p_ctx->codec_format || p_packet->av1_show_frame))
+  {
+      ni_lat_stats_end((ni_lat_stats_t *)p_ctx->lat_stats,
+                       NI_LATENCY_STAGE_ENCODE, ni_gettime_ns(), p_packet->dts);
+  }
+
 #ifdef MEASURE_LATENCY
   if ((p_packet->dts != NI_NOPTS_VALUE) && (p_ctx->frame_time_q != NULL) && (p_ctx->pkt_num > 0))
   {
@@ -6420,6 +6524,9 @@ ni_query_session_statistic_info(ni_session_context_t *p_ctx,
         LRETURN;
     }
     p_ctx->session_statistic = *p_session_statistic;
+    ni_session_rate_stats_fw_sample(
+        (ni_session_rate_stats_t *)p_ctx->p_session_stats, device_type,
+        p_session_statistic);
 
 END:
     ni_aligned_free(p_buffer);
@@ -12812,6 +12919,12 @@ int ni_hwupload_session_write(ni_session_context_t *p_ctx, ni_frame_t *p_frame,
     LRETURN;
   }
 
+  if ((p_frame->pts != NI_NOPTS_VALUE) && p_ctx->lat_stats)
+  {
+      ni_lat_stats_start((ni_lat_stats_t *)p_ctx->lat_stats, ni_gettime_ns(),
+                         p_frame->pts);
+  }
+
 #ifdef MEASURE_LATENCY
   if ((p_frame->pts != NI_NOPTS_VALUE) && (p_ctx->frame_time_q != NULL))
   {
@@ -12834,7 +12947,7 @@ int ni_hwupload_session_write(ni_session_context_t *p_ctx, ni_frame_t *p_frame,
 
   for (;;)
   {
-      query_sleep(p_ctx);
+      query_sleep(p_ctx, NI_PIPELINE_DIR_WRITE);
 
       retval = ni_query_instance_buf_info(p_ctx, INST_BUF_INFO_RW_UPLOAD,
                                           NI_DEVICE_TYPE_ENCODER, &buf_info);
@@ -12852,6 +12965,7 @@ int ni_hwupload_session_write(ni_session_context_t *p_ctx, ni_frame_t *p_frame,
           }
           retval = NI_RETCODE_ERROR_MEM_ALOC;
           p_ctx->status = NI_RETCODE_NVME_SC_WRITE_BUFFER_FULL;
+          ni_perf_count(NI_PERF_CTR_WRITE_BUFFER_FULL, 1);
           LRETURN;
       }
       if (buf_info.hw_inst_ind.buffer_avail == 0 && retry_count < 500)
@@ -12868,6 +12982,7 @@ int ni_hwupload_session_write(ni_session_context_t *p_ctx, ni_frame_t *p_frame,
           break;
       }
   }
+  query_done(p_ctx, NI_PIPELINE_DIR_WRITE);
   ni_log2(p_ctx, NI_LOG_DEBUG,  "Info hwupload write query success, available buf "
                  "size %u >= frame size %u , retry %u\n",
                  buf_info.buf_avail_size, frame_size_bytes, retry_count);
@@ -13089,6 +13204,12 @@ int ni_hwupload_session_write(ni_session_context_t *p_ctx, ni_frame_t *p_frame,
 #endif
   }
 
+  if ((p_frame->pts != NI_NOPTS_VALUE) && p_ctx->lat_stats)
+  {
+    ni_lat_stats_end((ni_lat_stats_t *)p_ctx->lat_stats,
+                     NI_LATENCY_STAGE_UPLOAD, ni_gettime_ns(), p_frame->pts);
+  }
+
 #ifdef MEASURE_LATENCY
   if ((p_frame->pts != NI_NOPTS_VALUE) && (p_ctx->frame_time_q != NULL))
   {
@@ -13150,7 +13271,7 @@ int ni_hwupload_session_read_hwdesc(ni_session_context_t *p_ctx,
 
   for (;;)
   {
-    query_sleep(p_ctx);
+    query_sleep(p_ctx, NI_PIPELINE_DIR_READ);
 
     query_retry++;
 #ifndef _WIN32
@@ -13188,6 +13309,7 @@ int ni_hwupload_session_read_hwdesc(ni_session_context_t *p_ctx,
       hwdesc->bit_depth = p_ctx->bit_depth_factor;
       hwdesc->src_cpu = (uint8_t)NI_DEVICE_TYPE_ENCODER;
       hwdesc->output_idx = 0;
+      query_done(p_ctx, NI_PIPELINE_DIR_READ);
       LRETURN;
     }
   }
@@ -13339,7 +13461,7 @@ start:
   }
   for (;;)
   {
-    query_sleep(p_ctx);
+    query_sleep(p_ctx, NI_PIPELINE_DIR_READ);
 
     query_retry++;
 
@@ -13579,6 +13701,7 @@ start:
       break;
     }
   }// end while1 query retry
+  query_done(p_ctx, NI_PIPELINE_DIR_READ);
 
   ni_log2(p_ctx, NI_LOG_DEBUG,  "total_bytes_to_read %u max_nvme_io_size %u ylen %u cr len "
                  "%u cb len %u hdr %d\n",
@@ -13976,6 +14099,13 @@ start:
                    p_ctx->pkt_pos[i]);
 
             p_frame->p_custom_sei_set = p_ctx->pkt_custom_sei_set[i];
+            if (p_ctx->pkt_custom_sei_set[i])
+            {
+                // owned by the frame now
+                ni_mem_account_uncharge(
+                    (ni_mem_account_t *)p_ctx->p_mem_account,
+                    NI_MEM_CAT_CUSTOM_SEI, sizeof(ni_custom_sei_set_t));
+            }
             p_ctx->pkt_custom_sei_set[i] = NULL;
         } else
         {
@@ -14044,6 +14174,12 @@ start:
                                 p_ctx->buffer_pool);
   }
 
+  if ((p_frame->dts != NI_NOPTS_VALUE) && p_ctx->lat_stats)
+  {
+    ni_lat_stats_end((ni_lat_stats_t *)p_ctx->lat_stats,
+                     NI_LATENCY_STAGE_DECODE, ni_gettime_ns(), p_frame->dts);
+  }
+
 #ifdef MEASURE_LATENCY
   if ((p_frame->dts != NI_NOPTS_VALUE) && (p_ctx->frame_time_q != NULL))
   {
@@ -15335,6 +15471,7 @@ ni_retcode_t ni_ai_session_write(ni_session_context_t *p_ctx,
                        "AI write query exceeded max retries: %d\n",
                        NI_MAX_ENCODER_QUERY_RETRIES);
                 p_ctx->status = NI_RETCODE_NVME_SC_WRITE_BUFFER_FULL;
+                ni_perf_count(NI_PERF_CTR_WRITE_BUFFER_FULL, 1);
                 retval = NI_RETCODE_SUCCESS;
                 LRETURN;
             }
@@ -16131,6 +16268,7 @@ ni_retcode_t ni_ai_multi_config_frame(ni_session_context_t *p_ctx,
                        "AI write query exceeded max retries: %d\n",
                        NI_MAX_ENCODER_QUERY_RETRIES);
                 p_ctx->status = NI_RETCODE_NVME_SC_WRITE_BUFFER_FULL;
+                ni_perf_count(NI_PERF_CTR_WRITE_BUFFER_FULL, 1);
                 retval = NI_RETCODE_SUCCESS;
                 LRETURN;
             }
@@ -16421,6 +16559,7 @@ ni_retcode_t ni_ai_alloc_hwframe(ni_session_context_t *p_ctx, int width,
                            "AI write query exceeded max retries: %d\n",
                            NI_MAX_ENCODER_QUERY_RETRIES);
                     p_ctx->status = NI_RETCODE_NVME_SC_WRITE_BUFFER_FULL;
+                    ni_perf_count(NI_PERF_CTR_WRITE_BUFFER_FULL, 1);
                     retval = NI_RETCODE_SUCCESS;
                     LRETURN;
                 }
@@ -16722,9 +16861,14 @@ END:
     return retval;
 }
 
+static void *ni_enc_aux_buf_alloc(ni_frame_t *p_frame, uint32_t size);
+static void ni_enc_aux_buf_free(ni_frame_t *p_frame, void *p_buf,
+                                uint32_t size);
+
 /*!*****************************************************************************
   *  \brief  Allocate memory for the metadata header and auxillary data for
-  *          encoder input data.
+  *          encoder input data. Taken from the session slab when the frame
+  *          is attached to one (ni_encoder_frame_aux_buffers_borrow).
   *
   *  \param[in] p_frame       Pointer to a caller allocated ni_frame_t struct
   *
@@ -16766,15 +16910,17 @@ ni_retcode_t ni_encoder_metadata_buffer_alloc(ni_frame_t *p_frame,
                "%s: free current p_frame metadata buffer, "
                "p_frame->buffer_size=%u\n",
                __func__, p_frame->metadata_buffer_size);
+        ni_enc_aux_buf_free(p_frame, p_frame->p_metadata_buffer,
+                            p_frame->metadata_buffer_size);
+        p_frame->p_metadata_buffer = NULL;
         p_frame->metadata_buffer_size = 0;
-        ni_aligned_free(p_frame->p_metadata_buffer);
     }
 
     // Check if new metadata buffer needs to be allocated
     if (p_frame->metadata_buffer_size != buffer_size)
     {
-        if (ni_posix_memalign(&metadata_buffer, sysconf(_SC_PAGESIZE),
-                              buffer_size))
+        metadata_buffer = ni_enc_aux_buf_alloc(p_frame, buffer_size);
+        if (!metadata_buffer)
         {
             ni_log(NI_LOG_ERROR,
                    "ERROR %d: %s() Cannot allocate metadata buffer.\n",
@@ -16783,8 +16929,6 @@ ni_retcode_t ni_encoder_metadata_buffer_alloc(ni_frame_t *p_frame,
             LRETURN;
         }
 
-        // init once after allocation
-        memset(metadata_buffer, 0, buffer_size);
         p_frame->metadata_buffer_size = buffer_size;
         p_frame->p_metadata_buffer = metadata_buffer;
 
@@ -16811,7 +16955,8 @@ END:
 
 /*!*****************************************************************************
   *  \brief  Allocate memory for the non-4k-aligned part at the start of YUV data for
-  *          encoder input data.
+  *          encoder input data. Taken from the session slab when the frame
+  *          is attached to one.
   *
   *  \param[in] p_frame       Pointer to a caller allocated ni_frame_t struct
   *
@@ -16840,8 +16985,9 @@ ni_retcode_t ni_encoder_start_buffer_alloc(ni_frame_t *p_frame)
     // Check if new start buffer needs to be allocated
     if (!p_frame->start_buffer_size)
     {
-        if (ni_posix_memalign(&start_buffer, sysconf(_SC_PAGESIZE),
-                              NI_MEM_PAGE_ALIGNMENT*NI_MAX_NUM_SW_FRAME_DATA_POINTERS))
+        start_buffer = ni_enc_aux_buf_alloc(
+            p_frame, NI_MEM_PAGE_ALIGNMENT*NI_MAX_NUM_SW_FRAME_DATA_POINTERS);
+        if (!start_buffer)
         {
             ni_log(NI_LOG_ERROR,
                    "ERROR %d: %s() Cannot allocate start buffer.\n",
@@ -16850,8 +16996,6 @@ ni_retcode_t ni_encoder_start_buffer_alloc(ni_frame_t *p_frame)
             LRETURN;
         }
 
-        // init once after allocation
-        memset(start_buffer, 0, NI_MEM_PAGE_ALIGNMENT*NI_MAX_NUM_SW_FRAME_DATA_POINTERS);
         p_frame->start_buffer_size = NI_MEM_PAGE_ALIGNMENT*NI_MAX_NUM_SW_FRAME_DATA_POINTERS;
         p_frame->p_start_buffer = start_buffer;
 
@@ -17159,6 +17303,877 @@ ni_retcode_t ni_dump_log_all_cores(ni_session_context_t *p_ctx, void* p_data, bo
     return NI_RETCODE_SUCCESS;
 }
 
+/*!*****************************************************************************
+ *  \brief  Set up an incremental firmware log reader
+ *
+ *  \return NI_RETCODE_SUCCESS, NI_RETCODE_INVALID_PARAM or
+ *          NI_RETCODE_ERROR_MEM_ALOC
+ ******************************************************************************/
+ni_retcode_t ni_fw_log_stream_init(ni_fw_log_stream_t *p_stream,
+                                   ni_session_context_t *p_ctx,
+                                   uint32_t max_pages)
+{
+    ni_fw_log_stream_priv_t *p_priv;
+
+    if (!p_stream || !p_ctx)
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s() passed parameters are null\n",
+               __func__);
+        return NI_RETCODE_INVALID_PARAM;
+    }
+    memset(p_stream, 0, sizeof(*p_stream));
+    if (!max_pages)
+    {
+        max_pages = NI_FW_LOG_STREAM_DEFAULT_PAGES;
+    } else if (max_pages > NI_FW_LOG_PAGES)
+    {
+        max_pages = NI_FW_LOG_PAGES;
+    }
+
+    p_priv = (ni_fw_log_stream_priv_t *)calloc(1, sizeof(ni_fw_log_stream_priv_t));
+    if (!p_priv)
+    {
+        ni_log2(p_ctx, NI_LOG_ERROR, "ERROR %d: %s() Cannot allocate stream\n",
+                NI_ERRNO, __func__);
+        return NI_RETCODE_ERROR_MEM_ALOC;
+    }
+    if (ni_posix_memalign((void **)&p_priv->p_io_buf, sysconf(_SC_PAGESIZE),
+                          max_pages * NI_FW_LOG_PAGE_SIZE))
+    {
+        ni_log2(p_ctx, NI_LOG_ERROR, "ERROR %d: %s() Cannot allocate buffer\n",
+                NI_ERRNO, __func__);
+        free(p_priv);
+        return NI_RETCODE_ERROR_MEM_ALOC;
+    }
+    p_stream->p_ctx = p_ctx;
+    p_stream->max_pages = max_pages;
+    p_stream->p_priv = p_priv;
+    return NI_RETCODE_SUCCESS;
+}
+
+// read count log pages of a core starting at page into the stream's io buffer
+static int ni_fw_log_read_pages(ni_fw_log_stream_t *p_stream,
+                                ni_core_type_t core, uint32_t page,
+                                uint32_t count)
+{
+    ni_fw_log_stream_priv_t *p_priv = (ni_fw_log_stream_priv_t *)p_stream->p_priv;
+    ni_session_context_t *p_ctx = p_stream->p_ctx;
+
+    if (ni_nvme_send_read_cmd(p_ctx->blk_io_handle, p_ctx->event_handle,
+                              p_priv->p_io_buf, count * NI_FW_LOG_PAGE_SIZE,
+                              ni_get_log_lba(core) + page) < 0)
+    {
+        ni_log2(p_ctx, NI_LOG_ERROR, "%s(): read of %s core log failed\n",
+                __func__, ni_get_core_name(core));
+        return NI_RETCODE_ERROR_NVME_CMD_FAILED;
+    }
+    return NI_RETCODE_SUCCESS;
+}
+
+// append to a ring, bytes that do not fit are dropped; returns bytes appended
+static uint32_t ni_fw_log_ring_append(ni_fw_log_ring_t *p_ring,
+                                      const uint8_t *p_data, uint32_t len)
+{
+    uint64_t space = p_ring->size - (p_ring->write_pos - p_ring->read_pos);
+    uint32_t offset, first;
+
+    if (len > space)
+    {
+        p_ring->dropped += len - space;
+        len = (uint32_t)space;
+    }
+    offset = (uint32_t)(p_ring->write_pos % p_ring->size);
+    first = p_ring->size - offset < len ? p_ring->size - offset : len;
+    memcpy(p_ring->p_buf + offset, p_data, first);
+    memcpy(p_ring->p_buf, p_data + first, len - first);
+    p_ring->write_pos += len;
+    return len;
+}
+
+/*!*****************************************************************************
+ *  \brief  Compare the pages just read with the copy of the log, append the
+ *          changed bytes of each page to the ring and update the copy
+ *
+ *  \return index after the last changed page if the change of that page
+ *          reaches its end, i.e. the firmware went on writing the next page;
+ *          the index of the last changed page otherwise; -1 if no page
+ *          changed. *p_appended is increased by the bytes appended.
+ ******************************************************************************/
+static int ni_fw_log_diff_pages(ni_fw_log_stream_t *p_stream,
+                                ni_fw_log_core_t *p_core, uint32_t page,
+                                uint32_t count, ni_fw_log_ring_t *p_ring,
+                                int *p_appended, int stop_at_unchanged)
+{
+    ni_fw_log_stream_priv_t *p_priv = (ni_fw_log_stream_priv_t *)p_stream->p_priv;
+    int next = -1;
+    uint32_t i, first, last;
+
+    for (i = 0; i < count; i++)
+    {
+        uint8_t *p_new = p_priv->p_io_buf + i * NI_FW_LOG_PAGE_SIZE;
+        uint8_t *p_old = p_core->p_shadow + (page + i) * NI_FW_LOG_PAGE_SIZE;
+
+        for (first = 0; first < NI_FW_LOG_PAGE_SIZE && p_new[first] == p_old[first];
+             first++)
+            ;
+        if (first == NI_FW_LOG_PAGE_SIZE)
+        {
+            if (stop_at_unchanged)
+            {
+                break;
+            }
+            continue;
+        }
+        for (last = NI_FW_LOG_PAGE_SIZE - 1; p_new[last] == p_old[last]; last--)
+            ;
+        if (p_ring)
+        {
+            *p_appended += (int)ni_fw_log_ring_append(p_ring, p_new + first,
+                                                      last - first + 1);
+        }
+        memcpy(p_old + first, p_new + first, last - first + 1);
+        next = (int)((page + i + (last == NI_FW_LOG_PAGE_SIZE - 1 ? 1 : 0)) %
+                     NI_FW_LOG_PAGES);
+        if (last != NI_FW_LOG_PAGE_SIZE - 1 && stop_at_unchanged)
+        {
+            break;
+        }
+    }
+    return next;
+}
+
+/*!*****************************************************************************
+ *  \brief  Append the firmware log bytes of a core written since the last
+ *          call to a ring, reading at most p_stream->max_pages pages.
+ *
+ *          The log is written sequentially, so new bytes are looked for at
+ *          the frontier page first, following the writer into the next
+ *          pages. Pages left of the budget sweep the rest of the buffer, so
+ *          that a writer that moved elsewhere (e.g. firmware restart) is
+ *          found again.
+ *
+ *  \return bytes appended, or NI_RETCODE_INVALID_PARAM,
+ *          NI_RETCODE_ERROR_MEM_ALOC, NI_RETCODE_ERROR_NVME_CMD_FAILED
+ ******************************************************************************/
+int ni_fw_log_stream_read(ni_fw_log_stream_t *p_stream, ni_core_type_t core,
+                          ni_fw_log_ring_t *p_ring)
+{
+    ni_fw_log_stream_priv_t *p_priv;
+    ni_fw_log_core_t *p_core;
+    uint32_t budget, chunk, count;
+    int appended = 0;
+    int next, rc;
+
+    if (!p_stream || !p_stream->p_priv || core < NVME_CORE ||
+        core >= NUM_OF_CORES || !p_ring || !p_ring->p_buf || !p_ring->size)
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s() invalid parameters\n", __func__);
+        return NI_RETCODE_INVALID_PARAM;
+    }
+    p_priv = (ni_fw_log_stream_priv_t *)p_stream->p_priv;
+    p_core = &p_priv->core[core];
+    budget = p_stream->max_pages;
+
+    if (!p_core->p_shadow)
+    {
+        p_core->p_shadow = (uint8_t *)malloc(CPU_LOG_BUFFER_SIZE);
+        if (!p_core->p_shadow)
+        {
+            ni_log2(p_stream->p_ctx, NI_LOG_ERROR,
+                    "ERROR %d: %s() Cannot allocate log copy\n", NI_ERRNO,
+                    __func__);
+            return NI_RETCODE_ERROR_MEM_ALOC;
+        }
+    }
+
+    // the log present when the stream starts is old, only take a copy
+    if (p_core->baseline_pages < NI_FW_LOG_PAGES)
+    {
+        count = NI_FW_LOG_PAGES - p_core->baseline_pages;
+        count = count < budget ? count : budget;
+        rc = ni_fw_log_read_pages(p_stream, core, p_core->baseline_pages, count);
+        if (rc != NI_RETCODE_SUCCESS)
+        {
+            return rc;
+        }
+        memcpy(p_core->p_shadow + p_core->baseline_pages * NI_FW_LOG_PAGE_SIZE,
+               p_priv->p_io_buf, count * NI_FW_LOG_PAGE_SIZE);
+        p_core->baseline_pages += count;
+        return 0;
+    }
+
+    // follow the writer from the frontier while pages fill up, one page
+    // first as the writer is usually still in it
+    chunk = 1;
+    while (budget)
+    {
+        count = NI_FW_LOG_PAGES - p_core->frontier;
+        count = count < chunk ? count : chunk;
+        rc = ni_fw_log_read_pages(p_stream, core, p_core->frontier, count);
+        if (rc != NI_RETCODE_SUCCESS)
+        {
+            return rc;
+        }
+        budget -= count;
+        next = ni_fw_log_diff_pages(p_stream, p_core, p_core->frontier, count,
+                                    p_ring, &appended, 1);
+        if (next < 0)
+        {
+            break;
+        }
+        if ((uint32_t)next == (p_core->frontier + count) % NI_FW_LOG_PAGES)
+        {
+            // every page read filled up, the writer may be further on
+            p_core->frontier = (uint32_t)next;
+            chunk = budget;
+            continue;
+        }
+        p_core->frontier = (uint32_t)next;
+        break;
+    }
+
+    // spend the rest of the budget looking for writes elsewhere
+    if (budget)
+    {
+        count = NI_FW_LOG_PAGES - p_core->sweep;
+        count = count < budget ? count : budget;
+        rc = ni_fw_log_read_pages(p_stream, core, p_core->sweep, count);
+        if (rc != NI_RETCODE_SUCCESS)
+        {
+            return rc;
+        }
+        next = ni_fw_log_diff_pages(p_stream, p_core, p_core->sweep, count,
+                                    p_ring, &appended, 0);
+        if (next >= 0)
+        {
+            p_core->frontier = (uint32_t)next;
+        }
+        p_core->sweep = (p_core->sweep + count) % NI_FW_LOG_PAGES;
+    }
+    return appended;
+}
+
+// forward the complete lines of a tail ring to the host log, within the
+// byte budget; a line longer than NI_FW_LOG_TAIL_LINE_MAX is cut
+static void ni_fw_log_tail_lines(ni_fw_log_stream_t *p_stream,
+                                 ni_core_type_t core, ni_fw_log_ring_t *p_ring,
+                                 uint64_t *p_tokens)
+{
+    char line[NI_FW_LOG_TAIL_LINE_MAX + 1];
+    uint32_t len = 0;
+    uint64_t pos;
+    char c;
+
+    for (pos = p_ring->read_pos; pos < p_ring->write_pos; pos++)
+    {
+        c = (char)p_ring->p_buf[pos % p_ring->size];
+        if (c != '\n' && c != '\0' && len < NI_FW_LOG_TAIL_LINE_MAX)
+        {
+            if (c != '\r')
+            {
+                line[len++] = c;
+            }
+            continue;
+        }
+        if (len)
+        {
+            if (len <= *p_tokens)
+            {
+                line[len] = '\0';
+                ni_log2(p_stream->p_ctx, NI_LOG_INFO, "FW %s: %s\n",
+                        ni_get_core_name(core), line);
+                *p_tokens -= len;
+            } else
+            {
+                p_stream->rate_dropped += len;
+            }
+        }
+        len = 0;
+        p_ring->read_pos = pos + 1;
+    }
+}
+
+static void *ni_fw_log_tail_thread(void *arg)
+{
+    ni_fw_log_stream_t *p_stream = (ni_fw_log_stream_t *)arg;
+    ni_fw_log_stream_priv_t *p_priv = (ni_fw_log_stream_priv_t *)p_stream->p_priv;
+    uint64_t tokens = p_priv->max_bytes_per_sec;
+    uint64_t last_time = ni_gettime_ns();
+    uint64_t now;
+    uint32_t slept_ms;
+    int core;
+
+    while (!p_priv->stop)
+    {
+        // token bucket refilled at max_bytes_per_sec, one second deep
+        now = ni_gettime_ns();
+        tokens += (now - last_time) * p_priv->max_bytes_per_sec / 1000000000;
+        if (tokens > p_priv->max_bytes_per_sec)
+        {
+            tokens = p_priv->max_bytes_per_sec;
+        }
+        last_time = now;
+
+        for (core = NVME_CORE; core < NUM_OF_CORES && !p_priv->stop; core++)
+        {
+            if (ni_fw_log_stream_read(p_stream, (ni_core_type_t)core,
+                                      &p_priv->tail_ring[core]) < 0)
+            {
+                continue;
+            }
+            ni_fw_log_tail_lines(p_stream, (ni_core_type_t)core,
+                                 &p_priv->tail_ring[core], &tokens);
+        }
+
+        for (slept_ms = 0; slept_ms < p_priv->interval_ms && !p_priv->stop;
+             slept_ms += 10)
+        {
+            ni_usleep(10 * 1000);
+        }
+    }
+    return NULL;
+}
+
+/*!*****************************************************************************
+ *  \brief  Start tailing the firmware logs of all cores into the host log
+ *
+ *  \return NI_RETCODE_SUCCESS, NI_RETCODE_INVALID_PARAM,
+ *          NI_RETCODE_ERROR_MEM_ALOC or NI_RETCODE_FAILURE
+ ******************************************************************************/
+ni_retcode_t ni_fw_log_stream_start(ni_fw_log_stream_t *p_stream,
+                                    uint32_t interval_ms,
+                                    uint32_t max_bytes_per_sec)
+{
+    ni_fw_log_stream_priv_t *p_priv;
+    int core;
+
+    if (!p_stream || !p_stream->p_priv || !interval_ms || !max_bytes_per_sec)
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s() invalid parameters\n", __func__);
+        return NI_RETCODE_INVALID_PARAM;
+    }
+    p_priv = (ni_fw_log_stream_priv_t *)p_stream->p_priv;
+    if (p_priv->thread_running)
+    {
+        return NI_RETCODE_SUCCESS;
+    }
+
+    for (core = NVME_CORE; core < NUM_OF_CORES; core++)
+    {
+        ni_fw_log_ring_t *p_ring = &p_priv->tail_ring[core];
+        if (!p_ring->p_buf)
+        {
+            p_ring->p_buf = (uint8_t *)malloc(NI_FW_LOG_TAIL_RING_SIZE);
+            if (!p_ring->p_buf)
+            {
+                ni_log2(p_stream->p_ctx, NI_LOG_ERROR,
+                        "ERROR %d: %s() Cannot allocate ring\n", NI_ERRNO,
+                        __func__);
+                return NI_RETCODE_ERROR_MEM_ALOC;
+            }
+            p_ring->size = NI_FW_LOG_TAIL_RING_SIZE;
+        }
+    }
+
+    p_priv->interval_ms = interval_ms;
+    p_priv->max_bytes_per_sec = max_bytes_per_sec;
+    p_priv->stop = 0;
+    if (ni_pthread_create(&p_priv->thread, NULL, ni_fw_log_tail_thread,
+                          p_stream))
+    {
+        ni_log2(p_stream->p_ctx, NI_LOG_ERROR,
+                "ERROR %d: %s() Cannot create thread\n", NI_ERRNO, __func__);
+        return NI_RETCODE_FAILURE;
+    }
+    p_priv->thread_running = 1;
+    return NI_RETCODE_SUCCESS;
+}
+
+/*!*****************************************************************************
+ *  \brief  Stop the background thread of a firmware log stream
+ *
+ *  \return none
+ ******************************************************************************/
+void ni_fw_log_stream_stop(ni_fw_log_stream_t *p_stream)
+{
+    ni_fw_log_stream_priv_t *p_priv;
+
+    if (!p_stream || !p_stream->p_priv)
+    {
+        return;
+    }
+    p_priv = (ni_fw_log_stream_priv_t *)p_stream->p_priv;
+    if (p_priv->thread_running)
+    {
+        p_priv->stop = 1;
+        ni_pthread_join(p_priv->thread, NULL);
+        p_priv->thread_running = 0;
+    }
+}
+
+/*!*****************************************************************************
+ *  \brief  Stop and free a firmware log stream
+ *
+ *  \return none
+ ******************************************************************************/
+void ni_fw_log_stream_close(ni_fw_log_stream_t *p_stream)
+{
+    ni_fw_log_stream_priv_t *p_priv;
+    int core;
+
+    if (!p_stream || !p_stream->p_priv)
+    {
+        return;
+    }
+    ni_fw_log_stream_stop(p_stream);
+    p_priv = (ni_fw_log_stream_priv_t *)p_stream->p_priv;
+    for (core = 0; core < NUM_OF_CORES; core++)
+    {
+        free(p_priv->core[core].p_shadow);
+        free(p_priv->tail_ring[core].p_buf);
+    }
+    ni_aligned_free(p_priv->p_io_buf);
+    free(p_priv);
+    p_stream->p_priv = NULL;
+}
+
+/*!*****************************************************************************
+ *  \brief  Forget a registered encoder input buffer and free its staging
+ *          memory
+ *
+ *  \param[in] p_bufs  registered buffer table p_reg is in
+ *  \param[in] p_reg   registered buffer
+ *
+ *  \return none
+ ******************************************************************************/
+void ni_enc_reg_buf_release(ni_enc_reg_bufs_t *p_bufs, ni_enc_reg_buf_t *p_reg)
+{
+    if (p_reg->p_staging)
+    {
+        ni_mem_pool_free(p_reg->p_staging, p_reg->staging_size);
+        ni_mem_account_uncharge(p_bufs->p_mem_account, NI_MEM_CAT_ENC_INPUT,
+                                p_reg->staging_size);
+    }
+    memset(p_reg, 0, sizeof(*p_reg));
+}
+
+/*!*****************************************************************************
+ *  \brief  Release all registered encoder input buffers of a session
+ *
+ *  \param[in] p_bufs  registered buffer table, may be NULL
+ *
+ *  \return none
+ ******************************************************************************/
+void ni_enc_reg_bufs_destroy(ni_enc_reg_bufs_t *p_bufs)
+{
+    int i;
+
+    if (!p_bufs)
+    {
+        return;
+    }
+    for (i = 0; i < NI_ENC_MAX_REGISTERED_BUFFERS; i++)
+    {
+        if (p_bufs->buf[i].registered)
+        {
+            ni_enc_reg_buf_release(p_bufs, &p_bufs->buf[i]);
+        }
+    }
+    ni_mem_account_unref(p_bufs->p_mem_account);
+    free(p_bufs);
+}
+
+/*!*****************************************************************************
+ *  \brief  Point the decoder packet tracking arrays of a session context at a
+ *          ni_dec_pkt_fifo_t, or clear them
+ *
+ *  \param[in] p_ctx   session context
+ *  \param[in] p_fifo  storage of the arrays, may be NULL
+ *
+ *  \return none
+ ******************************************************************************/
+void ni_dec_pkt_fifo_set(ni_session_context_t *p_ctx, ni_dec_pkt_fifo_t *p_fifo)
+{
+    p_ctx->p_dec_pkt_fifo = p_fifo;
+    p_ctx->pts_offsets = p_fifo ? p_fifo->pts_offsets : NULL;
+    p_ctx->pkt_offsets_index = p_fifo ? p_fifo->pkt_offsets_index : NULL;
+    p_ctx->pkt_offsets_index_min =
+        p_fifo ? p_fifo->pkt_offsets_index_min : NULL;
+    p_ctx->pkt_pos = p_fifo ? p_fifo->pkt_pos : NULL;
+    p_ctx->pkt_custom_sei_set = p_fifo ? p_fifo->pkt_custom_sei_set : NULL;
+    p_ctx->flags_array = p_fifo ? p_fifo->flags_array : NULL;
+}
+
+/*!*****************************************************************************
+ *  \brief  Allocate the decoder packet tracking arrays of a session context,
+ *          unless already allocated
+ *
+ *  \param[in] p_ctx  session context
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_ERROR_MEM_ALOC
+ ******************************************************************************/
+ni_retcode_t ni_dec_pkt_fifo_alloc(ni_session_context_t *p_ctx)
+{
+    ni_dec_pkt_fifo_t *p_fifo;
+
+    if (p_ctx->p_dec_pkt_fifo)
+    {
+        return NI_RETCODE_SUCCESS;
+    }
+    if (ni_mem_account_charge((ni_mem_account_t *)p_ctx->p_mem_account,
+                              NI_MEM_CAT_TIMESTAMP, sizeof(ni_dec_pkt_fifo_t)))
+    {
+        return NI_RETCODE_ERROR_MEM_ALOC;
+    }
+    p_fifo = (ni_dec_pkt_fifo_t *)calloc(1, sizeof(ni_dec_pkt_fifo_t));
+    if (!p_fifo)
+    {
+        ni_mem_account_uncharge((ni_mem_account_t *)p_ctx->p_mem_account,
+                                NI_MEM_CAT_TIMESTAMP,
+                                sizeof(ni_dec_pkt_fifo_t));
+        return NI_RETCODE_ERROR_MEM_ALOC;
+    }
+    ni_dec_pkt_fifo_set(p_ctx, p_fifo);
+    return NI_RETCODE_SUCCESS;
+}
+
+/*!*****************************************************************************
+ *  \brief  Free the decoder packet tracking arrays of a session context, with
+ *          the custom SEI sets still queued in them
+ *
+ *  \param[in] p_ctx  session context
+ *
+ *  \return none
+ ******************************************************************************/
+void ni_dec_pkt_fifo_free(ni_session_context_t *p_ctx)
+{
+    ni_dec_pkt_fifo_t *p_fifo = (ni_dec_pkt_fifo_t *)p_ctx->p_dec_pkt_fifo;
+
+    if (!p_fifo)
+    {
+        return;
+    }
+    ni_dec_pkt_fifo_free_sei(p_ctx);
+    free(p_fifo);
+    ni_mem_account_uncharge((ni_mem_account_t *)p_ctx->p_mem_account,
+                            NI_MEM_CAT_TIMESTAMP, sizeof(ni_dec_pkt_fifo_t));
+    ni_dec_pkt_fifo_set(p_ctx, NULL);
+}
+
+/*!*****************************************************************************
+ *  \brief  Free the custom SEI sets queued for decoded frames
+ *
+ *  \param[in] p_ctx  session context
+ *
+ *  \return none
+ ******************************************************************************/
+void ni_dec_pkt_fifo_free_sei(ni_session_context_t *p_ctx)
+{
+    int i;
+
+    for (i = 0; p_ctx->pkt_custom_sei_set && i < NI_FIFO_SZ; i++)
+    {
+        if (p_ctx->pkt_custom_sei_set[i])
+        {
+            ni_memfree(p_ctx->pkt_custom_sei_set[i]);
+            ni_mem_account_uncharge((ni_mem_account_t *)p_ctx->p_mem_account,
+                                    NI_MEM_CAT_CUSTOM_SEI,
+                                    sizeof(ni_custom_sei_set_t));
+        }
+    }
+}
+
+/*!*****************************************************************************
+ *  \brief  Free the encoder input frames kept for PSNR calculation
+ *
+ *  \param[in] p_ctx  session context
+ *
+ *  \return none
+ ******************************************************************************/
+void ni_input_frame_fifo_free(ni_session_context_t *p_ctx)
+{
+    int i;
+
+    if (!p_ctx->input_frame_fifo)
+    {
+        return;
+    }
+    for (i = 0; i < NI_INPUT_FRAME_FIFO_SZ; i++)
+    {
+        free(p_ctx->input_frame_fifo[i].p_input_buffer);
+    }
+    free(p_ctx->input_frame_fifo);
+    p_ctx->input_frame_fifo = NULL;
+}
+
+/*!*****************************************************************************
+ *  \brief  Create an empty encoder metadata/start buffer slab, holding the
+ *          session's reference
+ *
+ *  \param[in] p_account  memory account to charge, may be NULL
+ *
+ *  \return pointer to the slab, NULL on failure
+ ******************************************************************************/
+ni_enc_aux_slab_t *ni_enc_aux_slab_create(ni_mem_account_t *p_account)
+{
+    ni_enc_aux_slab_t *p_slab =
+        (ni_enc_aux_slab_t *)calloc(1, sizeof(ni_enc_aux_slab_t));
+
+    if (!p_slab)
+    {
+        return NULL;
+    }
+    if (ni_pthread_mutex_init(&p_slab->mutex))
+    {
+        free(p_slab);
+        return NULL;
+    }
+    p_slab->ref_count = 1;
+    p_slab->p_mem_account = p_account;
+    ni_mem_account_ref(p_account);
+    return p_slab;
+}
+
+/*!*****************************************************************************
+ *  \brief  Drop a reference to a slab, freeing its blocks with the last one
+ *
+ *  \param[in] p_slab  slab, may be NULL
+ *
+ *  \return none
+ ******************************************************************************/
+void ni_enc_aux_slab_release(ni_enc_aux_slab_t *p_slab)
+{
+    ni_enc_aux_slab_block_t *p_block;
+    int ref_count;
+
+    if (!p_slab)
+    {
+        return;
+    }
+    ni_pthread_mutex_lock(&p_slab->mutex);
+    ref_count = --p_slab->ref_count;
+    ni_pthread_mutex_unlock(&p_slab->mutex);
+    if (ref_count)
+    {
+        return;
+    }
+
+    ni_log(NI_LOG_DEBUG, "%s: %" PRIu64 " bytes carved, %" PRIu64
+           " buffers borrowed\n", __func__, p_slab->carved_bytes,
+           p_slab->borrow_count);
+    while (p_slab->p_blocks)
+    {
+        p_block = p_slab->p_blocks;
+        p_slab->p_blocks = p_block->p_next;
+        ni_mem_pool_free(p_block->p_mem, p_block->size);
+        free(p_block);
+    }
+    ni_mem_account_uncharge(p_slab->p_mem_account, NI_MEM_CAT_ENC_INPUT,
+                            p_slab->carved_bytes);
+    ni_mem_account_unref(p_slab->p_mem_account);
+    ni_pthread_mutex_destroy(&p_slab->mutex);
+    free(p_slab);
+}
+
+/*!*****************************************************************************
+ *  \brief  Take metadata and start buffers of a frame from a slab from now
+ *          on. Buffers the frame holds from elsewhere are freed first.
+ *
+ *  \param[in] p_slab   slab
+ *  \param[in] p_frame  frame
+ *
+ *  \return none
+ ******************************************************************************/
+void ni_enc_aux_slab_attach(ni_enc_aux_slab_t *p_slab, ni_frame_t *p_frame)
+{
+    if (p_frame->p_enc_aux_slab == p_slab)
+    {
+        return;
+    }
+    ni_enc_aux_buffers_free(p_frame);
+    ni_pthread_mutex_lock(&p_slab->mutex);
+    p_slab->ref_count++;
+    ni_pthread_mutex_unlock(&p_slab->mutex);
+    p_frame->p_enc_aux_slab = p_slab;
+}
+
+/*!*****************************************************************************
+ *  \brief  Get a page aligned buffer of whole pages from a slab, carving a
+ *          new block when the free list of its size is empty
+ *
+ *  \param[in] p_slab  slab
+ *  \param[in] size    multiple of NI_MEM_PAGE_ALIGNMENT
+ *
+ *  \return pointer to the buffer, NULL on failure
+ ******************************************************************************/
+static void *ni_enc_aux_slab_get(ni_enc_aux_slab_t *p_slab, uint32_t size)
+{
+    uint32_t pages = size / NI_MEM_PAGE_ALIGNMENT;
+    ni_enc_aux_slab_block_t *p_block;
+    void *p_buf = NULL;
+    uint8_t *p_chunk;
+    int i;
+
+    if (pages > NI_ENC_AUX_SLAB_MAX_PAGES)
+    {
+        if (ni_mem_account_charge(p_slab->p_mem_account, NI_MEM_CAT_ENC_INPUT,
+                                  size))
+        {
+            return NULL;
+        }
+        if (ni_mem_pool_alloc(&p_buf, size))
+        {
+            ni_mem_account_uncharge(p_slab->p_mem_account,
+                                    NI_MEM_CAT_ENC_INPUT, size);
+            return NULL;
+        }
+        // init once after allocation, like the carved blocks
+        memset(p_buf, 0, size);
+        return p_buf;
+    }
+
+    ni_pthread_mutex_lock(&p_slab->mutex);
+    if (!p_slab->p_free[pages - 1])
+    {
+        if (ni_mem_account_charge(p_slab->p_mem_account, NI_MEM_CAT_ENC_INPUT,
+                                  size * NI_ENC_AUX_SLAB_BLOCK_CHUNKS))
+        {
+            ni_pthread_mutex_unlock(&p_slab->mutex);
+            return NULL;
+        }
+        p_block = (ni_enc_aux_slab_block_t *)calloc(1, sizeof(*p_block));
+        if (!p_block ||
+            ni_mem_pool_alloc(&p_block->p_mem,
+                              size * NI_ENC_AUX_SLAB_BLOCK_CHUNKS))
+        {
+            ni_pthread_mutex_unlock(&p_slab->mutex);
+            free(p_block);
+            ni_mem_account_uncharge(p_slab->p_mem_account,
+                                    NI_MEM_CAT_ENC_INPUT,
+                                    size * NI_ENC_AUX_SLAB_BLOCK_CHUNKS);
+            return NULL;
+        }
+        p_block->size = size * NI_ENC_AUX_SLAB_BLOCK_CHUNKS;
+        // init once after allocation
+        memset(p_block->p_mem, 0, p_block->size);
+        p_block->p_next = p_slab->p_blocks;
+        p_slab->p_blocks = p_block;
+        p_slab->carved_bytes += p_block->size;
+        p_chunk = (uint8_t *)p_block->p_mem;
+        for (i = 0; i < NI_ENC_AUX_SLAB_BLOCK_CHUNKS; i++, p_chunk += size)
+        {
+            *(void **)p_chunk = p_slab->p_free[pages - 1];
+            p_slab->p_free[pages - 1] = p_chunk;
+        }
+    }
+    p_buf = p_slab->p_free[pages - 1];
+    p_slab->p_free[pages - 1] = *(void **)p_buf;
+    p_slab->borrow_count++;
+    ni_pthread_mutex_unlock(&p_slab->mutex);
+
+    *(void **)p_buf = NULL;
+    return p_buf;
+}
+
+/*!*****************************************************************************
+ *  \brief  Give a buffer from ni_enc_aux_slab_get back to its slab
+ *
+ *  \param[in] p_slab  slab
+ *  \param[in] p_buf   buffer
+ *  \param[in] size    size it was taken with
+ *
+ *  \return none
+ ******************************************************************************/
+static void ni_enc_aux_slab_put(ni_enc_aux_slab_t *p_slab, void *p_buf,
+                                uint32_t size)
+{
+    uint32_t pages = size / NI_MEM_PAGE_ALIGNMENT;
+
+    if (pages > NI_ENC_AUX_SLAB_MAX_PAGES)
+    {
+        ni_mem_pool_free(p_buf, size);
+        ni_mem_account_uncharge(p_slab->p_mem_account, NI_MEM_CAT_ENC_INPUT,
+                                size);
+        return;
+    }
+    ni_pthread_mutex_lock(&p_slab->mutex);
+    *(void **)p_buf = p_slab->p_free[pages - 1];
+    p_slab->p_free[pages - 1] = p_buf;
+    ni_pthread_mutex_unlock(&p_slab->mutex);
+}
+
+/*!*****************************************************************************
+ *  \brief  Allocate an encoder metadata or start buffer for a frame, from the
+ *          slab it is attached to if any
+ ******************************************************************************/
+static void *ni_enc_aux_buf_alloc(ni_frame_t *p_frame, uint32_t size)
+{
+    void *p_buf = NULL;
+
+    if (p_frame->p_enc_aux_slab)
+    {
+        return ni_enc_aux_slab_get(
+            (ni_enc_aux_slab_t *)p_frame->p_enc_aux_slab, size);
+    }
+    if (ni_mem_pool_alloc(&p_buf, size))
+    {
+        return NULL;
+    }
+    // init once after allocation
+    memset(p_buf, 0, size);
+    return p_buf;
+}
+
+/*!*****************************************************************************
+ *  \brief  Free a buffer from ni_enc_aux_buf_alloc
+ ******************************************************************************/
+static void ni_enc_aux_buf_free(ni_frame_t *p_frame, void *p_buf,
+                                uint32_t size)
+{
+    if (p_frame->p_enc_aux_slab)
+    {
+        ni_enc_aux_slab_put((ni_enc_aux_slab_t *)p_frame->p_enc_aux_slab,
+                            p_buf, size);
+    } else
+    {
+        ni_mem_pool_free(p_buf, size);
+    }
+}
+
+/*!*****************************************************************************
+ *  \brief  Free the metadata and start buffers of a frame, to the slab they
+ *          came from if any, and detach the frame from the slab
+ *
+ *  \param[in] p_frame  frame
+ *
+ *  \return none
+ ******************************************************************************/
+void ni_enc_aux_buffers_free(ni_frame_t *p_frame)
+{
+    if (p_frame->metadata_buffer_size)
+    {
+        ni_enc_aux_buf_free(p_frame, p_frame->p_metadata_buffer,
+                            p_frame->metadata_buffer_size);
+        p_frame->p_metadata_buffer = NULL;
+        p_frame->metadata_buffer_size = 0;
+    }
+    if (p_frame->start_buffer_size)
+    {
+        ni_enc_aux_buf_free(p_frame, p_frame->p_start_buffer,
+                            p_frame->start_buffer_size);
+        p_frame->p_start_buffer = NULL;
+        p_frame->start_buffer_size = 0;
+    }
+    if (p_frame->p_enc_aux_slab)
+    {
+        ni_enc_aux_slab_release((ni_enc_aux_slab_t *)p_frame->p_enc_aux_slab);
+        p_frame->p_enc_aux_slab = NULL;
+    }
+}
+
 ni_retcode_t ni_send_to_target(ni_session_context_t *p_ctx,
                                niFrameSurface1_t *source,
                                uint64_t ui64DestAddr,
@@ -36,6 +36,7 @@ extern "C"
 
 #include "ni_defs.h"
 #include "ni_rsrc_api.h"
+#include "ni_util.h"
 
 typedef enum
 {
@@ -1242,6 +1243,119 @@ ni_retcode_t ni_device_config_ns_qos(ni_device_handle_t device_handle,
 
 ni_retcode_t ni_dump_log_single_core(ni_session_context_t *p_ctx, void* p_data, uint32_t core_id, bool gen_log_file);
 ni_retcode_t ni_dump_log_all_cores(ni_session_context_t *p_ctx, void* p_data, bool gen_log_file);
+
+// incremental firmware log reading, see ni_device_fw_log_stream_init()
+#define NI_FW_LOG_PAGE_SIZE         NI_MEM_PAGE_ALIGNMENT
+#define NI_FW_LOG_PAGES             (CPU_LOG_BUFFER_SIZE / NI_FW_LOG_PAGE_SIZE)
+#define NI_FW_LOG_TAIL_RING_SIZE    (64 * 1024)
+#define NI_FW_LOG_TAIL_LINE_MAX     1024
+
+typedef struct _ni_fw_log_core_t
+{
+    uint8_t *p_shadow;          // log buffer content as last read
+    uint32_t baseline_pages;    // pages of p_shadow read, complete at
+                                // NI_FW_LOG_PAGES
+    uint32_t frontier;          // page the firmware is expected to write next
+    uint32_t sweep;             // next page checked for writes elsewhere
+} ni_fw_log_core_t;
+
+typedef struct _ni_fw_log_stream_priv_t
+{
+    ni_fw_log_core_t core[NUM_OF_CORES];
+    uint8_t *p_io_buf;          // page aligned, max_pages pages
+    // background mode
+    ni_pthread_t thread;
+    int thread_running;
+    volatile int stop;
+    uint32_t interval_ms;
+    uint32_t max_bytes_per_sec;
+    ni_fw_log_ring_t tail_ring[NUM_OF_CORES];
+} ni_fw_log_stream_priv_t;
+
+ni_retcode_t ni_fw_log_stream_init(ni_fw_log_stream_t *p_stream,
+                                   ni_session_context_t *p_ctx,
+                                   uint32_t max_pages);
+int ni_fw_log_stream_read(ni_fw_log_stream_t *p_stream, ni_core_type_t core,
+                          ni_fw_log_ring_t *p_ring);
+ni_retcode_t ni_fw_log_stream_start(ni_fw_log_stream_t *p_stream,
+                                    uint32_t interval_ms,
+                                    uint32_t max_bytes_per_sec);
+void ni_fw_log_stream_stop(ni_fw_log_stream_t *p_stream);
+void ni_fw_log_stream_close(ni_fw_log_stream_t *p_stream);
+
+// encoder input buffers registered with ni_encoder_frame_buffer_register()
+typedef struct _ni_enc_reg_buf_t
+{
+    int registered;
+    int width;
+    int height;
+    const uint8_t *p_data[NI_MAX_NUM_SW_FRAME_DATA_POINTERS];
+    int linesize[NI_MAX_NUM_SW_FRAME_DATA_POINTERS];
+    // planes whose linesize differs from the session's are copied to
+    // p_staging_plane at the session's linesize for every frame
+    int copy_row_bytes[NI_MAX_NUM_SW_FRAME_DATA_POINTERS];  // 0: zero copy
+    int session_linesize[NI_MAX_NUM_SW_FRAME_DATA_POINTERS];
+    uint8_t *p_staging_plane[NI_MAX_NUM_SW_FRAME_DATA_POINTERS];
+    uint8_t *p_staging;         // from ni_mem_pool_alloc
+    uint32_t staging_size;
+} ni_enc_reg_buf_t;
+
+typedef struct _ni_enc_reg_bufs_t
+{
+    ni_enc_reg_buf_t buf[NI_ENC_MAX_REGISTERED_BUFFERS];
+    ni_mem_account_t *p_mem_account;    // staging buffers charged to
+} ni_enc_reg_bufs_t;
+
+void ni_enc_reg_buf_release(ni_enc_reg_bufs_t *p_bufs, ni_enc_reg_buf_t *p_reg);
+void ni_enc_reg_bufs_destroy(ni_enc_reg_bufs_t *p_bufs);
+
+// per session slab of encoder metadata and start buffers, see
+// ni_encoder_frame_aux_buffers_borrow(). Chunks are whole pages, kept on one
+// free list per page count and never given back before the slab goes away;
+// larger buffers come from ni_mem_pool_alloc
+#define NI_ENC_AUX_SLAB_MAX_PAGES 16
+#define NI_ENC_AUX_SLAB_BLOCK_CHUNKS 8
+
+typedef struct _ni_enc_aux_slab_block_t
+{
+    struct _ni_enc_aux_slab_block_t *p_next;
+    void *p_mem;
+    uint32_t size;
+} ni_enc_aux_slab_block_t;
+
+typedef struct _ni_enc_aux_slab_t
+{
+    ni_pthread_mutex_t mutex;
+    int ref_count;   // the session's plus one per attached frame
+    void *p_free[NI_ENC_AUX_SLAB_MAX_PAGES];   // linked through first word
+    ni_enc_aux_slab_block_t *p_blocks;
+    uint64_t carved_bytes;
+    uint64_t borrow_count;
+    ni_mem_account_t *p_mem_account;    // blocks charged to, referenced
+} ni_enc_aux_slab_t;
+
+// decoder packet tracking arrays of a session, pointed to by the
+// ni_session_context_t fields of the same names
+typedef struct _ni_dec_pkt_fifo_t
+{
+    int64_t pts_offsets[NI_FIFO_SZ];
+    uint64_t pkt_offsets_index[NI_FIFO_SZ];
+    uint64_t pkt_offsets_index_min[NI_FIFO_SZ];
+    uint64_t pkt_pos[NI_FIFO_SZ];
+    ni_custom_sei_set_t *pkt_custom_sei_set[NI_FIFO_SZ];
+    int flags_array[NI_FIFO_SZ];
+} ni_dec_pkt_fifo_t;
+
+void ni_dec_pkt_fifo_set(ni_session_context_t *p_ctx, ni_dec_pkt_fifo_t *p_fifo);
+ni_retcode_t ni_dec_pkt_fifo_alloc(ni_session_context_t *p_ctx);
+void ni_dec_pkt_fifo_free(ni_session_context_t *p_ctx);
+void ni_dec_pkt_fifo_free_sei(ni_session_context_t *p_ctx);
+void ni_input_frame_fifo_free(ni_session_context_t *p_ctx);
+
+ni_enc_aux_slab_t *ni_enc_aux_slab_create(ni_mem_account_t *p_account);
+void ni_enc_aux_slab_release(ni_enc_aux_slab_t *p_slab);
+void ni_enc_aux_slab_attach(ni_enc_aux_slab_t *p_slab, ni_frame_t *p_frame);
+void ni_enc_aux_buffers_free(ni_frame_t *p_frame);
 ni_retcode_t ni_send_to_target(ni_session_context_t *p_ctx, niFrameSurface1_t *source, uint64_t ui64DestAddr, uint32_t ui32FrameSize);
 ni_retcode_t ni_recv_from_target(ni_session_context_t *pSession, const ni_p2p_sgl_t *dmaAddrs, ni_frame_t *pDstFrame);
 int lower_pixel_rate(const ni_load_query_t *pQuery, uint32_t ui32CurrentLowest);
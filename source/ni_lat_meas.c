@@ -26,6 +26,8 @@
  *          NETINT video processing devices
  ******************************************************************************/
 
+#define NI_LOG_MODULE NI_LOG_MODULE_UTIL
+
 #ifdef __linux__
 #include <sys/ioctl.h>
 #include <sys/stat.h>
@@ -241,3 +243,915 @@ uint64_t ni_lat_meas_q_check_latency(ni_lat_meas_q_t *frame_time_q,
 
     return ret;
 }
+
+/*!*****************************************************************************
+ *  \brief  Get the histogram bucket of a value
+ *
+ *  \param  value_us value in microseconds
+ *
+ *  \return bucket index
+ *
+ ******************************************************************************/
+static int ni_lat_hist_bucket(uint64_t value_us)
+{
+    int msb = 0;
+    int shift;
+
+    if (value_us < NI_LAT_HIST_SUB_COUNT)
+    {
+        return (int)value_us;
+    }
+    if (value_us >= (1ULL << NI_LAT_HIST_MAX_BITS))
+    {
+        return NI_LAT_HIST_BUCKETS - 1;
+    }
+    while ((value_us >> (msb + 1)) != 0)
+    {
+        msb++;
+    }
+    shift = msb - NI_LAT_HIST_SUB_BITS;
+    return (shift + 1) * NI_LAT_HIST_SUB_COUNT +
+        (int)((value_us >> shift) - NI_LAT_HIST_SUB_COUNT);
+}
+
+/*!*****************************************************************************
+ *  \brief  Get the highest value that falls in a histogram bucket
+ *
+ *  \param  bucket bucket index
+ *
+ *  \return value in microseconds
+ *
+ ******************************************************************************/
+static uint64_t ni_lat_hist_bucket_max(int bucket)
+{
+    int shift;
+    uint64_t sub;
+
+    if (bucket < NI_LAT_HIST_SUB_COUNT)
+    {
+        return (uint64_t)bucket;
+    }
+    shift = bucket / NI_LAT_HIST_SUB_COUNT - 1;
+    sub = (uint64_t)(bucket % NI_LAT_HIST_SUB_COUNT);
+    return ((NI_LAT_HIST_SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+/*!*****************************************************************************
+ *  \brief  Record a value into a latency histogram
+ *
+ *  \param  p_hist pointer to histogram
+ *  \param  value_us value in microseconds
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_lat_hist_record(ni_lat_hist_t *p_hist, uint64_t value_us)
+{
+    p_hist->buckets[ni_lat_hist_bucket(value_us)]++;
+    if (!p_hist->count || value_us < p_hist->min)
+    {
+        p_hist->min = value_us;
+    }
+    if (value_us > p_hist->max)
+    {
+        p_hist->max = value_us;
+    }
+    p_hist->count++;
+    p_hist->sum += value_us;
+}
+
+/*!*****************************************************************************
+ *  \brief  Get the value below which a percentage of the recorded values fall
+ *
+ *  \param  p_hist pointer to histogram
+ *  \param  percentile percentile in range 0 to 100
+ *
+ *  \return highest value equivalent to the percentile, capped at the recorded
+ *          maximum, 0 if the histogram is empty
+ *
+ ******************************************************************************/
+uint64_t ni_lat_hist_value_at_percentile(const ni_lat_hist_t *p_hist,
+                                         double percentile)
+{
+    uint64_t target;
+    uint64_t seen = 0;
+    int i;
+
+    if (!p_hist->count)
+    {
+        return 0;
+    }
+    target = (uint64_t)(percentile / 100.0 * (double)p_hist->count + 0.5);
+    if (target < 1)
+    {
+        target = 1;
+    }
+    for (i = 0; i < NI_LAT_HIST_BUCKETS; i++)
+    {
+        seen += p_hist->buckets[i];
+        if (seen >= target)
+        {
+            uint64_t value = ni_lat_hist_bucket_max(i);
+            return value < p_hist->max ? value : p_hist->max;
+        }
+    }
+    return p_hist->max;
+}
+
+/*!*****************************************************************************
+ *  \brief  Create the latency statistics of a session
+ *
+ *  \return pointer to ni_lat_stats_t, NULL if failed
+ *
+ ******************************************************************************/
+ni_lat_stats_t *ni_lat_stats_create(void)
+{
+    ni_lat_stats_t *p_stats = (ni_lat_stats_t *)calloc(1, sizeof(ni_lat_stats_t));
+    if (!p_stats)
+    {
+        ni_log(NI_LOG_ERROR,
+               "ERROR %d: Failed to allocate memory for latency stats\n",
+               NI_ERRNO);
+        return NULL;
+    }
+    if (ni_pthread_mutex_init(&p_stats->mutex))
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s() init mutex failed\n", __func__);
+        free(p_stats);
+        return NULL;
+    }
+    return p_stats;
+}
+
+/*!*****************************************************************************
+ *  \brief  Destroy the latency statistics of a session
+ *
+ *  \param  p_stats pointer to ni_lat_stats_t
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_lat_stats_destroy(ni_lat_stats_t *p_stats)
+{
+    int i;
+
+    if (!p_stats)
+    {
+        return;
+    }
+    if (p_stats->q)
+    {
+        ni_lat_meas_q_destroy(p_stats->q);
+    }
+    for (i = 0; i < NI_LATENCY_STAGE_MAX; i++)
+    {
+        free(p_stats->hist[i]);
+    }
+    ni_pthread_mutex_destroy(&p_stats->mutex);
+    free(p_stats);
+}
+
+/*!*****************************************************************************
+ *  \brief  Remember the start time of a frame/packet entering a session
+ *
+ *  \param  p_stats pointer to ni_lat_stats_t
+ *  \param  abs_time start time in ns
+ *  \param  ts_time timestamp the frame/packet is matched by when it leaves
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_lat_stats_start(ni_lat_stats_t *p_stats, uint64_t abs_time,
+                        int64_t ts_time)
+{
+    ni_pthread_mutex_lock(&p_stats->mutex);
+    if (!p_stats->q)
+    {
+        p_stats->q = ni_lat_meas_q_create(NI_LAT_STATS_Q_CAPACITY);
+    }
+    if (p_stats->q && !ni_lat_meas_q_add_entry(p_stats->q, abs_time, ts_time))
+    {
+        // queue full, the output side is not being matched (e.g. timestamps
+        // rewritten by the caller), restart from the newest frames
+        p_stats->q->front = p_stats->q->size = 0;
+        p_stats->q->rear = p_stats->q->capacity - 1;
+        ni_lat_meas_q_add_entry(p_stats->q, abs_time, ts_time);
+    }
+    ni_pthread_mutex_unlock(&p_stats->mutex);
+}
+
+static void ni_lat_stats_record_locked(ni_lat_stats_t *p_stats,
+                                       ni_latency_stage_t stage,
+                                       uint64_t latency_ns)
+{
+    if (!p_stats->hist[stage])
+    {
+        p_stats->hist[stage] = (ni_lat_hist_t *)calloc(1, sizeof(ni_lat_hist_t));
+        if (!p_stats->hist[stage])
+        {
+            return;
+        }
+    }
+    ni_lat_hist_record(p_stats->hist[stage], latency_ns / 1000);
+}
+
+/*!*****************************************************************************
+ *  \brief  Record the latency of a frame/packet leaving a session, matched
+ *          against the start times by timestamp
+ *
+ *  \param  p_stats pointer to ni_lat_stats_t
+ *  \param  stage processing stage
+ *  \param  abs_time end time in ns
+ *  \param  ts_time timestamp given to ni_lat_stats_start
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_lat_stats_end(ni_lat_stats_t *p_stats, ni_latency_stage_t stage,
+                      uint64_t abs_time, int64_t ts_time)
+{
+    uint64_t latency;
+
+    if (stage >= NI_LATENCY_STAGE_MAX)
+    {
+        return;
+    }
+    ni_pthread_mutex_lock(&p_stats->mutex);
+    if (p_stats->q)
+    {
+        latency = ni_lat_meas_q_check_latency(p_stats->q, abs_time, ts_time);
+        if (latency != (uint64_t)-1)
+        {
+            ni_lat_stats_record_locked(p_stats, stage, latency);
+        }
+    }
+    ni_pthread_mutex_unlock(&p_stats->mutex);
+}
+
+/*!*****************************************************************************
+ *  \brief  Record a measured latency
+ *
+ *  \param  p_stats pointer to ni_lat_stats_t
+ *  \param  stage processing stage
+ *  \param  latency_ns latency in ns
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_lat_stats_record(ni_lat_stats_t *p_stats, ni_latency_stage_t stage,
+                         uint64_t latency_ns)
+{
+    if (stage >= NI_LATENCY_STAGE_MAX)
+    {
+        return;
+    }
+    ni_pthread_mutex_lock(&p_stats->mutex);
+    ni_lat_stats_record_locked(p_stats, stage, latency_ns);
+    ni_pthread_mutex_unlock(&p_stats->mutex);
+}
+
+/*!*****************************************************************************
+ *  \brief  Summarize the latency histogram of a stage
+ *
+ *  \param  p_stats pointer to ni_lat_stats_t
+ *  \param  stage processing stage
+ *  \param  p_out summary, all zero if nothing recorded
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_lat_stats_get(ni_lat_stats_t *p_stats, ni_latency_stage_t stage,
+                      ni_latency_stats_t *p_out)
+{
+    const ni_lat_hist_t *p_hist;
+
+    memset(p_out, 0, sizeof(*p_out));
+    if (stage >= NI_LATENCY_STAGE_MAX)
+    {
+        return;
+    }
+    ni_pthread_mutex_lock(&p_stats->mutex);
+    p_hist = p_stats->hist[stage];
+    if (p_hist && p_hist->count)
+    {
+        p_out->count = p_hist->count;
+        p_out->min_us = p_hist->min;
+        p_out->max_us = p_hist->max;
+        p_out->mean_us = p_hist->sum / p_hist->count;
+        p_out->p50_us = ni_lat_hist_value_at_percentile(p_hist, 50.0);
+        p_out->p90_us = ni_lat_hist_value_at_percentile(p_hist, 90.0);
+        p_out->p99_us = ni_lat_hist_value_at_percentile(p_hist, 99.0);
+        p_out->p999_us = ni_lat_hist_value_at_percentile(p_hist, 99.9);
+    }
+    ni_pthread_mutex_unlock(&p_stats->mutex);
+}
+
+/*!*****************************************************************************
+ *  \brief  Clear all latency histograms
+ *
+ *  \param  p_stats pointer to ni_lat_stats_t
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_lat_stats_reset(ni_lat_stats_t *p_stats)
+{
+    int i;
+
+    ni_pthread_mutex_lock(&p_stats->mutex);
+    for (i = 0; i < NI_LATENCY_STAGE_MAX; i++)
+    {
+        if (p_stats->hist[i])
+        {
+            memset(p_stats->hist[i], 0, sizeof(ni_lat_hist_t));
+        }
+    }
+    ni_pthread_mutex_unlock(&p_stats->mutex);
+}
+
+/*!*****************************************************************************
+ *  \brief  Create the pipeline timing of a session
+ *
+ *  \return pointer to ni_pipeline_timing_t, NULL if failed
+ *
+ ******************************************************************************/
+ni_pipeline_timing_t *ni_pipeline_timing_create(void)
+{
+    ni_pipeline_timing_t *p_timing =
+        (ni_pipeline_timing_t *)calloc(1, sizeof(ni_pipeline_timing_t));
+    if (!p_timing)
+    {
+        ni_log(NI_LOG_ERROR,
+               "ERROR %d: Failed to allocate memory for pipeline timing\n",
+               NI_ERRNO);
+        return NULL;
+    }
+    if (ni_pthread_mutex_init(&p_timing->mutex))
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s() init mutex failed\n", __func__);
+        free(p_timing);
+        return NULL;
+    }
+    return p_timing;
+}
+
+/*!*****************************************************************************
+ *  \brief  Destroy the pipeline timing of a session
+ *
+ *  \param  p_timing pointer to ni_pipeline_timing_t
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_pipeline_timing_destroy(ni_pipeline_timing_t *p_timing)
+{
+    if (!p_timing)
+    {
+        return;
+    }
+    ni_pthread_mutex_destroy(&p_timing->mutex);
+    free(p_timing);
+}
+
+static void ni_pipeline_stage_add_locked(ni_pipeline_timing_t *p_timing,
+                                         ni_pipeline_stage_t stage,
+                                         uint64_t duration_ns)
+{
+    ni_pipeline_stage_stats_t *p_stage = &p_timing->stats.stage[stage];
+
+    p_stage->count++;
+    p_stage->total_ns += duration_ns;
+    if (duration_ns > p_stage->max_ns)
+    {
+        p_stage->max_ns = duration_ns;
+    }
+}
+
+/*!*****************************************************************************
+ *  \brief  Mark the entry of a session write or read call
+ *
+ *  \param  p_timing pointer to ni_pipeline_timing_t, may be NULL
+ *  \param  direction NI_PIPELINE_DIR_WRITE or NI_PIPELINE_DIR_READ
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_pipeline_timing_call_begin(ni_pipeline_timing_t *p_timing,
+                                   int direction)
+{
+    uint64_t *p_ts;
+
+    if (!p_timing)
+    {
+        return;
+    }
+    p_timing->query_count[direction] = 0;
+    p_ts = &p_timing->stats.last_ts[direction == NI_PIPELINE_DIR_WRITE ?
+                                        NI_PIPELINE_TS_WRITE_ENTRY :
+                                        NI_PIPELINE_TS_READ_ENTRY];
+    ni_pthread_mutex_lock(&p_timing->mutex);
+    p_ts[0] = ni_gettime_ns();
+    p_ts[1] = 0;
+    p_ts[2] = 0;
+    ni_pthread_mutex_unlock(&p_timing->mutex);
+}
+
+/*!*****************************************************************************
+ *  \brief  Mark the return of a session write or read call, accounting the
+ *          call total and the time since the device was ready
+ *
+ *  \param  p_timing pointer to ni_pipeline_timing_t, may be NULL
+ *  \param  direction NI_PIPELINE_DIR_WRITE or NI_PIPELINE_DIR_READ
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_pipeline_timing_call_end(ni_pipeline_timing_t *p_timing, int direction)
+{
+    uint64_t now;
+    uint64_t *p_ts;
+    int write = (direction == NI_PIPELINE_DIR_WRITE);
+
+    if (!p_timing)
+    {
+        return;
+    }
+    p_ts = &p_timing->stats.last_ts[write ? NI_PIPELINE_TS_WRITE_ENTRY :
+                                            NI_PIPELINE_TS_READ_ENTRY];
+    ni_pthread_mutex_lock(&p_timing->mutex);
+    now = ni_gettime_ns();
+    // entry is cleared if the stats were reset during the call
+    if (p_ts[0])
+    {
+        ni_pipeline_stage_add_locked(p_timing,
+                                     write ? NI_PIPELINE_STAGE_WRITE_TOTAL :
+                                             NI_PIPELINE_STAGE_READ_TOTAL,
+                                     now - p_ts[0]);
+    }
+    if (p_ts[1])
+    {
+        ni_pipeline_stage_add_locked(p_timing,
+                                     write ? NI_PIPELINE_STAGE_WRITE_SEND :
+                                             NI_PIPELINE_STAGE_READ_RECEIVE,
+                                     now - p_ts[1]);
+    }
+    p_ts[2] = now;
+    ni_pthread_mutex_unlock(&p_timing->mutex);
+}
+
+/*!*****************************************************************************
+ *  \brief  Count one iteration of a buffer/output query loop, the first one
+ *          starts the loop
+ *
+ *  \param  p_timing pointer to ni_pipeline_timing_t, may be NULL
+ *  \param  direction NI_PIPELINE_DIR_WRITE or NI_PIPELINE_DIR_READ
+ *
+ *  \return current time in ns, 0 if p_timing is NULL
+ *
+ ******************************************************************************/
+uint64_t ni_pipeline_timing_query(ni_pipeline_timing_t *p_timing,
+                                  int direction)
+{
+    uint64_t now;
+
+    if (!p_timing)
+    {
+        return 0;
+    }
+    now = ni_gettime_ns();
+    if (!p_timing->query_count[direction]++)
+    {
+        p_timing->query_start[direction] = now;
+    }
+    ni_pthread_mutex_lock(&p_timing->mutex);
+    if (direction == NI_PIPELINE_DIR_WRITE)
+    {
+        p_timing->stats.write_queries++;
+    } else
+    {
+        p_timing->stats.read_queries++;
+    }
+    ni_pthread_mutex_unlock(&p_timing->mutex);
+    return now;
+}
+
+/*!*****************************************************************************
+ *  \brief  Mark the successful end of a buffer/output query loop
+ *
+ *  \param  p_timing pointer to ni_pipeline_timing_t, may be NULL
+ *  \param  direction NI_PIPELINE_DIR_WRITE or NI_PIPELINE_DIR_READ
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_pipeline_timing_query_done(ni_pipeline_timing_t *p_timing,
+                                   int direction)
+{
+    uint64_t now;
+    uint32_t count;
+
+    if (!p_timing || !p_timing->query_count[direction])
+    {
+        return;
+    }
+    count = p_timing->query_count[direction];
+    p_timing->query_count[direction] = 0;
+    ni_pthread_mutex_lock(&p_timing->mutex);
+    now = ni_gettime_ns();
+    if (direction == NI_PIPELINE_DIR_WRITE)
+    {
+        ni_pipeline_stage_add_locked(p_timing, NI_PIPELINE_STAGE_WRITE_BUF_WAIT,
+                                     now - p_timing->query_start[direction]);
+        p_timing->stats.write_retries += count - 1;
+        p_timing->stats.last_ts[NI_PIPELINE_TS_WRITE_BUF_READY] = now;
+    } else
+    {
+        ni_pipeline_stage_add_locked(p_timing, NI_PIPELINE_STAGE_READ_QUERY,
+                                     now - p_timing->query_start[direction]);
+        p_timing->stats.read_retries += count - 1;
+        p_timing->stats.last_ts[NI_PIPELINE_TS_READ_READY] = now;
+    }
+    ni_pthread_mutex_unlock(&p_timing->mutex);
+}
+
+/*!*****************************************************************************
+ *  \brief  Account the time from start_ns to now to a stage
+ *
+ *  \param  p_timing pointer to ni_pipeline_timing_t, may be NULL
+ *  \param  stage pipeline stage
+ *  \param  start_ns start time in ns
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_pipeline_timing_add(ni_pipeline_timing_t *p_timing,
+                            ni_pipeline_stage_t stage, uint64_t start_ns)
+{
+    if (!p_timing || stage >= NI_PIPELINE_STAGE_MAX)
+    {
+        return;
+    }
+    ni_pthread_mutex_lock(&p_timing->mutex);
+    ni_pipeline_stage_add_locked(p_timing, stage, ni_gettime_ns() - start_ns);
+    ni_pthread_mutex_unlock(&p_timing->mutex);
+}
+
+/*!*****************************************************************************
+ *  \brief  Get a copy of the pipeline timing
+ *
+ *  \param  p_timing pointer to ni_pipeline_timing_t, may be NULL
+ *  \param  p_out timing statistics, all zero if p_timing is NULL
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_pipeline_timing_get(ni_pipeline_timing_t *p_timing,
+                            ni_pipeline_timing_stats_t *p_out)
+{
+    if (!p_timing)
+    {
+        memset(p_out, 0, sizeof(*p_out));
+        return;
+    }
+    ni_pthread_mutex_lock(&p_timing->mutex);
+    *p_out = p_timing->stats;
+    ni_pthread_mutex_unlock(&p_timing->mutex);
+}
+
+/*!*****************************************************************************
+ *  \brief  Clear the pipeline timing
+ *
+ *  \param  p_timing pointer to ni_pipeline_timing_t, may be NULL
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_pipeline_timing_reset(ni_pipeline_timing_t *p_timing)
+{
+    if (!p_timing)
+    {
+        return;
+    }
+    ni_pthread_mutex_lock(&p_timing->mutex);
+    memset(&p_timing->stats, 0, sizeof(p_timing->stats));
+    ni_pthread_mutex_unlock(&p_timing->mutex);
+}
+
+/*!*****************************************************************************
+ *  \brief  Create the rate statistics of a session
+ *
+ *  \return pointer to ni_session_rate_stats_t, NULL if failed
+ *
+ ******************************************************************************/
+ni_session_rate_stats_t *ni_session_rate_stats_create(void)
+{
+    ni_session_rate_stats_t *p_stats =
+        (ni_session_rate_stats_t *)calloc(1, sizeof(ni_session_rate_stats_t));
+    if (!p_stats)
+    {
+        ni_log(NI_LOG_ERROR,
+               "ERROR %d: Failed to allocate memory for session stats\n",
+               NI_ERRNO);
+        return NULL;
+    }
+    if (ni_pthread_mutex_init(&p_stats->mutex))
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s() init mutex failed\n", __func__);
+        free(p_stats);
+        return NULL;
+    }
+    p_stats->totals.start_time = ni_gettime_ns();
+    return p_stats;
+}
+
+/*!*****************************************************************************
+ *  \brief  Destroy the rate statistics of a session
+ *
+ *  \param  p_stats pointer to ni_session_rate_stats_t
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_session_rate_stats_destroy(ni_session_rate_stats_t *p_stats)
+{
+    if (!p_stats)
+    {
+        return;
+    }
+    ni_pthread_mutex_destroy(&p_stats->mutex);
+    free(p_stats);
+}
+
+// bucket of the current time, cleared when its slot is reused
+static ni_session_stats_bucket_t *
+ni_session_stats_bucket_locked(ni_session_rate_stats_t *p_stats, uint64_t now)
+{
+    uint64_t index = now / ((uint64_t)NI_SESSION_STATS_BUCKET_MS * 1000000);
+    ni_session_stats_bucket_t *p_bucket =
+        &p_stats->buckets[index % NI_SESSION_STATS_BUCKETS];
+
+    if (p_bucket->index != index)
+    {
+        memset(p_bucket, 0, sizeof(*p_bucket));
+        p_bucket->index = index;
+    }
+    return p_bucket;
+}
+
+static void ni_session_stats_add_retries(ni_session_rate_stats_t *p_stats,
+                                         int direction, uint32_t retries)
+{
+    ni_session_stats_bucket_t *p_bucket;
+
+    if (!retries)
+    {
+        return;
+    }
+    ni_pthread_mutex_lock(&p_stats->mutex);
+    p_bucket = ni_session_stats_bucket_locked(p_stats, ni_gettime_ns());
+    p_bucket->retries[direction] += retries;
+    if (direction == NI_PIPELINE_DIR_WRITE)
+    {
+        p_stats->totals.write_retries += retries;
+    } else
+    {
+        p_stats->totals.read_retries += retries;
+    }
+    ni_pthread_mutex_unlock(&p_stats->mutex);
+}
+
+/*!*****************************************************************************
+ *  \brief  Account a session write or read call
+ *
+ *  \param  p_stats pointer to ni_session_rate_stats_t, may be NULL
+ *  \param  direction NI_PIPELINE_DIR_WRITE or NI_PIPELINE_DIR_READ
+ *  \param  retval return of the call, bytes transferred if positive
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_session_rate_stats_call(ni_session_rate_stats_t *p_stats,
+                                int direction, int retval)
+{
+    ni_session_stats_bucket_t *p_bucket;
+    int write = (direction == NI_PIPELINE_DIR_WRITE);
+
+    if (!p_stats)
+    {
+        return;
+    }
+    // queries of a loop that did not succeed are all retries
+    if (p_stats->loop_queries[direction])
+    {
+        ni_session_stats_add_retries(p_stats, direction,
+                                     p_stats->loop_queries[direction]);
+        p_stats->loop_queries[direction] = 0;
+    }
+    ni_pthread_mutex_lock(&p_stats->mutex);
+    p_bucket = ni_session_stats_bucket_locked(p_stats, ni_gettime_ns());
+    p_bucket->calls[direction]++;
+    if (write)
+    {
+        p_stats->totals.write_calls++;
+    } else
+    {
+        p_stats->totals.read_calls++;
+    }
+    if (retval > 0)
+    {
+        p_bucket->frames[direction]++;
+        p_bucket->bytes[direction] += (uint64_t)retval;
+        if (write)
+        {
+            p_stats->totals.frames_written++;
+            p_stats->totals.bytes_written += (uint64_t)retval;
+        } else
+        {
+            p_stats->totals.frames_read++;
+            p_stats->totals.bytes_read += (uint64_t)retval;
+        }
+    }
+    ni_pthread_mutex_unlock(&p_stats->mutex);
+}
+
+/*!*****************************************************************************
+ *  \brief  Account one buffer/output query of a query loop, or the success
+ *          that ends the loop. All queries of a loop but the successful one
+ *          are retries.
+ *
+ *  \param  p_stats pointer to ni_session_rate_stats_t, may be NULL
+ *  \param  direction NI_PIPELINE_DIR_WRITE or NI_PIPELINE_DIR_READ
+ *  \param  hit 0 for a query, 1 for the end of the loop
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_session_rate_stats_query(ni_session_rate_stats_t *p_stats,
+                                 int direction, int hit)
+{
+    if (!p_stats)
+    {
+        return;
+    }
+    if (!hit)
+    {
+        p_stats->loop_queries[direction]++;
+    } else if (p_stats->loop_queries[direction])
+    {
+        ni_session_stats_add_retries(p_stats, direction,
+                                     p_stats->loop_queries[direction] - 1);
+        p_stats->loop_queries[direction] = 0;
+    }
+}
+
+/*!*****************************************************************************
+ *  \brief  Keep a session statistic the data path got from the device
+ *
+ *  \param  p_stats pointer to ni_session_rate_stats_t, may be NULL
+ *  \param  device_type device type the statistic was queried for
+ *  \param  p_fw_stats session statistic
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_session_rate_stats_fw_sample(ni_session_rate_stats_t *p_stats,
+                                     ni_device_type_t device_type,
+                                     const ni_session_statistic_t *p_fw_stats)
+{
+    ni_session_stats_snapshot_t *p_totals;
+    ni_session_stats_bucket_t *p_bucket;
+    uint64_t now;
+
+    if (!p_stats)
+    {
+        return;
+    }
+    p_totals = &p_stats->totals;
+    ni_pthread_mutex_lock(&p_stats->mutex);
+    now = ni_gettime_ns();
+    p_totals->fw_timestamp = now;
+    p_totals->fw_frames_input = p_fw_stats->ui32FramesInput;
+    p_totals->fw_frames_buffered = p_fw_stats->ui32FramesBuffered;
+    p_totals->fw_frames_completed = p_fw_stats->ui32FramesCompleted;
+    p_totals->fw_frames_output = p_fw_stats->ui32FramesOutput;
+    p_totals->fw_frames_dropped = p_fw_stats->ui32FramesDropped;
+    p_totals->fw_inst_errors = p_fw_stats->ui32InstErrors;
+    // the AI engine takes frames through hw frames, no write buffer
+    if (device_type != NI_DEVICE_TYPE_AI)
+    {
+        p_totals->write_buf_avail = p_fw_stats->ui32WrBufAvailSize;
+        if (p_totals->write_buf_avail > p_totals->write_buf_size)
+        {
+            p_totals->write_buf_size = p_totals->write_buf_avail;
+        }
+        if (p_totals->write_buf_size)
+        {
+            p_bucket = ni_session_stats_bucket_locked(p_stats, now);
+            p_bucket->occupancy_sum +=
+                (uint64_t)(p_totals->write_buf_size - p_totals->write_buf_avail) *
+                1000 / p_totals->write_buf_size;
+            p_bucket->occupancy_samples++;
+        }
+    }
+    ni_pthread_mutex_unlock(&p_stats->mutex);
+}
+
+/*!*****************************************************************************
+ *  \brief  Get the session totals and the rates over the snapshot windows,
+ *          no device I/O
+ *
+ *  \param  p_stats pointer to ni_session_rate_stats_t, may be NULL
+ *  \param  p_out snapshot, all zero if p_stats is NULL
+ *
+ *  \return
+ *
+ ******************************************************************************/
+void ni_session_rate_stats_get(ni_session_rate_stats_t *p_stats,
+                               ni_session_stats_snapshot_t *p_out)
+{
+    static const uint32_t window_buckets[NI_SESSION_STATS_WINDOW_MAX] = {
+        1000 / NI_SESSION_STATS_BUCKET_MS, NI_SESSION_STATS_BUCKETS};
+    const uint64_t bucket_ns = (uint64_t)NI_SESSION_STATS_BUCKET_MS * 1000000;
+    ni_session_stats_bucket_t sum;
+    ni_session_rates_t *p_rates;
+    uint64_t now, index, elapsed_ns;
+    uint32_t w, i;
+
+    if (!p_stats)
+    {
+        memset(p_out, 0, sizeof(*p_out));
+        return;
+    }
+    ni_pthread_mutex_lock(&p_stats->mutex);
+    now = ni_gettime_ns();
+    index = now / bucket_ns;
+    *p_out = p_stats->totals;
+    p_out->timestamp = now;
+
+    for (w = 0; w < NI_SESSION_STATS_WINDOW_MAX; w++)
+    {
+        memset(&sum, 0, sizeof(sum));
+        for (i = 0; i < window_buckets[w] && i <= index; i++)
+        {
+            const ni_session_stats_bucket_t *p_bucket =
+                &p_stats->buckets[(index - i) % NI_SESSION_STATS_BUCKETS];
+            if (p_bucket->index != index - i)
+            {
+                continue;
+            }
+            sum.calls[0] += p_bucket->calls[0];
+            sum.calls[1] += p_bucket->calls[1];
+            sum.frames[0] += p_bucket->frames[0];
+            sum.frames[1] += p_bucket->frames[1];
+            sum.bytes[0] += p_bucket->bytes[0];
+            sum.bytes[1] += p_bucket->bytes[1];
+            sum.retries[0] += p_bucket->retries[0];
+            sum.retries[1] += p_bucket->retries[1];
+            sum.occupancy_sum += p_bucket->occupancy_sum;
+            sum.occupancy_samples += p_bucket->occupancy_samples;
+        }
+
+        // full buckets before the current one plus the elapsed part of it
+        p_rates = &p_out->rates[w];
+        elapsed_ns = (window_buckets[w] - 1) * bucket_ns + now % bucket_ns;
+        if (elapsed_ns > now - p_stats->totals.start_time)
+        {
+            elapsed_ns = now - p_stats->totals.start_time;
+        }
+        p_rates->window_s = (double)elapsed_ns / 1e9;
+        if (elapsed_ns)
+        {
+            p_rates->write_fps = (double)sum.frames[NI_PIPELINE_DIR_WRITE] /
+                p_rates->window_s;
+            p_rates->read_fps = (double)sum.frames[NI_PIPELINE_DIR_READ] /
+                p_rates->window_s;
+            p_rates->write_bitrate = (double)sum.bytes[NI_PIPELINE_DIR_WRITE] *
+                8 / p_rates->window_s;
+            p_rates->read_bitrate = (double)sum.bytes[NI_PIPELINE_DIR_READ] *
+                8 / p_rates->window_s;
+        }
+        if (sum.frames[NI_PIPELINE_DIR_WRITE])
+        {
+            p_rates->avg_write_size = (double)sum.bytes[NI_PIPELINE_DIR_WRITE] /
+                sum.frames[NI_PIPELINE_DIR_WRITE];
+        }
+        if (sum.frames[NI_PIPELINE_DIR_READ])
+        {
+            p_rates->avg_read_size = (double)sum.bytes[NI_PIPELINE_DIR_READ] /
+                sum.frames[NI_PIPELINE_DIR_READ];
+        }
+        p_rates->write_buf_occupancy = sum.occupancy_samples ?
+            (double)sum.occupancy_sum / sum.occupancy_samples / 10 : -1;
+        if (sum.calls[NI_PIPELINE_DIR_WRITE])
+        {
+            p_rates->write_retry_rate = (double)sum.retries[NI_PIPELINE_DIR_WRITE] /
+                sum.calls[NI_PIPELINE_DIR_WRITE];
+        }
+        if (sum.calls[NI_PIPELINE_DIR_READ])
+        {
+            p_rates->read_retry_rate = (double)sum.retries[NI_PIPELINE_DIR_READ] /
+                sum.calls[NI_PIPELINE_DIR_READ];
+        }
+    }
+    ni_pthread_mutex_unlock(&p_stats->mutex);
+}
@@ -29,6 +29,7 @@
 #pragma once
 
 #include <stdint.h>
+#include "ni_device_api.h"
 
 typedef struct _ni_lat_meas_q_entry_t
 {
@@ -53,3 +54,139 @@ void *ni_lat_meas_q_add_entry(ni_lat_meas_q_t *frame_time_q, uint64_t abs_time,
 
 uint64_t ni_lat_meas_q_check_latency(ni_lat_meas_q_t *frame_time_q,
                                      uint64_t abs_time, int64_t ts_time);
+
+// log-linear latency histogram: values below 2^NI_LAT_HIST_SUB_BITS us are
+// exact, above that every power of 2 range is split in NI_LAT_HIST_SUB_COUNT
+// linear buckets, i.e. about 3% relative precision up to 2^32 us
+#define NI_LAT_HIST_SUB_BITS   5
+#define NI_LAT_HIST_SUB_COUNT  (1 << NI_LAT_HIST_SUB_BITS)
+#define NI_LAT_HIST_MAX_BITS   32
+#define NI_LAT_HIST_BUCKETS                                                    \
+    ((NI_LAT_HIST_MAX_BITS - NI_LAT_HIST_SUB_BITS + 1) * NI_LAT_HIST_SUB_COUNT)
+
+// frames in flight tracked for latency statistics
+#define NI_LAT_STATS_Q_CAPACITY 512
+
+typedef struct _ni_lat_hist_t
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint32_t buckets[NI_LAT_HIST_BUCKETS];
+} ni_lat_hist_t;
+
+typedef struct _ni_lat_stats_t
+{
+    ni_pthread_mutex_t mutex;
+    ni_lat_meas_q_t *q;                         // start times in flight
+    ni_lat_hist_t *hist[NI_LATENCY_STAGE_MAX];  // allocated on first sample
+} ni_lat_stats_t;
+
+// NI latency histogram operations
+void ni_lat_hist_record(ni_lat_hist_t *p_hist, uint64_t value_us);
+
+uint64_t ni_lat_hist_value_at_percentile(const ni_lat_hist_t *p_hist,
+                                         double percentile);
+
+// NI per session latency statistics operations
+ni_lat_stats_t *ni_lat_stats_create(void);
+
+void ni_lat_stats_destroy(ni_lat_stats_t *p_stats);
+
+void ni_lat_stats_start(ni_lat_stats_t *p_stats, uint64_t abs_time,
+                        int64_t ts_time);
+
+void ni_lat_stats_end(ni_lat_stats_t *p_stats, ni_latency_stage_t stage,
+                      uint64_t abs_time, int64_t ts_time);
+
+void ni_lat_stats_record(ni_lat_stats_t *p_stats, ni_latency_stage_t stage,
+                         uint64_t latency_ns);
+
+void ni_lat_stats_get(ni_lat_stats_t *p_stats, ni_latency_stage_t stage,
+                      ni_latency_stats_t *p_out);
+
+void ni_lat_stats_reset(ni_lat_stats_t *p_stats);
+
+// direction of a session call for pipeline timing
+#define NI_PIPELINE_DIR_WRITE 0
+#define NI_PIPELINE_DIR_READ  1
+
+typedef struct _ni_pipeline_timing_t
+{
+    ni_pthread_mutex_t mutex;                   // guards stats
+    ni_pipeline_timing_stats_t stats;
+    // query loop of the call in progress, owned by the thread making the
+    // call of each direction
+    uint64_t query_start[2];
+    uint32_t query_count[2];
+} ni_pipeline_timing_t;
+
+// NI per session pipeline timing operations, all accept a NULL p_timing
+ni_pipeline_timing_t *ni_pipeline_timing_create(void);
+
+void ni_pipeline_timing_destroy(ni_pipeline_timing_t *p_timing);
+
+void ni_pipeline_timing_call_begin(ni_pipeline_timing_t *p_timing,
+                                   int direction);
+
+void ni_pipeline_timing_call_end(ni_pipeline_timing_t *p_timing,
+                                 int direction);
+
+uint64_t ni_pipeline_timing_query(ni_pipeline_timing_t *p_timing,
+                                  int direction);
+
+void ni_pipeline_timing_query_done(ni_pipeline_timing_t *p_timing,
+                                   int direction);
+
+void ni_pipeline_timing_add(ni_pipeline_timing_t *p_timing,
+                            ni_pipeline_stage_t stage, uint64_t start_ns);
+
+void ni_pipeline_timing_get(ni_pipeline_timing_t *p_timing,
+                            ni_pipeline_timing_stats_t *p_out);
+
+void ni_pipeline_timing_reset(ni_pipeline_timing_t *p_timing);
+
+// session stats are kept in NI_SESSION_STATS_BUCKET_MS buckets, covering the
+// longest snapshot window
+#define NI_SESSION_STATS_BUCKET_MS 100
+#define NI_SESSION_STATS_BUCKETS   100
+
+typedef struct _ni_session_stats_bucket_t
+{
+    uint64_t index;             // ni_gettime_ns() / bucket length
+    uint64_t calls[2];          // by NI_PIPELINE_DIR_*
+    uint64_t frames[2];
+    uint64_t bytes[2];
+    uint64_t retries[2];
+    uint64_t occupancy_sum;     // write buffer occupancy samples, permille
+    uint64_t occupancy_samples;
+} ni_session_stats_bucket_t;
+
+typedef struct _ni_session_rate_stats_t
+{
+    ni_pthread_mutex_t mutex;
+    ni_session_stats_snapshot_t totals;     // rates not filled in
+    ni_session_stats_bucket_t buckets[NI_SESSION_STATS_BUCKETS];
+    // queries of the loop in progress, owned by the thread making the call
+    // of each direction
+    uint32_t loop_queries[2];
+} ni_session_rate_stats_t;
+
+// NI per session rate statistics operations, all accept a NULL p_stats
+ni_session_rate_stats_t *ni_session_rate_stats_create(void);
+
+void ni_session_rate_stats_destroy(ni_session_rate_stats_t *p_stats);
+
+void ni_session_rate_stats_call(ni_session_rate_stats_t *p_stats,
+                                int direction, int retval);
+
+void ni_session_rate_stats_query(ni_session_rate_stats_t *p_stats,
+                                 int direction, int hit);
+
+void ni_session_rate_stats_fw_sample(ni_session_rate_stats_t *p_stats,
+                                     ni_device_type_t device_type,
+                                     const ni_session_statistic_t *p_fw_stats);
+
+void ni_session_rate_stats_get(ni_session_rate_stats_t *p_stats,
+                               ni_session_stats_snapshot_t *p_out);
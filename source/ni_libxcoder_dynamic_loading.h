@@ -112,6 +112,22 @@ typedef int (LIB_API* PNIPTHREADCONDSIGNAL) (ni_pthread_cond_t *cond);
 typedef int (LIB_API* PNIPTHREADCONDTIMEDWAIT) (ni_pthread_cond_t *cond, ni_pthread_mutex_t *mutex, const struct timespec *abstime);
 typedef int (LIB_API* PNIPTHREADSIGMASK) (int how, const ni_sigset_t *set, ni_sigset_t *oldset);
 typedef int (LIB_API* PNIPOSIXMEMALIGN) (void **memptr, size_t alignment, size_t size);
+typedef int (LIB_API* PNIGETDEVICENUMANODE) (const char *p_dev);
+typedef int (LIB_API* PNIGETCURRENTNUMANODE) (void);
+typedef int (LIB_API* PNINUMABINDBUFFER) (void *p_buf, size_t size, int numa_node);
+typedef int (LIB_API* PNIMEMPOOLALLOC) (void **pp_buf, size_t size);
+typedef void (LIB_API* PNIMEMPOOLFREE) (void *p_buf, size_t size);
+typedef uint64_t (LIB_API* PNIMEMPOOLTRIM) (uint64_t keep_bytes);
+typedef void (LIB_API* PNIMEMPOOLGETSTATS) (ni_mem_pool_stats_t *p_stats);
+typedef int (LIB_API* PNIMEMSETHUGEPAGES) (ni_mem_huge_pages_t mode);
+typedef int (LIB_API* PNIMEMARENAALLOC) (void **pp_buf, size_t size);
+typedef void (LIB_API* PNIMEMARENAFREE) (void *p_buf, size_t size);
+typedef void (LIB_API* PNIMEMGETUSAGE) (ni_mem_usage_t *p_usage);
+typedef ni_retcode_t (LIB_API* PNIDEVICESESSIONGETMEMUSAGE) (ni_session_context_t *p_ctx, ni_mem_usage_t *p_usage);
+typedef ni_retcode_t (LIB_API* PNINVMETRACESTART) (const char *p_path, uint32_t num_records);
+typedef void (LIB_API* PNINVMETRACESTOP) (void);
+typedef int (LIB_API* PNIPERFCOUNTERSREAD) (ni_perf_counters_t *p_procs, int max_procs, ni_perf_counters_t *p_total);
+typedef const char * (LIB_API* PNIPERFCOUNTERNAME) (ni_perf_counter_t counter);
 typedef const char * (LIB_API* PNIAIERRNOTOSTR) (int rc);
 //
 
@@ -137,6 +153,11 @@ typedef int (LIB_API* PNIDEVICESESSIONREAD) (ni_session_context_t *p_ctx, ni_ses
 typedef ni_retcode_t (LIB_API* PNIDEVICESESSIONQUERY) (ni_session_context_t *p_ctx, ni_device_type_t device_type);
 typedef ni_retcode_t (LIB_API* PNIDEVICESESSIONQUERYDETAIL) (ni_session_context_t* p_ctx, ni_device_type_t device_type, ni_instance_mgr_detail_status_t *detail_data);
 typedef ni_retcode_t (LIB_API* PNIDEVICESESSIONQUERYDETAILV1) (ni_session_context_t* p_ctx, ni_device_type_t device_type, ni_instance_mgr_detail_status_v1_t *detail_data);
+typedef ni_retcode_t (LIB_API* PNIDEVICESESSIONGETLATENCYSTATS) (ni_session_context_t *p_ctx, ni_latency_stage_t stage, ni_latency_stats_t *p_stats);
+typedef ni_retcode_t (LIB_API* PNIDEVICESESSIONRESETLATENCYSTATS) (ni_session_context_t *p_ctx);
+typedef ni_retcode_t (LIB_API* PNIDEVICESESSIONGETPIPELINETIMING) (ni_session_context_t *p_ctx, ni_pipeline_timing_stats_t *p_stats);
+typedef ni_retcode_t (LIB_API* PNIDEVICESESSIONRESETPIPELINETIMING) (ni_session_context_t *p_ctx);
+typedef ni_retcode_t (LIB_API* PNIDEVICESESSIONGETSTATSSNAPSHOT) (ni_session_context_t *p_ctx, ni_session_stats_snapshot_t *p_snapshot);
 typedef ni_retcode_t (LIB_API* PNIDEVICECONFIGNAMESPACENUM) (ni_device_handle_t device_handle, uint32_t namespace_num, uint32_t sriov_index);
 typedef ni_retcode_t (LIB_API* PNIDEVICECONFIGQOS) (ni_device_handle_t device_handle, uint32_t mode);
 typedef ni_retcode_t (LIB_API* PNIDEVICECONFIGQOSOP) (ni_device_handle_t device_handle, ni_device_handle_t device_handle_t, uint32_t over_provision);
@@ -153,6 +174,7 @@ typedef ni_retcode_t (LIB_API* PNIENCODERSWFRAMEBUFFERALLOC) (bool planar, ni_fr
 typedef ni_retcode_t (LIB_API* PNIFRAMEBUFFERFREE) (ni_frame_t *pframe);
 typedef ni_retcode_t (LIB_API* PNIDECODERFRAMEBUFFERFREE) (ni_frame_t *pframe);
 typedef void (LIB_API* PNIDECODERFRAMEBUFFERPOOLRETURNBUF) (ni_buf_t *buf, ni_buf_pool_t *p_buffer_pool);
+typedef ni_retcode_t (LIB_API* PNIDECODERSETBUFFERALLOCATOR) (ni_session_context_t *p_ctx, const ni_dec_buffer_allocator_t *p_allocator);
 typedef ni_retcode_t (LIB_API* PNIPACKETBUFFERALLOC) (ni_packet_t *ppacket, int packet_size);
 typedef ni_retcode_t (LIB_API* PNICUSTOMPACKETBUFFERALLOC) (void *p_buffer, ni_packet_t *p_packet, int buffer_size);
 typedef ni_retcode_t (LIB_API* PNIPACKETBUFFERFREE) (ni_packet_t *ppacket);
@@ -218,10 +240,20 @@ typedef ni_retcode_t (LIB_API* PNIQUERYTEMPERATURE) (ni_device_handle_t device_h
 typedef ni_retcode_t (LIB_API* PNIQUERYEXTRAINFO) (ni_device_handle_t device_handle, ni_device_extra_info_t *p_dev_extra_info, uint8_t fw_rev[]);
 typedef ni_retcode_t (LIB_API* PNIENCODERFRAMEZEROCOPYCHECK) (ni_session_context_t *p_enc_ctx, ni_xcoder_params_t *p_enc_params, int width, int height, const int linesize[], bool set_linesize);
 typedef ni_retcode_t (LIB_API* PNIENCODERFRAMEZEROCOPYBUFFERALLOC) (ni_frame_t *p_frame, int video_width, int video_height, const int linesize[], const uint8_t *data[], int extra_len);
+typedef ni_retcode_t (LIB_API* PNIENCODERFRAMEBUFFERREGISTER) (ni_session_context_t *p_enc_ctx, int width, int height, const uint8_t *data[], const int linesize[], int *p_handle);
+typedef ni_retcode_t (LIB_API* PNIENCODERFRAMEBUFFERUNREGISTER) (ni_session_context_t *p_enc_ctx, int handle);
+typedef ni_retcode_t (LIB_API* PNIENCODERFRAMEREGISTEREDBUFFERALLOC) (ni_session_context_t *p_enc_ctx, ni_frame_t *p_frame, int handle, int extra_len);
+typedef ni_retcode_t (LIB_API* PNIENCODERFRAMEAUXBUFFERSBORROW) (ni_session_context_t *p_enc_ctx, ni_frame_t *p_frame, int extra_len);
+typedef void (LIB_API* PNIENCODERFRAMEAUXBUFFERSRETURN) (ni_frame_t *p_frame);
 typedef ni_retcode_t (LIB_API* PNIUPLOADERFRAMEZEROCOPYCHECK) (ni_session_context_t *p_upl_ctx, int width, int height, const int linesize[], int pixel_format);
 typedef ni_retcode_t (LIB_API* PNIRECONFIGCRF) (ni_session_context_t *p_ctx, int32_t crf);
 typedef ni_retcode_t (LIB_API* PNIRECONFIGCRF2) (ni_session_context_t *p_ctx, float crf);
 typedef ni_retcode_t (LIB_API* PNIDEVICEALLOCANDGETFIRMWARELOGS) (ni_session_context_t *p_ctx, void** p_log_buffer, bool gen_log_file);
+typedef ni_retcode_t (LIB_API* PNIDEVICEFWLOGSTREAMINIT) (ni_fw_log_stream_t *p_stream, ni_session_context_t *p_ctx, uint32_t max_pages);
+typedef int (LIB_API* PNIDEVICEFWLOGSTREAMREAD) (ni_fw_log_stream_t *p_stream, ni_core_type_t core, ni_fw_log_ring_t *p_ring);
+typedef ni_retcode_t (LIB_API* PNIDEVICEFWLOGSTREAMSTART) (ni_fw_log_stream_t *p_stream, uint32_t interval_ms, uint32_t max_bytes_per_sec);
+typedef void (LIB_API* PNIDEVICEFWLOGSTREAMSTOP) (ni_fw_log_stream_t *p_stream);
+typedef void (LIB_API* PNIDEVICEFWLOGSTREAMCLOSE) (ni_fw_log_stream_t *p_stream);
 typedef ni_retcode_t (LIB_API* PNIRECONFIGVBVVALUE) (ni_session_context_t *p_ctx, int32_t vbvMaxRate, int32_t vbvBufferSize);
 typedef ni_retcode_t (LIB_API* PNIDEVICESESSIONUPDATEFRAMEPOOL) (ni_session_context_t *p_ctx, uint32_t pool_size);
 typedef ni_retcode_t (LIB_API* PNISETDEMOROIMAP) (ni_session_context_t *p_enc_ctx);
@@ -300,6 +332,22 @@ typedef struct _NETINT_LIBXCODER_API_FUNCTION_LIST
     PNIPTHREADCONDTIMEDWAIT              niPthreadCondTimedwait;               /** Client should access ::ni_pthread_cond_timedwait API through this pointer */
     PNIPTHREADSIGMASK                    niPthreadSigmask;                     /** Client should access ::ni_pthread_sigmask API through this pointer */
     PNIPOSIXMEMALIGN                     niPosixMemalign;                      /** Client should access ::ni_posix_memalign API through this pointer */
+    PNIGETDEVICENUMANODE                 niGetDeviceNumaNode;                  /** Client should access ::ni_get_device_numa_node API through this pointer */
+    PNIGETCURRENTNUMANODE                niGetCurrentNumaNode;                 /** Client should access ::ni_get_current_numa_node API through this pointer */
+    PNINUMABINDBUFFER                    niNumaBindBuffer;                     /** Client should access ::ni_numa_bind_buffer API through this pointer */
+    PNIMEMPOOLALLOC                      niMemPoolAlloc;                       /** Client should access ::ni_mem_pool_alloc API through this pointer */
+    PNIMEMPOOLFREE                       niMemPoolFree;                        /** Client should access ::ni_mem_pool_free API through this pointer */
+    PNIMEMPOOLTRIM                       niMemPoolTrim;                        /** Client should access ::ni_mem_pool_trim API through this pointer */
+    PNIMEMPOOLGETSTATS                   niMemPoolGetStats;                    /** Client should access ::ni_mem_pool_get_stats API through this pointer */
+    PNIMEMSETHUGEPAGES                   niMemSetHugePages;                    /** Client should access ::ni_mem_set_huge_pages API through this pointer */
+    PNIMEMARENAALLOC                     niMemArenaAlloc;                      /** Client should access ::ni_mem_arena_alloc API through this pointer */
+    PNIMEMARENAFREE                      niMemArenaFree;                       /** Client should access ::ni_mem_arena_free API through this pointer */
+    PNIMEMGETUSAGE                       niMemGetUsage;                        /** Client should access ::ni_mem_get_usage API through this pointer */
+    PNIDEVICESESSIONGETMEMUSAGE          niDeviceSessionGetMemUsage;           /** Client should access ::ni_device_session_get_mem_usage API through this pointer */
+    PNINVMETRACESTART                    niNvmeTraceStart;                     /** Client should access ::ni_nvme_trace_start API through this pointer */
+    PNINVMETRACESTOP                     niNvmeTraceStop;                      /** Client should access ::ni_nvme_trace_stop API through this pointer */
+    PNIPERFCOUNTERSREAD                  niPerfCountersRead;                   /** Client should access ::ni_perf_counters_read API through this pointer */
+    PNIPERFCOUNTERNAME                   niPerfCounterName;                    /** Client should access ::ni_perf_counter_name API through this pointer */
     PNIAIERRNOTOSTR                      niAiErrnoToStr;                       /** Client should access ::ni_ai_errno_to_str API through this pointer */
     //
     // API function list for ni_device_api.h
@@ -323,6 +371,11 @@ typedef struct _NETINT_LIBXCODER_API_FUNCTION_LIST
     PNIDEVICESESSIONQUERY                niDeviceSessionQuery;                 /** Client should access ::ni_device_session_query API through this pointer */
     PNIDEVICESESSIONQUERYDETAIL          niDeviceSessionQueryDetail;           /** Client should access ::ni_device_session_query_detail API through this pointer */
     PNIDEVICESESSIONQUERYDETAILV1        niDeviceSessionQueryDetailV1;         /** Client should access ::ni_device_session_query_detail_v1 API through this pointer */
+    PNIDEVICESESSIONGETLATENCYSTATS      niDeviceSessionGetLatencyStats;       /** Client should access ::ni_device_session_get_latency_stats API through this pointer */
+    PNIDEVICESESSIONRESETLATENCYSTATS    niDeviceSessionResetLatencyStats;     /** Client should access ::ni_device_session_reset_latency_stats API through this pointer */
+    PNIDEVICESESSIONGETPIPELINETIMING    niDeviceSessionGetPipelineTiming;     /** Client should access ::ni_device_session_get_pipeline_timing API through this pointer */
+    PNIDEVICESESSIONRESETPIPELINETIMING  niDeviceSessionResetPipelineTiming;   /** Client should access ::ni_device_session_reset_pipeline_timing API through this pointer */
+    PNIDEVICESESSIONGETSTATSSNAPSHOT     niDeviceSessionGetStatsSnapshot;      /** Client should access ::ni_device_session_get_stats_snapshot API through this pointer */
     PNIDEVICECONFIGNAMESPACENUM          niDeviceConfigNamespaceNum;           /** Client should access ::ni_device_config_namespace_num API through this pointer */
     PNIDEVICECONFIGQOS                   niDeviceConfigQos;                    /** Client should access ::ni_device_config_qos API through this pointer */
     PNIDEVICECONFIGQOSOP                 niDeviceConfigQosOp;                  /** Client should access ::ni_device_config_qos_op API through this pointer */
@@ -338,6 +391,7 @@ typedef struct _NETINT_LIBXCODER_API_FUNCTION_LIST
     PNIFRAMEBUFFERFREE                   niFrameBufferFree;                    /** Client should access ::ni_frame_buffer_free API through this pointer */
     PNIDECODERFRAMEBUFFERFREE            niDecoderFrameBufferFree;             /** Client should access ::ni_decoder_frame_buffer_free API through this pointer */
     PNIDECODERFRAMEBUFFERPOOLRETURNBUF   niDecoderFrameBufferPoolReturnBuf;    /** Client should access ::ni_decoder_frame_buffer_pool_return_buf API through this pointer */
+    PNIDECODERSETBUFFERALLOCATOR         niDecoderSetBufferAllocator;          /** Client should access ::ni_decoder_set_buffer_allocator API through this pointer */
     PNIPACKETBUFFERALLOC                 niPacketBufferAlloc;                  /** Client should access ::ni_packet_buffer_alloc API through this pointer */
     PNICUSTOMPACKETBUFFERALLOC           niCustomPacketBufferAlloc;            /** Client should access ::ni_custom_packet_buffer_alloc API through this pointer */
     PNIPACKETBUFFERFREE                  niPacketBufferFree;                   /** Client should access ::ni_packet_buffer_free API through this pointer */
@@ -403,10 +457,20 @@ typedef struct _NETINT_LIBXCODER_API_FUNCTION_LIST
     PNIQUERYEXTRAINFO                    niQueryExtraInfo;                     /** Client should access ::ni_query_extra_info API through this pointer */
     PNIENCODERFRAMEZEROCOPYCHECK         niEncoderFrameZerocopyCheck;          /** Client should access ::ni_encoder_frame_zerocopy_check API through this pointer */
     PNIENCODERFRAMEZEROCOPYBUFFERALLOC   niEncoderFrameZerocopyBufferAlloc;    /** Client should access ::ni_encoder_frame_zerocopy_buffer_alloc API through this pointer */
+    PNIENCODERFRAMEBUFFERREGISTER        niEncoderFrameBufferRegister;         /** Client should access ::ni_encoder_frame_buffer_register API through this pointer */
+    PNIENCODERFRAMEBUFFERUNREGISTER      niEncoderFrameBufferUnregister;       /** Client should access ::ni_encoder_frame_buffer_unregister API through this pointer */
+    PNIENCODERFRAMEREGISTEREDBUFFERALLOC niEncoderFrameRegisteredBufferAlloc;  /** Client should access ::ni_encoder_frame_registered_buffer_alloc API through this pointer */
+    PNIENCODERFRAMEAUXBUFFERSBORROW      niEncoderFrameAuxBuffersBorrow;       /** Client should access ::ni_encoder_frame_aux_buffers_borrow API through this pointer */
+    PNIENCODERFRAMEAUXBUFFERSRETURN      niEncoderFrameAuxBuffersReturn;       /** Client should access ::ni_encoder_frame_aux_buffers_return API through this pointer */
     PNIUPLOADERFRAMEZEROCOPYCHECK        niUploaderFrameZerocopyCheck;         /** Client should access ::ni_uploader_frame_zerocopy_check API through this pointer */
     PNIRECONFIGCRF                       niReconfigCrf;                        /** Client should access ::ni_reconfig_crf API through this pointer */
     PNIRECONFIGCRF2                      niReconfigCrf2;                       /** Client should access ::ni_reconfig_crf2 API through this pointer */
     PNIDEVICEALLOCANDGETFIRMWARELOGS     niDeviceAllocAndGetFirmwareLogs;      /** Client should access ::ni_device_alloc_and_get_firmware_logs API through this pointer */
+    PNIDEVICEFWLOGSTREAMINIT             niDeviceFwLogStreamInit;              /** Client should access ::ni_device_fw_log_stream_init API through this pointer */
+    PNIDEVICEFWLOGSTREAMREAD             niDeviceFwLogStreamRead;              /** Client should access ::ni_device_fw_log_stream_read API through this pointer */
+    PNIDEVICEFWLOGSTREAMSTART            niDeviceFwLogStreamStart;             /** Client should access ::ni_device_fw_log_stream_start API through this pointer */
+    PNIDEVICEFWLOGSTREAMSTOP             niDeviceFwLogStreamStop;              /** Client should access ::ni_device_fw_log_stream_stop API through this pointer */
+    PNIDEVICEFWLOGSTREAMCLOSE            niDeviceFwLogStreamClose;             /** Client should access ::ni_device_fw_log_stream_close API through this pointer */
     PNIRECONFIGVBVVALUE                  niReconfigVbvValue;                   /** Client should access ::ni_reconfig_vbv_value API through this pointer */
     PNIDEVICESESSIONUPDATEFRAMEPOOL      niDeviceSessionUpdateFramepool;       /** Client should access ::ni_device_session_update_framepool API through this pointer */
     PNIGETFRAMEDIM                       niGetFrameDim;                        /** Client should access ::ni_get_frame_dim API through this pointer */
@@ -491,6 +555,22 @@ public:
         functionList->niPthreadCondTimedwait = reinterpret_cast<decltype(ni_pthread_cond_timedwait)*>(dlsym(lib,"ni_pthread_cond_timedwait"));
         functionList->niPthreadSigmask = reinterpret_cast<decltype(ni_pthread_sigmask)*>(dlsym(lib,"ni_pthread_sigmask"));
         functionList->niPosixMemalign = reinterpret_cast<decltype(ni_posix_memalign)*>(dlsym(lib,"ni_posix_memalign"));
+        functionList->niGetDeviceNumaNode = reinterpret_cast<decltype(ni_get_device_numa_node)*>(dlsym(lib,"ni_get_device_numa_node"));
+        functionList->niGetCurrentNumaNode = reinterpret_cast<decltype(ni_get_current_numa_node)*>(dlsym(lib,"ni_get_current_numa_node"));
+        functionList->niNumaBindBuffer = reinterpret_cast<decltype(ni_numa_bind_buffer)*>(dlsym(lib,"ni_numa_bind_buffer"));
+        functionList->niMemPoolAlloc = reinterpret_cast<decltype(ni_mem_pool_alloc)*>(dlsym(lib,"ni_mem_pool_alloc"));
+        functionList->niMemPoolFree = reinterpret_cast<decltype(ni_mem_pool_free)*>(dlsym(lib,"ni_mem_pool_free"));
+        functionList->niMemPoolTrim = reinterpret_cast<decltype(ni_mem_pool_trim)*>(dlsym(lib,"ni_mem_pool_trim"));
+        functionList->niMemPoolGetStats = reinterpret_cast<decltype(ni_mem_pool_get_stats)*>(dlsym(lib,"ni_mem_pool_get_stats"));
+        functionList->niMemSetHugePages = reinterpret_cast<decltype(ni_mem_set_huge_pages)*>(dlsym(lib,"ni_mem_set_huge_pages"));
+        functionList->niMemArenaAlloc = reinterpret_cast<decltype(ni_mem_arena_alloc)*>(dlsym(lib,"ni_mem_arena_alloc"));
+        functionList->niMemArenaFree = reinterpret_cast<decltype(ni_mem_arena_free)*>(dlsym(lib,"ni_mem_arena_free"));
+        functionList->niMemGetUsage = reinterpret_cast<decltype(ni_mem_get_usage)*>(dlsym(lib,"ni_mem_get_usage"));
+        functionList->niDeviceSessionGetMemUsage = reinterpret_cast<decltype(ni_device_session_get_mem_usage)*>(dlsym(lib,"ni_device_session_get_mem_usage"));
+        functionList->niNvmeTraceStart = reinterpret_cast<decltype(ni_nvme_trace_start)*>(dlsym(lib,"ni_nvme_trace_start"));
+        functionList->niNvmeTraceStop = reinterpret_cast<decltype(ni_nvme_trace_stop)*>(dlsym(lib,"ni_nvme_trace_stop"));
+        functionList->niPerfCountersRead = reinterpret_cast<decltype(ni_perf_counters_read)*>(dlsym(lib,"ni_perf_counters_read"));
+        functionList->niPerfCounterName = reinterpret_cast<decltype(ni_perf_counter_name)*>(dlsym(lib,"ni_perf_counter_name"));
         functionList->niAiErrnoToStr = reinterpret_cast<decltype(ni_ai_errno_to_str)*>(dlsym(lib,"ni_ai_errno_to_str"));
         //
         // Function/symbol loading for ni_device_api.h
@@ -514,6 +594,11 @@ public:
         functionList->niDeviceSessionQuery = reinterpret_cast<decltype(ni_device_session_query)*>(dlsym(lib,"ni_device_session_query"));
         functionList->niDeviceSessionQueryDetail = reinterpret_cast<decltype(ni_device_session_query_detail)*>(dlsym(lib,"ni_device_session_query_detail"));
         functionList->niDeviceSessionQueryDetailV1 = reinterpret_cast<decltype(ni_device_session_query_detail_v1)*>(dlsym(lib,"ni_device_session_query_detail_v1"));
+        functionList->niDeviceSessionGetLatencyStats = reinterpret_cast<decltype(ni_device_session_get_latency_stats)*>(dlsym(lib,"ni_device_session_get_latency_stats"));
+        functionList->niDeviceSessionResetLatencyStats = reinterpret_cast<decltype(ni_device_session_reset_latency_stats)*>(dlsym(lib,"ni_device_session_reset_latency_stats"));
+        functionList->niDeviceSessionGetPipelineTiming = reinterpret_cast<decltype(ni_device_session_get_pipeline_timing)*>(dlsym(lib,"ni_device_session_get_pipeline_timing"));
+        functionList->niDeviceSessionResetPipelineTiming = reinterpret_cast<decltype(ni_device_session_reset_pipeline_timing)*>(dlsym(lib,"ni_device_session_reset_pipeline_timing"));
+        functionList->niDeviceSessionGetStatsSnapshot = reinterpret_cast<decltype(ni_device_session_get_stats_snapshot)*>(dlsym(lib,"ni_device_session_get_stats_snapshot"));
         functionList->niDeviceConfigNamespaceNum = reinterpret_cast<decltype(ni_device_config_namespace_num)*>(dlsym(lib,"ni_device_config_namespace_num"));
         functionList->niDeviceConfigQos = reinterpret_cast<decltype(ni_device_config_qos)*>(dlsym(lib,"ni_device_config_qos"));
         functionList->niDeviceConfigQosOp = reinterpret_cast<decltype(ni_device_config_qos_op)*>(dlsym(lib,"ni_device_config_qos_op"));
@@ -529,6 +614,7 @@ public:
         functionList->niFrameBufferFree = reinterpret_cast<decltype(ni_frame_buffer_free)*>(dlsym(lib,"ni_frame_buffer_free"));
         functionList->niDecoderFrameBufferFree = reinterpret_cast<decltype(ni_decoder_frame_buffer_free)*>(dlsym(lib,"ni_decoder_frame_buffer_free"));
         functionList->niDecoderFrameBufferPoolReturnBuf = reinterpret_cast<decltype(ni_decoder_frame_buffer_pool_return_buf)*>(dlsym(lib,"ni_decoder_frame_buffer_pool_return_buf"));
+        functionList->niDecoderSetBufferAllocator = reinterpret_cast<decltype(ni_decoder_set_buffer_allocator)*>(dlsym(lib,"ni_decoder_set_buffer_allocator"));
         functionList->niPacketBufferAlloc = reinterpret_cast<decltype(ni_packet_buffer_alloc)*>(dlsym(lib,"ni_packet_buffer_alloc"));
         functionList->niCustomPacketBufferAlloc = reinterpret_cast<decltype(ni_custom_packet_buffer_alloc)*>(dlsym(lib,"ni_custom_packet_buffer_alloc"));
         functionList->niPacketBufferFree = reinterpret_cast<decltype(ni_packet_buffer_free)*>(dlsym(lib,"ni_packet_buffer_free"));
@@ -594,10 +680,20 @@ public:
         functionList->niQueryExtraInfo = reinterpret_cast<decltype(ni_query_extra_info)*>(dlsym(lib,"ni_query_extra_info"));
         functionList->niEncoderFrameZerocopyCheck = reinterpret_cast<decltype(ni_encoder_frame_zerocopy_check)*>(dlsym(lib,"ni_encoder_frame_zerocopy_check"));
         functionList->niEncoderFrameZerocopyBufferAlloc = reinterpret_cast<decltype(ni_encoder_frame_zerocopy_buffer_alloc)*>(dlsym(lib,"ni_encoder_frame_zerocopy_buffer_alloc"));
+        functionList->niEncoderFrameBufferRegister = reinterpret_cast<decltype(ni_encoder_frame_buffer_register)*>(dlsym(lib,"ni_encoder_frame_buffer_register"));
+        functionList->niEncoderFrameBufferUnregister = reinterpret_cast<decltype(ni_encoder_frame_buffer_unregister)*>(dlsym(lib,"ni_encoder_frame_buffer_unregister"));
+        functionList->niEncoderFrameRegisteredBufferAlloc = reinterpret_cast<decltype(ni_encoder_frame_registered_buffer_alloc)*>(dlsym(lib,"ni_encoder_frame_registered_buffer_alloc"));
+        functionList->niEncoderFrameAuxBuffersBorrow = reinterpret_cast<decltype(ni_encoder_frame_aux_buffers_borrow)*>(dlsym(lib,"ni_encoder_frame_aux_buffers_borrow"));
+        functionList->niEncoderFrameAuxBuffersReturn = reinterpret_cast<decltype(ni_encoder_frame_aux_buffers_return)*>(dlsym(lib,"ni_encoder_frame_aux_buffers_return"));
         functionList->niUploaderFrameZerocopyCheck = reinterpret_cast<decltype(ni_uploader_frame_zerocopy_check)*>(dlsym(lib,"ni_uploader_frame_zerocopy_check"));
         functionList->niReconfigCrf = reinterpret_cast<decltype(ni_reconfig_crf)*>(dlsym(lib,"ni_reconfig_crf"));
         functionList->niReconfigCrf2 = reinterpret_cast<decltype(ni_reconfig_crf2)*>(dlsym(lib,"ni_reconfig_crf2"));
         functionList->niDeviceAllocAndGetFirmwareLogs = reinterpret_cast<decltype(ni_device_alloc_and_get_firmware_logs)*>(dlsym(lib,"ni_device_alloc_and_get_firmware_logs"));
+        functionList->niDeviceFwLogStreamInit = reinterpret_cast<decltype(ni_device_fw_log_stream_init)*>(dlsym(lib,"ni_device_fw_log_stream_init"));
+        functionList->niDeviceFwLogStreamRead = reinterpret_cast<decltype(ni_device_fw_log_stream_read)*>(dlsym(lib,"ni_device_fw_log_stream_read"));
+        functionList->niDeviceFwLogStreamStart = reinterpret_cast<decltype(ni_device_fw_log_stream_start)*>(dlsym(lib,"ni_device_fw_log_stream_start"));
+        functionList->niDeviceFwLogStreamStop = reinterpret_cast<decltype(ni_device_fw_log_stream_stop)*>(dlsym(lib,"ni_device_fw_log_stream_stop"));
+        functionList->niDeviceFwLogStreamClose = reinterpret_cast<decltype(ni_device_fw_log_stream_close)*>(dlsym(lib,"ni_device_fw_log_stream_close"));
         functionList->niReconfigVbvValue = reinterpret_cast<decltype(ni_reconfig_vbv_value)*>(dlsym(lib,"ni_reconfig_vbv_value"));
         functionList->niDeviceSessionUpdateFramepool = reinterpret_cast<decltype(ni_device_session_update_framepool)*>(dlsym(lib,"ni_device_session_update_framepool"));
         functionList->niGetFrameDim = reinterpret_cast<decltype(ni_get_frame_dim)*>(dlsym(lib,"ni_get_frame_dim"));
@@ -25,8 +25,12 @@
  *  \brief  Logging definitions
  ******************************************************************************/
 
+// this file implements ni_log()/ni_log2(), keep them plain functions here
+#define NI_LOG_NO_CALL_SITE_CHECK
+
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <time.h>
 #include <inttypes.h>
@@ -44,6 +48,8 @@
 static ni_log_level_t ni_log_level = NI_LOG_INFO;
 static void (*ni_log_callback)(int, const char*, va_list) =
     ni_log_default_callback;
+// per module level + 1, 0 to follow ni_log_level
+static int ni_log_module_level[NI_LOG_MODULE_MAX] = {0};
 
 #ifdef _WIN32
 static ni_pthread_mutex_t ni_log2_mutex;
@@ -64,6 +70,62 @@ static int ni_log2_print_with_mutex = 0;
 
 #define NI_LOG2_PRINT_BUFF_SIZE 512
 
+#ifndef _WIN32
+#define NI_LOG_ASYNC_SUPPORTED
+#endif
+
+#ifdef NI_LOG_ASYNC_SUPPORTED
+#include <pthread.h>
+
+// Asynchronous logging: each logging thread formats its message into a ring
+// of its own (single producer, no lock) and one writer thread drains all rings
+// in timestamp order into ni_log_callback. Producers take the list mutex only
+// when a thread logs for the first time or exits; the drain takes it to copy
+// out one record at a time and never holds it while calling ni_log_callback.
+// The writer sleeps on a condition variable while all rings are empty and is
+// signalled by the producer that finds it idle.
+#define NI_LOG_ASYNC_RING_BYTES 16384   // per thread, power of 2
+#define NI_LOG_ASYNC_TRUNC_MARK "...\n" // ends a message cut to the buffer
+
+// variable size record, followed by its NUL terminated message
+typedef struct _ni_log_record
+{
+    uint64_t timestamp;
+    uint32_t size;      // bytes taken in the ring, multiple of the header
+    int16_t level;
+    uint8_t forced;     // above ni_log_level, let through by a module level
+    uint8_t wrap;       // no message, pads the ring up to its end
+} ni_log_record_t;
+
+typedef struct _ni_log_ring
+{
+    uint32_t head;      // byte offset, written by the owning thread only
+    uint32_t tail;      // byte offset, written under ni_log_ring_list_mutex only
+    uint32_t dropped;   // records lost because the ring was full
+    int closed;         // owning thread exited, free once drained
+    struct _ni_log_ring *p_next;
+    uint64_t data[NI_LOG_ASYNC_RING_BYTES / sizeof(uint64_t)];
+} ni_log_ring_t;
+
+static int ni_log_async_on = 0;
+static int ni_log_async_stop = 0;
+static int ni_log_async_idle = 0;       // writer waits on the wake condition
+static pthread_t ni_log_async_thread;
+static pthread_mutex_t ni_log_async_ctrl_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t ni_log_async_wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ni_log_async_wake_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t ni_log_ring_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ni_log_ring_t *ni_log_ring_list = NULL;
+static pthread_key_t ni_log_ring_key;
+static pthread_once_t ni_log_ring_key_once = PTHREAD_ONCE_INIT;
+static int ni_log_ring_key_valid = 0;   // created and not deleted yet
+static __thread ni_log_ring_t *ni_log_thread_ring = NULL;
+
+static int ni_log_async_push(int level, int forced, const char *prefix,
+                             const char *fmt, va_list vl);
+static int ni_log_async_drain(void);
+#endif
+
 #ifdef _ANDROID
 #include <android/log.h>
 
@@ -131,34 +193,71 @@ int32_t ni_log_gettimeofday(struct timeval *p_tp, struct timezone *p_tzp)
  *  \note This function doesn't automatically append a newline to the end of 
  *       the log message.
  ******************************************************************************/
-void ni_log_default_callback(int level, const char* fmt, va_list vl)
+static void ni_log_default_write(int level, const char* fmt, va_list vl)
 {
-    if (level <= ni_log_level)
-    {
 #ifndef _ANDROID
 #ifdef NI_LOG_TRACE_TIMESTAMPS
-        if (level == NI_LOG_TRACE)
-        {
-            struct timeval tv;
-            ni_log_gettimeofday(&tv, NULL);
-            fprintf(stderr, "[%" PRIu64 "] ", (uint64_t) (tv.tv_sec * 1000000LL + tv.tv_usec));
-        }
+    if (level == NI_LOG_TRACE)
+    {
+        struct timeval tv;
+        ni_log_gettimeofday(&tv, NULL);
+        fprintf(stderr, "[%" PRIu64 "] ", (uint64_t) (tv.tv_sec * 1000000LL + tv.tv_usec));
+    }
 #endif
 #endif
 
 #ifdef _ANDROID
-        if (level >= NI_LOG_DEBUG)
-            ALOGD(fmt, vl);
-        else if (level == NI_LOG_INFO)
-            ALOGI(fmt, vl);
-        else
-            ALOGE(fmt, vl);
+    if (level >= NI_LOG_DEBUG)
+        ALOGD(fmt, vl);
+    else if (level == NI_LOG_INFO)
+        ALOGI(fmt, vl);
+    else
+        ALOGE(fmt, vl);
 #else
-        vfprintf(stderr, fmt, vl);
+    vfprintf(stderr, fmt, vl);
 #endif
+}
+
+void ni_log_default_callback(int level, const char* fmt, va_list vl)
+{
+    if (level <= ni_log_level)
+    {
+        ni_log_default_write(level, fmt, vl);
     }
 }
 
+/*!*****************************************************************************
+ *  \brief  Pass a message to ni_log_callback
+ *
+ *  \param[in] level   log level
+ *  \param[in] forced  1 if a module level lets the message through although
+ *                     it is above ni_log_level, the default callback would
+ *                     drop it otherwise
+ *  \param[in] fmt     printf format specifier
+ *  \param[in] vl      variadric args list
+ *
+ *  \return
+ ******************************************************************************/
+static void ni_log_output(int level, int forced, const char *fmt, va_list vl)
+{
+    if (forced && ni_log_callback == ni_log_default_callback)
+    {
+        ni_log_default_write(level, fmt, vl);
+    } else if (ni_log_callback)
+    {
+        ni_log_callback(level, fmt, vl);
+    }
+}
+
+static void ni_log_output_fmt(int level, int forced, const char *fmt, ...)
+{
+    va_list vl;
+
+    va_start(vl, fmt);
+    ni_log_output(level, forced, fmt, vl);
+    va_end(vl);
+}
+
 /*!*****************************************************************************
  *  \brief  Set ni_log() callback
  *
@@ -184,6 +283,21 @@ void ni_log(ni_log_level_t level, const char *fmt, ...)
 {
     va_list vl;
 
+#ifdef NI_LOG_ASYNC_SUPPORTED
+    if (__atomic_load_n(&ni_log_async_on, __ATOMIC_RELAXED) &&
+        level <= ni_log_level)
+    {
+        int ret;
+        va_start(vl, fmt);
+        ret = ni_log_async_push(level, 0, NULL, fmt, vl);
+        va_end(vl);
+        if (0 == ret)
+        {
+            return;
+        }
+    }
+#endif
+
     va_start(vl, fmt);
     if (ni_log_callback)
     {
@@ -192,6 +306,43 @@ void ni_log(ni_log_level_t level, const char *fmt, ...)
     va_end(vl);
 }
 
+/*!*****************************************************************************
+ *  \brief  ni_log() for a message already checked against the module level,
+ *          called by NI_LOG()
+ *
+ *  \param[in] module module of the caller
+ *  \param[in] level  log level
+ *  \param[in] format printf format specifier
+ *  \param[in] ...    additional arguments
+ *
+ *  \return
+ ******************************************************************************/
+void ni_log_module(ni_log_module_t module, ni_log_level_t level,
+                   const char *fmt, ...)
+{
+    int forced = level > ni_log_level;
+    va_list vl;
+
+    (void)module;
+#ifdef NI_LOG_ASYNC_SUPPORTED
+    if (__atomic_load_n(&ni_log_async_on, __ATOMIC_RELAXED))
+    {
+        int ret;
+        va_start(vl, fmt);
+        ret = ni_log_async_push(level, forced, NULL, fmt, vl);
+        va_end(vl);
+        if (0 == ret)
+        {
+            return;
+        }
+    }
+#endif
+
+    va_start(vl, fmt);
+    ni_log_output(level, forced, fmt, vl);
+    va_end(vl);
+}
+
 /*!*****************************************************************************
  *  \brief  Set ni_log_level
  *
@@ -214,6 +365,64 @@ ni_log_level_t ni_log_get_level(void)
     return ni_log_level;
 }
 
+/*!*****************************************************************************
+ *  \brief Set the log level of one module
+ *
+ *  \param[in] module  module to set
+ *  \param[in] level   log level, NI_LOG_INVALID to follow the global level
+ *
+ *  \return
+ ******************************************************************************/
+void ni_log_set_module_level(ni_log_module_t module, ni_log_level_t level)
+{
+    if (module >= NI_LOG_MODULE_DEFAULT && module < NI_LOG_MODULE_MAX)
+    {
+        ni_log_module_level[module] =
+            (level >= NI_LOG_NONE && level <= NI_LOG_TRACE) ? level + 1 : 0;
+    }
+}
+
+/*!*****************************************************************************
+ *  \brief Get the effective log level of a module
+ *
+ *  \param[in] module  module
+ *
+ *  \return the module override if set, the global log level otherwise
+ ******************************************************************************/
+ni_log_level_t ni_log_get_module_level(ni_log_module_t module)
+{
+    if (module >= NI_LOG_MODULE_DEFAULT && module < NI_LOG_MODULE_MAX &&
+        ni_log_module_level[module])
+    {
+        return (ni_log_level_t)(ni_log_module_level[module] - 1);
+    }
+    return ni_log_level;
+}
+
+/*!*****************************************************************************
+ *  \brief Get the level NI_LOG() checks messages of a module against
+ *
+ *  \param[in] module  module
+ *
+ *  \return the module override if set, NI_LOG_TRACE with a custom callback,
+ *          NI_LOG_NONE without callback and the global log level otherwise
+ ******************************************************************************/
+ni_log_level_t ni_log_get_call_site_level(ni_log_module_t module)
+{
+    if (module >= NI_LOG_MODULE_DEFAULT && module < NI_LOG_MODULE_MAX &&
+        ni_log_module_level[module])
+    {
+        return (ni_log_level_t)(ni_log_module_level[module] - 1);
+    }
+    if (!ni_log_callback)
+    {
+        return NI_LOG_NONE;
+    }
+    // a custom callback gets every message, as with a plain ni_log() call
+    return (ni_log_callback == ni_log_default_callback) ? ni_log_level :
+                                                           NI_LOG_TRACE;
+}
+
 /*!*****************************************************************************
  *  \brief Convert ffmpeg log level integer to appropriate ni_log_level_t
  *
@@ -334,14 +543,47 @@ void ni_log2_with_mutex(int on)
     ni_log2_print_with_mutex = on;
 }
 
-void ni_log2(const void *p_context, ni_log_level_t level, const char *fmt, ...)
+static void ni_log2_vl(const ni_session_context_t *p_session_context,
+                       ni_log_level_t level, int forced, const char *fmt,
+                       va_list vl)
 {
-    const ni_session_context_t *p_session_context = (const ni_session_context_t *)p_context;
+    char printbuf[NI_LOG2_PRINT_BUFF_SIZE];
+    int this_used_size = 0;
+    va_list vl_copy;
 
-    if(level > ni_log_level)
+#ifdef NI_LOG_ASYNC_SUPPORTED
+    if (__atomic_load_n(&ni_log_async_on, __ATOMIC_RELAXED))
     {
-        return;
+        int ret;
+
+        printbuf[0] = '\0';
+        if(p_session_context && level == NI_LOG_ERROR)
+        {
+            snprintf(printbuf, sizeof(printbuf),
+                     NI_LOG2_SESSION_ID_TIMESTAMP_FMT "" NI_LOG2_E2EID_FMT "" NI_LOG2_SPACE,
+                     p_session_context->session_id, ni_log_get_utime(), p_session_context->E2EID);
+        }
+        else if(p_session_context)
+        {
+            snprintf(printbuf, sizeof(printbuf),
+                     NI_LOG2_SESSION_ID_FMT "" NI_LOG2_E2EID_FMT "" NI_LOG2_SPACE,
+                     p_session_context->session_id, p_session_context->E2EID);
+        }
+        else if (level == NI_LOG_ERROR)
+        {
+            snprintf(printbuf, sizeof(printbuf),
+                     NI_LOG2_TIMESTAMP_FMT "" NI_LOG2_SPACE, ni_log_get_utime());
+        }
+
+        va_copy(vl_copy, vl);
+        ret = ni_log_async_push(level, forced, printbuf, fmt, vl_copy);
+        va_end(vl_copy);
+        if (0 == ret)
+        {
+            return;
+        }
     }
+#endif
 
     if(ni_log2_print_with_mutex)
     {
@@ -349,106 +591,496 @@ void ni_log2(const void *p_context, ni_log_level_t level, const char *fmt, ...)
 
         if(p_session_context && level == NI_LOG_ERROR)
         {
-            ni_log(level, NI_LOG2_SESSION_ID_TIMESTAMP_FMT "" NI_LOG2_E2EID_FMT "" NI_LOG2_SPACE, 
-                   p_session_context->session_id, ni_log_get_utime(), p_session_context->E2EID);
+            ni_log_output_fmt(level, forced, NI_LOG2_SESSION_ID_TIMESTAMP_FMT "" NI_LOG2_E2EID_FMT "" NI_LOG2_SPACE, 
+                              p_session_context->session_id, ni_log_get_utime(), p_session_context->E2EID);
         }
         else if(p_session_context)
         {
-            ni_log(level, NI_LOG2_SESSION_ID_FMT "" NI_LOG2_E2EID_FMT "" NI_LOG2_SPACE, 
-                   p_session_context->session_id, p_session_context->E2EID);
+            ni_log_output_fmt(level, forced, NI_LOG2_SESSION_ID_FMT "" NI_LOG2_E2EID_FMT "" NI_LOG2_SPACE, 
+                              p_session_context->session_id, p_session_context->E2EID);
         }
         else if (level == NI_LOG_ERROR)
         {
-            ni_log(level, NI_LOG2_TIMESTAMP_FMT "" NI_LOG2_SPACE, 
-                   ni_log_get_utime());
+            ni_log_output_fmt(level, forced, NI_LOG2_TIMESTAMP_FMT "" NI_LOG2_SPACE, 
+                              ni_log_get_utime());
         }
 
-        va_list vl;
-        va_start(vl, fmt);
-        if (ni_log_callback)
-        {
-            ni_log_callback(level, fmt, vl);
-        }
-        va_end(vl);
+        ni_log_output(level, forced, fmt, vl);
 
         ni_pthread_mutex_unlock(&ni_log2_mutex);
+        return;
     }
-    else
+
+    if(!p_session_context && level != NI_LOG_ERROR)
+    {
+        ni_log_output(level, forced, fmt, vl);
+        return;
+    }
+
+    if(p_session_context && level == NI_LOG_ERROR)
+    {
+        this_used_size = snprintf(printbuf, NI_LOG2_PRINT_BUFF_SIZE, 
+                                  NI_LOG2_SESSION_ID_TIMESTAMP_FMT "" NI_LOG2_E2EID_FMT "" NI_LOG2_SPACE "" NI_LOG2_FMT_FMT,
+                                  p_session_context->session_id, ni_log_get_utime(), p_session_context->E2EID, fmt);
+    }
+    else if(p_session_context)
+    {
+        this_used_size = snprintf(printbuf, NI_LOG2_PRINT_BUFF_SIZE, 
+                                  NI_LOG2_SESSION_ID_FMT "" NI_LOG2_E2EID_FMT "" NI_LOG2_SPACE "" NI_LOG2_FMT_FMT,
+                                  p_session_context->session_id, p_session_context->E2EID, fmt);
+    }
+    else if (level == NI_LOG_ERROR)
+    {
+        this_used_size = snprintf(printbuf, NI_LOG2_PRINT_BUFF_SIZE, 
+                                  NI_LOG2_TIMESTAMP_FMT "" NI_LOG2_SPACE "" NI_LOG2_FMT_FMT,
+                                  ni_log_get_utime(), fmt);
+    }
+
+    if(this_used_size < 0)
+    {
+        ni_log(NI_LOG_ERROR,"ni_log2: an error occurd in snprintf\n");
+        ni_log_output(level, forced, fmt, vl);
+        return;
+    }
+
+    if(this_used_size >= NI_LOG2_PRINT_BUFF_SIZE)
+    {
+        ni_log(NI_LOG_ERROR,"ni_log2: too many characters for output\n");
+        ni_log_output(level, forced, fmt, vl);
+        return;
+    }
+
+    ni_log_output(level, forced, printbuf, vl);
+}
+
+void ni_log2(const void *p_context, ni_log_level_t level, const char *fmt, ...)
+{
+    va_list vl;
+
+    if(level > ni_log_level)
     {
-        if(!p_session_context && level != NI_LOG_ERROR)
+        return;
+    }
+
+    va_start(vl, fmt);
+    ni_log2_vl((const ni_session_context_t *)p_context, level, 0, fmt, vl);
+    va_end(vl);
+}
+
+/*!*****************************************************************************
+ *  \brief  ni_log2() for a message already checked against the module level,
+ *          called by NI_LOG2()
+ *
+ *  \param[in] module    module of the caller
+ *  \param[in] p_context a pointer to ni_session_context_t or NULL
+ *  \param[in] level     log level
+ *  \param[in] format    printf format specifier
+ *  \param[in] ...       additional arguments
+ *
+ *  \return
+ ******************************************************************************/
+void ni_log2_module(ni_log_module_t module, const void *p_context,
+                    ni_log_level_t level, const char *fmt, ...)
+{
+    int forced = level > ni_log_level;
+    va_list vl;
+
+    (void)module;
+    // like ni_log2(), a custom callback gets nothing above ni_log_level
+    if (forced && ni_log_callback != ni_log_default_callback)
+    {
+        return;
+    }
+    va_start(vl, fmt);
+    ni_log2_vl((const ni_session_context_t *)p_context, level, forced, fmt,
+               vl);
+    va_end(vl);
+}
+
+#ifdef NI_LOG_ASYNC_SUPPORTED
+/*!*****************************************************************************
+ *  \brief  Key destructor, run when a thread that logged exits: free its ring
+ *          now if it is empty, otherwise leave it to the next drain
+ ******************************************************************************/
+static void ni_log_ring_release(void *p_arg)
+{
+    ni_log_ring_t *p_ring = (ni_log_ring_t *)p_arg;
+    ni_log_ring_t **pp_ring;
+
+    pthread_mutex_lock(&ni_log_ring_list_mutex);
+    if (p_ring->head != p_ring->tail)
+    {
+        __atomic_store_n(&p_ring->closed, 1, __ATOMIC_RELEASE);
+        p_ring = NULL;
+    } else
+    {
+        for (pp_ring = &ni_log_ring_list; *pp_ring; pp_ring = &(*pp_ring)->p_next)
         {
-            va_list vl;
-            va_start(vl, fmt);
-            if (ni_log_callback)
+            if (*pp_ring == p_ring)
             {
-                ni_log_callback(level, fmt, vl);
+                *pp_ring = p_ring->p_next;
+                break;
             }
-            va_end(vl);
-
-            return;
         }
+    }
+    pthread_mutex_unlock(&ni_log_ring_list_mutex);
+    free(p_ring);
+    // a later key destructor that logs gets a new ring
+    ni_log_thread_ring = NULL;
+}
 
-        char printbuf[NI_LOG2_PRINT_BUFF_SIZE];
-        // int used_size = 0;
-        // size_t free_size = NI_LOG2_PRINT_BUFF_SIZE;
-        int this_used_size = 0;
+static void ni_log_ring_key_init(void)
+{
+    if (0 == pthread_key_create(&ni_log_ring_key, ni_log_ring_release))
+    {
+        __atomic_store_n(&ni_log_ring_key_valid, 1, __ATOMIC_RELEASE);
+    }
+}
 
-        if(p_session_context && level == NI_LOG_ERROR)
+/*!*****************************************************************************
+ *  \brief  Run when the library is unloaded or the process exits. Stops the
+ *          writer thread, writing out what is queued, and deletes the ring
+ *          key so that threads exiting after a dlclose() do not call its
+ *          destructor in unmapped code.
+ ******************************************************************************/
+__attribute__((destructor)) static void ni_log_async_unload(void)
+{
+    ni_log_set_async(0);
+    if (__atomic_exchange_n(&ni_log_ring_key_valid, 0, __ATOMIC_ACQ_REL))
+    {
+        pthread_key_delete(ni_log_ring_key);
+    }
+}
+
+static ni_log_ring_t *ni_log_get_thread_ring(void)
+{
+    ni_log_ring_t *p_ring = ni_log_thread_ring;
+
+    if (p_ring)
+    {
+        return p_ring;
+    }
+
+    pthread_once(&ni_log_ring_key_once, ni_log_ring_key_init);
+    if (!__atomic_load_n(&ni_log_ring_key_valid, __ATOMIC_ACQUIRE))
+    {
+        // no key, or deleted at unload: log synchronously
+        return NULL;
+    }
+    p_ring = (ni_log_ring_t *)calloc(1, sizeof(ni_log_ring_t));
+    if (!p_ring)
+    {
+        return NULL;
+    }
+    pthread_mutex_lock(&ni_log_ring_list_mutex);
+    p_ring->p_next = ni_log_ring_list;
+    ni_log_ring_list = p_ring;
+    pthread_mutex_unlock(&ni_log_ring_list_mutex);
+
+    // the key destructor hands the ring to the writer when the thread exits
+    pthread_setspecific(ni_log_ring_key, p_ring);
+    ni_log_thread_ring = p_ring;
+    return p_ring;
+}
+
+static ni_log_record_t *ni_log_ring_record(ni_log_ring_t *p_ring,
+                                           uint32_t offset)
+{
+    return (ni_log_record_t *)((uint8_t *)p_ring->data +
+                               (offset & (NI_LOG_ASYNC_RING_BYTES - 1)));
+}
+
+static void ni_log_async_wake(void)
+{
+    pthread_mutex_lock(&ni_log_async_wake_mutex);
+    pthread_cond_signal(&ni_log_async_wake_cond);
+    pthread_mutex_unlock(&ni_log_async_wake_mutex);
+}
+
+/*!*****************************************************************************
+ *  \brief  Format a log message into the calling thread's ring. A message
+ *          longer than NI_LOG2_PRINT_BUFF_SIZE - 1 bytes, prefix included, is
+ *          cut and ends with NI_LOG_ASYNC_TRUNC_MARK.
+ *
+ *  \return 0 if the message was queued or dropped, -1 if the caller should
+ *          log it synchronously (no ring, or ring full and level <= INFO)
+ ******************************************************************************/
+static int ni_log_async_push(int level, int forced, const char *prefix,
+                             const char *fmt, va_list vl)
+{
+    ni_log_ring_t *p_ring = ni_log_get_thread_ring();
+    ni_log_record_t *p_record;
+    char msg[NI_LOG2_PRINT_BUFF_SIZE];
+    uint32_t head, size, pad;
+    size_t used = 0;
+    int ret;
+
+    if (!p_ring)
+    {
+        return -1;
+    }
+
+    if (prefix && prefix[0])
+    {
+        used = strlen(prefix);
+        if (used >= sizeof(msg))
         {
-            this_used_size = snprintf(printbuf, NI_LOG2_PRINT_BUFF_SIZE, 
-                                      NI_LOG2_SESSION_ID_TIMESTAMP_FMT "" NI_LOG2_E2EID_FMT "" NI_LOG2_SPACE "" NI_LOG2_FMT_FMT,
-                                      p_session_context->session_id, ni_log_get_utime(), p_session_context->E2EID, fmt);
+            used = sizeof(msg) - 1;
         }
-        else if(p_session_context)
+        memcpy(msg, prefix, used);
+    }
+    ret = vsnprintf(msg + used, sizeof(msg) - used, fmt, vl);
+    if (ret < 0)
+    {
+        msg[used] = '\0';
+    } else if ((size_t)ret >= sizeof(msg) - used)
+    {
+        memcpy(msg + sizeof(msg) - sizeof(NI_LOG_ASYNC_TRUNC_MARK),
+               NI_LOG_ASYNC_TRUNC_MARK, sizeof(NI_LOG_ASYNC_TRUNC_MARK));
+        used = sizeof(msg) - 1;
+    } else
+    {
+        used += (size_t)ret;
+    }
+
+    // records never wrap around, a record that does not fit before the end
+    // of the ring is preceded by one padding up to it
+    size = (uint32_t)((sizeof(ni_log_record_t) + used + 1 +
+                       sizeof(ni_log_record_t) - 1) &
+                      ~(sizeof(ni_log_record_t) - 1));
+    head = p_ring->head;
+    pad = NI_LOG_ASYNC_RING_BYTES - (head & (NI_LOG_ASYNC_RING_BYTES - 1));
+    if (pad >= size)
+    {
+        pad = 0;
+    }
+    if (head - __atomic_load_n(&p_ring->tail, __ATOMIC_ACQUIRE) + pad + size >
+        NI_LOG_ASYNC_RING_BYTES)
+    {
+        // never block the caller on a slow writer for debug output, but do
+        // not lose anything more important
+        if (level <= NI_LOG_INFO)
         {
-            this_used_size = snprintf(printbuf, NI_LOG2_PRINT_BUFF_SIZE, 
-                                      NI_LOG2_SESSION_ID_FMT "" NI_LOG2_E2EID_FMT "" NI_LOG2_SPACE "" NI_LOG2_FMT_FMT,
-                                      p_session_context->session_id, p_session_context->E2EID, fmt);
+            return -1;
         }
-        else if (level == NI_LOG_ERROR)
+        __atomic_add_fetch(&p_ring->dropped, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    if (pad)
+    {
+        p_record = ni_log_ring_record(p_ring, head);
+        p_record->size = pad;
+        p_record->wrap = 1;
+        head += pad;
+    }
+    p_record = ni_log_ring_record(p_ring, head);
+    p_record->timestamp = ni_log_get_utime();
+    p_record->size = size;
+    p_record->level = (int16_t)level;
+    p_record->forced = (uint8_t)forced;
+    p_record->wrap = 0;
+    memcpy(p_record + 1, msg, used + 1);
+
+    __atomic_store_n(&p_ring->head, head + size, __ATOMIC_RELEASE);
+
+    // ni_log_set_async(0) may have drained the rings between the check of
+    // ni_log_async_on by the caller and the store above: write the record out
+    // here rather than leave it queued. The same fence orders the store
+    // against the check of ni_log_async_idle, see ni_log_async_thread_func().
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&ni_log_async_on, __ATOMIC_RELAXED))
+    {
+        ni_log_async_drain();
+    } else if (__atomic_load_n(&ni_log_async_idle, __ATOMIC_RELAXED))
+    {
+        ni_log_async_wake();
+    }
+    return 0;
+}
+
+/*!*****************************************************************************
+ *  \brief  Get the oldest record of a ring, skipping padding. Called with
+ *          ni_log_ring_list_mutex held.
+ *
+ *  \return the record, NULL if the ring is empty
+ ******************************************************************************/
+static ni_log_record_t *ni_log_ring_peek(ni_log_ring_t *p_ring)
+{
+    ni_log_record_t *p_record;
+
+    while (__atomic_load_n(&p_ring->head, __ATOMIC_ACQUIRE) != p_ring->tail)
+    {
+        p_record = ni_log_ring_record(p_ring, p_ring->tail);
+        if (!p_record->wrap)
         {
-            this_used_size = snprintf(printbuf, NI_LOG2_PRINT_BUFF_SIZE, 
-                                      NI_LOG2_TIMESTAMP_FMT "" NI_LOG2_SPACE "" NI_LOG2_FMT_FMT,
-                                      ni_log_get_utime(), fmt);
+            return p_record;
         }
+        __atomic_store_n(&p_ring->tail, p_ring->tail + p_record->size,
+                         __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
 
-        if(this_used_size < 0)
+/*!*****************************************************************************
+ *  \brief  Write out all queued records, oldest first across threads, and
+ *          free the rings of exited threads. Each record is copied out under
+ *          the list mutex and written after releasing it, so a callback may
+ *          log again from any thread.
+ *
+ *  \return number of records written
+ ******************************************************************************/
+static int ni_log_async_drain(void)
+{
+    ni_log_ring_t **pp_ring;
+    ni_log_ring_t *p_ring;
+    ni_log_ring_t *p_oldest;
+    ni_log_record_t *p_record;
+    ni_log_record_t *p_oldest_record = NULL;
+    ni_log_record_t record;
+    char msg[NI_LOG2_PRINT_BUFF_SIZE];
+    uint32_t dropped;
+    int written = 0;
+
+    while (1)
+    {
+        p_oldest = NULL;
+        dropped = 0;
+        pthread_mutex_lock(&ni_log_ring_list_mutex);
+        pp_ring = &ni_log_ring_list;
+        while ((p_ring = *pp_ring) != NULL)
         {
-            ni_log(NI_LOG_ERROR,"ni_log2: an error occurd in snprintf\n");
+            dropped += __atomic_exchange_n(&p_ring->dropped, 0, __ATOMIC_RELAXED);
 
-            va_list vl;
-            va_start(vl, fmt);
-            if (ni_log_callback)
+            p_record = ni_log_ring_peek(p_ring);
+            if (p_record)
+            {
+                if (!p_oldest || p_record->timestamp < p_oldest_record->timestamp)
+                {
+                    p_oldest = p_ring;
+                    p_oldest_record = p_record;
+                }
+            } else if (__atomic_load_n(&p_ring->closed, __ATOMIC_ACQUIRE) &&
+                       __atomic_load_n(&p_ring->head, __ATOMIC_ACQUIRE) == p_ring->tail)
             {
-                ni_log_callback(level, fmt, vl);
+                *pp_ring = p_ring->p_next;
+                free(p_ring);
+                continue;
             }
-            va_end(vl);
-
-            return;
+            pp_ring = &p_ring->p_next;
         }
+        if (p_oldest)
+        {
+            record = *p_oldest_record;
+            memcpy(msg, p_oldest_record + 1,
+                   record.size - sizeof(ni_log_record_t));
+            __atomic_store_n(&p_oldest->tail, p_oldest->tail + record.size,
+                             __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&ni_log_ring_list_mutex);
 
-        if(this_used_size >= NI_LOG2_PRINT_BUFF_SIZE)
+        if (dropped)
+        {
+            ni_log_output_fmt(NI_LOG_ERROR, 0,
+                              "ni_log: %u messages dropped\n", dropped);
+        }
+        if (!p_oldest)
         {
-            ni_log(NI_LOG_ERROR,"ni_log2: too many characters for output\n");
+            break;
+        }
+        ni_log_output_fmt(record.level, record.forced, "%s", msg);
+        written++;
+    }
+    return written;
+}
 
-            va_list vl;
-            va_start(vl, fmt);
-            if (ni_log_callback)
-            {
-                ni_log_callback(level, fmt, vl);
-            }
-            va_end(vl);
+// whether a ring has records or drops to report
+static int ni_log_async_pending(void)
+{
+    ni_log_ring_t *p_ring;
+    int pending = 0;
 
-            return;
+    pthread_mutex_lock(&ni_log_ring_list_mutex);
+    for (p_ring = ni_log_ring_list; p_ring && !pending; p_ring = p_ring->p_next)
+    {
+        pending = __atomic_load_n(&p_ring->head, __ATOMIC_ACQUIRE) != p_ring->tail ||
+            __atomic_load_n(&p_ring->dropped, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&ni_log_ring_list_mutex);
+    return pending;
+}
+
+static void *ni_log_async_thread_func(void *arg)
+{
+    (void)arg;
+
+    while (!__atomic_load_n(&ni_log_async_stop, __ATOMIC_ACQUIRE))
+    {
+        if (ni_log_async_drain())
+        {
+            continue;
         }
+        pthread_mutex_lock(&ni_log_async_wake_mutex);
+        // announce the wait before looking at the rings again: a producer
+        // either queued before and is seen below, or sees the flag and
+        // signals once this thread waits
+        __atomic_store_n(&ni_log_async_idle, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&ni_log_async_stop, __ATOMIC_ACQUIRE) &&
+            !ni_log_async_pending())
+        {
+            pthread_cond_wait(&ni_log_async_wake_cond,
+                              &ni_log_async_wake_mutex);
+        }
+        __atomic_store_n(&ni_log_async_idle, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&ni_log_async_wake_mutex);
+    }
+    ni_log_async_drain();
+    return NULL;
+}
+#endif
 
-        va_list vl;
-        va_start(vl, fmt);
-        if (ni_log_callback)
+/*!*****************************************************************************
+ *  \brief  Turn asynchronous logging on or off
+ *
+ *  \param[in] on  1 to queue ni_log()/ni_log2() messages and have them written
+ *                 by a background thread, 0 to go back to logging on the
+ *                 caller's thread after writing out what is queued
+ *
+ *  \return 0 on success, -1 on failure or if not supported (Windows)
+ ******************************************************************************/
+int ni_log_set_async(int on)
+{
+#ifdef NI_LOG_ASYNC_SUPPORTED
+    int ret = 0;
+
+    pthread_mutex_lock(&ni_log_async_ctrl_mutex);
+    if (on && !ni_log_async_on)
+    {
+        __atomic_store_n(&ni_log_async_stop, 0, __ATOMIC_RELEASE);
+        if (pthread_create(&ni_log_async_thread, NULL, ni_log_async_thread_func,
+                           NULL))
         {
-            ni_log_callback(level, printbuf, vl);
+            ret = -1;
+        } else
+        {
+            __atomic_store_n(&ni_log_async_on, 1, __ATOMIC_RELEASE);
         }
-        va_end(vl);  
-        
+    } else if (!on && ni_log_async_on)
+    {
+        // pairs with the fence in ni_log_async_push(): a thread that still
+        // saw async on either has its record drained below or drains it
+        __atomic_store_n(&ni_log_async_on, 0, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&ni_log_async_stop, 1, __ATOMIC_RELEASE);
+        ni_log_async_wake();
+        pthread_join(ni_log_async_thread, NULL);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        ni_log_async_drain();
     }
+    pthread_mutex_unlock(&ni_log_async_ctrl_mutex);
+    return ret;
+#else
+    (void)on;
+    return -1;
+#endif
 }
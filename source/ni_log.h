@@ -64,6 +64,27 @@ typedef enum
                          // transactions, read/write polling retries)
 } ni_log_level_t;
 
+// Modules whose log level can be set apart from the global one, see
+// ni_log_set_module_level()
+typedef enum
+{
+    NI_LOG_MODULE_DEFAULT = 0,     // applications and anything not below
+    NI_LOG_MODULE_DEVICE_API,      // ni_device_api.c
+    NI_LOG_MODULE_DEVICE_API_PRIV, // ni_device_api_priv.c
+    NI_LOG_MODULE_NVME,            // ni_nvme.c
+    NI_LOG_MODULE_RSRC,            // ni_rsrc_api.cpp, ni_rsrc_priv.cpp
+    NI_LOG_MODULE_UTIL,            // ni_util.c, ni_lat_meas.c
+    NI_LOG_MODULE_AV_CODEC,        // ni_av_codec.c, ni_bitstream.c
+    NI_LOG_MODULE_MAX
+} ni_log_module_t;
+
+// Most verbose level compiled in: calls through NI_LOG()/NI_LOG2() above it
+// are removed by the compiler. Set by configure --log-level-floor for the
+// library build, numeric so it can be used in #if.
+#ifndef NI_LOG_LEVEL_FLOOR
+#define NI_LOG_LEVEL_FLOOR 5 // NI_LOG_TRACE
+#endif
+
 /*!*************************************/
 // libxcoder logging utility
 /*!*****************************************************************************
@@ -164,6 +185,130 @@ LIB_API_LOG void ni_log2(const void *p_context, ni_log_level_t level, const char
  ******************************************************************************/
 void ni_log2_with_mutex(int on);
 
+/*!*****************************************************************************
+ *  \brief Turn asynchronous logging on or off. When on, ni_log() and ni_log2()
+ *         format the message into a per-thread ring without taking any lock
+ *         and a background thread passes it to the log callback, so the
+ *         callback runs on that thread. Messages above the current log level
+ *         are still passed to the callback synchronously by ni_log(). If a
+ *         ring is full, DEBUG and TRACE messages are dropped (the drop count
+ *         is logged) and other messages are logged synchronously.
+ *         Each thread that logs gets a 16KB ring, freed when it exits. A
+ *         queued message is limited to 511 bytes including the ni_log2()
+ *         prefix; longer ones are cut and end with "...".
+ *         The background thread sleeps while no message is queued.
+ *         Turning it off writes out the queued messages first.
+ *
+ *  \param[in] on 1 to turn on, 0 to turn off
+ *
+ *  \return 0 on success, -1 on failure or if not supported (Windows)
+ ******************************************************************************/
+LIB_API_LOG int ni_log_set_async(int on);
+
+/*!*****************************************************************************
+ *  \brief Set the log level of one module, overriding ni_log_set_level() for
+ *         the NI_LOG()/NI_LOG2() calls of that module. The override may be
+ *         more verbose than the global level; messages it lets through are
+ *         written by the default callback. A custom callback gets the NI_LOG()
+ *         ones and may still drop them by its own level; NI_LOG2() ones above
+ *         the global level do not reach it, as with ni_log2().
+ *
+ *  \param[in] module  module to set
+ *  \param[in] level   log level, NI_LOG_INVALID to follow the global level
+ *
+ *  \return
+ ******************************************************************************/
+LIB_API_LOG void ni_log_set_module_level(ni_log_module_t module,
+                                         ni_log_level_t level);
+
+/*!*****************************************************************************
+ *  \brief Get the effective log level of a module
+ *
+ *  \param[in] module  module
+ *
+ *  \return the module override if set, the global log level otherwise
+ ******************************************************************************/
+LIB_API_LOG ni_log_level_t ni_log_get_module_level(ni_log_module_t module);
+
+/*!*****************************************************************************
+ *  \brief Get the level NI_LOG() checks messages of a module against at the
+ *         call site. With a callback set by ni_log_set_callback() that is the
+ *         module override if there is one: other messages all reach the
+ *         callback, which filters them by its own level as ni_log() always
+ *         did. With the default callback it is ni_log_get_module_level().
+ *         NI_LOG2() checks against ni_log_get_module_level() instead, as
+ *         ni_log2() never passed messages above the log level on.
+ *
+ *  \param[in] module  module
+ *
+ *  \return log level
+ ******************************************************************************/
+LIB_API_LOG ni_log_level_t ni_log_get_call_site_level(ni_log_module_t module);
+
+/*!*****************************************************************************
+ *  \brief  ni_log() for a message already checked against the module level,
+ *          called by NI_LOG()
+ *
+ *  \param[in] module module of the caller
+ *  \param[in] level  log level
+ *  \param[in] format printf format specifier
+ *  \param[in] ...    additional arguments
+ *
+ *  \return
+ ******************************************************************************/
+LIB_API_LOG void ni_log_module(ni_log_module_t module, ni_log_level_t level,
+                               const char *fmt, ...);
+
+/*!*****************************************************************************
+ *  \brief  ni_log2() for a message already checked against the module level,
+ *          called by NI_LOG2()
+ *
+ *  \param[in] module    module of the caller
+ *  \param[in] p_context a pointer to ni_session_context_t or NULL
+ *  \param[in] level     log level
+ *  \param[in] format    printf format specifier
+ *  \param[in] ...       additional arguments
+ *
+ *  \return
+ ******************************************************************************/
+LIB_API_LOG void ni_log2_module(ni_log_module_t module, const void *p_context,
+                                ni_log_level_t level, const char *fmt, ...);
+
+// Level checks done at the call site, before any argument is evaluated.
+// The module is NI_LOG_MODULE as defined by the including file before it
+// includes this header, NI_LOG_MODULE_DEFAULT otherwise.
+#ifndef NI_LOG_MODULE
+#define NI_LOG_MODULE NI_LOG_MODULE_DEFAULT
+#endif
+
+#define NI_LOG_ENABLED(level)                                                  \
+    ((int)(level) <= NI_LOG_LEVEL_FLOOR &&                                     \
+     (level) <= ni_log_get_call_site_level(NI_LOG_MODULE))
+
+#define NI_LOG(level, ...)                                                     \
+    do                                                                         \
+    {                                                                          \
+        if (NI_LOG_ENABLED(level))                                             \
+            ni_log_module(NI_LOG_MODULE, (level), __VA_ARGS__);                \
+    } while (0)
+
+#define NI_LOG2_ENABLED(level)                                                 \
+    ((int)(level) <= NI_LOG_LEVEL_FLOOR &&                                     \
+     (level) <= ni_log_get_module_level(NI_LOG_MODULE))
+
+#define NI_LOG2(p_context, level, ...)                                         \
+    do                                                                         \
+    {                                                                          \
+        if (NI_LOG2_ENABLED(level))                                            \
+            ni_log2_module(NI_LOG_MODULE, (p_context), (level), __VA_ARGS__);  \
+    } while (0)
+
+// Inside the library every ni_log()/ni_log2() call gets the call site check
+#if defined(LIBXCODER_OBJS_BUILD) && !defined(NI_LOG_NO_CALL_SITE_CHECK)
+#define ni_log(level, ...) NI_LOG(level, __VA_ARGS__)
+#define ni_log2(p_context, level, ...) NI_LOG2(p_context, level, __VA_ARGS__)
+#endif
+
 #ifdef _ANDROID
 /*!******************************************************************************
  *  \brief  Set ni_log_tag
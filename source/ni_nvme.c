@@ -26,6 +26,8 @@
  *          devices over NVMe
  ******************************************************************************/
 
+#define NI_LOG_MODULE NI_LOG_MODULE_NVME
+
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
@@ -42,7 +44,14 @@
 #endif
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <unistd.h>
+#define NI_NVME_TRACE_SUPPORTED
 #endif
 
 #include "ni_nvme.h"
@@ -50,6 +59,20 @@
 
 #define ROUND_TO_ULONG(x) ni_round_up(x,sizeof(uint32_t))
 
+#ifdef NI_NVME_TRACE_SUPPORTED
+#define NI_NVME_TRACE_OPEN_ATTEMPTS 8   // the ring file may be replaced meanwhile
+
+static ni_nvme_trace_header_t *g_nvme_trace_hdr = NULL;
+static void *g_nvme_trace_map = NULL;
+static size_t g_nvme_trace_map_size = 0;
+static pthread_once_t g_nvme_trace_env_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t g_nvme_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void ni_nvme_decode_lba(uint32_t lba, ni_nvme_trace_record_t *p_record);
+static void ni_nvme_perf_count(int write, uint32_t lba, uint32_t data_len,
+                               int32_t rc);
+
 /*!******************************************************************************
  *  \brief  Check f/w error return code, and if it's a fatal one, terminate
  *          application's decoding/encoding processing by sending
@@ -350,6 +373,7 @@ int32_t ni_nvme_send_admin_cmd(ni_nvme_admin_opcode_t opcode,
     *p_result = ni_htonl(nvme_cmd.result);
 #endif
 
+    ni_perf_count(NI_PERF_CTR_NVME_ADMIN, 1);
     ni_log(NI_LOG_DEBUG, "%s: handle=%" PRIx64 ", result=%08x, rc=%d\n",
            __func__, (int64_t)handle, (uint32_t)(*p_result), rc);
 
@@ -395,6 +419,7 @@ int32_t ni_nvme_send_io_cmd(ni_nvme_opcode_t opcode, ni_device_handle_t handle,
     *p_result = ni_htonl(nvme_cmd.result);
 #endif
 
+    ni_perf_count(NI_PERF_CTR_NVME_IO, 1);
     ni_log(NI_LOG_DEBUG, "%s: handle=%" PRIx64 ", result=%08x, rc=%d\n",
            __func__, (int64_t)handle, (uint32_t)(*p_result), rc);
 
@@ -437,6 +462,7 @@ int32_t ni_nvme_send_io_cmd_thru_admin_queue(ni_nvme_admin_opcode_t opcode,
     //*!pResult = *p_addr;
     *p_result = ni_htonl(nvme_cmd.result);
 
+    ni_perf_count(NI_PERF_CTR_NVME_ADMIN, 1);
     ni_log(NI_LOG_DEBUG, "%s: handle=%d, result=%08x, rc=%d\n", __func__,
            handle, *p_result, rc);
 
@@ -455,21 +481,18 @@ int32_t ni_nvme_send_io_cmd_thru_admin_queue(ni_nvme_admin_opcode_t opcode,
  *******************************************************************************/
 void ni_parse_lba(uint64_t lba)
 {
-    uint64_t lba_high = (lba >> NI_INSTANCE_TYPE_OFFSET);
-    uint64_t lba_low = (lba & 0x3FFFF);
-    uint8_t device_type = (lba_high & NI_DEVICE_TYPE_ENCODER);
-    uint16_t session_id = (uint16_t)(
-        lba_high >> (NI_SESSION_ID_OFFSET - NI_INSTANCE_TYPE_OFFSET));
-    if (device_type == NI_DEVICE_TYPE_ENCODER)
+    ni_nvme_trace_record_t decoded;
+    ni_nvme_decode_lba((uint32_t)lba, &decoded);
+    if ((decoded.device_type & NI_DEVICE_TYPE_ENCODER) == NI_DEVICE_TYPE_ENCODER)
     {
         ni_log(NI_LOG_DEBUG,
                "encoder lba:0x%" PRIx64 "(4K-aligned), 0x%" PRIx64
                "(512B-aligned), session ID:%u\n",
-               lba, ((uint64_t)lba << 3), session_id);
-        if (lba_low >= WR_OFFSET_IN_4K)
+               lba, ((uint64_t)lba << 3), decoded.session_id);
+        if (decoded.lba_class == NI_NVME_TRACE_LBA_WRITE)
         {
             ni_log(NI_LOG_ERROR, "encoder send frame failed\n");
-        } else if (lba_low >= RD_OFFSET_IN_4K)
+        } else if (decoded.lba_class == NI_NVME_TRACE_LBA_READ)
         {
             ni_log(NI_LOG_ERROR, "encoder receive packet failed\n");
         } else
@@ -477,11 +500,7 @@ void ni_parse_lba(uint64_t lba)
             ni_log(NI_LOG_ERROR,
                    "encoder ctrl command failed: op-0x%x, "
                    "subtype-0x%x, option-0x%x\n",
-                   (uint32_t)(
-                       ((lba_low - START_OFFSET_IN_4K) >> NI_OP_BIT_OFFSET) +
-                       0xD0),
-                   (uint32_t)((lba_low >> NI_SUB_BIT_OFFSET) & 0xF),
-                   (uint32_t)(lba_low & 0xF));
+                   decoded.lba_op, decoded.lba_subtype, decoded.lba_option);
         }
     }
     else
@@ -489,11 +508,11 @@ void ni_parse_lba(uint64_t lba)
         ni_log(NI_LOG_DEBUG,
                "decoder lba:0x%" PRIx64 "(4K-aligned), 0x%" PRIx64
                "(512B-aligned), session ID:%u\n",
-               lba, ((uint64_t)lba << 3), session_id);
-        if (lba_low >= WR_OFFSET_IN_4K)
+               lba, ((uint64_t)lba << 3), decoded.session_id);
+        if (decoded.lba_class == NI_NVME_TRACE_LBA_WRITE)
         {
             ni_log(NI_LOG_ERROR, "decoder send packet failed\n");
-        } else if (lba_low >= RD_OFFSET_IN_4K)
+        } else if (decoded.lba_class == NI_NVME_TRACE_LBA_READ)
         {
             ni_log(NI_LOG_ERROR, "decoder receive frame failed\n");
         } else
@@ -501,15 +520,323 @@ void ni_parse_lba(uint64_t lba)
             ni_log(NI_LOG_ERROR,
                    "decoder ctrl command failed: op-0x%x, "
                    "subtype-0x%x, option-0x%x\n",
-                   (uint32_t)(
-                       ((lba_low - START_OFFSET_IN_4K) >> NI_OP_BIT_OFFSET) +
-                       0xD0),
-                   (uint32_t)((lba_low >> NI_SUB_BIT_OFFSET) & 0xF),
-                   (uint32_t)(lba_low & 0xF));
+                   decoded.lba_op, decoded.lba_subtype, decoded.lba_option);
         }
     }
 }
 
+/*!******************************************************************************
+ *  \brief  Decode the session id, instance type and command of a 4K aligned
+ *          instance lba the same way ni_parse_lba() does
+ *
+ *  \param[in]  lba        4K aligned lba
+ *  \param[out] p_record   session_id, device_type, lba_class, lba_op,
+ *                         lba_subtype and lba_option are filled in
+ *
+ *  \return
+ *******************************************************************************/
+static void ni_nvme_decode_lba(uint32_t lba, ni_nvme_trace_record_t *p_record)
+{
+    uint32_t lba_high = (lba >> NI_INSTANCE_TYPE_OFFSET);
+    uint32_t lba_low = (lba & 0x3FFFF);
+
+    p_record->session_id = (uint16_t)(
+        lba_high >> (NI_SESSION_ID_OFFSET - NI_INSTANCE_TYPE_OFFSET));
+    p_record->device_type = (uint8_t)(lba_high & 0x7);
+    p_record->lba_op = 0;
+    p_record->lba_subtype = 0;
+    p_record->lba_option = 0;
+    if (lba_low >= WR_OFFSET_IN_4K)
+    {
+        p_record->lba_class = NI_NVME_TRACE_LBA_WRITE;
+    } else if (lba_low >= RD_OFFSET_IN_4K)
+    {
+        p_record->lba_class = NI_NVME_TRACE_LBA_READ;
+    } else
+    {
+        p_record->lba_class = NI_NVME_TRACE_LBA_CTRL;
+        p_record->lba_op = (uint8_t)(
+            ((lba_low - START_OFFSET_IN_4K) >> NI_OP_BIT_OFFSET) + 0xD0);
+        p_record->lba_subtype = (uint8_t)((lba_low >> NI_SUB_BIT_OFFSET) & 0xF);
+        p_record->lba_option = (uint8_t)(lba_low & 0xF);
+    }
+}
+
+/*!******************************************************************************
+ *  \brief  Count a completed read/write command in the performance counters
+ *
+ *  \param[in] write     1 for a write command, 0 for a read command
+ *  \param[in] lba       4K aligned lba
+ *  \param[in] data_len  transfer size
+ *  \param[in] rc        ni_retcode_t of the command
+ *
+ *  \return
+ *******************************************************************************/
+static void ni_nvme_perf_count(int write, uint32_t lba, uint32_t data_len,
+                               int32_t rc)
+{
+    ni_nvme_trace_record_t decoded;
+    int data;
+
+    ni_nvme_decode_lba(lba, &decoded);
+    data = (decoded.lba_class != NI_NVME_TRACE_LBA_CTRL);
+    if (write)
+    {
+        ni_perf_count(data ? NI_PERF_CTR_NVME_WRITE_DATA :
+                             NI_PERF_CTR_NVME_WRITE_CTRL, 1);
+    } else
+    {
+        ni_perf_count(data ? NI_PERF_CTR_NVME_READ_DATA :
+                             NI_PERF_CTR_NVME_READ_CTRL, 1);
+    }
+    if (rc != NI_RETCODE_SUCCESS)
+    {
+        ni_perf_count(NI_PERF_CTR_NVME_ERRORS, 1);
+        return;
+    }
+    ni_perf_count(write ? NI_PERF_CTR_BYTES_WRITTEN : NI_PERF_CTR_BYTES_READ,
+                  data_len);
+}
+
+#ifdef NI_NVME_TRACE_SUPPORTED
+static void ni_nvme_trace_env_start(void)
+{
+    const char *p_path = getenv(NI_NVME_TRACE_ENV);
+    if (p_path && p_path[0] && !g_nvme_trace_hdr)
+    {
+        ni_nvme_trace_start(p_path, 0);
+    }
+}
+
+/*!******************************************************************************
+ *  \brief  Return the start time of a command if tracing is on, 0 otherwise
+ *******************************************************************************/
+static inline uint64_t ni_nvme_trace_begin(void)
+{
+    pthread_once(&g_nvme_trace_env_once, ni_nvme_trace_env_start);
+    if (!__atomic_load_n(&g_nvme_trace_hdr, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+    return ni_gettime_ns();
+}
+
+/*!******************************************************************************
+ *  \brief  Append one command to the trace ring. A record is claimed with an
+ *          atomic increment on the shared write index so several threads and
+ *          processes can write concurrently, and it is published by storing
+ *          its sequence number last.
+ *******************************************************************************/
+static void ni_nvme_trace_end(uint64_t start, ni_nvme_trace_op_t opcode,
+                              uint32_t lba, uint32_t data_len, int32_t rc)
+{
+    ni_nvme_trace_header_t *p_hdr;
+    ni_nvme_trace_record_t *p_rec;
+    uint64_t index;
+    uint64_t duration;
+
+    p_hdr = __atomic_load_n(&g_nvme_trace_hdr, __ATOMIC_ACQUIRE);
+    if (!start || !p_hdr)
+    {
+        return;
+    }
+
+    duration = ni_gettime_ns() - start;
+    index = __atomic_fetch_add(&p_hdr->write_index, 1, __ATOMIC_RELAXED);
+    p_rec = (ni_nvme_trace_record_t *)(p_hdr + 1) + index % p_hdr->capacity;
+
+    __atomic_store_n(&p_rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    p_rec->timestamp = start;
+    p_rec->duration = duration > UINT32_MAX ? UINT32_MAX : (uint32_t)duration;
+    p_rec->lba = lba;
+    p_rec->data_len = data_len;
+    p_rec->rc = rc;
+    p_rec->pid = (uint32_t)getpid();
+#if __linux__
+    p_rec->tid = (uint32_t)syscall(SYS_gettid);
+#else
+    p_rec->tid = (uint32_t)(uintptr_t)pthread_self();
+#endif
+    p_rec->opcode = (uint8_t)opcode;
+    ni_nvme_decode_lba(lba, p_rec);
+    __atomic_store_n(&p_rec->seq, index + 1, __ATOMIC_RELEASE);
+}
+#endif
+
+/*!******************************************************************************
+ *  \brief  Start recording NVMe read/write commands to a ring file
+ *
+ *  \param[in] p_path       ring file path
+ *  \param[in] num_records  ring capacity if the file is created, 0 for default
+ *
+ *  \return NI_RETCODE_SUCCESS on success, ni_retcode_t error otherwise
+ *******************************************************************************/
+ni_retcode_t ni_nvme_trace_start(const char *p_path, uint32_t num_records)
+{
+#ifdef NI_NVME_TRACE_SUPPORTED
+    ni_retcode_t retval = NI_RETCODE_SUCCESS;
+    ni_nvme_trace_header_t hdr;
+    struct stat st;
+    struct stat path_st;
+    size_t map_size;
+    void *p_map;
+    int fd = -1;
+    int attempt;
+
+    if (!p_path || !p_path[0])
+    {
+        return NI_RETCODE_INVALID_PARAM;
+    }
+    if (!num_records)
+    {
+        num_records = NI_NVME_TRACE_DEFAULT_RECORDS;
+    }
+
+    pthread_mutex_lock(&g_nvme_trace_mutex);
+    if (g_nvme_trace_hdr)
+    {
+        ni_log(NI_LOG_INFO, "%s: NVMe trace already started\n", __func__);
+        LRETURN;
+    }
+
+    // the mapping of a stopped trace is kept until here as commands that
+    // were in flight when it was stopped may still have been writing to it
+    if (g_nvme_trace_map)
+    {
+        munmap(g_nvme_trace_map, g_nvme_trace_map_size);
+        g_nvme_trace_map = NULL;
+    }
+
+    // serialize creation of the ring with other processes opening it. A ring
+    // of another layout may still be mapped by the processes using it:
+    // shrinking it would kill them with SIGBUS, so it is unlinked and a new
+    // file created. The lock only counts if it was taken on the file that
+    // p_path names, not on one another process unlinked meanwhile.
+    for (attempt = 0; attempt < NI_NVME_TRACE_OPEN_ATTEMPTS; attempt++)
+    {
+        fd = open(p_path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (fd < 0)
+        {
+            ni_log(NI_LOG_ERROR, "ERROR %d: %s() open %s failed\n", NI_ERRNO,
+                   __func__, p_path);
+            retval = NI_RETCODE_ERROR_INVALID_HANDLE;
+            LRETURN;
+        }
+        flock(fd, LOCK_EX);
+        if (fstat(fd, &st) != 0 || stat(p_path, &path_st) != 0 ||
+            st.st_dev != path_st.st_dev || st.st_ino != path_st.st_ino)
+        {
+            // replaced while waiting for the lock
+            flock(fd, LOCK_UN);
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        if ((size_t)st.st_size >= sizeof(hdr) &&
+            pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+            hdr.magic == NI_NVME_TRACE_MAGIC &&
+            hdr.version == NI_NVME_TRACE_VERSION &&
+            hdr.header_size == sizeof(ni_nvme_trace_header_t) &&
+            hdr.record_size == sizeof(ni_nvme_trace_record_t) && hdr.capacity &&
+            (size_t)st.st_size >= sizeof(hdr) + (size_t)hdr.capacity * sizeof(ni_nvme_trace_record_t))
+        {
+            // join the existing ring
+            num_records = hdr.capacity;
+            break;
+        }
+        if (0 == st.st_size)
+        {
+            // new file, nobody maps it before the header is written
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.magic = NI_NVME_TRACE_MAGIC;
+            hdr.version = NI_NVME_TRACE_VERSION;
+            hdr.header_size = sizeof(ni_nvme_trace_header_t);
+            hdr.record_size = sizeof(ni_nvme_trace_record_t);
+            hdr.capacity = num_records;
+            hdr.create_time = ni_gettime_ns();
+            if (ftruncate(fd, sizeof(hdr) + (off_t)num_records * sizeof(ni_nvme_trace_record_t)) != 0 ||
+                pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr))
+            {
+                ni_log(NI_LOG_ERROR, "ERROR %d: %s() init %s failed\n",
+                       NI_ERRNO, __func__, p_path);
+                ftruncate(fd, 0);
+                flock(fd, LOCK_UN);
+                close(fd);
+                retval = NI_RETCODE_FAILURE;
+                LRETURN;
+            }
+            break;
+        }
+        ni_log(NI_LOG_INFO, "%s: %s has another layout, replacing it\n",
+               __func__, p_path);
+        if (unlink(p_path) != 0)
+        {
+            ni_log(NI_LOG_ERROR, "ERROR %d: %s() unlink %s failed\n",
+                   NI_ERRNO, __func__, p_path);
+            flock(fd, LOCK_UN);
+            close(fd);
+            retval = NI_RETCODE_FAILURE;
+            LRETURN;
+        }
+        flock(fd, LOCK_UN);
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0)
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s() %s keeps being replaced\n",
+               __func__, p_path);
+        retval = NI_RETCODE_FAILURE;
+        LRETURN;
+    }
+    flock(fd, LOCK_UN);
+
+    map_size = sizeof(hdr) + (size_t)num_records * sizeof(ni_nvme_trace_record_t);
+    p_map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p_map == MAP_FAILED)
+    {
+        ni_log(NI_LOG_ERROR, "ERROR %d: %s() mmap %s failed\n", NI_ERRNO,
+               __func__, p_path);
+        retval = NI_RETCODE_ERROR_MEM_ALOC;
+        LRETURN;
+    }
+
+    g_nvme_trace_map = p_map;
+    g_nvme_trace_map_size = map_size;
+    __atomic_store_n(&g_nvme_trace_hdr, (ni_nvme_trace_header_t *)p_map,
+                     __ATOMIC_RELEASE);
+    ni_log(NI_LOG_INFO, "NVMe trace started: %s, %u records\n", p_path,
+           num_records);
+
+END:
+    pthread_mutex_unlock(&g_nvme_trace_mutex);
+    return retval;
+#else
+    (void)p_path;
+    (void)num_records;
+    return NI_RETCODE_ERROR_UNSUPPORTED_FEATURE;
+#endif
+}
+
+/*!******************************************************************************
+ *  \brief  Stop NVMe command tracing. The ring file stays mapped until the
+ *          next ni_nvme_trace_start() or process exit, as commands in flight
+ *          may still write to it.
+ *
+ *  \return
+ *******************************************************************************/
+void ni_nvme_trace_stop(void)
+{
+#ifdef NI_NVME_TRACE_SUPPORTED
+    // the mapping itself is released by the next ni_nvme_trace_start()
+    pthread_mutex_lock(&g_nvme_trace_mutex);
+    __atomic_store_n(&g_nvme_trace_hdr, NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_nvme_trace_mutex);
+#endif
+}
+
 /*!******************************************************************************
  *  \brief  Compose an io read command
  *
@@ -562,6 +889,8 @@ int32_t ni_nvme_send_read_cmd(ni_device_handle_t handle,
         rc = NI_RETCODE_SUCCESS;
     }
 #else
+    uint64_t trace_start;
+
     if (!handle || handle == NI_INVALID_DEVICE_HANDLE)
     {
         //if we can make sure that all handles are initialized to NI_INVALID_DEVICE_HANDLE
@@ -570,6 +899,7 @@ int32_t ni_nvme_send_read_cmd(ni_device_handle_t handle,
         return NI_RETCODE_INVALID_PARAM;
     }
 
+        trace_start = ni_nvme_trace_begin();
         if (((uintptr_t)p_data) % NI_MEM_PAGE_ALIGNMENT)
         {
             ni_log(NI_LOG_DEBUG,
@@ -586,12 +916,16 @@ int32_t ni_nvme_send_read_cmd(ni_device_handle_t handle,
             }
             else
             {
+                ni_mem_account_charge(NULL, NI_MEM_CAT_BOUNCE, data_len);
                 rc = pread(handle, p_buf, data_len, offset);
                 if (rc >= 0)//copy only if anything has been read
                 {
                     memcpy(p_data, p_buf, data_len);
+                    ni_perf_count(NI_PERF_CTR_BOUNCE_COPIES, 1);
+                    ni_perf_count(NI_PERF_CTR_BOUNCE_BYTES, data_len);
                 }
                 ni_aligned_free(p_buf);
+                ni_mem_account_uncharge(NULL, NI_MEM_CAT_BOUNCE, data_len);
             }
         } else
         {
@@ -612,7 +946,9 @@ int32_t ni_nvme_send_read_cmd(ni_device_handle_t handle,
         {
             rc = NI_RETCODE_SUCCESS;
         }
+        ni_nvme_trace_end(trace_start, NI_NVME_TRACE_OP_READ, lba, data_len, rc);
 #endif
+    ni_nvme_perf_count(0, lba, data_len, rc);
     return rc;
 }
 
@@ -670,6 +1006,8 @@ int32_t ni_nvme_send_write_cmd(ni_device_handle_t handle,
         rc = NI_RETCODE_SUCCESS;
     }
 #else
+    uint64_t trace_start;
+
     if (!handle || handle == NI_INVALID_DEVICE_HANDLE)
     {
         //if we can make sure that all handles are initialized to NI_INVALID_DEVICE_HANDLE
@@ -678,6 +1016,7 @@ int32_t ni_nvme_send_write_cmd(ni_device_handle_t handle,
         return NI_RETCODE_INVALID_PARAM;
     }
 
+        trace_start = ni_nvme_trace_begin();
         if (((uintptr_t)p_data) % NI_MEM_PAGE_ALIGNMENT)
         {
             ni_log(NI_LOG_ERROR,
@@ -694,9 +1033,13 @@ int32_t ni_nvme_send_write_cmd(ni_device_handle_t handle,
             }
             else
             {
+                ni_mem_account_charge(NULL, NI_MEM_CAT_BOUNCE, data_len);
                 memcpy(p_buf, p_data, data_len);
+                ni_perf_count(NI_PERF_CTR_BOUNCE_COPIES, 1);
+                ni_perf_count(NI_PERF_CTR_BOUNCE_BYTES, data_len);
                 rc = pwrite(handle, p_buf, data_len, offset);
                 ni_aligned_free(p_buf);
+                ni_mem_account_uncharge(NULL, NI_MEM_CAT_BOUNCE, data_len);
             }
         }
         else
@@ -717,6 +1060,8 @@ int32_t ni_nvme_send_write_cmd(ni_device_handle_t handle,
         {
             rc = NI_RETCODE_SUCCESS;
         }
+        ni_nvme_trace_end(trace_start, NI_NVME_TRACE_OP_WRITE, lba, data_len, rc);
 #endif
+    ni_nvme_perf_count(1, lba, data_len, rc);
     return rc;
 }
@@ -25,6 +25,8 @@
  *  \brief  Public definitions for managing NETINT video processing devices
  ******************************************************************************/
 
+#define NI_LOG_MODULE NI_LOG_MODULE_RSRC
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -50,6 +52,12 @@
 #include "ni_rsrc_priv.h"
 #include "ni_util.h"
 
+#ifdef XCODER_311
+#define CHECK_HW_INFO_LOG_LEVEL NI_LOG_DEBUG
+#else
+#define CHECK_HW_INFO_LOG_LEVEL NI_LOG_INFO
+#endif
+
 static const char *ni_codec_format_str[] = {"H.264", "H.265", "VP9", "JPEG",
                                             "AV1"};
 static const char *ni_dec_name_str[] = {"h264_ni_quadra_dec", "h265_ni_quadra_dec",
@@ -224,6 +232,45 @@ ni_retcode_t ni_rsrc_refresh(int should_match_rev)
     }
     int devices_removed = 0;
     int devices_added = 0;
+#if __linux__ || __APPLE__
+    ni_device_fingerprint_t fingerprints[NI_MAX_DEVICE_CNT];
+    int fingerprint_cnt =
+        ni_rsrc_get_pool_fingerprints(fingerprints, NI_MAX_DEVICE_CNT);
+
+    // a device still present under the same name but with a different serial
+    // number or firmware revision is re-identified: drop it from the previous
+    // list so it is removed and then added back below
+    for (i = 0; i < xcoder_dev_count; i++)
+    {
+        if (is_str_in_str_array(xcoder_dev_names[i], curr_dev_names,
+                                curr_dev_count) &&
+            0 == ni_rsrc_check_device_fingerprint(xcoder_dev_names[i],
+                                                  fingerprints,
+                                                  fingerprint_cnt, NULL))
+        {
+            ni_log(NI_LOG_INFO, "\n\n%s changed, re-adding !\n",
+                   xcoder_dev_names[i]);
+            if (NI_RETCODE_SUCCESS ==
+                ni_rsrc_remove_device(xcoder_dev_names[i]))
+            {
+                devices_removed++;
+                if (NI_RETCODE_SUCCESS ==
+                    ni_rsrc_add_device(xcoder_dev_names[i], should_match_rev))
+                {
+                    devices_added++;
+                } else
+                {
+                    ni_log(NI_LOG_ERROR, "%s failed to add !\n",
+                           xcoder_dev_names[i]);
+                }
+            } else
+            {
+                ni_log(NI_LOG_ERROR, "%s failed to delete !\n",
+                       xcoder_dev_names[i]);
+            }
+        }
+    }
+#endif
     // remove from resource pool any device that is not available now
     for (i = 0; i < xcoder_dev_count; i++)
     {
@@ -575,6 +622,7 @@ ni_device_context_t* ni_rsrc_get_device_context(ni_device_type_t device_type, in
   strncpy(p_device_context->shm_name, shm_name, sizeof(p_device_context->shm_name));
   p_device_context->lock = mutex_handle;
   p_device_context->p_device_info = p_device_queue;
+  p_device_context->broker_granted = 0;
 
 END:
 
@@ -645,6 +693,8 @@ int ni_rsrc_get_local_device_list(char ni_devices[][NI_MAX_DEVICE_NAME_LEN],
   ni_device_handle_t dev_handle = NI_INVALID_DEVICE_HANDLE;
   ni_retcode_t rc;
   uint32_t tmp_io_size;
+  ni_device_fingerprint_t fingerprints[NI_MAX_DEVICE_CNT];
+  int fingerprint_cnt;
   g_device_in_ctxt = false;
 
   if ((ni_devices == NULL)||(max_handles == 0))
@@ -653,6 +703,11 @@ int ni_rsrc_get_local_device_list(char ni_devices[][NI_MAX_DEVICE_NAME_LEN],
     return 0;
   }
 
+  // devices already in the resource pool and unchanged since are known to be
+  // xcoders, so their capability identify can be skipped
+  fingerprint_cnt = ni_rsrc_get_pool_fingerprints(fingerprints,
+                                                  NI_MAX_DEVICE_CNT);
+
   int nvme_dev_cnt = 0;
   char nvme_devices[200][NI_MAX_DEVICE_NAME_LEN];
 
@@ -771,7 +826,19 @@ int ni_rsrc_get_local_device_list(char ni_devices[][NI_MAX_DEVICE_NAME_LEN],
               }
               dev_handle = ni_device_open(device_info.dev_name, &tmp_io_size);
 
-              if (NI_INVALID_DEVICE_HANDLE != dev_handle)
+              if (NI_INVALID_DEVICE_HANDLE != dev_handle &&
+                  1 == ni_rsrc_check_device_fingerprint(device_info.dev_name,
+                                                        fingerprints,
+                                                        fingerprint_cnt,
+                                                        NULL))
+              {
+                  ni_log(NI_LOG_DEBUG, "%s unchanged, skipping identify\n",
+                         device_info.dev_name);
+                  ni_devices[xcoder_device_cnt][0] = '\0';
+                  strcat(ni_devices[xcoder_device_cnt], device_info.dev_name);
+                  xcoder_device_cnt++;
+                  ni_device_close(dev_handle);
+              } else if (NI_INVALID_DEVICE_HANDLE != dev_handle)
               {
                 g_dev_handle = dev_handle;
                   rc = ni_device_capability_query(dev_handle,
@@ -1148,6 +1215,15 @@ ni_device_context_t* ni_rsrc_get_device_context(ni_device_type_t device_type, in
            strerror(NI_ERRNO));
     LRETURN;
   }
+#ifndef _ANDROID
+  // a record from an older init_rsrc is smaller, reading past it would fault
+  if (ni_rsrc_fit_device_record(shm_fd) < 0)
+  {
+    ni_log(NI_LOG_ERROR, "ERROR %s() cannot extend %s: %s\n", __func__,
+           shm_name, strerror(NI_ERRNO));
+    LRETURN;
+  }
+#endif
 
   p_device_queue = (ni_device_info_t *)mmap(0, sizeof(ni_device_info_t), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
   if (MAP_FAILED == p_device_queue)
@@ -1171,6 +1247,7 @@ ni_device_context_t* ni_rsrc_get_device_context(ni_device_type_t device_type, in
   strncpy(p_device_context->shm_name, shm_name, sizeof(p_device_context->shm_name));
   p_device_context->lock = lock;
   p_device_context->p_device_info = p_device_queue;
+  p_device_context->broker_granted = 0;
 
 END:
   lockf(lock, F_ULOCK, 0);
@@ -1287,6 +1364,7 @@ ni_retcode_t ni_rsrc_list_devices(ni_device_type_t device_type,
       lockf(p_device_context->lock, F_ULOCK, 0);
 #endif
 
+      ni_rsrc_sync_device_load(&p_device_info[i], 1);
       ni_rsrc_free_device_context(p_device_context);
 
       (*p_device_count)++;
@@ -1498,6 +1576,12 @@ void ni_rsrc_print_device_info(const ni_device_info_t *p_device_info)
         ni_log(NI_LOG_INFO, "  H/W ID: %d\n", p_device_info->hw_id);
         ni_log(NI_LOG_INFO, "  MaxNumInstances: %d\n",
                p_device_info->max_instance_cnt);
+        if (p_device_info->topology_magic == NI_DEVICE_INFO_TOPOLOGY_MAGIC &&
+            p_device_info->pcie_addr[0])
+        {
+            ni_log(NI_LOG_INFO, "  PCIe: %s NUMA node: %d\n",
+                   p_device_info->pcie_addr, p_device_info->numa_node);
+        }
 
         if (NI_DEVICE_TYPE_SCALER == p_device_info->device_type)
         {
@@ -1666,6 +1750,7 @@ ni_device_info_t *ni_rsrc_get_device_info(ni_device_type_t device_type, int guid
 
   lockf(p_device_context->lock, F_ULOCK, 0);
 #endif
+  ni_rsrc_sync_device_load(p_device_info, 1);
 
 END:
 
@@ -1765,6 +1850,8 @@ int ni_rsrc_update_device_load(ni_device_context_t *p_device_context, int load,
                int sw_instance_cnt, const ni_sw_instance_info_t sw_instance_info[])
 {
   int i;
+  ni_device_load_table_t *p_load_table;
+  ni_device_load_t device_load;
   if (!p_device_context || !sw_instance_info)
   {
     ni_log(NI_LOG_ERROR, "ERROR: %s() invalid input pointers\n", __func__);
@@ -1782,8 +1869,13 @@ int ni_rsrc_update_device_load(ni_device_context_t *p_device_context, int load,
   lockf(p_device_context->lock, F_LOCK, 0);
 #endif
 
-  p_device_context->p_device_info->load = load;
-  p_device_context->p_device_info->active_num_inst = sw_instance_cnt;
+  p_load_table = ni_rsrc_get_load_table();
+  ni_rsrc_get_device_load(p_load_table, p_device_context->p_device_info,
+                          &device_load);
+  device_load.load = load;
+  device_load.active_num_inst = sw_instance_cnt;
+  ni_rsrc_set_device_load(p_load_table, p_device_context->p_device_info,
+                          &device_load);
   for (i = 0; i < sw_instance_cnt; i++)
   {
     p_device_context->p_device_info->sw_instance[i] = sw_instance_info[i];
@@ -1841,8 +1933,22 @@ void ni_rsrc_release_resource(ni_device_context_t *p_device_context,
 {
 
 #if 1
-    (void) p_device_context;
+    ni_rsrc_broker_msg_t broker_msg;
+
     (void) load;
+    if (!p_device_context || !p_device_context->broker_granted)
+    {
+        return;
+    }
+    // let the broker know the allocation it handed out is gone; the load
+    // itself is tracked by the firmware. Contexts the broker did not grant
+    // have nothing to release, so no broker is contacted for them.
+    p_device_context->broker_granted = 0;
+    memset(&broker_msg, 0, sizeof(broker_msg));
+    broker_msg.op = NI_RSRC_BROKER_OP_RELEASE;
+    broker_msg.device_type = p_device_context->p_device_info->device_type;
+    broker_msg.guid = p_device_context->p_device_info->module_id;
+    ni_rsrc_broker_request(&broker_msg);
     return;
 
 #else
@@ -2104,6 +2210,7 @@ int ni_rsrc_remove_device(const char* dev)
     ni_device_pool_t *p_device_pool = NULL;
     ni_device_queue_t *p_device_queue;
     ni_device_type_t device_type;
+    ni_device_load_t device_load;
 
     if (!dev)
     {
@@ -2192,6 +2299,11 @@ int ni_rsrc_remove_device(const char* dev)
 #endif
 #endif
 
+            // the guid may be reused by the next device added
+            memset(&device_load, 0, sizeof(device_load));
+            ni_rsrc_set_device_load(ni_rsrc_get_load_table(),
+                                    p_device_context->p_device_info,
+                                    &device_load);
             ni_rsrc_free_device_context(p_device_context);
 
 #if __linux__ || __APPLE__
@@ -2372,6 +2484,17 @@ int ni_rsrc_remove_all_devices(void)
         ni_log(NI_LOG_ERROR, "%s failed to delete !\n", CODERS_SHM_NAME);
     }
 
+    // processes still running keep the table they mapped, a new one is
+    // created zero filled by the next ni_rsrc_init()
+    if (0 == shm_unlink(CODERS_LOAD_SHM_NAME))
+    {
+        ni_log(NI_LOG_INFO, "%s deleted.\n", CODERS_LOAD_SHM_NAME);
+    }
+    else if (ENOENT != NI_ERRNO)
+    {
+        ni_log(NI_LOG_ERROR, "%s failed to delete !\n", CODERS_LOAD_SHM_NAME);
+    }
+
     for (i = 0; i < NI_DEVICE_TYPE_XCODER_MAX; i++)
     {
         if (0 == unlink(XCODERS_RETRY_LCK_NAME[i]))
@@ -3284,6 +3407,20 @@ void ni_hw_device_info_free_quadra(ni_hw_device_info_quadra_t *p_hw_device_info)
     return;
 }
 
+/*!*********************************************************************************************
+*  \brief    Check whether a card sits on the given NUMA node
+*            This function is used for ni_check_hw_info()
+*
+*  \param[in]  p_card_info  Poiner to a ni_card_info_quadra_t struct
+*  \param[in]  numa_node    NUMA node of the caller, -1 if unknown
+*
+*  \return     true if the card is on numa_node, false otherwise or if either is unknown
+***********************************************************************************************/
+static bool check_hw_info_numa_local(const ni_card_info_quadra_t *p_card_info, int numa_node)
+{
+    return numa_node >= 0 && p_card_info->numa_node == numa_node;
+}
+
 int ni_check_hw_info(ni_hw_device_info_quadra_t **pointer_to_p_hw_device_info, 
                      int task_mode,
                      ni_hw_device_info_quadra_threshold_param_t *hw_info_threshold_param,
@@ -3324,6 +3461,9 @@ int ni_check_hw_info(ni_hw_device_info_quadra_t **pointer_to_p_hw_device_info,
 
     int i = 0;
     bool b_valid = false;
+    int caller_numa_node = -1;
+    bool numa_local = false;
+    bool current_numa_local = false;
 
 
     // int *mem_usage = NULL;
@@ -3595,6 +3735,7 @@ int ni_check_hw_info(ni_hw_device_info_quadra_t **pointer_to_p_hw_device_info,
             p_hw_device_info->card_info[i][j].task_num = -1;
             p_hw_device_info->card_info[i][j].max_task_num = NI_MAX_CONTEXTS_PER_HW_INSTANCE;
             p_hw_device_info->card_info[i][j].shared_mem_usage = -1;
+            p_hw_device_info->card_info[i][j].numa_node = -1;
         }
     }
 
@@ -3719,6 +3860,7 @@ int ni_check_hw_info(ni_hw_device_info_quadra_t **pointer_to_p_hw_device_info,
                 }
 
                 p_hw_device_info->card_info[j][i].card_idx      = p_device_context->p_device_info->module_id;
+                p_hw_device_info->card_info[j][i].numa_node     = ni_rsrc_get_numa_node(p_device_context->p_device_info);
 
                 //use model_load in card remove for encoder just like before
 #ifdef XCODER_311
@@ -3771,11 +3913,7 @@ int ni_check_hw_info(ni_hw_device_info_quadra_t **pointer_to_p_hw_device_info,
     {
         for(int j = 0; j < p_hw_device_info->device_type_num; ++j)
         {
-#ifdef XCODER_311
-            ni_log(NI_LOG_DEBUG, "%s Card[%3d], load: %3d,  task_num: %3d,  model_load: %3d, shared_mem_usage: %3d\n",
-#else
-            ni_log(NI_LOG_INFO, "%s Card[%3d], load: %3d,  task_num: %3d,  model_load: %3d, shared_mem_usage: %3d\n",
-#endif
+            ni_log(CHECK_HW_INFO_LOG_LEVEL, "%s Card[%3d], load: %3d,  task_num: %3d,  model_load: %3d, shared_mem_usage: %3d\n",
                     (p_hw_device_info->device_type[j] == NI_DEVICE_TYPE_DECODER ? "Decoder" : 
                     ((p_hw_device_info->device_type[j] == NI_DEVICE_TYPE_ENCODER) ? "Encoder" :
                     (p_hw_device_info->device_type[j] == NI_DEVICE_TYPE_SCALER) ? "Scaler " : "AIs    ")),
@@ -3858,6 +3996,9 @@ int ni_check_hw_info(ni_hw_device_info_quadra_t **pointer_to_p_hw_device_info,
         }
     }
 
+    //on a tie, prefer the card on the caller's NUMA node
+    caller_numa_node = ni_get_current_numa_node();
+
     if (task_mode)
     {
         //select the min_task_num
@@ -3875,12 +4016,17 @@ int ni_check_hw_info(ni_hw_device_info_quadra_t **pointer_to_p_hw_device_info,
         int min_load = 100;
         for (i = 0; i < p_hw_device_info->available_card_num; i++)
         {
-            if (p_hw_device_info->card_info[0][i].load < min_load &&
+            numa_local = check_hw_info_numa_local(&p_hw_device_info->card_info[0][i], caller_numa_node);
+            if ((p_hw_device_info->card_info[0][i].load < min_load ||
+                 (p_hw_device_info->card_info[0][i].load == min_load &&
+                  p_hw_device_info->card_current_card >= 0 &&
+                  numa_local && !current_numa_local)) &&
                 card_remove[i] == 0 &&
                 p_hw_device_info->card_info[0][i].task_num == min_task_num)
             {
                 min_load = p_hw_device_info->card_info[0][i].load;
                 p_hw_device_info->card_current_card = p_hw_device_info->card_info[0][i].card_idx;
+                current_numa_local = numa_local;
             }
         }
     }
@@ -3891,11 +4037,16 @@ int ni_check_hw_info(ni_hw_device_info_quadra_t **pointer_to_p_hw_device_info,
         int min_task_num = p_hw_device_info->card_info[0][0].max_task_num;
         for (i = 0; i < p_hw_device_info->available_card_num; i++)
         {
-            if (p_hw_device_info->card_info[0][i].task_num < min_task_num &&
+            numa_local = check_hw_info_numa_local(&p_hw_device_info->card_info[0][i], caller_numa_node);
+            if ((p_hw_device_info->card_info[0][i].task_num < min_task_num ||
+                 (p_hw_device_info->card_info[0][i].task_num == min_task_num &&
+                  p_hw_device_info->card_current_card >= 0 &&
+                  numa_local && !current_numa_local)) &&
                 card_remove[i] == 0)
             {
                 p_hw_device_info->card_current_card = p_hw_device_info->card_info[0][i].card_idx;
                 min_task_num = p_hw_device_info->card_info[0][i].task_num;
+                current_numa_local = numa_local;
             }
         }
     }
@@ -3942,20 +4093,12 @@ END:
   {
     if(hw_mode)
     {
-#ifdef XCODER_311
-      ni_log(NI_LOG_DEBUG, "In hw_mode select card_current_card %d retval %d\n",
-#else
-      ni_log(NI_LOG_INFO, "In hw_mode select card_current_card %d retval %d\n",
-#endif
+      ni_log(CHECK_HW_INFO_LOG_LEVEL, "In hw_mode select card_current_card %d retval %d\n",
             p_hw_device_info->card_current_card, retval);
     }
     else
     {
-#ifdef XCODER_311
-      ni_log(NI_LOG_DEBUG, "In sw_mode select device_type %s card_current_card %d retval %d\n",
-#else
-      ni_log(NI_LOG_INFO, "In sw_mode select device_type %s card_current_card %d retval %d\n",
-#endif
+      ni_log(CHECK_HW_INFO_LOG_LEVEL, "In sw_mode select device_type %s card_current_card %d retval %d\n",
              ((preferential_device_type == 0) ? "decode" : (preferential_device_type == 1 ? "encode" : "scaler")), p_hw_device_info->card_current_card, retval);
     }
   }
@@ -4003,6 +4146,12 @@ ni_device_context_t *ni_rsrc_allocate_auto(
     uint32_t num_sw_instances = 0;
     int least_model_load = 0;
     uint64_t job_mload = 0;
+    ni_device_load_table_t *p_load_table = NULL;
+    ni_device_load_t dev_load;
+    int caller_numa_node = -1;
+    bool guid_numa_local = false;
+    bool numa_local = false;
+    ni_rsrc_broker_msg_t broker_msg;
 
 
     if(device_type != NI_DEVICE_TYPE_DECODER && device_type != NI_DEVICE_TYPE_ENCODER)
@@ -4010,6 +4159,36 @@ ni_device_context_t *ni_rsrc_allocate_auto(
         ni_log2(NULL, NI_LOG_ERROR, "ERROR: Device type %d is not allowed\n", device_type);
         return NULL;
     }
+
+    /*! a local resource broker, when running, already knows the load of all
+       devices: one request to it replaces the sweep below */
+    memset(&broker_msg, 0, sizeof(broker_msg));
+    broker_msg.op = NI_RSRC_BROKER_OP_ALLOCATE;
+    broker_msg.device_type = device_type;
+    broker_msg.rule = rule;
+    broker_msg.codec = codec;
+    broker_msg.width = width;
+    broker_msg.height = height;
+    broker_msg.frame_rate = frame_rate;
+    broker_msg.numa_node = (EN_ALLOC_LEAST_LOAD_NUMA == rule) ?
+        ni_get_current_numa_node() : -1;
+    if (NI_RETCODE_SUCCESS == ni_rsrc_broker_request(&broker_msg))
+    {
+        p_device_context = ni_rsrc_get_device_context(device_type,
+                                                      broker_msg.guid);
+        if (p_device_context)
+        {
+            ni_log(NI_LOG_DEBUG, "%s: broker allocated %s guid %d\n",
+                   __func__, g_device_type_str[device_type], broker_msg.guid);
+            p_device_context->broker_granted = 1;
+            if (p_load)
+            {
+                *p_load = broker_msg.load;
+            }
+            return p_device_context;
+        }
+    }
+
     /*! retrieve the record and based on the allocation rule specified, find the
        least loaded or least number of s/w instances among the coders */
     p_device_pool = ni_rsrc_get_device_pool();
@@ -4033,6 +4212,15 @@ ni_device_context_t *ni_rsrc_allocate_auto(
     coders = p_device_pool->p_device_queue->xcoders[device_type];
     count = p_device_pool->p_device_queue->xcoder_cnt[device_type];
 
+    p_load_table = ni_rsrc_get_load_table();
+
+    if (EN_ALLOC_LEAST_LOAD_NUMA == rule)
+    {
+        caller_numa_node = ni_get_current_numa_node();
+        ni_log(NI_LOG_DEBUG, "%s: caller NUMA node %d\n", __func__,
+               caller_numa_node);
+    }
+
     for (i = 0; i < count; i++)
     {
         /*! get the individual device_info info and check the load/num-of-instances */
@@ -4085,26 +4273,50 @@ ni_device_context_t *ni_rsrc_allocate_auto(
         ni_rsrc_update_record(p_device_context, &p_session_context);
 
         p_device_info = p_device_context->p_device_info;
+        ni_rsrc_get_device_load(p_load_table, p_device_info, &dev_load);
+        numa_local = (caller_numa_node >= 0 &&
+                      ni_rsrc_get_numa_node(p_device_info) == caller_numa_node);
         if (i == 0)
         {
             guid = coders[i];
-            load = p_device_info->load;
-            least_model_load = p_device_info->model_load;
-            num_sw_instances = p_device_info->active_num_inst;
+            load = dev_load.load;
+            least_model_load = dev_load.model_load;
+            num_sw_instances = dev_load.active_num_inst;
+            guid_numa_local = numa_local;
         }
 
-        ni_log(NI_LOG_INFO, "Coder [%d]: %d , load: %d (%d), activ_inst: %d , max_inst %d\n",
-               i, coders[i], p_device_info->load, p_device_info->model_load, p_device_info->active_num_inst,
-               p_device_info->max_instance_cnt);
+        ni_log(NI_LOG_INFO, "Coder [%d]: %d , load: %d (%d), activ_inst: %d , max_inst %d, numa_node %d\n",
+               i, coders[i], dev_load.load, dev_load.model_load, dev_load.active_num_inst,
+               p_device_info->max_instance_cnt, ni_rsrc_get_numa_node(p_device_info));
 
         switch (rule)
         {
+            case EN_ALLOC_LEAST_LOAD_NUMA:
+            {
+                int curr_load = (NI_DEVICE_TYPE_ENCODER == device_type) ?
+                    dev_load.model_load : dev_load.load;
+                int best_load = (NI_DEVICE_TYPE_ENCODER == device_type) ?
+                    least_model_load : load;
+
+                // a card on the caller's node wins over any remote card, the
+                // load only decides among cards of the same locality
+                if ((numa_local && !guid_numa_local) ||
+                    (numa_local == guid_numa_local && curr_load < best_load))
+                {
+                    guid = coders[i];
+                    guid_numa_local = numa_local;
+                    load = dev_load.load;
+                    least_model_load = dev_load.model_load;
+                }
+                break;
+            }
+
             case EN_ALLOC_LEAST_INSTANCE:
             {
-                if (p_device_info->active_num_inst < num_sw_instances)
+                if (dev_load.active_num_inst < num_sw_instances)
                 {
                     guid = coders[i];
-                    num_sw_instances = p_device_info->active_num_inst;
+                    num_sw_instances = dev_load.active_num_inst;
                 }
                 break;
             }
@@ -4114,16 +4326,16 @@ ni_device_context_t *ni_rsrc_allocate_auto(
             {
                 if (NI_DEVICE_TYPE_ENCODER == device_type)
                 {
-                    if (p_device_info->model_load < least_model_load)
+                    if (dev_load.model_load < least_model_load)
                     {
                         guid = coders[i];
-                        least_model_load = p_device_info->model_load;
+                        least_model_load = dev_load.model_load;
                     }
                 }
-                else if (p_device_info->load < load)
+                else if (dev_load.load < load)
                 {
                     guid = coders[i];
-                    load = p_device_info->load;
+                    load = dev_load.load;
                 }
                 break;
             }
@@ -4173,3 +4385,416 @@ END:
     }
     return p_device_context;
 }
+
+typedef struct _ni_rsrc_batch_card
+{
+    bool present[NI_DEVICE_TYPE_XCODER_MAX];
+    int load[NI_DEVICE_TYPE_XCODER_MAX];
+    int model_load[NI_DEVICE_TYPE_XCODER_MAX];
+    int task_num[NI_DEVICE_TYPE_XCODER_MAX];
+    int numa_node;
+} ni_rsrc_batch_card_t;
+
+/*!*****************************************************************************
+*   \brief      Estimate the model load of one decode or encode job, with the
+*               same formulas ni_check_hw_info() uses
+*
+*   \return     model load in percent of a card, 0 for scaler and AI
+*******************************************************************************/
+int ni_rsrc_estimate_need_load(ni_device_type_t device_type, int codec,
+                               int width, int height, int frame_rate,
+                               int bit_depth)
+{
+    ni_hw_device_info_quadra_decoder_param_t decoder_param = {0};
+    ni_hw_device_info_quadra_encoder_param_t encoder_param = {0};
+    uint32_t bit_8_10 = (10 == bit_depth) ? 10 : 8;
+
+    if (NI_DEVICE_TYPE_DECODER == device_type)
+    {
+        decoder_param.w = (uint32_t)width;
+        decoder_param.h = (uint32_t)height;
+        decoder_param.fps = (uint32_t)frame_rate;
+        decoder_param.bit_8_10 = bit_8_10;
+        return check_hw_info_decoder_need_load(&decoder_param);
+    }
+    if (NI_DEVICE_TYPE_ENCODER == device_type)
+    {
+        encoder_param.w = (uint32_t)width;
+        encoder_param.h = (uint32_t)height;
+        encoder_param.fps = (uint32_t)frame_rate;
+        encoder_param.bit_8_10 = bit_8_10;
+        // 0 h264, 1 h265, 2 av1, 3 jpeg
+        encoder_param.code_format = (EN_AV1 == codec) ? 2 :
+            (EN_JPEG == codec) ? 3 :
+            (EN_H265 == codec) ? 1 : 0;
+        return check_hw_info_encoder_need_load(&encoder_param);
+    }
+    // no estimate for scaler and AI, only their instance count is checked
+    return 0;
+}
+
+static int batch_request_need_load(const ni_rsrc_alloc_request_t *p_request)
+{
+    return ni_rsrc_estimate_need_load(p_request->device_type,
+                                      p_request->codec, p_request->width,
+                                      p_request->height, p_request->frame_rate,
+                                      p_request->bit_depth);
+}
+
+static bool batch_card_fits(const ni_rsrc_batch_card_t *p_card, int type,
+                            int need_load)
+{
+    return p_card->present[type] &&
+        p_card->model_load[type] + need_load < 100 &&
+        p_card->task_num[type] < NI_MAX_CONTEXTS_PER_HW_INSTANCE;
+}
+
+static int batch_card_rank(const ni_rsrc_batch_card_t *p_card, int type,
+                           ni_alloc_rule_t rule)
+{
+    if (EN_ALLOC_LEAST_INSTANCE == rule)
+    {
+        return p_card->task_num[type];
+    }
+    return (NI_DEVICE_TYPE_ENCODER == type) ? p_card->model_load[type] :
+                                              p_card->load[type];
+}
+
+static void batch_card_add(ni_rsrc_batch_card_t *p_card, int type,
+                           int need_load)
+{
+    // need_load is a model load estimate; load is the firmware's measured
+    // figure and is left as queried
+    p_card->model_load[type] += need_load;
+    p_card->task_num[type]++;
+}
+
+/*!*****************************************************************************
+*   \brief      Query every card listed for the requested device types once,
+*               refresh their shared records and fill p_cards, indexed by guid
+*******************************************************************************/
+static void batch_query_cards(ni_device_queue_t *p_device_queue,
+                              const bool *p_type_needed,
+                              ni_rsrc_batch_card_t *p_cards)
+{
+    ni_session_context_t session_ctx;
+    ni_device_context_t *p_device_context;
+    ni_rsrc_batch_card_t *p_card;
+    ni_device_handle_t handle;
+    uint32_t max_io_size;
+    int type, i, guid;
+
+    for (type = 0; type < NI_DEVICE_TYPE_XCODER_MAX; type++)
+    {
+        for (i = 0; p_type_needed[type] &&
+             i < (int)p_device_queue->xcoder_cnt[type]; i++)
+        {
+            guid = p_device_queue->xcoders[type][i];
+            if (guid >= 0 && guid < NI_MAX_DEVICE_CNT)
+            {
+                p_cards[guid].present[type] = true;
+            }
+        }
+    }
+
+    ni_device_session_context_init(&session_ctx);
+    for (guid = 0; guid < NI_MAX_DEVICE_CNT; guid++)
+    {
+        p_card = &p_cards[guid];
+        p_card->numa_node = -1;
+        handle = NI_INVALID_DEVICE_HANDLE;
+
+        // all modules of a card share its block device: open it once
+        for (type = 0; type < NI_DEVICE_TYPE_XCODER_MAX; type++)
+        {
+            if (!p_card->present[type])
+            {
+                continue;
+            }
+            p_card->present[type] = false;
+            p_device_context =
+                ni_rsrc_get_device_context((ni_device_type_t)type, guid);
+            if (!p_device_context)
+            {
+                continue;
+            }
+            if (NI_INVALID_DEVICE_HANDLE == handle)
+            {
+                handle = ni_device_open(p_device_context->p_device_info->dev_name,
+                                        &max_io_size);
+            }
+            if (NI_INVALID_DEVICE_HANDLE == handle)
+            {
+                ni_log(NI_LOG_ERROR, "ERROR %s() ni_device_open() %s: %s\n",
+                       __func__, p_device_context->p_device_info->dev_name,
+                       strerror(NI_ERRNO));
+                ni_rsrc_free_device_context(p_device_context);
+                continue;
+            }
+
+            session_ctx.device_handle = handle;
+            session_ctx.blk_io_handle = handle;
+            session_ctx.hw_id = p_device_context->p_device_info->hw_id;
+#ifdef _WIN32
+            session_ctx.event_handle = ni_create_event();
+#endif
+            if (NI_RETCODE_SUCCESS ==
+                ni_device_session_query(&session_ctx, (ni_device_type_t)type))
+            {
+#ifdef _WIN32
+                if (WAIT_ABANDONED == WaitForSingleObject(p_device_context->lock, INFINITE))
+                {
+                    ni_log(NI_LOG_ERROR, "ERROR: %s() failed to obtain mutex: %p\n",
+                           __func__, p_device_context->lock);
+                }
+                ni_rsrc_update_record(p_device_context, &session_ctx);
+                ReleaseMutex(p_device_context->lock);
+#elif __linux__ || __APPLE__
+                lockf(p_device_context->lock, F_LOCK, 0);
+                ni_rsrc_update_record(p_device_context, &session_ctx);
+                lockf(p_device_context->lock, F_ULOCK, 0);
+#endif
+                p_card->present[type] = true;
+                p_card->load[type] =
+                    session_ctx.load_query.total_contexts ?
+                    (int)session_ctx.load_query.current_load : 0;
+                p_card->model_load[type] =
+                    (int)session_ctx.load_query.fw_model_load;
+                p_card->task_num[type] =
+                    (int)session_ctx.load_query.total_contexts;
+                p_card->numa_node = ni_rsrc_get_numa_node(p_device_context->p_device_info);
+            } else
+            {
+                ni_log(NI_LOG_ERROR, "ERROR: query %s %s.%d\n",
+                       g_device_type_str[type],
+                       p_device_context->p_device_info->dev_name,
+                       p_device_context->p_device_info->hw_id);
+            }
+#ifdef _WIN32
+            ni_close_event(session_ctx.event_handle);
+            session_ctx.event_handle = NI_INVALID_EVENT_HANDLE;
+#endif
+            ni_rsrc_free_device_context(p_device_context);
+        }
+
+        if (NI_INVALID_DEVICE_HANDLE != handle)
+        {
+            ni_device_close(handle);
+        }
+    }
+    ni_device_session_context_clear(&session_ctx);
+}
+
+/*!*****************************************************************************
+*   \brief      Allocate resources for a group of sessions at once
+*
+*   \param[in,out] p_requests  array of requests, p_device_context and load
+*                              are filled in on success
+*   \param[in]  count          number of requests
+*   \param[in]  rule           allocation rule used to rank the cards
+*   \param[in]  same_card      1 to place all requests on one card, 0 to place
+*                              each request on its own best card
+*
+*   \return     NI_RETCODE_SUCCESS, NI_RETCODE_ERROR_RESOURCE_UNAVAILABLE,
+*               NI_RETCODE_INVALID_PARAM or NI_RETCODE_FAILURE
+*******************************************************************************/
+ni_retcode_t ni_rsrc_allocate_batch(ni_rsrc_alloc_request_t *p_requests,
+                                    int count,
+                                    ni_alloc_rule_t rule,
+                                    int same_card)
+{
+    ni_device_pool_t *p_device_pool = NULL;
+    ni_rsrc_batch_card_t *p_cards = NULL;
+    ni_rsrc_batch_card_t trial;
+    int *p_need_load = NULL;
+    int *p_placement = NULL;
+    bool type_needed[NI_DEVICE_TYPE_XCODER_MAX] = {false};
+    ni_retcode_t retval = NI_RETCODE_FAILURE;
+    int caller_numa_node = -1;
+    int best_guid, best_rank, rank;
+    bool best_local, local, fits;
+    int i, guid, type;
+
+    if (!p_requests || count <= 0)
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s() invalid input\n", __func__);
+        return NI_RETCODE_INVALID_PARAM;
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (!IS_XCODER_DEVICE_TYPE(p_requests[i].device_type))
+        {
+            ni_log(NI_LOG_ERROR, "ERROR: %s() request %d: device type %d is "
+                   "not allowed\n", __func__, i, p_requests[i].device_type);
+            return NI_RETCODE_INVALID_PARAM;
+        }
+        type_needed[p_requests[i].device_type] = true;
+        p_requests[i].p_device_context = NULL;
+        p_requests[i].load = 0;
+    }
+
+    p_cards = (ni_rsrc_batch_card_t *)calloc(NI_MAX_DEVICE_CNT,
+                                             sizeof(ni_rsrc_batch_card_t));
+    p_need_load = (int *)malloc(sizeof(int) * count);
+    p_placement = (int *)malloc(sizeof(int) * count);
+    if (!p_cards || !p_need_load || !p_placement)
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s() malloc failed\n", __func__);
+        retval = NI_RETCODE_ERROR_MEM_ALOC;
+        LRETURN;
+    }
+    for (i = 0; i < count; i++)
+    {
+        p_need_load[i] = batch_request_need_load(&p_requests[i]);
+        p_placement[i] = -1;
+    }
+    if (EN_ALLOC_LEAST_LOAD_NUMA == rule)
+    {
+        caller_numa_node = ni_get_current_numa_node();
+    }
+
+    p_device_pool = ni_rsrc_get_device_pool();
+    if (!p_device_pool)
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s() Could not get device pool\n", __func__);
+        LRETURN;
+    }
+
+#ifdef _WIN32
+    if (WAIT_ABANDONED == WaitForSingleObject(p_device_pool->lock, INFINITE)) // no time-out interval) //we got the mutex
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s() failed to obtain mutex: %p\n", __func__, p_device_pool->lock);
+    }
+#elif __linux__ || __APPLE__
+    lockf(p_device_pool->lock, F_LOCK, 0);
+#endif
+
+    batch_query_cards(p_device_pool->p_device_queue, type_needed, p_cards);
+
+    retval = NI_RETCODE_ERROR_RESOURCE_UNAVAILABLE;
+    if (same_card)
+    {
+        // the card that fits the whole batch with the least load of the
+        // requested types, a card on the caller's node first for the NUMA rule
+        best_guid = -1;
+        best_rank = 0;
+        best_local = false;
+        for (guid = 0; guid < NI_MAX_DEVICE_CNT; guid++)
+        {
+            trial = p_cards[guid];
+            fits = true;
+            rank = 0;
+            for (i = 0; i < count && fits; i++)
+            {
+                type = p_requests[i].device_type;
+                fits = batch_card_fits(&trial, type, p_need_load[i]);
+                rank += batch_card_rank(&p_cards[guid], type, rule);
+                batch_card_add(&trial, type, p_need_load[i]);
+            }
+            if (!fits)
+            {
+                continue;
+            }
+            local = (caller_numa_node >= 0 &&
+                     p_cards[guid].numa_node == caller_numa_node);
+            if (best_guid < 0 || (local && !best_local) ||
+                (local == best_local && rank < best_rank))
+            {
+                best_guid = guid;
+                best_rank = rank;
+                best_local = local;
+            }
+        }
+        if (best_guid < 0)
+        {
+            ni_log(NI_LOG_ERROR, "ERROR: %s() no card fits all %d requests\n",
+                   __func__, count);
+            LRETURN;
+        }
+        for (i = 0; i < count; i++)
+        {
+            p_placement[i] = best_guid;
+        }
+    } else
+    {
+        // in request order, each on the best card given what the batch
+        // already placed
+        for (i = 0; i < count; i++)
+        {
+            type = p_requests[i].device_type;
+            best_guid = -1;
+            best_rank = 0;
+            best_local = false;
+            for (guid = 0; guid < NI_MAX_DEVICE_CNT; guid++)
+            {
+                if (!batch_card_fits(&p_cards[guid], type, p_need_load[i]))
+                {
+                    continue;
+                }
+                rank = batch_card_rank(&p_cards[guid], type, rule);
+                local = (caller_numa_node >= 0 &&
+                         p_cards[guid].numa_node == caller_numa_node);
+                if (best_guid < 0 || (local && !best_local) ||
+                    (local == best_local && rank < best_rank))
+                {
+                    best_guid = guid;
+                    best_rank = rank;
+                    best_local = local;
+                }
+            }
+            if (best_guid < 0)
+            {
+                ni_log(NI_LOG_ERROR, "ERROR: %s() no card fits request %d "
+                       "(%s)\n", __func__, i, g_device_type_str[type]);
+                LRETURN;
+            }
+            batch_card_add(&p_cards[best_guid], type, p_need_load[i]);
+            p_placement[i] = best_guid;
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        p_requests[i].p_device_context = ni_rsrc_get_device_context(
+            p_requests[i].device_type, p_placement[i]);
+        if (!p_requests[i].p_device_context)
+        {
+            ni_log(NI_LOG_ERROR,
+                   "ERROR: %s() ni_rsrc_get_device_context() failed\n", __func__);
+            retval = NI_RETCODE_FAILURE;
+            LRETURN;
+        }
+        p_requests[i].load = (uint64_t)p_need_load[i];
+        ni_log(NI_LOG_DEBUG, "%s: request %d %s -> guid %d, load %d\n",
+               __func__, i, g_device_type_str[p_requests[i].device_type],
+               p_placement[i], p_need_load[i]);
+    }
+    retval = NI_RETCODE_SUCCESS;
+
+END:
+
+    if (p_device_pool)
+    {
+#ifdef _WIN32
+        ReleaseMutex(p_device_pool->lock);
+#elif __linux__ || __APPLE__
+        lockf(p_device_pool->lock, F_ULOCK, 0);
+#endif
+        ni_rsrc_free_device_pool(p_device_pool);
+    }
+    if (NI_RETCODE_SUCCESS != retval)
+    {
+        for (i = 0; i < count; i++)
+        {
+            if (p_requests[i].p_device_context)
+            {
+                ni_rsrc_free_device_context(p_requests[i].p_device_context);
+                p_requests[i].p_device_context = NULL;
+            }
+        }
+    }
+    free(p_placement);
+    free(p_need_load);
+    free(p_cards);
+    return retval;
+}
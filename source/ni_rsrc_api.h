@@ -105,6 +105,10 @@ typedef struct _ni_device_info
   char                   blk_name[NI_MAX_DEVICE_NAME_LEN];
   int                    hw_id;
   int                    module_id; /*! global unique id, assigned at creation */
+  // load, model_load and active_num_inst are current in the copies returned
+  // by ni_rsrc_get_device_info() and ni_rsrc_list_all_devices(); the shared
+  // record mapped by ni_rsrc_get_device_context() does not track them on
+  // Linux and MacOS, the shared load table does
   int                    load;       /*! p_load value retrieved from f/w */
   int                    model_load; /*! p_load value modelled internally */
   uint64_t               xcode_load_pixel; /*! xcode p_load in pixels: encoder only */
@@ -133,8 +137,17 @@ typedef struct _ni_device_info
 
   ni_sw_instance_info_t sw_instance[NI_MAX_CONTEXTS_PER_HW_INSTANCE];
   ni_lock_handle_t lock;
+
+  /*! host topology, recorded at resource init. Records written by an older
+   *  init_rsrc end before these fields: they are only valid if
+   *  topology_magic is NI_DEVICE_INFO_TOPOLOGY_MAGIC */
+  int                    numa_node;    /*! NUMA node of the card, -1 if unknown */
+  char                   pcie_addr[16]; /*! PCIe address, e.g. 0000:0a:00.0 */
+  uint32_t               topology_magic;
 } ni_device_info_t;
 
+#define NI_DEVICE_INFO_TOPOLOGY_MAGIC 0x4E554D41   // "NUMA"
+
 // This structure is very big (2.6MB). Recommend storing in heap
 typedef struct _ni_device 
 {
@@ -147,6 +160,7 @@ typedef struct _ni_device_context
   char   shm_name[NI_MAX_DEVICE_NAME_LEN];
   ni_lock_handle_t    lock;
   ni_device_info_t * p_device_info;
+  int                 broker_granted; /*! allocated by the resource broker */
 } ni_device_context_t;
 
 typedef struct _ni_card_info_quadra
@@ -157,6 +171,7 @@ typedef struct _ni_card_info_quadra
   int task_num;
   int max_task_num;
   int shared_mem_usage;
+  int numa_node;
 } ni_card_info_quadra_t;
 
 typedef struct _ni_hw_device_info_quadra
@@ -225,6 +240,19 @@ typedef struct _ni_hw_device_info_quadra_coder_param
     ni_hw_device_info_quadra_scaler_param_t *scaler_param;
     ni_hw_device_info_quadra_ai_param_t *ai_param;
 }ni_hw_device_info_quadra_coder_param_t;
+
+/*! one session of a batch allocation, see ni_rsrc_allocate_batch() */
+typedef struct _ni_rsrc_alloc_request
+{
+    ni_device_type_t device_type;/*! decoder, encoder, scaler or AI*/
+    ni_codec_t codec;/*! encoder codec, used for the load estimate*/
+    int width;
+    int height;
+    int frame_rate;
+    int bit_depth;/*! 8 or 10, 0 for 8*/
+    ni_device_context_t *p_device_context;/*! out: allocated device*/
+    uint64_t load;/*! out: estimated model load (percent) of this session*/
+}ni_rsrc_alloc_request_t;
 typedef struct _ni_device_vf_ns_id
 {
     uint16_t vf_id;
@@ -250,7 +278,9 @@ typedef struct _ni_device_extra_info
 typedef enum
 {
     EN_ALLOC_LEAST_LOAD,
-    EN_ALLOC_LEAST_INSTANCE
+    EN_ALLOC_LEAST_INSTANCE,
+    EN_ALLOC_LEAST_LOAD_NUMA /*! least load among the cards on the caller's
+                                NUMA node, any card if none is local */
 } ni_alloc_rule_t;
 
 /*!******************************************************************************
@@ -539,7 +569,7 @@ LIB_API ni_device_pool_t* ni_rsrc_get_device_pool(void);
 /*!*****************************************************************************
 *   \brief      Free all resources taken by the device pool
 *
-*   \param[in]  p_device_pool  Poiner to a device pool struct
+*   \param[in]  p_device_pool  Pointer to a device pool struct
 *
 *   \return     None
 *******************************************************************************/
@@ -637,6 +667,7 @@ LIB_API void ni_hw_device_info_free_quadra(ni_hw_device_info_quadra_t *p_hw_devi
  *  \param[in] task_mode: affect the scheduling strategy,
  *                        1 - both the load_num and task_num should consider, usually applied to live scenes
  *                        0 - only consider the task_num, don not care the load_num
+ *                        in both modes a card on the caller's NUMA node is preferred when cards tie
  *  \param[in] hw_info_threshold_param : an array of threshold including device type task threshold and load threshold
  *                                       in hw_mode fill the arry with both encoder and decoder threshold or 
  *                                       fill the arry with preferential device type threshold when don not in hw_mode
@@ -694,6 +725,36 @@ LIB_API ni_device_context_t* ni_rsrc_allocate_auto( ni_device_type_t device_type
                                                     int frame_rate,
                                                     uint64_t *p_load);
 
+/*!*****************************************************************************
+*   \brief      Allocate resources for a group of sessions at once, e.g. the
+*               decoder, scaler and encoders of an ABR ladder. The device pool
+*               is locked once and every card queried once for all requests.
+*
+*   \param[in,out] p_requests  array of requests, p_device_context and load
+*                              are filled in on success
+*   \param[in]  count          number of requests
+*   \param[in]  rule           allocation rule used to rank the cards
+*   \param[in]  same_card      1 to place all requests on one card so frames
+*                              can be shared in hw without cross card copies,
+*                              0 to place each request on its own best card
+*
+*   \return     NI_RETCODE_SUCCESS on success,
+*               NI_RETCODE_ERROR_RESOURCE_UNAVAILABLE if the requests do not
+*               fit, NI_RETCODE_INVALID_PARAM or NI_RETCODE_FAILURE otherwise.
+*               Either all requests get a device or none.
+*
+*   Note:  a card is only used for a request while the estimated model load
+*          stays below 100 and the instance count below
+*          NI_MAX_CONTEXTS_PER_HW_INSTANCE, the limits ni_check_hw_info()
+*          applies. Load is only estimated for decoders and encoders.
+*   Note:  each returned ni_device_context_t must be released by calling
+*          ni_rsrc_free_device_context.
+*******************************************************************************/
+LIB_API ni_retcode_t ni_rsrc_allocate_batch(ni_rsrc_alloc_request_t *p_requests,
+                                            int count,
+                                            ni_alloc_rule_t rule,
+                                            int same_card);
+
 #ifdef __cplusplus
 }
 #endif
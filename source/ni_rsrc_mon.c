@@ -29,6 +29,9 @@
 #if __linux__ || __APPLE__
 #include <unistd.h>
 #include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #endif
 
 #include <stdio.h>
@@ -73,7 +76,8 @@ enum outFormat
   FMT_JSON,
   FMT_JSON1,
   FMT_JSON2,
-  FMT_EXTRA
+  FMT_EXTRA,
+  FMT_OPENMETRICS
 };
 
 #ifdef _WIN32
@@ -155,36 +159,11 @@ void get_pcie_addr(char *device_name, char *pcie)
  *
  *  \param[in] char *device_name
  *
- *  \return    int atoi(cmd_ret)
+ *  \return    numa node of the device, -1 if unknown
  *******************************************************************************/
 int get_numa_node(char *device_name)
 {
-  int ret = -1;
-  FILE *cmd_fp;
-  char *ptr = NULL;
-  char cmd[128] = {0};
-  char cmd_ret[64] = {0};
-  
-  if(!device_name)
-  {
-    return ret;
-  }
-  ptr = device_name + 5;
-  snprintf(cmd, sizeof(cmd) - 1, "cat /sys/block/%s/device/*/numa_node",ptr);
-  cmd_fp = popen(cmd, "r");
-  if (!cmd_fp)
-  {
-    return ret;
-  }
-  if (fgets(cmd_ret, sizeof(cmd_ret)/sizeof(cmd_ret[0]), cmd_fp) == 0)
-  {
-    goto get_numa_node_ret;
-  }
-  ret = atoi(cmd_ret);
-
-get_numa_node_ret:
-  pclose(cmd_fp);
-  return ret;
+  return ni_get_device_numa_node(device_name);
 }
 
 #endif //__linux__
@@ -2278,6 +2257,1046 @@ void print_extra(ni_device_queue_t *p_device_queue, ni_session_context_t *p_sess
   free(module_ids);
 }
 
+/*!*****************************************************************************
+ *  \brief  Print the libxcoder performance counters of every process using
+ *          the library (except this one) and their total
+ *
+ *  \param  format  output format, JSON formats print a JSON object
+ *
+ *  \return none
+ ******************************************************************************/
+void print_perf_counters(enum outFormat format)
+{
+  ni_perf_counters_t procs[NI_PERF_MAX_PROCESSES];
+  ni_perf_counters_t total = {0};
+  dyn_str_buf_t output_buf = {0};
+  int json = (format == FMT_JSON || format == FMT_JSON1 || format == FMT_JSON2);
+  int32_t self_pid = 0;
+  int count, i, j;
+
+#ifndef _WIN32
+  self_pid = (int32_t)getpid();
+#endif
+  count = ni_perf_counters_read(procs, NI_PERF_MAX_PROCESSES, NULL);
+  if (count < 0)
+  {
+    fprintf(stderr, "ERROR: libxcoder performance counters not available\n");
+    return;
+  }
+  count = count < NI_PERF_MAX_PROCESSES ? count : NI_PERF_MAX_PROCESSES;
+  total.num_counters = NI_PERF_CTR_MAX;
+  for (i = 0; i < count; i++)
+  {
+    if (procs[i].pid == self_pid)
+    {
+      continue;
+    }
+    for (j = 0; j < NI_PERF_CTR_MAX; j++)
+    {
+      total.value[j] += procs[i].value[j];
+    }
+    total.pid++;
+  }
+
+  if (json)
+  {
+    strcat_dyn_buf(&output_buf, "{\n  \"perf_counters\": {\n"
+                   "    \"processes\": %d,\n    \"total\": {", total.pid);
+    for (j = 0; j < NI_PERF_CTR_MAX; j++)
+    {
+      strcat_dyn_buf(&output_buf, "%s\"%s\": %" PRIu64, j ? ", " : " ",
+                     ni_perf_counter_name((ni_perf_counter_t)j),
+                     total.value[j]);
+    }
+    strcat_dyn_buf(&output_buf, " },\n    \"process\": [");
+    for (i = 0, j = 0; i < count; i++)
+    {
+      int k;
+      if (procs[i].pid == self_pid)
+      {
+        continue;
+      }
+      strcat_dyn_buf(&output_buf, "%s\n      { \"pid\": %d", j++ ? "," : "",
+                     procs[i].pid);
+      for (k = 0; k < NI_PERF_CTR_MAX; k++)
+      {
+        strcat_dyn_buf(&output_buf, ", \"%s\": %" PRIu64,
+                       ni_perf_counter_name((ni_perf_counter_t)k),
+                       procs[i].value[k]);
+      }
+      strcat_dyn_buf(&output_buf, " }");
+    }
+    strcat_dyn_buf(&output_buf, "\n    ]\n  }\n}\n");
+  } else
+  {
+    strcat_dyn_buf(&output_buf, "Num libxcoder processes: %d\n", total.pid);
+    strcat_dyn_buf(&output_buf,
+                   "%-8s %-9s %-9s %-9s %-9s %-7s %-6s %-10s %-10s %-9s "
+                   "%-9s %-7s %-6s %-6s %-6s %-9s\n",
+                   "PID", "DATA_RD", "DATA_WR", "CTRL_RD", "CTRL_WR", "ADMIN",
+                   "ERR", "MB_READ", "MB_WRITE", "QUERIES", "RETRIES",
+                   "BOUNCE", "POOLX", "TS_OVF", "WBFULL", "IO");
+    for (i = 0; i <= count; i++)
+    {
+      // the last row is the total
+      const ni_perf_counters_t *p = (i < count) ? &procs[i] : &total;
+      const uint64_t *v = p->value;
+      char pid_str[16];
+
+      if (i < count && p->pid == self_pid)
+      {
+        continue;
+      }
+      if (i < count)
+      {
+        snprintf(pid_str, sizeof(pid_str), "%d", p->pid);
+      } else
+      {
+        snprintf(pid_str, sizeof(pid_str), "TOTAL");
+      }
+      strcat_dyn_buf(&output_buf,
+                     "%-8s %-9" PRIu64 " %-9" PRIu64 " %-9" PRIu64 " %-9" PRIu64
+                     " %-7" PRIu64 " %-6" PRIu64 " %-10" PRIu64 " %-10" PRIu64
+                     " %-9" PRIu64 " %-9" PRIu64 " %-7" PRIu64 " %-6" PRIu64
+                     " %-6" PRIu64 " %-6" PRIu64 " %-9" PRIu64 "\n",
+                     pid_str, v[NI_PERF_CTR_NVME_READ_DATA],
+                     v[NI_PERF_CTR_NVME_WRITE_DATA],
+                     v[NI_PERF_CTR_NVME_READ_CTRL],
+                     v[NI_PERF_CTR_NVME_WRITE_CTRL], v[NI_PERF_CTR_NVME_ADMIN],
+                     v[NI_PERF_CTR_NVME_ERRORS],
+                     v[NI_PERF_CTR_BYTES_READ] >> 20,
+                     v[NI_PERF_CTR_BYTES_WRITTEN] >> 20,
+                     v[NI_PERF_CTR_QUERIES],
+                     v[NI_PERF_CTR_QUERIES] - v[NI_PERF_CTR_QUERY_HITS],
+                     v[NI_PERF_CTR_BOUNCE_COPIES],
+                     v[NI_PERF_CTR_BUF_POOL_EXPAND],
+                     v[NI_PERF_CTR_TS_QUEUE_OVERFLOW],
+                     v[NI_PERF_CTR_WRITE_BUFFER_FULL],
+                     v[NI_PERF_CTR_NVME_IO]);
+    }
+  }
+
+  if (output_buf.str_buf)
+      printf("%s", output_buf.str_buf);
+  clear_dyn_str_buf(&output_buf);
+}
+
+/*!*****************************************************************************
+ *  Persistent collector shared by the OpenMetrics exporter (-o openmetrics,
+ *  -M, -U) and the continuous mode (-c)
+ *
+ *  Every Quadra card is queried by its own thread with its own session
+ *  context, device handles are kept open across intervals in
+ *  device_handles[][], and the card table is only rebuilt when the device
+ *  queue changes.
+ ******************************************************************************/
+#define OM_CONTENT_TYPE                                                        \
+    "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+typedef enum _mon_field
+{
+  MON_UP, MON_LOAD, MON_MODEL_LOAD, MON_FW_LOAD, MON_INSTANCES, MON_MEM,
+  MON_SHARE_MEM, MON_P2P_MEM, MON_FIELD_MAX
+} mon_field_t;
+
+typedef struct _mon_module
+{
+  ni_device_type_t device_type;
+  int32_t module_id;
+  int32_t hw_id;
+  char dev_name[NI_MAX_DEVICE_NAME_LEN];
+  uint8_t fw_rev[8];
+  int up;                       // last query succeeded
+  uint32_t load;
+  uint32_t model_load;
+  uint32_t fw_load;
+  uint32_t instances;
+  uint32_t mem_usage;
+  uint32_t share_mem_usage;
+  uint32_t p2p_mem_usage;
+  int detail_up;                // last detail query succeeded
+  ni_instance_mgr_detail_status_v1_t detail;
+  // continuous mode: what was last printed
+  int reported_valid;
+  uint32_t reported[MON_FIELD_MAX];
+  ni_instance_mgr_detail_status_v1_t reported_detail;
+} mon_module_t;
+
+typedef struct _mon_card
+{
+  mon_module_t modules[NI_DEVICE_TYPE_XCODER_MAX];
+  int module_count;
+  ni_session_context_t *p_ctx;  // private to the card's collector thread
+  int query_detail;             // also get decoder/encoder instance details
+  ni_pthread_t thread;
+  int thread_started;
+  int nvme_up;                  // ni_query_nvme_status succeeded
+  uint32_t tp_fw_load;
+  uint32_t pcie_load;
+  uint32_t pcie_throughput;     // GBps * 10
+} mon_card_t;
+
+typedef struct _mon_collector
+{
+  ni_device_queue_t queue;      // snapshot the card table was built from
+  mon_card_t *cards;
+  int card_count;
+  int query_detail;
+  dyn_str_buf_t text;           // last rendered exposition
+  ni_perf_counters_t procs[NI_PERF_MAX_PROCESSES];
+} mon_collector_t;
+
+static void mon_free_cards(mon_collector_t *p_mon)
+{
+  int i;
+  for (i = 0; i < p_mon->card_count; i++)
+  {
+    if (p_mon->cards[i].p_ctx)
+    {
+      ni_device_session_context_free(p_mon->cards[i].p_ctx);
+    }
+  }
+  free(p_mon->cards);
+  p_mon->cards = NULL;
+  p_mon->card_count = 0;
+}
+
+/*!*****************************************************************************
+ *  \brief  Build the card table from a device queue snapshot, grouping the
+ *          decoder/encoder/scaler/AI modules of each Quadra
+ *
+ *  \return 0 on success, -1 on failure
+ ******************************************************************************/
+static int mon_build_cards(mon_collector_t *p_mon, const ni_device_queue_t *p_queue)
+{
+  ni_device_context_t *p_device_context;
+  ni_device_type_t device_type;
+  int card_count = (int)p_queue->xcoder_cnt[NI_DEVICE_TYPE_ENCODER];
+  int guid;
+
+  mon_free_cards(p_mon);
+  p_mon->queue = *p_queue;
+  if (!card_count)
+  {
+    return 0;
+  }
+  p_mon->cards = (mon_card_t *)calloc(card_count, sizeof(mon_card_t));
+  if (!p_mon->cards)
+  {
+    fprintf(stderr, "ERROR: calloc() failed for mon_card_t\n");
+    return -1;
+  }
+  p_mon->card_count = card_count;
+
+  for (guid = 0; guid < card_count; guid++)
+  {
+    mon_card_t *p_card = &p_mon->cards[guid];
+
+    p_card->p_ctx = ni_device_session_context_alloc_init();
+    if (!p_card->p_ctx)
+    {
+      fprintf(stderr, "ERROR: cannot allocate ni_session_context_t\n");
+      return -1;
+    }
+    p_card->query_detail = p_mon->query_detail;
+    for (device_type = NI_DEVICE_TYPE_DECODER;
+         device_type < NI_DEVICE_TYPE_XCODER_MAX; device_type++)
+    {
+      mon_module_t *p_module;
+
+      if (p_queue->xcoders[device_type][guid] == -1)
+      {
+        continue;
+      }
+      p_device_context = ni_rsrc_get_device_context(
+          device_type, p_queue->xcoders[device_type][guid]);
+      if (!p_device_context)
+      {
+        continue;
+      }
+      p_module = &p_card->modules[p_card->module_count++];
+      p_module->device_type = device_type;
+      p_module->module_id = p_device_context->p_device_info->module_id;
+      p_module->hw_id = p_device_context->p_device_info->hw_id;
+      snprintf(p_module->dev_name, sizeof(p_module->dev_name), "%s",
+               p_device_context->p_device_info->dev_name);
+      memcpy(p_module->fw_rev, p_device_context->p_device_info->fw_rev,
+             sizeof(p_module->fw_rev));
+      ni_rsrc_free_device_context(p_device_context);
+    }
+  }
+  return 0;
+}
+
+/*!*****************************************************************************
+ *  \brief  Collector thread of one card: query every module through the
+ *          cached device handle, then the NVMe/TP/PCIe status of the card
+ ******************************************************************************/
+static void *mon_collect_card(void *arg)
+{
+  mon_card_t *p_card = (mon_card_t *)arg;
+  ni_session_context_t *p_ctx = p_card->p_ctx;
+  ni_device_handle_t last_handle = NI_INVALID_DEVICE_HANDLE;
+  const uint8_t *p_last_fw_rev = NULL;
+  ni_load_query_t *p_load = &p_ctx->load_query;
+  int i;
+
+  for (i = 0; i < p_card->module_count; i++)
+  {
+    mon_module_t *p_module = &p_card->modules[i];
+    ni_device_type_t xcoder_type = GET_XCODER_DEVICE_TYPE(p_module->device_type);
+    ni_device_handle_t handle = device_handles[xcoder_type][p_module->module_id];
+
+    p_module->up = 0;
+    if (handle == NI_INVALID_DEVICE_HANDLE)
+    {
+      handle = ni_device_open(p_module->dev_name, &p_ctx->max_nvme_io_size);
+      if (handle == NI_INVALID_DEVICE_HANDLE)
+      {
+        continue;
+      }
+      device_handles[xcoder_type][p_module->module_id] = handle;
+    }
+    p_ctx->device_handle = p_ctx->blk_io_handle = handle;
+    p_ctx->hw_id = p_module->hw_id;
+    memcpy(p_ctx->fw_rev, p_module->fw_rev, sizeof(p_module->fw_rev));
+
+    if (ni_device_session_query(p_ctx, xcoder_type) != NI_RETCODE_SUCCESS)
+    {
+      remove_device_from_saved(p_module->device_type, p_module->module_id,
+                               handle);
+      ni_device_close(handle);
+      continue;
+    }
+    if (!p_load->total_contexts)
+    {
+      p_load->current_load = 0;
+    }
+    p_module->load =
+#ifdef XCODER_311
+        p_load->current_load;
+#else
+        (p_load->total_contexts == 0 || p_load->current_load > p_load->fw_load) ?
+        p_load->current_load : p_load->fw_load;
+#endif
+    p_module->model_load = p_load->fw_model_load;
+    p_module->fw_load = p_load->fw_load;
+    p_module->instances = p_load->total_contexts;
+    p_module->mem_usage = p_load->fw_video_mem_usage;
+    p_module->share_mem_usage = p_load->fw_share_mem_usage;
+    p_module->p2p_mem_usage = p_load->fw_p2p_mem_usage;
+    p_module->up = 1;
+    last_handle = handle;
+
+    // one command returns the details of all instances of the module
+    p_module->detail_up = 0;
+    if (p_card->query_detail &&
+        (p_module->device_type == NI_DEVICE_TYPE_DECODER ||
+         p_module->device_type == NI_DEVICE_TYPE_ENCODER) &&
+        ni_cmp_fw_api_ver((char *)&p_module->fw_rev[NI_XCODER_REVISION_API_MAJOR_VER_IDX],
+                          "6i") >= 0)
+    {
+      ni_retcode_t rc;
+      if (ni_cmp_fw_api_ver((char *)&p_module->fw_rev[NI_XCODER_REVISION_API_MAJOR_VER_IDX],
+                            "6r6") < 0)
+      {
+        memset(&p_module->detail, 0, sizeof(p_module->detail));
+        rc = ni_device_session_query_detail(p_ctx, xcoder_type,
+            (ni_instance_mgr_detail_status_t *)&p_module->detail);
+      } else
+      {
+        rc = ni_device_session_query_detail_v1(p_ctx, xcoder_type,
+                                               &p_module->detail);
+      }
+      p_module->detail_up = (rc == NI_RETCODE_SUCCESS);
+    }
+    p_last_fw_rev = p_module->fw_rev;
+  }
+
+  p_card->nvme_up = 0;
+  if (last_handle != NI_INVALID_DEVICE_HANDLE &&
+      ni_cmp_fw_api_ver((char *)&p_last_fw_rev[NI_XCODER_REVISION_API_MAJOR_VER_IDX],
+                        "6O") >= 0)
+  {
+    ni_load_query_t nvme_status = {0};
+
+    p_ctx->device_handle = p_ctx->blk_io_handle = last_handle;
+    if (ni_query_nvme_status(p_ctx, &nvme_status) == NI_RETCODE_SUCCESS)
+    {
+      p_card->tp_fw_load = nvme_status.tp_fw_load;
+      p_card->pcie_load = nvme_status.pcie_load;
+      p_card->pcie_throughput = nvme_status.pcie_throughput;
+      p_card->nvme_up = 1;
+    }
+  }
+  return NULL;
+}
+
+/*!*****************************************************************************
+ *  \brief  Query all cards concurrently, one thread per card
+ ******************************************************************************/
+static void mon_collect(mon_collector_t *p_mon)
+{
+  int i;
+
+  for (i = 0; i < p_mon->card_count; i++)
+  {
+    mon_card_t *p_card = &p_mon->cards[i];
+    p_card->thread_started =
+        (ni_pthread_create(&p_card->thread, NULL, mon_collect_card, p_card) == 0);
+    if (!p_card->thread_started)
+    {
+      mon_collect_card(p_card);
+    }
+  }
+  for (i = 0; i < p_mon->card_count; i++)
+  {
+    if (p_mon->cards[i].thread_started)
+    {
+      ni_pthread_join(p_mon->cards[i].thread, NULL);
+    }
+  }
+}
+
+static const char *om_field_family[MON_FIELD_MAX][2] = {
+  {"ni_quadra_up", "1 if the last query of the module succeeded"},
+  {"ni_quadra_load_percent", "Realtime load, max of VPU and FW load"},
+  {"ni_quadra_model_load_percent", "Load estimated from framerate and resolution"},
+  {"ni_quadra_fw_load_percent", "Firmware system load"},
+  {"ni_quadra_instances", "Number of job instances"},
+  {"ni_quadra_mem_usage_percent", "Memory usage of the module"},
+  {"ni_quadra_share_mem_usage_percent", "Usage of memory shared across modules"},
+  {"ni_quadra_p2p_mem_usage_percent", "Memory usage by P2P"},
+};
+
+static uint32_t mon_module_field(const mon_module_t *p_module, mon_field_t field)
+{
+  switch (field)
+  {
+    case MON_UP:         return (uint32_t)p_module->up;
+    case MON_LOAD:       return p_module->load;
+    case MON_MODEL_LOAD: return p_module->model_load;
+    case MON_FW_LOAD:    return p_module->fw_load;
+    case MON_INSTANCES:  return p_module->instances;
+    case MON_MEM:        return p_module->mem_usage;
+    case MON_SHARE_MEM:  return p_module->share_mem_usage;
+    default:             return p_module->p2p_mem_usage;
+  }
+}
+
+/*!*****************************************************************************
+ *  \brief  Render the last collected values as OpenMetrics text into
+ *          p_om->text, reusing its buffer
+ ******************************************************************************/
+static void om_render(mon_collector_t *p_om, double scrape_seconds)
+{
+  ni_perf_counters_t total;
+  dyn_str_buf_t *p_text = &p_om->text;
+  int32_t self_pid = 0;
+  int field, i, j, proc_count;
+
+  p_text->str_len = 0;
+  if (p_text->str_buf)
+  {
+    p_text->str_buf[0] = '\0';
+  }
+
+  for (field = MON_UP; field < MON_FIELD_MAX; field++)
+  {
+    strcat_dyn_buf(p_text, "# TYPE %s gauge\n# HELP %s %s.\n",
+                   om_field_family[field][0], om_field_family[field][0],
+                   om_field_family[field][1]);
+    for (i = 0; i < p_om->card_count; i++)
+    {
+      for (j = 0; j < p_om->cards[i].module_count; j++)
+      {
+        const mon_module_t *p_module = &p_om->cards[i].modules[j];
+        if (field != MON_UP && !p_module->up)
+        {
+          continue;
+        }
+        strcat_dyn_buf(p_text, "%s{device=\"%s\",type=\"%s\",module=\"%d\"} %u\n",
+                       om_field_family[field][0], p_module->dev_name,
+                       g_device_type_str[p_module->device_type],
+                       p_module->module_id,
+                       mon_module_field(p_module, (mon_field_t)field));
+      }
+    }
+  }
+
+  strcat_dyn_buf(p_text, "# TYPE ni_quadra_tp_fw_load_percent gauge\n"
+                 "# HELP ni_quadra_tp_fw_load_percent TP firmware load.\n");
+  for (i = 0; i < p_om->card_count; i++)
+  {
+    if (p_om->cards[i].nvme_up && p_om->cards[i].module_count)
+    {
+      strcat_dyn_buf(p_text, "ni_quadra_tp_fw_load_percent{device=\"%s\"} %u\n",
+                     p_om->cards[i].modules[0].dev_name,
+                     p_om->cards[i].tp_fw_load);
+    }
+  }
+  strcat_dyn_buf(p_text, "# TYPE ni_quadra_pcie_load_percent gauge\n"
+                 "# HELP ni_quadra_pcie_load_percent PCIe load.\n");
+  for (i = 0; i < p_om->card_count; i++)
+  {
+    if (p_om->cards[i].nvme_up && p_om->cards[i].module_count)
+    {
+      strcat_dyn_buf(p_text, "ni_quadra_pcie_load_percent{device=\"%s\"} %u\n",
+                     p_om->cards[i].modules[0].dev_name,
+                     p_om->cards[i].pcie_load);
+    }
+  }
+  strcat_dyn_buf(p_text, "# TYPE ni_quadra_pcie_throughput_gigabytes_per_second gauge\n"
+                 "# HELP ni_quadra_pcie_throughput_gigabytes_per_second PCIe throughput.\n");
+  for (i = 0; i < p_om->card_count; i++)
+  {
+    if (p_om->cards[i].nvme_up && p_om->cards[i].module_count)
+    {
+      strcat_dyn_buf(p_text,
+                     "ni_quadra_pcie_throughput_gigabytes_per_second{device=\"%s\"} %.1f\n",
+                     p_om->cards[i].modules[0].dev_name,
+                     (double)p_om->cards[i].pcie_throughput / 10);
+    }
+  }
+
+  // libxcoder counters summed over the processes using the library, the
+  // queries of this monitor excluded
+#ifndef _WIN32
+  self_pid = (int32_t)getpid();
+#endif
+  proc_count = ni_perf_counters_read(p_om->procs, NI_PERF_MAX_PROCESSES, NULL);
+  if (proc_count >= 0)
+  {
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < proc_count && i < NI_PERF_MAX_PROCESSES; i++)
+    {
+      if (p_om->procs[i].pid == self_pid)
+      {
+        continue;
+      }
+      for (j = 0; j < NI_PERF_CTR_MAX && j < (int)p_om->procs[i].num_counters; j++)
+      {
+        total.value[j] += p_om->procs[i].value[j];
+      }
+      total.pid++;
+    }
+    for (j = 0; j < NI_PERF_CTR_MAX; j++)
+    {
+      const char *name = ni_perf_counter_name((ni_perf_counter_t)j);
+      strcat_dyn_buf(p_text, "# TYPE ni_libxcoder_%s counter\n"
+                     "ni_libxcoder_%s_total %" PRIu64 "\n",
+                     name, name, total.value[j]);
+    }
+    strcat_dyn_buf(p_text, "# TYPE ni_libxcoder_processes gauge\n"
+                   "ni_libxcoder_processes %d\n", total.pid);
+  }
+
+  strcat_dyn_buf(p_text, "# TYPE ni_rsrc_mon_scrape_duration_seconds gauge\n"
+                 "ni_rsrc_mon_scrape_duration_seconds %.6f\n# EOF\n",
+                 scrape_seconds);
+}
+
+/*!*****************************************************************************
+ *  \brief  Write the exposition to a textfile collector file; the file is
+ *          replaced atomically so readers never see a partial write
+ *
+ *  \return 0 on success, -1 on failure
+ ******************************************************************************/
+static int om_write_file(const mon_collector_t *p_om, const char *p_path)
+{
+  char tmp_path[512];
+  FILE *p_file;
+  int ret = 0;
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", p_path);
+  p_file = fopen(tmp_path, "w");
+  if (!p_file)
+  {
+    fprintf(stderr, "ERROR: cannot open %s: %s\n", tmp_path, strerror(NI_ERRNO));
+    return -1;
+  }
+  if (p_om->text.str_len &&
+      fwrite(p_om->text.str_buf, 1, p_om->text.str_len, p_file) !=
+          (size_t)p_om->text.str_len)
+  {
+    ret = -1;
+  }
+  if (fclose(p_file) != 0 || ret != 0 || rename(tmp_path, p_path) != 0)
+  {
+    fprintf(stderr, "ERROR: cannot write %s: %s\n", p_path, strerror(NI_ERRNO));
+    remove(tmp_path);
+    return -1;
+  }
+  return 0;
+}
+
+#if __linux__ || __APPLE__
+/*!*****************************************************************************
+ *  \brief  Create the listening Unix domain socket
+ *
+ *  \return socket fd, -1 on failure
+ ******************************************************************************/
+static int om_listen(const char *p_path)
+{
+  struct sockaddr_un addr = {0};
+  int fd;
+
+  if (strlen(p_path) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "ERROR: socket path too long: %s\n", p_path);
+    return -1;
+  }
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    fprintf(stderr, "ERROR: socket(): %s\n", strerror(NI_ERRNO));
+    return -1;
+  }
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, p_path, sizeof(addr.sun_path) - 1);
+  unlink(p_path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 16) != 0)
+  {
+    fprintf(stderr, "ERROR: cannot listen on %s: %s\n", p_path,
+            strerror(NI_ERRNO));
+    close(fd);
+    return -1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  return fd;
+}
+
+/*!*****************************************************************************
+ *  \brief  Serve the last exposition to clients connecting to the socket
+ *          until timeout_ms has passed. A client sending an HTTP GET gets an
+ *          HTTP response, any other client gets the bare text.
+ ******************************************************************************/
+static void om_serve(const mon_collector_t *p_om, int listen_fd, int timeout_ms)
+{
+  uint64_t deadline = ni_gettime_ns() + (uint64_t)timeout_ms * 1000000;
+  struct pollfd pfd;
+  char request[256];
+  char header[256];
+  uint64_t now;
+
+  while (!g_xcoder_stop_process && (now = ni_gettime_ns()) < deadline)
+  {
+    int client_fd;
+    ssize_t req_len = 0;
+
+    pfd.fd = listen_fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, (int)((deadline - now) / 1000000) + 1) <= 0)
+    {
+      continue;
+    }
+    client_fd = accept(listen_fd, NULL, NULL);
+    if (client_fd < 0)
+    {
+      continue;
+    }
+    // give an HTTP client a moment to send its request line
+    pfd.fd = client_fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 100) > 0)
+    {
+      req_len = recv(client_fd, request, sizeof(request) - 1, 0);
+    }
+    if (req_len >= 4 && !strncmp(request, "GET ", 4))
+    {
+      int header_len = snprintf(header, sizeof(header),
+                                "HTTP/1.0 200 OK\r\nContent-Type: %s\r\n"
+                                "Content-Length: %d\r\n\r\n",
+                                OM_CONTENT_TYPE, p_om->text.str_len);
+      if (write(client_fd, header, header_len) < 0)
+      {
+        close(client_fd);
+        continue;
+      }
+    }
+    if (p_om->text.str_len &&
+        write(client_fd, p_om->text.str_buf, p_om->text.str_len) < 0)
+    {
+      fprintf(stderr, "ERROR: write to metrics client: %s\n",
+              strerror(NI_ERRNO));
+    }
+    close(client_fd);
+  }
+}
+#endif
+
+/*!*****************************************************************************
+ *  \brief  OpenMetrics exporter main loop
+ *
+ *  \param  p_device_pool        device pool
+ *  \param  interval_s           collection interval in seconds, 0 to run once
+ *  \param  refresh_device_pool  refresh devices every interval
+ *  \param  should_match_rev     see ni_rsrc_refresh()
+ *  \param  p_file               textfile collector file, NULL for stdout
+ *  \param  p_socket             Unix socket path to serve on, may be NULL
+ *
+ *  \return 0 on success, 1 on failure
+ ******************************************************************************/
+int run_openmetrics(ni_device_pool_t *p_device_pool, int interval_s,
+                    int refresh_device_pool, int should_match_rev,
+                    const char *p_file, const char *p_socket)
+{
+  mon_collector_t *p_om;
+  ni_device_queue_t queue;
+  int listen_fd = -1;
+  int first = 1;
+  int ret = 0;
+
+  p_om = (mon_collector_t *)calloc(1, sizeof(mon_collector_t));
+  if (!p_om)
+  {
+    fprintf(stderr, "ERROR: calloc() failed for mon_collector_t\n");
+    return 1;
+  }
+
+  if (p_socket)
+  {
+#if __linux__ || __APPLE__
+    listen_fd = om_listen(p_socket);
+    if (listen_fd < 0)
+    {
+      free(p_om);
+      return 1;
+    }
+    if (!interval_s)
+    {
+      interval_s = 1;
+    }
+#else
+    fprintf(stderr, "ERROR: -U is not supported on this platform\n");
+    free(p_om);
+    return 1;
+#endif
+  }
+
+  while (!g_xcoder_stop_process)
+  {
+    uint64_t start = ni_gettime_ns();
+
+    if (first || refresh_device_pool)
+    {
+      ni_rsrc_refresh(should_match_rev);
+    }
+#ifdef _WIN32
+    if (WAIT_ABANDONED == WaitForSingleObject(p_device_pool->lock, INFINITE))
+    {
+      fprintf(stderr, "ERROR: Failed to obtain mutex: %p\n", p_device_pool->lock);
+      ret = 1;
+      break;
+    }
+    queue = *p_device_pool->p_device_queue;
+    ReleaseMutex((HANDLE)p_device_pool->lock);
+#elif __linux__ || __APPLE__
+    if (lockf(p_device_pool->lock, F_LOCK, 0))
+    {
+      perror("ERROR: cannot lock p_device_pool");
+    }
+    queue = *p_device_pool->p_device_queue;
+    if (lockf(p_device_pool->lock, F_ULOCK, 0))
+    {
+      perror("ERROR: cannot unlock p_device_pool");
+    }
+#endif
+    if (first || memcmp(&queue, &p_om->queue, sizeof(queue)))
+    {
+      if (mon_build_cards(p_om, &queue))
+      {
+        ret = 1;
+        break;
+      }
+    }
+    first = 0;
+
+    mon_collect(p_om);
+    om_render(p_om, (double)(ni_gettime_ns() - start) / 1e9);
+
+    if (p_file)
+    {
+      om_write_file(p_om, p_file);
+    } else if (listen_fd < 0 && p_om->text.str_buf)
+    {
+      printf("%s", p_om->text.str_buf);
+      fflush(stdout);
+    }
+
+    if (!interval_s)
+    {
+      break;
+    }
+#if __linux__ || __APPLE__
+    if (listen_fd >= 0)
+    {
+      om_serve(p_om, listen_fd, interval_s * 1000);
+      continue;
+    }
+#endif
+    ni_usleep(interval_s * 1000 * 1000);
+  }
+
+#if __linux__ || __APPLE__
+  if (listen_fd >= 0)
+  {
+    close(listen_fd);
+    unlink(p_socket);
+  }
+#endif
+  mon_free_cards(p_om);
+  clear_dyn_str_buf(&p_om->text);
+  free(p_om);
+  return ret;
+}
+
+/*!*****************************************************************************
+ *  Continuous mode (-c)
+ *
+ *  Built on the persistent collector: handles stay open, decoder/encoder
+ *  instance details come from one detail query per module, and only values
+ *  that changed since they were last printed are written, from a fixed
+ *  buffer flushed once per interval.
+ ******************************************************************************/
+#define CONT_MIN_INTERVAL_MS 100
+#define CONT_REFRESH_MS      1000
+#define CONT_OUT_SIZE        (64 * 1024)
+
+static const char *cont_field_name[MON_FIELD_MAX] = {
+  "up", "load", "model_load", "fw_load", "inst", "mem", "share_mem", "p2p_mem"
+};
+
+typedef struct _cont_out
+{
+  char buf[CONT_OUT_SIZE];
+  int len;
+} cont_out_t;
+
+static void cont_flush(cont_out_t *p_out)
+{
+  if (p_out->len)
+  {
+    fwrite(p_out->buf, 1, p_out->len, stdout);
+    fflush(stdout);
+    p_out->len = 0;
+  }
+}
+
+static void cont_printf(cont_out_t *p_out, const char *fmt, ...)
+{
+  va_list args;
+  int len;
+
+  // a line never exceeds 256 bytes, flush early rather than reallocate
+  if (p_out->len > CONT_OUT_SIZE - 256)
+  {
+    cont_flush(p_out);
+  }
+  va_start(args, fmt);
+  len = vsnprintf(p_out->buf + p_out->len, CONT_OUT_SIZE - p_out->len, fmt,
+                  args);
+  va_end(args);
+  if (len > 0)
+  {
+    p_out->len += len < CONT_OUT_SIZE - p_out->len ?
+        len : CONT_OUT_SIZE - p_out->len - 1;
+  }
+}
+
+/*!*****************************************************************************
+ *  \brief  Print the changes of one module since its last report. Frame and
+ *          IDR counts of instances are printed as increments.
+ ******************************************************************************/
+static void cont_report_module(cont_out_t *p_out, mon_module_t *p_module,
+                               double elapsed)
+{
+  const ni_instance_mgr_detail_status_t *p_cur, *p_prev;
+  const ni_instance_mgr_detail_status_append_t *p_app;
+  uint32_t value;
+  int field, index, changed = 0;
+
+  for (field = MON_UP; field < MON_FIELD_MAX; field++)
+  {
+    value = mon_module_field(p_module, (mon_field_t)field);
+    if (p_module->reported_valid && p_module->reported[field] == value)
+    {
+      continue;
+    }
+    if (!changed)
+    {
+      cont_printf(p_out, "%.3f %s %s %d", elapsed, p_module->dev_name,
+                  g_device_type_str[p_module->device_type],
+                  p_module->module_id);
+      changed = 1;
+    }
+    cont_printf(p_out, " %s=%u", cont_field_name[field], value);
+    p_module->reported[field] = value;
+  }
+  if (changed)
+  {
+    cont_printf(p_out, "\n");
+  }
+  p_module->reported_valid = 1;
+
+  if (!p_module->detail_up)
+  {
+    return;
+  }
+  for (index = 0; index < NI_MAX_CONTEXTS_PER_HW_INSTANCE; index++)
+  {
+    p_cur = &p_module->detail.sInstDetailStatus[index];
+    p_prev = &p_module->reported_detail.sInstDetailStatus[index];
+    p_app = &p_module->detail.sInstDetailStatusAppend[index];
+
+    if (!memcmp(p_cur, p_prev, sizeof(*p_cur)))
+    {
+      continue;
+    }
+    if (!p_cur->ui16FrameRate)
+    {
+      if (p_prev->ui16FrameRate)
+      {
+        cont_printf(p_out, "%.3f %s %s %d inst=%d closed\n", elapsed,
+                    p_module->dev_name, g_device_type_str[p_module->device_type],
+                    p_module->module_id, index);
+      }
+    } else
+    {
+      // counters restart from zero when the slot is reused
+      const ni_instance_mgr_detail_status_t *p_base =
+          p_prev->ui16FrameRate && p_cur->ui32NumInFrame >= p_prev->ui32NumInFrame ?
+          p_prev : NULL;
+      cont_printf(p_out,
+                  "%.3f %s %s %d inst=%d cost=%u fps=%u %ux%u idr=+%u in=+%u "
+                  "out=+%u",
+                  elapsed, p_module->dev_name,
+                  g_device_type_str[p_module->device_type], p_module->module_id,
+                  index, p_cur->ui8AvgCost, p_cur->ui16FrameRate,
+                  p_app->ui32Width, p_app->ui32Height,
+                  p_cur->ui32NumIDR - (p_base ? p_base->ui32NumIDR : 0),
+                  p_cur->ui32NumInFrame - (p_base ? p_base->ui32NumInFrame : 0),
+                  p_cur->ui32NumOutFrame - (p_base ? p_base->ui32NumOutFrame : 0));
+      if (p_module->device_type == NI_DEVICE_TYPE_ENCODER)
+      {
+        cont_printf(p_out, " bitrate=%u avg_bitrate=%u", p_cur->ui32BitRate,
+                    p_cur->ui32AvgBitRate);
+      }
+      cont_printf(p_out, "\n");
+    }
+  }
+  p_module->reported_detail = p_module->detail;
+}
+
+/*!*****************************************************************************
+ *  \brief  Continuous mode main loop
+ *
+ *  \param  p_device_pool        device pool
+ *  \param  interval_ms          reporting interval in milliseconds
+ *  \param  refresh_device_pool  look for new devices, at most once a second
+ *  \param  should_match_rev     see ni_rsrc_refresh()
+ *
+ *  \return 0 on success, 1 on failure
+ ******************************************************************************/
+int run_continuous(ni_device_pool_t *p_device_pool, int interval_ms,
+                   int refresh_device_pool, int should_match_rev)
+{
+  mon_collector_t *p_mon;
+  cont_out_t *p_out;
+  ni_device_queue_t queue;
+  uint64_t start_time, next_time, last_refresh = 0, now;
+  int first = 1;
+  int ret = 0;
+  int i, j;
+
+  if (interval_ms < CONT_MIN_INTERVAL_MS)
+  {
+    interval_ms = CONT_MIN_INTERVAL_MS;
+  }
+  p_mon = (mon_collector_t *)calloc(1, sizeof(mon_collector_t));
+  p_out = (cont_out_t *)malloc(sizeof(cont_out_t));
+  if (!p_mon || !p_out)
+  {
+    fprintf(stderr, "ERROR: cannot allocate continuous mode state\n");
+    free(p_mon);
+    free(p_out);
+    return 1;
+  }
+  p_mon->query_detail = 1;
+  p_out->len = 0;
+
+  start_time = next_time = ni_gettime_ns();
+  while (!g_xcoder_stop_process)
+  {
+    now = ni_gettime_ns();
+    if (first || (refresh_device_pool &&
+                  now - last_refresh >= (uint64_t)CONT_REFRESH_MS * 1000000))
+    {
+      ni_rsrc_refresh(should_match_rev);
+      last_refresh = now;
+    }
+#ifdef _WIN32
+    if (WAIT_ABANDONED == WaitForSingleObject(p_device_pool->lock, INFINITE))
+    {
+      fprintf(stderr, "ERROR: Failed to obtain mutex: %p\n", p_device_pool->lock);
+      ret = 1;
+      break;
+    }
+    queue = *p_device_pool->p_device_queue;
+    ReleaseMutex((HANDLE)p_device_pool->lock);
+#elif __linux__ || __APPLE__
+    if (lockf(p_device_pool->lock, F_LOCK, 0))
+    {
+      perror("ERROR: cannot lock p_device_pool");
+    }
+    queue = *p_device_pool->p_device_queue;
+    if (lockf(p_device_pool->lock, F_ULOCK, 0))
+    {
+      perror("ERROR: cannot unlock p_device_pool");
+    }
+#endif
+    if (first || memcmp(&queue, &p_mon->queue, sizeof(queue)))
+    {
+      if (mon_build_cards(p_mon, &queue))
+      {
+        ret = 1;
+        break;
+      }
+      cont_printf(p_out, "%.3f devices %d\n",
+                  (double)(now - start_time) / 1e9, p_mon->card_count);
+    }
+    first = 0;
+
+    mon_collect(p_mon);
+    for (i = 0; i < p_mon->card_count; i++)
+    {
+      for (j = 0; j < p_mon->cards[i].module_count; j++)
+      {
+        cont_report_module(p_out, &p_mon->cards[i].modules[j],
+                           (double)(now - start_time) / 1e9);
+      }
+    }
+    cont_flush(p_out);
+
+    // fixed schedule, a slow round does not shift the following ones
+    next_time += (uint64_t)interval_ms * 1000000;
+    now = ni_gettime_ns();
+    if (next_time > now)
+    {
+      ni_usleep((next_time - now) / 1000);
+    } else
+    {
+      next_time = now;
+    }
+  }
+
+  mon_free_cards(p_mon);
+  free(p_mon);
+  free(p_out);
+  return ret;
+}
+
 int main(int argc, char *argv[])
 {
     setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
@@ -2304,6 +3323,10 @@ int main(int argc, char *argv[])
     int refresh_device_pool = 1;
     bool is_first_query = true;
     int ret = 0;
+    int perf_counters = 0;
+    const char *metrics_file = NULL;
+    const char *metrics_socket = NULL;
+    int continuous_ms = 0;
 
 #ifdef _WIN32
   SetConsoleCtrlHandler(console_ctrl_handler, TRUE);
@@ -2312,7 +3335,7 @@ int main(int argc, char *argv[])
 #endif
 
   // arg handling
-  while ((opt = getopt(argc, argv, "n:o:D:k:R:rt:Sl:hvd")) != -1)
+  while ((opt = getopt(argc, argv, "n:o:D:k:R:rt:Sl:hvdPM:U:c:")) != -1)
   {
     switch (opt)
     {
@@ -2346,6 +3369,10 @@ int main(int argc, char *argv[])
       {
         printFormat = FMT_EXTRA;
       }
+      else if (!strcmp(optarg, "openmetrics"))
+      {
+        printFormat = FMT_OPENMETRICS;
+      }
       else
       {
         fprintf(stderr, "Error: unknown selection for outputFormat: %s\n", optarg);
@@ -2397,7 +3424,8 @@ int main(int argc, char *argv[])
              "-R  Specify if refresh devices on host in each monitor interval.\n"
              "    If 0, only refresh devices at the start.\n"
              "    Default: 1\n"
-             "-o  Output format. [text, simple, full, json, json1, json2, extra]\n"
+             "-o  Output format.\n"
+             "    [text, simple, full, json, json1, json2, extra, openmetrics]\n"
              "    Default: text\n"
              "-D  Dump firmware logs to current directory. Default: 0(not dump fw log).\n"
              "-k  Specify to dump which card's firmware logs.\n"
@@ -2411,6 +3439,15 @@ int main(int argc, char *argv[])
              "    Default: 0\n"
              "-S  Skip init_rsrc.\n"
              "-d  Print detailed infomation for decoder/encoder in text and json formats.\n"
+             "-P  Also print libxcoder performance counters (NVMe commands, bytes,\n"
+             "    query retries, bounce copies, ...) of every process using the library.\n"
+             "-M  Write openmetrics output to this file every interval, for the node\n"
+             "    exporter textfile collector. Implies -o openmetrics.\n"
+             "-U  Serve openmetrics output on this Unix socket path, to plain or HTTP\n"
+             "    GET requests. Implies -o openmetrics. Default interval: 1.\n"
+             "-c  Continuous mode: keep devices open and every given number of\n"
+             "    milliseconds (at least %d) print only the loads and decoder/encoder\n"
+             "    instance details that changed. Frame counts are printed as increments.\n"
              "-l  Set loglevel of libxcoder API.\n"
              "    [none, fatal, error, info, debug, trace]\n"
              "    Default: info\n"
@@ -2444,7 +3481,7 @@ int main(int argc, char *argv[])
              "Additional reporting columns for full JSON formats\n"
              "LOAD          VPU load\n"
              "FW_LOAD	      system load\n",
-             NI_XCODER_REVISION);
+             NI_XCODER_REVISION, CONT_MIN_INTERVAL_MS);
       return 0;
     case 'v':
         printf("Release ver: %s\n"
@@ -2466,6 +3503,26 @@ int main(int argc, char *argv[])
     case 'd':
         detail = 1;
         break;
+    case 'P':
+        perf_counters = 1;
+        break;
+    case 'M':
+        metrics_file = optarg;
+        printFormat = FMT_OPENMETRICS;
+        break;
+    case 'U':
+        metrics_socket = optarg;
+        printFormat = FMT_OPENMETRICS;
+        break;
+    case 'c':
+        continuous_ms = atoi(optarg);
+        if (continuous_ms < CONT_MIN_INTERVAL_MS)
+        {
+            fprintf(stderr, "Error: -c interval must be at least %d ms\n",
+                    CONT_MIN_INTERVAL_MS);
+            return 1;
+        }
+        break;
     case ':':
         fprintf(stderr, "FATAL: option '-%c' lacks arg\n", opt);
         return 1;
@@ -2481,6 +3538,13 @@ int main(int argc, char *argv[])
     return 1;
   }
 
+  // keep libxcoder info prints out of the metrics exposition and changes
+  if ((printFormat == FMT_OPENMETRICS || continuous_ms) &&
+      log_level > NI_LOG_ERROR)
+  {
+    log_level = NI_LOG_ERROR;
+  }
+
   if ((argc <= 2) && (optind == 1))
   {
     for (; optind < argc; optind++)
@@ -2517,7 +3581,8 @@ int main(int argc, char *argv[])
     LRETURN;
   }
 
-  if (log_level >= NI_LOG_INFO)
+  if (log_level >= NI_LOG_INFO && printFormat != FMT_OPENMETRICS &&
+      !continuous_ms)
   {
     printf("**************************************************\n");
   }
@@ -2531,6 +3596,19 @@ int main(int argc, char *argv[])
       }
   }
 
+  if (continuous_ms)
+  {
+    ret = run_continuous(p_device_pool, continuous_ms, refresh_device_pool,
+                         should_match_rev);
+    LRETURN;
+  }
+  if (printFormat == FMT_OPENMETRICS)
+  {
+    ret = run_openmetrics(p_device_pool, checkInterval, refresh_device_pool,
+                          should_match_rev, metrics_file, metrics_socket);
+    LRETURN;
+  }
+
   startTime = time(NULL);
   if(checkInterval)
   {
@@ -2618,6 +3696,14 @@ int main(int argc, char *argv[])
       case FMT_EXTRA:
         print_extra(coders, p_xCtxt);
         break;
+      case FMT_OPENMETRICS:
+        // handled by run_openmetrics()
+        break;
+    }
+
+    if (perf_counters)
+    {
+      print_perf_counters(printFormat);
     }
 
     is_first_query = false;
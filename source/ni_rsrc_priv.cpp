@@ -26,6 +26,8 @@
  *          NETINT video processing devices
  ******************************************************************************/
 
+#define NI_LOG_MODULE NI_LOG_MODULE_RSRC
+
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,6 +43,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #endif
 
 #if __APPLE__
@@ -272,6 +278,152 @@ void ni_rsrc_get_shm_name(ni_device_type_t device_type, int32_t guid, char* p_na
     }
 }
 
+/*!******************************************************************************
+ *  \brief     Get the NUMA node of a device from its record
+ *
+ *  \param[in] p_device_info  device record
+ *
+ *  \return    NUMA node, -1 if unknown or if the record was written by an
+ *             init_rsrc that did not record the host topology
+ *******************************************************************************/
+int ni_rsrc_get_numa_node(const ni_device_info_t *p_device_info)
+{
+    if (p_device_info->topology_magic != NI_DEVICE_INFO_TOPOLOGY_MAGIC)
+    {
+        return -1;
+    }
+    return p_device_info->numa_node;
+}
+
+#if __linux__ || __APPLE__
+/*!******************************************************************************
+ *  \brief     Extend a device record shm created by an older init_rsrc, with
+ *             a smaller ni_device_info_t, to the current size. The added
+ *             fields read as zero, so topology_magic marks them unknown.
+ *
+ *  \param[in] shm_fd  descriptor of the device record shm, opened read/write
+ *
+ *  \return    0 on success, -1 on failure
+ *******************************************************************************/
+int ni_rsrc_fit_device_record(int shm_fd)
+{
+    struct stat st;
+
+    if (fstat(shm_fd, &st) < 0)
+    {
+        return -1;
+    }
+    if (st.st_size > 0 && (size_t)st.st_size < sizeof(ni_device_info_t))
+    {
+        ni_log(NI_LOG_INFO, "%s: device record of %ld bytes from an older "
+               "libxcoder, extending to %zu\n", __func__, (long)st.st_size,
+               sizeof(ni_device_info_t));
+        if (ftruncate(shm_fd, sizeof(ni_device_info_t)) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+#endif
+
+static bool is_valid_load_table_index(const ni_device_info_t *p_device_info)
+{
+    return IS_XCODER_DEVICE_TYPE(p_device_info->device_type) &&
+        p_device_info->module_id >= 0 &&
+        p_device_info->module_id < NI_MAX_DEVICE_CNT;
+}
+
+/*!******************************************************************************
+ *  \brief     Read the load counters of a device, from the shared load table
+ *             when there is one, from the device record otherwise
+ *
+ *  \param[in]  p_load_table   load table from ni_rsrc_get_load_table(), or NULL
+ *  \param[in]  p_device_info  device record
+ *  \param[out] p_load         load counters
+ *
+ *  \return    void
+ *******************************************************************************/
+void ni_rsrc_get_device_load(const ni_device_load_table_t *p_load_table,
+                             const ni_device_info_t *p_device_info,
+                             ni_device_load_t *p_load)
+{
+    int type = p_device_info->device_type;
+    int guid = p_device_info->module_id;
+
+    if (p_load_table && is_valid_load_table_index(p_device_info))
+    {
+        p_load->load = p_load_table->load[type][guid];
+        p_load->model_load = p_load_table->model_load[type][guid];
+        p_load->active_num_inst = p_load_table->active_num_inst[type][guid];
+    } else
+    {
+        p_load->load = p_device_info->load;
+        p_load->model_load = p_device_info->model_load;
+        p_load->active_num_inst = p_device_info->active_num_inst;
+    }
+}
+
+/*!******************************************************************************
+ *  \brief     Store the load counters of a device in the shared load table
+ *             when there is one, in the device record otherwise. Copies of
+ *             the record handed out by the API get them back through
+ *             ni_rsrc_sync_device_load().
+ *
+ *  \param[in]  p_load_table   load table from ni_rsrc_get_load_table(), or NULL
+ *  \param[in]  p_device_info  device record
+ *  \param[in]  p_load         load counters
+ *
+ *  \return    void
+ *******************************************************************************/
+void ni_rsrc_set_device_load(ni_device_load_table_t *p_load_table,
+                             ni_device_info_t *p_device_info,
+                             const ni_device_load_t *p_load)
+{
+    int type = p_device_info->device_type;
+    int guid = p_device_info->module_id;
+
+    if (p_load_table && is_valid_load_table_index(p_device_info))
+    {
+        p_load_table->load[type][guid] = p_load->load;
+        p_load_table->model_load[type][guid] = p_load->model_load;
+        p_load_table->active_num_inst[type][guid] = p_load->active_num_inst;
+    } else
+    {
+        p_device_info->load = p_load->load;
+        p_device_info->model_load = p_load->model_load;
+        p_device_info->active_num_inst = p_load->active_num_inst;
+    }
+}
+
+/*!******************************************************************************
+ *  \brief     Refresh the load counters of private copies of device records
+ *             from the shared load table
+ *
+ *  \param[in,out] p_device_info  array of device record copies
+ *  \param[in]     count          number of records
+ *
+ *  \return    void
+ *******************************************************************************/
+void ni_rsrc_sync_device_load(ni_device_info_t *p_device_info, int count)
+{
+    ni_device_load_table_t *p_load_table = ni_rsrc_get_load_table();
+    ni_device_load_t load;
+    int i;
+
+    if (!p_load_table)
+    {
+        return;
+    }
+    for (i = 0; i < count; i++)
+    {
+        ni_rsrc_get_device_load(p_load_table, &p_device_info[i], &load);
+        p_device_info[i].load = load.load;
+        p_device_info[i].model_load = load.model_load;
+        p_device_info[i].active_num_inst = load.active_num_inst;
+    }
+}
+
 /*!*****************************************************************************
  *  \brief Check if a FW_rev retrieved from card is supported by this version of
  *         libxcoder.
@@ -388,6 +540,13 @@ static void fill_device_info(ni_device_info_t *device_info,
     device_info->max_instance_cnt = hw_capability->max_number_of_contexts;
     device_info->device_type = device_type;
 
+#if __linux__ || __APPLE__
+    get_dev_pcie_addr(device_info->dev_name, device_info->pcie_addr,
+                      NULL, NULL, NULL, NULL);
+#endif
+    device_info->numa_node = ni_get_device_numa_node(device_name);
+    device_info->topology_magic = NI_DEVICE_INFO_TOPOLOGY_MAGIC;
+
     ni_rsrc_fill_device_info(device_info,
                              (ni_codec_t)hw_capability->codec_format,
                              device_type,
@@ -780,6 +939,40 @@ END:
 
 
 
+/*!******************************************************************************
+ *  \brief     Get the shared load table; not used on Windows
+ *
+ *  \return    NULL
+ *******************************************************************************/
+ni_device_load_table_t *ni_rsrc_get_load_table(void)
+{
+    // load counters stay in the device records on Windows
+    return NULL;
+}
+
+/*!******************************************************************************
+ *  \brief     Send a request to the resource broker; not supported on Windows
+ *
+ *  \return    NI_RETCODE_FAILURE
+ *******************************************************************************/
+ni_retcode_t ni_rsrc_broker_request(ni_rsrc_broker_msg_t *p_msg)
+{
+    (void)p_msg;
+    return NI_RETCODE_FAILURE;
+}
+
+/*!******************************************************************************
+ *  \brief     Run the resource broker; not supported on Windows
+ *
+ *  \return    -1
+ *******************************************************************************/
+int ni_rsrc_broker_run(int poll_interval_ms)
+{
+    (void)poll_interval_ms;
+    ni_log(NI_LOG_ERROR, "ERROR: resource broker is not supported on Windows\n");
+    return -1;
+}
+
 /*!******************************************************************************
  *  \brief
  *
@@ -1076,12 +1269,34 @@ static bool check_correctness_count(const ni_device_queue_t *existing_device_que
     ni_device_capability_t device_capability;
     ni_device_handle_t device_handle;
     ni_device_queue_t device_queue;
+    ni_device_fingerprint_t fingerprints[NI_MAX_DEVICE_CNT];
+    const ni_device_fingerprint_t *p_fingerprint;
+    int fingerprint_cnt;
 
     memset(device_queue.xcoder_cnt, 0, sizeof(device_queue.xcoder_cnt));
 
+    fingerprint_cnt = ni_rsrc_get_pool_fingerprints(fingerprints,
+                                                    NI_MAX_DEVICE_CNT);
+
     max_io_size = NI_INVALID_IO_SIZE;
     for (i = 0; i < existing_number_of_devices; i++)
     {
+        // a device whose serial number and firmware revision match its pool
+        // record needs no identify, count the modules it already holds
+        if (1 == ni_rsrc_check_device_fingerprint(device_names[i],
+                                                  fingerprints,
+                                                  fingerprint_cnt,
+                                                  &p_fingerprint))
+        {
+            ni_log(NI_LOG_DEBUG, "%s(): %s unchanged\n", __func__,
+                   device_names[i]);
+            for (j = NI_DEVICE_TYPE_DECODER; j < NI_DEVICE_TYPE_XCODER_MAX; j++)
+            {
+                device_queue.xcoder_cnt[j] += p_fingerprint->module_cnt[j];
+            }
+            continue;
+        }
+
         device_handle = ni_device_open(device_names[i], &max_io_size);
         if (device_handle == NI_INVALID_DEVICE_HANDLE)
         {
@@ -1431,6 +1646,7 @@ void ni_rsrc_get_one_device_info (ni_device_info_t * p_device_info)
   int32_t lock = -1;
   bool skip_ftruncate = false;
   ni_device_info_t * p_coder_info_dst = NULL;
+  ni_device_load_t load;
 
   if( !p_device_info )
   {
@@ -1551,6 +1767,12 @@ void ni_rsrc_get_one_device_info (ni_device_info_t * p_device_info)
            strerror(NI_ERRNO));
     LRETURN;
   }
+  if (skip_ftruncate && ni_rsrc_fit_device_record(shm_fd) < 0)
+  {
+    ni_log(NI_LOG_ERROR, "ERROR %s() cannot extend %s: %s\n", __func__,
+           shm_name, strerror(NI_ERRNO));
+    LRETURN;
+  }
 #endif
 
   /*! map the shared memory segment */
@@ -1565,6 +1787,11 @@ void ni_rsrc_get_one_device_info (ni_device_info_t * p_device_info)
   }
 
   memcpy(p_coder_info_dst, p_device_info, sizeof(ni_device_info_t));
+  // a guid reused for another device starts with the load of the new record
+  load.load = p_device_info->load;
+  load.model_load = p_device_info->model_load;
+  load.active_num_inst = p_device_info->active_num_inst;
+  ni_rsrc_set_device_load(ni_rsrc_get_load_table(), p_coder_info_dst, &load);
 
   if (msync((void*)p_coder_info_dst, sizeof(ni_device_info_t), MS_SYNC | MS_INVALIDATE))
   {
@@ -1605,21 +1832,25 @@ END:
 void ni_rsrc_update_record(ni_device_context_t *p_device_context, ni_session_context_t *p_session_context)
 {
     uint32_t j;
+    ni_device_load_t load;
 
     if ((!p_device_context) || (!p_session_context))
     {
         return;
     }
 
-  p_device_context->p_device_info->load = p_session_context->load_query.current_load;
-  p_device_context->p_device_info->active_num_inst = p_session_context->load_query.total_contexts;
+  load.load = p_session_context->load_query.current_load;
+  load.active_num_inst = p_session_context->load_query.total_contexts;
   // Now we get the model load from the FW
-  p_device_context->p_device_info->model_load = p_session_context->load_query.fw_model_load;
-  if (0 == p_device_context->p_device_info->active_num_inst)
+  load.model_load = p_session_context->load_query.fw_model_load;
+  if (0 == load.active_num_inst)
   {
-    p_device_context->p_device_info->load = 0;
+    load.load = 0;
   }
-  for (j = 0; j < p_device_context->p_device_info->active_num_inst; j++)
+  ni_rsrc_set_device_load(ni_rsrc_get_load_table(),
+                          p_device_context->p_device_info, &load);
+
+  for (j = 0; j < load.active_num_inst; j++)
   {
     p_device_context->p_device_info->sw_instance[j].id =
         p_session_context->load_query.context_status[j].context_id;
@@ -1644,6 +1875,78 @@ void ni_rsrc_update_record(ni_device_context_t *p_device_context, ni_session_con
 }
 
 
+#ifndef _ANDROID
+static ni_device_load_table_t *g_p_load_table = NULL;
+static pthread_once_t g_load_table_once = PTHREAD_ONCE_INIT;
+
+/*!******************************************************************************
+ *  \brief     Map the shared load table (CODERS_LOAD_SHM_NAME) for the rest of
+ *             the process, creating it zero filled if it does not exist yet.
+ *             Run once through g_load_table_once.
+ *
+ *  \return    void
+ *******************************************************************************/
+static void ni_rsrc_map_load_table(void)
+{
+  const mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+  ni_device_load_table_t *p_load_table;
+  struct stat st;
+  int shm_fd;
+
+  shm_fd = shm_open(CODERS_LOAD_SHM_NAME, O_CREAT | O_RDWR, mode);
+  if (shm_fd < 0)
+  {
+    ni_log(NI_LOG_ERROR, "ERROR %s() shm_open() %s: %s\n", __func__,
+           CODERS_LOAD_SHM_NAME, strerror(NI_ERRNO));
+    return;
+  }
+
+  // ftruncate zero fills, so a concurrent creator or a table left by an
+  // older layout only ever grows
+  if (fstat(shm_fd, &st) != 0 ||
+      (st.st_size < (off_t)sizeof(ni_device_load_table_t) &&
+       ftruncate(shm_fd, sizeof(ni_device_load_table_t)) != 0))
+  {
+    ni_log(NI_LOG_ERROR, "ERROR %s() sizing %s: %s\n", __func__,
+           CODERS_LOAD_SHM_NAME, strerror(NI_ERRNO));
+    close(shm_fd);
+    return;
+  }
+
+  p_load_table = (ni_device_load_table_t *)mmap(0,
+                                                sizeof(ni_device_load_table_t),
+                                                PROT_READ | PROT_WRITE,
+                                                MAP_SHARED,
+                                                shm_fd,
+                                                0);
+  close(shm_fd);
+  if (MAP_FAILED == p_load_table)
+  {
+    ni_log(NI_LOG_ERROR, "ERROR %s() mmap() %s: %s\n", __func__,
+           CODERS_LOAD_SHM_NAME, strerror(NI_ERRNO));
+    return;
+  }
+  g_p_load_table = p_load_table;
+}
+#endif
+
+/*!******************************************************************************
+ *  \brief     Get the shared load table. It is mapped on first use and stays
+ *             mapped until the process exits, so callers never unmap it.
+ *
+ *  \return    pointer to the mapped table, NULL on failure or where the load
+ *             counters are kept in the device records (Android)
+ *******************************************************************************/
+ni_device_load_table_t *ni_rsrc_get_load_table(void)
+{
+#ifdef _ANDROID
+  return NULL;
+#else
+  pthread_once(&g_load_table_once, ni_rsrc_map_load_table);
+  return g_p_load_table;
+#endif
+}
+
 /*!******************************************************************************
  *  \brief     get PCIe address information from device name
  *
@@ -1699,7 +2002,8 @@ void get_dev_pcie_addr(char *device_name,
   pcie[10] = '.';
   //last pcie info is for the device
   while(ptr != NULL) {
-      ni_log2(NULL, NI_LOG_DEBUG, "===%d ptr:%s\n", ++i, ptr);
+      ++i;
+      ni_log2(NULL, NI_LOG_DEBUG, "===%d ptr:%s\n", i, ptr);
       if (strlen(ptr) == 12)//e.g.: 0000:09:00.0
       {
           ret = sscanf(ptr, "%4c:%2c:%2c.%1c", pcie, pcie+5,pcie+8,pcie+11);
@@ -1725,4 +2029,1021 @@ end:
 #endif
 }
 
+/*!******************************************************************************
+ *  \brief     Compare two space padded identify strings, ignoring the padding
+ *
+ *  \return    true if equal
+ *  *******************************************************************************/
+static bool id_field_equal(const uint8_t *p_a, const uint8_t *p_b, size_t size)
+{
+  size_t len_a = size, len_b = size;
+
+  while (len_a > 0 && (p_a[len_a - 1] == ' ' || p_a[len_a - 1] == '\0'))
+  {
+    len_a--;
+  }
+  while (len_b > 0 && (p_b[len_b - 1] == ' ' || p_b[len_b - 1] == '\0'))
+  {
+    len_b--;
+  }
+  return len_a == len_b && 0 == memcmp(p_a, p_b, len_a);
+}
+
+#ifdef __linux__
+static bool read_sysfs_id_field(const char *device_name, const char *attr,
+                                uint8_t *p_value, size_t size)
+{
+  char path[PATH_MAX];
+  char buf[64] = {0};
+  FILE *p_file;
+  size_t len;
+
+  snprintf(path, sizeof(path), "%s%s/device/%s", SYS_PARAMS_PREFIX_PATH,
+           device_name + 5, attr);
+  p_file = fopen(path, "r");
+  if (!p_file)
+  {
+    return false;
+  }
+  if (!fgets(buf, sizeof(buf), p_file))
+  {
+    fclose(p_file);
+    return false;
+  }
+  fclose(p_file);
+
+  len = strcspn(buf, "\n");
+  while (len > 0 && buf[len - 1] == ' ')
+  {
+    len--;
+  }
+  if (len == 0 || len > size)
+  {
+    return false;
+  }
+  memset(p_value, ' ', size);
+  memcpy(p_value, buf, len);
+  return true;
+}
+#endif
+
+/*!******************************************************************************
+ *  \brief     Read the serial number and firmware revision of an NVMe device
+ *             from sysfs, without sending any command to the device. Values
+ *             are space padded like the identify controller fields they mirror
+ *
+ *  \param[in]  device_name    e.g. /dev/nvme0n1
+ *  \param[out] serial_number  serial number
+ *  \param[out] fw_rev         firmware revision
+ *
+ *  \return    true on success, false if not available on this platform/driver
+ *  *******************************************************************************/
+bool ni_rsrc_read_device_fingerprint(const char *device_name,
+                                     uint8_t serial_number[20],
+                                     uint8_t fw_rev[8])
+{
+#ifdef __linux__
+  if (!device_name || strncmp(device_name, "/dev/", 5) != 0)
+  {
+    return false;
+  }
+  return read_sysfs_id_field(device_name, "serial", serial_number, 20) &&
+         read_sysfs_id_field(device_name, "firmware_rev", fw_rev, 8);
+#else
+  (void)device_name;
+  (void)serial_number;
+  (void)fw_rev;
+  return false;
+#endif
+}
+
+/*!******************************************************************************
+ *  \brief     Collect the identity of every device currently in the resource
+ *             pool, without taking any lock or touching the devices. Records
+ *             that cannot be mapped (e.g. left by a library with a different
+ *             layout) are skipped.
+ *
+ *  \param[out] p_fingerprints    array to fill, one entry per device
+ *  \param[in]  max_fingerprints  size of p_fingerprints
+ *
+ *  \return    number of entries filled, 0 if there is no resource pool
+ *  *******************************************************************************/
+int ni_rsrc_get_pool_fingerprints(ni_device_fingerprint_t *p_fingerprints,
+                                  int max_fingerprints)
+{
+#ifdef _ANDROID
+  (void)p_fingerprints;
+  (void)max_fingerprints;
+  return 0;
+#else
+  ni_device_queue_t *p_device_queue;
+  ni_device_info_t *p_device_info;
+  char shm_name[32] = { 0 };
+  struct stat st;
+  int shm_fd;
+  int count = 0;
+  int i, j, k;
+
+  shm_fd = shm_open(CODERS_SHM_NAME, O_RDONLY, 0);
+  if (shm_fd < 0)
+  {
+    return 0;
+  }
+  if (fstat(shm_fd, &st) != 0 || st.st_size < (off_t)sizeof(ni_device_queue_t))
+  {
+    close(shm_fd);
+    return 0;
+  }
+  p_device_queue = (ni_device_queue_t *)mmap(0, sizeof(ni_device_queue_t),
+                                             PROT_READ, MAP_SHARED, shm_fd, 0);
+  close(shm_fd);
+  if (p_device_queue == MAP_FAILED)
+  {
+    return 0;
+  }
+
+  for (i = NI_DEVICE_TYPE_DECODER; i < NI_DEVICE_TYPE_XCODER_MAX; i++)
+  {
+    for (j = 0; j < (int)p_device_queue->xcoder_cnt[i] && j < NI_MAX_DEVICE_CNT; j++)
+    {
+      ni_rsrc_get_shm_name((ni_device_type_t)i, p_device_queue->xcoders[i][j],
+                           shm_name, sizeof(shm_name));
+      shm_fd = shm_open(shm_name, O_RDONLY, 0);
+      if (shm_fd < 0)
+      {
+        continue;
+      }
+      if (fstat(shm_fd, &st) != 0 || st.st_size < (off_t)sizeof(ni_device_info_t))
+      {
+        close(shm_fd);
+        continue;
+      }
+      p_device_info = (ni_device_info_t *)mmap(0, sizeof(ni_device_info_t),
+                                               PROT_READ, MAP_SHARED, shm_fd, 0);
+      close(shm_fd);
+      if (p_device_info == MAP_FAILED)
+      {
+        continue;
+      }
+
+      for (k = 0; k < count; k++)
+      {
+        if (0 == strncmp(p_fingerprints[k].dev_name, p_device_info->dev_name,
+                         NI_MAX_DEVICE_NAME_LEN))
+        {
+          break;
+        }
+      }
+      if (k == count && count < max_fingerprints)
+      {
+        memset(&p_fingerprints[k], 0, sizeof(ni_device_fingerprint_t));
+        memcpy(p_fingerprints[k].dev_name, p_device_info->dev_name,
+               NI_MAX_DEVICE_NAME_LEN - 1);
+        memcpy(p_fingerprints[k].serial_number, p_device_info->serial_number,
+               sizeof(p_fingerprints[k].serial_number));
+        memcpy(p_fingerprints[k].fw_rev, p_device_info->fw_rev,
+               sizeof(p_fingerprints[k].fw_rev));
+        count++;
+      }
+      if (k < count)
+      {
+        p_fingerprints[k].module_cnt[i]++;
+      }
+      munmap(p_device_info, sizeof(ni_device_info_t));
+    }
+  }
+
+  munmap(p_device_queue, sizeof(ni_device_queue_t));
+  return count;
+#endif
+}
+
+/*!******************************************************************************
+ *  \brief     Check a device against the resource pool identities collected by
+ *             ni_rsrc_get_pool_fingerprints()
+ *
+ *  \param[in]  device_name      e.g. /dev/nvme0n1
+ *  \param[in]  p_fingerprints   resource pool identities
+ *  \param[in]  fingerprint_cnt  number of entries in p_fingerprints
+ *  \param[out] pp_match         optional, set to the matching entry if any
+ *
+ *  \return    1 if the device is in the pool with the same serial number and
+ *             firmware revision, 0 if it is in the pool but either changed,
+ *             -1 if it is not in the pool or its identity cannot be read
+ *  *******************************************************************************/
+int ni_rsrc_check_device_fingerprint(const char *device_name,
+                                     const ni_device_fingerprint_t *p_fingerprints,
+                                     int fingerprint_cnt,
+                                     const ni_device_fingerprint_t **pp_match)
+{
+  uint8_t serial_number[20];
+  uint8_t fw_rev[8];
+  int i;
+
+  if (pp_match)
+  {
+    *pp_match = NULL;
+  }
+
+  for (i = 0; i < fingerprint_cnt; i++)
+  {
+    if (0 == strncmp(device_name, p_fingerprints[i].dev_name,
+                     NI_MAX_DEVICE_NAME_LEN))
+    {
+      break;
+    }
+  }
+  if (i == fingerprint_cnt ||
+      !ni_rsrc_read_device_fingerprint(device_name, serial_number, fw_rev))
+  {
+    return -1;
+  }
+
+  if (!id_field_equal(serial_number, p_fingerprints[i].serial_number,
+                      sizeof(serial_number)) ||
+      !id_field_equal(fw_rev, p_fingerprints[i].fw_rev, sizeof(fw_rev)))
+  {
+    ni_log(NI_LOG_INFO, "%s changed: serial %.*s FW %.*s -> serial %.*s FW %.*s\n",
+           device_name,
+           (int)sizeof(serial_number), p_fingerprints[i].serial_number,
+           (int)sizeof(fw_rev), p_fingerprints[i].fw_rev,
+           (int)sizeof(serial_number), serial_number,
+           (int)sizeof(fw_rev), fw_rev);
+    return 0;
+  }
+
+  if (pp_match)
+  {
+    *pp_match = &p_fingerprints[i];
+  }
+  return 1;
+}
+
+
+static int broker_set_timeout(int fd, int timeout_ms)
+{
+  struct timeval tv;
+
+  tv.tv_sec = timeout_ms / 1000;
+  tv.tv_usec = (timeout_ms % 1000) * 1000;
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) ||
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)))
+  {
+    return -1;
+  }
+#ifdef SO_NOSIGPIPE
+  {
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+  }
+#endif
+  return 0;
+}
+
+static int broker_send_msg(int fd, const ni_rsrc_broker_msg_t *p_msg)
+{
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+  const uint8_t *p_data = (const uint8_t *)p_msg;
+  size_t done = 0;
+  ssize_t ret;
+
+  while (done < sizeof(*p_msg))
+  {
+    ret = send(fd, p_data + done, sizeof(*p_msg) - done, flags);
+    if (ret <= 0)
+    {
+      if (ret < 0 && EINTR == NI_ERRNO)
+      {
+        continue;
+      }
+      return -1;
+    }
+    done += (size_t)ret;
+  }
+  return 0;
+}
+
+static int broker_recv_msg(int fd, ni_rsrc_broker_msg_t *p_msg)
+{
+  uint8_t *p_data = (uint8_t *)p_msg;
+  size_t done = 0;
+  ssize_t ret;
+
+  while (done < sizeof(*p_msg))
+  {
+    ret = recv(fd, p_data + done, sizeof(*p_msg) - done, 0);
+    if (ret <= 0)
+    {
+      if (ret < 0 && EINTR == NI_ERRNO)
+      {
+        continue;
+      }
+      return -1;
+    }
+    done += (size_t)ret;
+  }
+  if (NI_RSRC_BROKER_MAGIC != p_msg->magic ||
+      NI_RSRC_BROKER_VERSION != p_msg->version)
+  {
+    return -1;
+  }
+  return 0;
+}
+
+/*!******************************************************************************
+ *  \brief     Send a request to the local resource broker and wait for its
+ *             reply
+ *
+ *  \param[in,out] p_msg  request, overwritten with the reply
+ *
+ *  \return    NI_RETCODE_FAILURE if no broker is running or it could not be
+ *             reached, the retcode of the reply otherwise
+ *******************************************************************************/
+ni_retcode_t ni_rsrc_broker_request(ni_rsrc_broker_msg_t *p_msg)
+{
+  struct sockaddr_un addr;
+  ni_retcode_t retval = NI_RETCODE_FAILURE;
+  int fd;
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    return NI_RETCODE_FAILURE;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
+           NI_RSRC_BROKER_SOCK_NAME);
+
+  // no broker is the common case, fail quietly and let the caller fall back
+  if (broker_set_timeout(fd, NI_RSRC_BROKER_TIMEOUT_MS) ||
+      connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+  {
+    LRETURN;
+  }
+
+  p_msg->magic = NI_RSRC_BROKER_MAGIC;
+  p_msg->version = NI_RSRC_BROKER_VERSION;
+  if (broker_send_msg(fd, p_msg) || broker_recv_msg(fd, p_msg))
+  {
+    ni_log(NI_LOG_ERROR, "ERROR: %s() no reply from resource broker: %s\n",
+           __func__, strerror(NI_ERRNO));
+    LRETURN;
+  }
+  retval = (ni_retcode_t)p_msg->retcode;
+
+END:
+
+  close(fd);
+  return retval;
+}
+
+typedef struct _ni_rsrc_broker_device
+{
+  ni_device_handle_t handle;
+  int present;          // in the device queue at the last refresh
+  char dev_name[NI_MAX_DEVICE_NAME_LEN];
+  int hw_id;
+  int numa_node;
+  int max_instance_cnt;
+  uint32_t codecs;      // bit (1 << ni_codec_t) per codec the device supports
+  int pending;          // allocations handed out since the last load poll
+  int pending_load;     // model load estimate of those allocations
+} ni_rsrc_broker_device_t;
+
+// a client connection, served without blocking the other clients
+typedef struct _ni_rsrc_broker_client
+{
+  int fd;               // -1: free slot
+  ni_rsrc_broker_msg_t msg;
+  size_t done;          // bytes of msg received, then of the reply sent
+  int replying;
+  uint64_t deadline_ns;
+} ni_rsrc_broker_client_t;
+
+typedef struct _ni_rsrc_broker
+{
+  ni_device_pool_t *p_device_pool;
+  ni_device_load_table_t *p_load_table;
+  ni_session_context_t session_ctx;
+  int polling;    // 0: serve the load table as written by others
+  ni_rsrc_broker_device_t devices[NI_DEVICE_TYPE_XCODER_MAX][NI_MAX_DEVICE_CNT];
+  ni_rsrc_broker_client_t clients[NI_RSRC_BROKER_MAX_CLIENTS];
+} ni_rsrc_broker_t;
+
+/*!******************************************************************************
+ *  \brief     Refresh the broker's copy of the static data of every device in
+ *             the pool: name, NUMA node, instance limit and codecs. Devices
+ *             no longer in the pool are closed.
+ *
+ *  \return    void
+ *******************************************************************************/
+static void broker_refresh_devices(ni_rsrc_broker_t *p_broker)
+{
+  ni_device_queue_t *p_device_queue = p_broker->p_device_pool->p_device_queue;
+  ni_rsrc_broker_device_t *p_dev;
+  ni_device_context_t *p_device_context;
+  ni_device_info_t *p_device_info;
+  int type, i, guid, present;
+
+  lockf(p_broker->p_device_pool->lock, F_LOCK, 0);
+  for (type = 0; type < NI_DEVICE_TYPE_XCODER_MAX; type++)
+  {
+    for (guid = 0; guid < NI_MAX_DEVICE_CNT; guid++)
+    {
+      p_broker->devices[type][guid].present = 0;
+    }
+    for (i = 0; i < (int)p_device_queue->xcoder_cnt[type]; i++)
+    {
+      guid = p_device_queue->xcoders[type][i];
+      if (guid < 0 || guid >= NI_MAX_DEVICE_CNT)
+      {
+        continue;
+      }
+      p_device_context =
+          ni_rsrc_get_device_context((ni_device_type_t)type, guid);
+      if (!p_device_context)
+      {
+        continue;
+      }
+      p_device_info = p_device_context->p_device_info;
+      p_dev = &p_broker->devices[type][guid];
+      if (strncmp(p_dev->dev_name, p_device_info->dev_name,
+                  sizeof(p_dev->dev_name)) &&
+          NI_INVALID_DEVICE_HANDLE != p_dev->handle)
+      {
+        // guid reused for another device
+        ni_device_close(p_dev->handle);
+        p_dev->handle = NI_INVALID_DEVICE_HANDLE;
+      }
+      snprintf(p_dev->dev_name, sizeof(p_dev->dev_name), "%s",
+               p_device_info->dev_name);
+      p_dev->hw_id = p_device_info->hw_id;
+      p_dev->numa_node = ni_rsrc_get_numa_node(p_device_info);
+      p_dev->max_instance_cnt = p_device_info->max_instance_cnt;
+      p_dev->codecs = 0;
+      for (present = 0; present < EN_CODEC_MAX; present++)
+      {
+        if (p_device_info->dev_cap[present].supports_codec >= 0 &&
+            p_device_info->dev_cap[present].supports_codec < EN_CODEC_MAX)
+        {
+          p_dev->codecs |= 1U << p_device_info->dev_cap[present].supports_codec;
+        }
+      }
+      p_dev->present = 1;
+      ni_rsrc_free_device_context(p_device_context);
+    }
+  }
+  lockf(p_broker->p_device_pool->lock, F_ULOCK, 0);
+
+  for (type = 0; type < NI_DEVICE_TYPE_XCODER_MAX; type++)
+  {
+    for (guid = 0; guid < NI_MAX_DEVICE_CNT; guid++)
+    {
+      p_dev = &p_broker->devices[type][guid];
+      if (!p_dev->present && NI_INVALID_DEVICE_HANDLE != p_dev->handle)
+      {
+        ni_device_close(p_dev->handle);
+        p_dev->handle = NI_INVALID_DEVICE_HANDLE;
+      }
+    }
+  }
+}
+
+/*!******************************************************************************
+ *  \brief     Query the load of every device. The NVMe queries run without
+ *             the pool lock, so allocations of other processes are not held
+ *             up; each result is stored under the lock afterwards, if the
+ *             device is still in the pool.
+ *
+ *  \return    void
+ *******************************************************************************/
+static void broker_poll_load(ni_rsrc_broker_t *p_broker)
+{
+  ni_device_queue_t *p_device_queue = p_broker->p_device_pool->p_device_queue;
+  ni_session_context_t *p_session_ctx = &p_broker->session_ctx;
+  ni_rsrc_broker_device_t *p_dev;
+  ni_device_context_t *p_device_context;
+  uint32_t max_io_size;
+  int type, i, guid;
+  bool in_pool;
+
+  for (type = 0; type < NI_DEVICE_TYPE_XCODER_MAX; type++)
+  {
+    for (guid = 0; guid < NI_MAX_DEVICE_CNT; guid++)
+    {
+      p_dev = &p_broker->devices[type][guid];
+      if (!p_dev->present)
+      {
+        continue;
+      }
+      if (NI_INVALID_DEVICE_HANDLE == p_dev->handle)
+      {
+        p_dev->handle = ni_device_open(p_dev->dev_name, &max_io_size);
+      }
+      if (NI_INVALID_DEVICE_HANDLE == p_dev->handle)
+      {
+        continue;
+      }
+
+      p_session_ctx->device_handle = p_dev->handle;
+      p_session_ctx->blk_io_handle = p_dev->handle;
+      p_session_ctx->hw_id = p_dev->hw_id;
+      if (NI_RETCODE_SUCCESS !=
+          ni_device_session_query(p_session_ctx, (ni_device_type_t)type))
+      {
+        ni_log(NI_LOG_ERROR, "ERROR: query %s %s.%d\n",
+               g_device_type_str[type], p_dev->dev_name, p_dev->hw_id);
+        // reopen on the next poll in case the device was reset
+        ni_device_close(p_dev->handle);
+        p_dev->handle = NI_INVALID_DEVICE_HANDLE;
+        continue;
+      }
+
+      lockf(p_broker->p_device_pool->lock, F_LOCK, 0);
+      in_pool = false;
+      for (i = 0; i < (int)p_device_queue->xcoder_cnt[type]; i++)
+      {
+        if (p_device_queue->xcoders[type][i] == guid)
+        {
+          in_pool = true;
+          break;
+        }
+      }
+      p_device_context = in_pool ?
+          ni_rsrc_get_device_context((ni_device_type_t)type, guid) : NULL;
+      if (p_device_context &&
+          0 == strncmp(p_device_context->p_device_info->dev_name,
+                       p_dev->dev_name, sizeof(p_dev->dev_name)))
+      {
+        lockf(p_device_context->lock, F_LOCK, 0);
+        ni_rsrc_update_record(p_device_context, p_session_ctx);
+        lockf(p_device_context->lock, F_ULOCK, 0);
+        // the firmware counters now include what was handed out
+        p_dev->pending = 0;
+        p_dev->pending_load = 0;
+      }
+      ni_rsrc_free_device_context(p_device_context);
+      lockf(p_broker->p_device_pool->lock, F_ULOCK, 0);
+    }
+  }
+}
+
+static void broker_allocate(ni_rsrc_broker_t *p_broker,
+                            ni_rsrc_broker_msg_t *p_msg)
+{
+  ni_device_queue_t *p_device_queue = p_broker->p_device_pool->p_device_queue;
+  ni_rsrc_broker_device_t *p_dev;
+  int type = p_msg->device_type;
+  int best_guid = -1;
+  int best_load = 0;
+  uint32_t best_inst = 0;
+  bool best_local = false;
+  bool better;
+  int i, guid, curr_load, need_load;
+  uint32_t curr_inst;
+  bool local;
+
+  p_msg->guid = -1;
+  p_msg->load = 0;
+  p_msg->retcode = NI_RETCODE_INVALID_PARAM;
+  if (NI_DEVICE_TYPE_DECODER != type && NI_DEVICE_TYPE_ENCODER != type)
+  {
+    return;
+  }
+  need_load = ni_rsrc_estimate_need_load((ni_device_type_t)type, p_msg->codec,
+                                         p_msg->width, p_msg->height,
+                                         p_msg->frame_rate, 8);
+
+  lockf(p_broker->p_device_pool->lock, F_LOCK, 0);
+  for (i = 0; i < (int)p_device_queue->xcoder_cnt[type]; i++)
+  {
+    guid = p_device_queue->xcoders[type][i];
+    if (guid < 0 || guid >= NI_MAX_DEVICE_CNT)
+    {
+      continue;
+    }
+    p_dev = &p_broker->devices[type][guid];
+    if (!p_dev->present ||
+        (p_broker->polling && NI_INVALID_DEVICE_HANDLE == p_dev->handle))
+    {
+      continue;
+    }
+
+    curr_inst = p_broker->p_load_table->active_num_inst[type][guid] +
+        p_dev->pending;
+    // eligible: supports the codec, has a free instance and room for the
+    // estimated model load, as ni_rsrc_allocate_batch() checks
+    if ((p_msg->codec >= 0 && p_msg->codec < EN_CODEC_MAX &&
+         !(p_dev->codecs & (1U << p_msg->codec))) ||
+        (p_dev->max_instance_cnt > 0 &&
+         curr_inst >= (uint32_t)p_dev->max_instance_cnt) ||
+        p_broker->p_load_table->model_load[type][guid] + p_dev->pending_load +
+                need_load >= 100)
+    {
+      continue;
+    }
+
+    curr_load = (NI_DEVICE_TYPE_ENCODER == type) ?
+        p_broker->p_load_table->model_load[type][guid] + p_dev->pending_load :
+        p_broker->p_load_table->load[type][guid];
+    local = (p_msg->numa_node >= 0 && p_dev->numa_node == p_msg->numa_node);
+
+    // same rules as ni_rsrc_allocate_auto(), the instances handed out since
+    // the last poll break ties so a burst is spread over equal cards
+    switch (p_msg->rule)
+    {
+      case EN_ALLOC_LEAST_INSTANCE:
+        better = curr_inst < best_inst;
+        break;
+      case EN_ALLOC_LEAST_LOAD_NUMA:
+        better = (local && !best_local) ||
+            (local == best_local &&
+             (curr_load < best_load ||
+              (curr_load == best_load && curr_inst < best_inst)));
+        break;
+      case EN_ALLOC_LEAST_LOAD:
+      default:
+        better = curr_load < best_load ||
+            (curr_load == best_load && curr_inst < best_inst);
+        break;
+    }
+
+    if (best_guid < 0 || better)
+    {
+      best_guid = guid;
+      best_load = curr_load;
+      best_inst = curr_inst;
+      best_local = local;
+    }
+  }
+  lockf(p_broker->p_device_pool->lock, F_ULOCK, 0);
+
+  if (best_guid < 0)
+  {
+    p_msg->retcode = NI_RETCODE_ERROR_RESOURCE_UNAVAILABLE;
+    return;
+  }
+
+  p_broker->devices[type][best_guid].pending++;
+  p_broker->devices[type][best_guid].pending_load += need_load;
+  p_msg->guid = best_guid;
+  if (NI_DEVICE_TYPE_ENCODER == type)
+  {
+    p_msg->load = (uint64_t)p_msg->width * p_msg->height * p_msg->frame_rate;
+  }
+  p_msg->retcode = NI_RETCODE_SUCCESS;
+}
+
+static void broker_release(ni_rsrc_broker_t *p_broker,
+                           ni_rsrc_broker_msg_t *p_msg)
+{
+  ni_rsrc_broker_device_t *p_dev;
+  int type = p_msg->device_type;
+
+  if (IS_XCODER_DEVICE_TYPE(type) && p_msg->guid >= 0 &&
+      p_msg->guid < NI_MAX_DEVICE_CNT)
+  {
+    p_dev = &p_broker->devices[type][p_msg->guid];
+    if (p_dev->pending > 0)
+    {
+      // the estimates are not kept apiece, give back their average
+      p_dev->pending_load -= p_dev->pending_load / p_dev->pending;
+      p_dev->pending--;
+    }
+  }
+  p_msg->retcode = NI_RETCODE_SUCCESS;
+}
+
+static void broker_close_client(ni_rsrc_broker_client_t *p_client)
+{
+  close(p_client->fd);
+  p_client->fd = -1;
+}
+
+static void broker_accept_clients(ni_rsrc_broker_t *p_broker, int listen_fd)
+{
+  ni_rsrc_broker_client_t *p_client;
+  int i, fd;
+
+  for (i = 0; i < NI_RSRC_BROKER_MAX_CLIENTS; i++)
+  {
+    p_client = &p_broker->clients[i];
+    if (p_client->fd >= 0)
+    {
+      continue;
+    }
+    fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+    {
+      return;
+    }
+#ifdef SO_NOSIGPIPE
+    {
+      int on = 1;
+      setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    }
+#endif
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK))
+    {
+      close(fd);
+      continue;
+    }
+    p_client->fd = fd;
+    p_client->done = 0;
+    p_client->replying = 0;
+    p_client->deadline_ns =
+        ni_gettime_ns() + (uint64_t)NI_RSRC_BROKER_TIMEOUT_MS * 1000000;
+  }
+}
+
+/*!******************************************************************************
+ *  \brief     Move a client on as far as its socket allows without blocking:
+ *             receive the request, answer it, send the reply, then close
+ *
+ *  \return    void
+ *******************************************************************************/
+static void broker_serve_client(ni_rsrc_broker_t *p_broker,
+                                ni_rsrc_broker_client_t *p_client)
+{
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+  uint8_t *p_data = (uint8_t *)&p_client->msg;
+  ssize_t ret;
+
+  while (!p_client->replying)
+  {
+    ret = recv(p_client->fd, p_data + p_client->done,
+               sizeof(p_client->msg) - p_client->done, 0);
+    if (ret < 0 && (EAGAIN == NI_ERRNO || EWOULDBLOCK == NI_ERRNO))
+    {
+      return;
+    }
+    if (ret < 0 && EINTR == NI_ERRNO)
+    {
+      continue;
+    }
+    if (ret <= 0)
+    {
+      broker_close_client(p_client);
+      return;
+    }
+    p_client->done += (size_t)ret;
+    if (p_client->done < sizeof(p_client->msg))
+    {
+      continue;
+    }
+
+    if (NI_RSRC_BROKER_MAGIC != p_client->msg.magic ||
+        NI_RSRC_BROKER_VERSION != p_client->msg.version)
+    {
+      ni_log(NI_LOG_ERROR, "ERROR: %s() bad request\n", __func__);
+      broker_close_client(p_client);
+      return;
+    }
+    switch (p_client->msg.op)
+    {
+      case NI_RSRC_BROKER_OP_ALLOCATE:
+        broker_allocate(p_broker, &p_client->msg);
+        ni_log(NI_LOG_DEBUG, "%s: allocate %d -> guid %d rc %d\n", __func__,
+               p_client->msg.device_type, p_client->msg.guid,
+               p_client->msg.retcode);
+        break;
+      case NI_RSRC_BROKER_OP_RELEASE:
+        broker_release(p_broker, &p_client->msg);
+        break;
+      default:
+        p_client->msg.retcode = NI_RETCODE_INVALID_PARAM;
+        break;
+    }
+    p_client->replying = 1;
+    p_client->done = 0;
+  }
+
+  while (p_client->done < sizeof(p_client->msg))
+  {
+    ret = send(p_client->fd, p_data + p_client->done,
+               sizeof(p_client->msg) - p_client->done, flags);
+    if (ret < 0 && (EAGAIN == NI_ERRNO || EWOULDBLOCK == NI_ERRNO))
+    {
+      return;
+    }
+    if (ret < 0 && EINTR == NI_ERRNO)
+    {
+      continue;
+    }
+    if (ret <= 0)
+    {
+      ni_log(NI_LOG_ERROR, "ERROR: %s() reply failed: %s\n", __func__,
+             strerror(NI_ERRNO));
+      break;
+    }
+    p_client->done += (size_t)ret;
+  }
+  broker_close_client(p_client);
+}
+
+/*!******************************************************************************
+ *  \brief     Run the local resource broker until g_xcoder_stop_process is
+ *             set. The broker keeps every device open, polls the load of all
+ *             of them every poll_interval_ms and serves allocation requests
+ *             sent through ni_rsrc_broker_request() from the load table.
+ *             Clients are served with non-blocking I/O, a slow one only
+ *             delays itself and is dropped after NI_RSRC_BROKER_TIMEOUT_MS.
+ *
+ *  \param[in] poll_interval_ms  load poll interval, 0 or less to never open
+ *                               or query the devices and serve from the load
+ *                               table as written by others
+ *
+ *  \return    0 on clean exit, -1 on failure
+ *******************************************************************************/
+int ni_rsrc_broker_run(int poll_interval_ms)
+{
+  ni_rsrc_broker_t *p_broker;
+  ni_rsrc_broker_client_t *p_client;
+  struct sockaddr_un addr;
+  struct pollfd pfds[NI_RSRC_BROKER_MAX_CLIENTS + 1];
+  int slots[NI_RSRC_BROKER_MAX_CLIENTS + 1];
+  uint64_t next_poll_ns = 0;   // first poll right away
+  uint64_t next_refresh_ns = 0;
+  uint64_t now_ns, wake_ns;
+  int timeout_ms;
+  int listen_fd = -1;
+  int retval = -1;
+  int type, guid, i, nfds;
+
+  p_broker = (ni_rsrc_broker_t *)calloc(1, sizeof(ni_rsrc_broker_t));
+  if (!p_broker)
+  {
+    ni_log(NI_LOG_ERROR, "ERROR: %s() calloc failed\n", __func__);
+    return -1;
+  }
+  for (type = 0; type < NI_DEVICE_TYPE_XCODER_MAX; type++)
+  {
+    for (guid = 0; guid < NI_MAX_DEVICE_CNT; guid++)
+    {
+      p_broker->devices[type][guid].handle = NI_INVALID_DEVICE_HANDLE;
+      p_broker->devices[type][guid].numa_node = -1;
+    }
+  }
+  for (i = 0; i < NI_RSRC_BROKER_MAX_CLIENTS; i++)
+  {
+    p_broker->clients[i].fd = -1;
+  }
+  ni_device_session_context_init(&p_broker->session_ctx);
+
+  p_broker->p_device_pool = ni_rsrc_get_device_pool();
+  p_broker->p_load_table = ni_rsrc_get_load_table();
+  if (!p_broker->p_device_pool || !p_broker->p_load_table)
+  {
+    ni_log(NI_LOG_ERROR, "ERROR: %s() resource pool not initialized\n",
+           __func__);
+    LRETURN;
+  }
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0)
+  {
+    ni_log(NI_LOG_ERROR, "ERROR: %s() socket(): %s\n", __func__,
+           strerror(NI_ERRNO));
+    LRETURN;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
+           NI_RSRC_BROKER_SOCK_NAME);
+  unlink(addr.sun_path);
+  if (fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL, 0) | O_NONBLOCK) ||
+      bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      chmod(addr.sun_path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP) ||
+      listen(listen_fd, SOMAXCONN))
+  {
+    ni_log(NI_LOG_ERROR, "ERROR: %s() cannot listen on %s: %s\n", __func__,
+           addr.sun_path, strerror(NI_ERRNO));
+    LRETURN;
+  }
+
+  // without polling no device is touched, which allows serving a pool and
+  // load table populated by a test instead of real cards
+  p_broker->polling = (poll_interval_ms > 0);
+  broker_refresh_devices(p_broker);
+  next_refresh_ns = ni_gettime_ns() +
+      (uint64_t)NI_RSRC_BROKER_REFRESH_MS * 1000000;
+  ni_log(NI_LOG_INFO, "Resource broker listening on %s\n", addr.sun_path);
+
+  while (!g_xcoder_stop_process)
+  {
+    now_ns = ni_gettime_ns();
+    if (now_ns >= next_refresh_ns)
+    {
+      broker_refresh_devices(p_broker);
+      next_refresh_ns = now_ns + (uint64_t)NI_RSRC_BROKER_REFRESH_MS * 1000000;
+    }
+    if (p_broker->polling && now_ns >= next_poll_ns)
+    {
+      broker_poll_load(p_broker);
+      now_ns = ni_gettime_ns();
+      next_poll_ns = now_ns + (uint64_t)poll_interval_ms * 1000000;
+    }
+
+    // drop clients that did not finish in time, wake for the next deadline
+    wake_ns = next_refresh_ns;
+    if (p_broker->polling && next_poll_ns < wake_ns)
+    {
+      wake_ns = next_poll_ns;
+    }
+    nfds = 0;
+    for (i = 0; i < NI_RSRC_BROKER_MAX_CLIENTS; i++)
+    {
+      p_client = &p_broker->clients[i];
+      if (p_client->fd < 0)
+      {
+        continue;
+      }
+      if (now_ns >= p_client->deadline_ns)
+      {
+        ni_log(NI_LOG_ERROR, "ERROR: %s() client timed out\n", __func__);
+        broker_close_client(p_client);
+        continue;
+      }
+      if (p_client->deadline_ns < wake_ns)
+      {
+        wake_ns = p_client->deadline_ns;
+      }
+      pfds[nfds].fd = p_client->fd;
+      pfds[nfds].events = p_client->replying ? POLLOUT : POLLIN;
+      pfds[nfds].revents = 0;
+      slots[nfds++] = i;
+    }
+    // no new connection while every slot is busy, they wait in the backlog
+    if (nfds < NI_RSRC_BROKER_MAX_CLIENTS)
+    {
+      pfds[nfds].fd = listen_fd;
+      pfds[nfds].events = POLLIN;
+      pfds[nfds].revents = 0;
+      slots[nfds++] = -1;
+    }
+    timeout_ms = (wake_ns > now_ns) ?
+        (int)((wake_ns - now_ns) / 1000000) + 1 : 0;
+
+    if (poll(pfds, (nfds_t)nfds, timeout_ms) <= 0)
+    {
+      continue;
+    }
+    for (i = 0; i < nfds; i++)
+    {
+      if (!pfds[i].revents)
+      {
+        continue;
+      }
+      if (slots[i] < 0)
+      {
+        broker_accept_clients(p_broker, listen_fd);
+      } else
+      {
+        broker_serve_client(p_broker, &p_broker->clients[slots[i]]);
+      }
+    }
+  }
+  retval = 0;
+
+END:
+
+  for (i = 0; i < NI_RSRC_BROKER_MAX_CLIENTS; i++)
+  {
+    if (p_broker->clients[i].fd >= 0)
+    {
+      broker_close_client(&p_broker->clients[i]);
+    }
+  }
+  if (listen_fd >= 0)
+  {
+    close(listen_fd);
+    unlink(NI_RSRC_BROKER_SOCK_NAME);
+  }
+  for (type = 0; type < NI_DEVICE_TYPE_XCODER_MAX; type++)
+  {
+    for (guid = 0; guid < NI_MAX_DEVICE_CNT; guid++)
+    {
+      if (NI_INVALID_DEVICE_HANDLE != p_broker->devices[type][guid].handle)
+      {
+        ni_device_close(p_broker->devices[type][guid].handle);
+      }
+    }
+  }
+  ni_device_session_context_clear(&p_broker->session_ctx);
+  ni_rsrc_free_device_pool(p_broker->p_device_pool);
+  free(p_broker);
+  ni_log(NI_LOG_INFO, "Resource broker stopped\n");
+  return retval;
+}
+
 #endif
@@ -51,6 +51,7 @@ NI_UNUSED static const char *XCODERS_RETRY_LCK_NAME[] = {
     LOCK_DIR "/NI_RETRY_LCK_SCALERS", LOCK_DIR "/NI_RETRY_LCK_AI"};
 
 #define CODERS_SHM_NAME "NI_SHM_CODERS"
+#define CODERS_LOAD_SHM_NAME CODERS_SHM_NAME "_LOAD"
 
 // The macro definition in libxcoder_FFmpeg3.1.1only/source/ni_rsrc_priv.h need to be synchronized with libxcoder
 // If you change this,you should also change MAX_LOCK_RETRY LOCK_WAIT in libxcoder_FFmpeg3.1.1only/source/ni_rsrc_priv.h
@@ -59,11 +60,87 @@ NI_UNUSED static const char *XCODERS_RETRY_LCK_NAME[] = {
 
 extern LIB_API uint32_t g_xcoder_stop_process;
 
+// Frequently updated load counters of every device, kept in their own shared
+// memory segment (CODERS_LOAD_SHM_NAME) instead of the mostly static
+// ni_device_info_t records so that updating them does not dirty the cache
+// lines readers of the static data use, and an allocation scan reads one
+// contiguous region. The load fields of the shared records are not updated
+// where the table exists; ni_rsrc_sync_device_load() fills them in copies. Struct of arrays indexed [device_type][guid]: each row is
+// NI_MAX_DEVICE_CNT * 4 bytes, a multiple of the cache line size, so with the
+// page aligned mapping every row starts on a cache line boundary.
+typedef struct _ni_device_load_table
+{
+  int32_t load[NI_DEVICE_TYPE_XCODER_MAX][NI_MAX_DEVICE_CNT];
+  int32_t model_load[NI_DEVICE_TYPE_XCODER_MAX][NI_MAX_DEVICE_CNT];
+  uint32_t active_num_inst[NI_DEVICE_TYPE_XCODER_MAX][NI_MAX_DEVICE_CNT];
+} ni_device_load_table_t;
+
+typedef struct _ni_device_load
+{
+  int load;
+  int model_load;
+  uint32_t active_num_inst;
+} ni_device_load_t;
+
+// Optional local resource broker (init_rsrc -b). It owns the device handles,
+// polls the load of every card and answers allocation requests sent over a
+// Unix domain socket, so clients skip the per-process device sweep.
+#define NI_RSRC_BROKER_SOCK_NAME LOCK_DIR "/NI_RSRC_BROKER"
+#define NI_RSRC_BROKER_MAGIC 0x4E494252   // "NIBR"
+#define NI_RSRC_BROKER_VERSION 1
+#define NI_RSRC_BROKER_TIMEOUT_MS 1000    // client send/receive timeout
+#define NI_RSRC_BROKER_MAX_CLIENTS 64     // clients served at the same time
+#define NI_RSRC_BROKER_REFRESH_MS 1000    // device pool re-read interval
+#define NI_RSRC_BROKER_POLL_MS 100        // default load poll interval
+
+typedef enum _ni_rsrc_broker_op
+{
+  NI_RSRC_BROKER_OP_ALLOCATE = 1,
+  NI_RSRC_BROKER_OP_RELEASE = 2,
+} ni_rsrc_broker_op_t;
+
+// Fixed size request/reply, the broker replies with the request it received
+// with guid, load and retcode filled in.
+typedef struct _ni_rsrc_broker_msg
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t op;          // ni_rsrc_broker_op_t
+  int32_t device_type;
+  int32_t rule;         // ni_alloc_rule_t
+  int32_t codec;
+  int32_t width;
+  int32_t height;
+  int32_t frame_rate;
+  int32_t numa_node;    // NUMA node of the client, -1 if unknown
+  int32_t guid;         // allocated guid in reply, released guid in request
+  int32_t retcode;      // ni_retcode_t, reply only
+  int32_t reserved;
+  uint64_t load;        // job load of the allocation
+} ni_rsrc_broker_msg_t;
+
 // The macro definition in libxcoder_FFmpeg3.1.1only/source/ni_rsrc_priv.h need to be synchronized with libxcoder
 // If you change these functions,you should also change these functions in libxcoder_FFmpeg3.1.1only/source/ni_rsrc_priv.h
 void ni_rsrc_get_lock_name(ni_device_type_t device_type, int32_t guid, char* p_name, size_t max_name_len);
 void ni_rsrc_get_shm_name(ni_device_type_t device_type, int32_t guid, char* p_name, size_t max_name_len);
 void ni_rsrc_update_record(ni_device_context_t *p_device_context, ni_session_context_t *p_session_ctx);
+ni_device_load_table_t *ni_rsrc_get_load_table(void);
+void ni_rsrc_get_device_load(const ni_device_load_table_t *p_load_table,
+                             const ni_device_info_t *p_device_info,
+                             ni_device_load_t *p_load);
+void ni_rsrc_set_device_load(ni_device_load_table_t *p_load_table,
+                             ni_device_info_t *p_device_info,
+                             const ni_device_load_t *p_load);
+void ni_rsrc_sync_device_load(ni_device_info_t *p_device_info, int count);
+int ni_rsrc_get_numa_node(const ni_device_info_t *p_device_info);
+#if __linux__ || __APPLE__
+int ni_rsrc_fit_device_record(int shm_fd);
+#endif
+ni_retcode_t ni_rsrc_broker_request(ni_rsrc_broker_msg_t *p_msg);
+int ni_rsrc_broker_run(int poll_interval_ms);
+int ni_rsrc_estimate_need_load(ni_device_type_t device_type, int codec,
+                               int width, int height, int frame_rate,
+                               int bit_depth);
 void ni_rsrc_get_one_device_info(ni_device_info_t *p_device_info);
 ni_retcode_t ni_rsrc_fill_device_info(ni_device_info_t* p_device_info, ni_codec_t fmt, ni_device_type_t type, ni_hw_capability_t* p_hw_cap);
 #ifdef _WIN32
@@ -92,6 +169,26 @@ void get_dev_pcie_addr(char *device_name,
                        char *pcie, 
                        char *domain, char *slot, char *dev, char *func);
 
+// identity of a device already in the resource pool, used to skip the NVMe
+// identify of devices that are unchanged since the pool was populated
+typedef struct _ni_device_fingerprint
+{
+  char dev_name[NI_MAX_DEVICE_NAME_LEN];
+  uint8_t serial_number[20];
+  uint8_t fw_rev[8];
+  int module_cnt[NI_DEVICE_TYPE_XCODER_MAX]; // pool entries per device type
+} ni_device_fingerprint_t;
+
+bool ni_rsrc_read_device_fingerprint(const char *device_name,
+                                     uint8_t serial_number[20],
+                                     uint8_t fw_rev[8]);
+int ni_rsrc_get_pool_fingerprints(ni_device_fingerprint_t *p_fingerprints,
+                                  int max_fingerprints);
+int ni_rsrc_check_device_fingerprint(const char *device_name,
+                                     const ni_device_fingerprint_t *p_fingerprints,
+                                     int fingerprint_cnt,
+                                     const ni_device_fingerprint_t **pp_match);
+
 #ifdef __cplusplus
 }
 #endif
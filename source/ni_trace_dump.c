@@ -0,0 +1,268 @@
+/*******************************************************************************
+ *
+ * Copyright (C) 2022 NETINT Technologies
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+/*!*****************************************************************************
+ * \file   ni_trace_dump.c
+ *
+ * \brief  Application to decode an NVMe command trace ring file written by
+ *         ni_nvme_trace_start() into text or Chrome trace JSON
+ ******************************************************************************/
+
+#if __linux__ || __APPLE__
+#include <unistd.h>
+#include <sys/types.h>
+#elif _WIN32
+#include "ni_getopt.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ni_util.h"
+
+static const char *trace_device_type_str(uint8_t device_type)
+{
+    if (device_type <= NI_DEVICE_TYPE_AI)
+    {
+        return g_device_type_str[device_type];
+    }
+    return "unknown";
+}
+
+static const char *trace_lba_class_str(uint8_t lba_class)
+{
+    switch (lba_class)
+    {
+        case NI_NVME_TRACE_LBA_READ:
+            return "data_rd";
+        case NI_NVME_TRACE_LBA_WRITE:
+            return "data_wr";
+        default:
+            return "ctrl";
+    }
+}
+
+static void print_text_record(FILE *p_out, const ni_nvme_trace_record_t *p_rec,
+                              uint64_t base_time)
+{
+    fprintf(p_out,
+            "%14.3f %7u %7u %-7s sid %-5u %-5s %-7s",
+            (double)(p_rec->timestamp - base_time) / 1000.0, p_rec->pid,
+            p_rec->tid, trace_device_type_str(p_rec->device_type),
+            p_rec->session_id,
+            p_rec->opcode == NI_NVME_TRACE_OP_WRITE ? "write" : "read",
+            trace_lba_class_str(p_rec->lba_class));
+    if (p_rec->lba_class == NI_NVME_TRACE_LBA_CTRL)
+    {
+        fprintf(p_out, " op 0x%02x sub 0x%x opt 0x%x", p_rec->lba_op,
+                p_rec->lba_subtype, p_rec->lba_option);
+    }
+    fprintf(p_out, " lba 0x%08x len %8u dur %10.3f us rc %d\n",
+            p_rec->lba, p_rec->data_len, (double)p_rec->duration / 1000.0,
+            p_rec->rc);
+}
+
+static void print_json_record(FILE *p_out, const ni_nvme_trace_record_t *p_rec,
+                              uint64_t base_time, int first)
+{
+    fprintf(p_out,
+            "%s\n{\"name\":\"%s %s %s\",\"cat\":\"nvme\",\"ph\":\"X\","
+            "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u,"
+            "\"args\":{\"session_id\":%u,\"lba\":\"0x%08x\",\"len\":%u,"
+            "\"rc\":%d",
+            first ? "" : ",", trace_device_type_str(p_rec->device_type),
+            p_rec->opcode == NI_NVME_TRACE_OP_WRITE ? "write" : "read",
+            trace_lba_class_str(p_rec->lba_class),
+            (double)(p_rec->timestamp - base_time) / 1000.0,
+            (double)p_rec->duration / 1000.0, p_rec->pid, p_rec->tid,
+            p_rec->session_id, p_rec->lba, p_rec->data_len, p_rec->rc);
+    if (p_rec->lba_class == NI_NVME_TRACE_LBA_CTRL)
+    {
+        fprintf(p_out, ",\"op\":\"0x%02x\",\"subtype\":\"0x%x\",\"option\":\"0x%x\"",
+                p_rec->lba_op, p_rec->lba_subtype, p_rec->lba_option);
+    }
+    fprintf(p_out, "}}");
+}
+
+int32_t main(int argc, char *argv[])
+{
+    int opt;
+    int json = 0;
+    int first = 1;
+    const char *p_in_name = NULL;
+    const char *p_out_name = NULL;
+    FILE *p_in = NULL;
+    FILE *p_out = stdout;
+    ni_nvme_trace_header_t hdr;
+    ni_nvme_trace_record_t *p_recs = NULL;
+    uint64_t index, start, end;
+    uint64_t base_time = 0;
+    uint32_t torn = 0;
+    int ret = 1;
+
+    while ((opt = getopt(argc, argv, "hjo:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h':
+                printf("-------- ni_trace_dump v%s --------\n"
+                       "Decode an NVMe command trace ring file.\n"
+                       "Usage: ni_trace_dump [-j] [-o output] trace_file\n"
+                       "\n"
+                       "-j  Output Chrome trace JSON (chrome://tracing, Perfetto)\n"
+                       "    instead of text.\n"
+                       "-o  Write output to a file instead of stdout.\n"
+                       "-h  Display this help and exit.\n"
+                       "-v  Print version info.\n"
+                       "\n"
+                       "Tracing is enabled in libxcoder by setting the %s\n"
+                       "environment variable to the ring file path, or by\n"
+                       "calling ni_nvme_trace_start().\n",
+                       NI_XCODER_REVISION, NI_NVME_TRACE_ENV);
+                return 0;
+            case 'j':
+                json = 1;
+                break;
+            case 'o':
+                p_out_name = optarg;
+                break;
+            case 'v':
+                printf("Release ver: %s\n"
+                       "API ver:     %s\n"
+                       "Date:        %s\n"
+                       "ID:          %s\n",
+                       NI_XCODER_REVISION, LIBXCODER_API_VERSION,
+                       NI_SW_RELEASE_TIME, NI_SW_RELEASE_ID);
+                return 0;
+            default:
+                fprintf(stderr, "FATAL: invalid arg '%c'\n", opt);
+                return 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf(stderr, "Error: missing trace file, see -h\n");
+        return 1;
+    }
+    p_in_name = argv[optind];
+
+    p_in = fopen(p_in_name, "rb");
+    if (!p_in)
+    {
+        fprintf(stderr, "Error: cannot open %s\n", p_in_name);
+        return 1;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, p_in) != 1 ||
+        hdr.magic != NI_NVME_TRACE_MAGIC || hdr.version != NI_NVME_TRACE_VERSION ||
+        hdr.header_size != sizeof(ni_nvme_trace_header_t) ||
+        hdr.record_size != sizeof(ni_nvme_trace_record_t) || !hdr.capacity)
+    {
+        fprintf(stderr, "Error: %s is not a version %d NVMe trace file\n",
+                p_in_name, NI_NVME_TRACE_VERSION);
+        goto end;
+    }
+
+    p_recs = malloc((size_t)hdr.capacity * sizeof(ni_nvme_trace_record_t));
+    if (!p_recs ||
+        fread(p_recs, sizeof(ni_nvme_trace_record_t), hdr.capacity, p_in) !=
+            hdr.capacity)
+    {
+        fprintf(stderr, "Error: cannot read %u records from %s\n",
+                hdr.capacity, p_in_name);
+        goto end;
+    }
+
+    if (p_out_name)
+    {
+        p_out = fopen(p_out_name, "w");
+        if (!p_out)
+        {
+            fprintf(stderr, "Error: cannot open %s\n", p_out_name);
+            p_out = stdout;
+            goto end;
+        }
+    }
+
+    // records are claimed in write_index order but may be written out of
+    // order, only the last capacity ones are still in the ring
+    end = hdr.write_index;
+    start = end > hdr.capacity ? end - hdr.capacity : 0;
+    for (index = start; index < end; index++)
+    {
+        const ni_nvme_trace_record_t *p_rec = &p_recs[index % hdr.capacity];
+        if (p_rec->seq == index + 1 &&
+            (!base_time || p_rec->timestamp < base_time))
+        {
+            base_time = p_rec->timestamp;
+        }
+    }
+
+    if (json)
+    {
+        fprintf(p_out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    } else
+    {
+        fprintf(p_out, "# %s: %" PRIu64 " commands recorded, ring of %u, "
+                "base time %" PRIu64 " ns\n"
+                "#      time(us)     pid     tid type    session  cmd   lba\n",
+                p_in_name, hdr.write_index, hdr.capacity, base_time);
+    }
+
+    for (index = start; index < end; index++)
+    {
+        const ni_nvme_trace_record_t *p_rec = &p_recs[index % hdr.capacity];
+        if (p_rec->seq != index + 1)
+        {
+            torn++;
+            continue;
+        }
+        if (json)
+        {
+            print_json_record(p_out, p_rec, base_time, first);
+            first = 0;
+        } else
+        {
+            print_text_record(p_out, p_rec, base_time);
+        }
+    }
+
+    if (json)
+    {
+        fprintf(p_out, "\n]}\n");
+    }
+    if (torn)
+    {
+        fprintf(stderr, "%u records incomplete or overwritten while reading, "
+                "skipped\n", torn);
+    }
+    ret = 0;
+
+end:
+    free(p_recs);
+    fclose(p_in);
+    if (p_out != stdout)
+    {
+        fclose(p_out);
+    }
+    return ret;
+}
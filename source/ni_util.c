@@ -25,6 +25,8 @@
  *  \brief  Utility definitions
  ******************************************************************************/
 
+#define NI_LOG_MODULE NI_LOG_MODULE_UTIL
+
 #if __linux__ || __APPLE__
 #include <sys/ioctl.h>
 #include <sys/stat.h>
@@ -36,6 +38,16 @@
 #include <unistd.h>
 #endif
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#if (__linux__ || __APPLE__) && !defined(_ANDROID)
+#include <errno.h>
+#include <pthread.h>
+#define NI_PERF_COUNTERS_SUPPORTED
+#endif
+
 #include "ni_nvme.h"
 #include "ni_util.h"
 
@@ -337,46 +349,1314 @@ END:
 
 #endif
 
-void ni_usleep(int64_t usec)
+/*!*****************************************************************************
+ *  \brief Get the NUMA node an NVMe block device is attached to
+ *
+ *  \param[in] p_dev   device name, e.g. /dev/nvme0n1
+ *
+ *  \return NUMA node number, -1 if unknown or not supported on this platform
+ ******************************************************************************/
+int ni_get_device_numa_node(const char *p_dev)
 {
-#ifdef _WIN32
-    if (usec < 5000)   //this will be more accurate when less than 5000
+#ifdef __linux__
+    // the block device's "device" is the nvme controller, whose "device" is
+    // the PCIe function; older kernels only expose numa_node on the latter
+    static const char *numa_node_paths[] = {"/device/device/numa_node",
+                                            "/device/numa_node"};
+    char file_name[128];
+    FILE *p_file = NULL;
+    int numa_node = -1;
+    size_t i;
+
+    if (!p_dev || strncmp(p_dev, "/dev/", 5) != 0 ||
+        strlen(p_dev) - 5 < MIN_NVME_DEV_NAME_LEN)
     {
-        LARGE_INTEGER StartCount;
-        LARGE_INTEGER StopCount;
-        LARGE_INTEGER Frequency;
-        QueryPerformanceCounter(&StartCount);
-        QueryPerformanceFrequency(&Frequency);
-        StopCount.QuadPart =
-            StartCount.QuadPart + usec * (Frequency.QuadPart / 1000000);
-        do
+        return -1;
+    }
+
+    for (i = 0; i < sizeof(numa_node_paths) / sizeof(numa_node_paths[0]); i++)
+    {
+        snprintf(file_name, sizeof(file_name), "%s%s%s",
+                 SYS_PARAMS_PREFIX_PATH, p_dev + 5, numa_node_paths[i]);
+        p_file = fopen(file_name, "r");
+        if (!p_file)
         {
-            QueryPerformanceCounter(&StartCount);
-        } while (StartCount.QuadPart < StopCount.QuadPart);
+            continue;
+        }
+        if (1 != fscanf(p_file, "%d", &numa_node))
+        {
+            numa_node = -1;
+        }
+        fclose(p_file);
+        break;
+    }
+
+    ni_log(NI_LOG_DEBUG, "%s: %s numa_node %d\n", __func__, p_dev, numa_node);
+    return numa_node;
+#else
+    (void)p_dev;
+    return -1;
+#endif
+}
+
+/*!*****************************************************************************
+ *  \brief Get the NUMA node of the CPU the calling thread is running on
+ *
+ *  \return NUMA node number, -1 if unknown or not supported on this platform
+ ******************************************************************************/
+int ni_get_current_numa_node(void)
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned int cpu = 0, node = 0;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+    {
+        return -1;
+    }
+    return (int)node;
+#else
+    return -1;
+#endif
+}
+
+/*!*****************************************************************************
+ *  \brief Set a preferred NUMA node memory policy on a range of host memory
+ *         so its pages are placed on (or migrated to) the given node. Best
+ *         called right after allocation, before the buffer is first touched.
+ *
+ *  \param[in] p_buf      start of the memory range
+ *  \param[in] size       size of the memory range in bytes
+ *  \param[in] numa_node  NUMA node to bind to
+ *
+ *  \return 0 on success, -1 on failure or if not supported on this platform
+ ******************************************************************************/
+int ni_numa_bind_buffer(void *p_buf, size_t size, int numa_node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    // values from <numaif.h>, libnuma is not a dependency of libxcoder
+    const int mpol_preferred = 1;
+    const unsigned int mpol_mf_move = (1 << 1);
+    const int bits_per_long = (int)(sizeof(unsigned long) * 8);
+    unsigned long node_mask[4] = {0};
+    uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start, end;
+
+    if (!p_buf || !size || numa_node < 0 ||
+        numa_node >= (int)(sizeof(node_mask) * 8))
+    {
+        return -1;
+    }
+
+    // mbind works on whole pages
+    start = (uintptr_t)p_buf & ~(page_size - 1);
+    end = ((uintptr_t)p_buf + size + page_size - 1) & ~(page_size - 1);
+    node_mask[numa_node / bits_per_long] = 1UL << (numa_node % bits_per_long);
+
+    if (syscall(SYS_mbind, (void *)start, end - start, mpol_preferred,
+                node_mask, sizeof(node_mask) * 8 + 1, mpol_mf_move) != 0)
+    {
+        ni_log(NI_LOG_DEBUG, "%s: mbind %p size %zu to node %d failed: %s\n",
+               __func__, p_buf, size, numa_node, strerror(NI_ERRNO));
+        return -1;
+    }
+    return 0;
+#else
+    (void)p_buf;
+    (void)size;
+    (void)numa_node;
+    return -1;
+#endif
+}
+
+#ifndef _WIN32
+#define NI_MEM_POOL_SUPPORTED
+#endif
+
+#ifdef NI_MEM_POOL_SUPPORTED
+// free blocks are chained through their first bytes
+typedef struct _ni_mem_pool_cache
+{
+    void *p_head[NI_MEM_POOL_NUM_CLASSES];
+    uint32_t count[NI_MEM_POOL_NUM_CLASSES];
+    uint64_t bytes;
+} ni_mem_pool_cache_t;
+
+static pthread_mutex_t g_mem_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void *g_mem_pool_depot[NI_MEM_POOL_NUM_CLASSES];
+static uint64_t g_mem_pool_depot_bytes = 0;
+static ni_mem_pool_stats_t g_mem_pool_stats;
+static pthread_key_t g_mem_pool_cache_key;
+static pthread_once_t g_mem_pool_cache_key_once = PTHREAD_ONCE_INIT;
+static int g_mem_pool_cache_key_valid = 0;  // created and not deleted yet
+static __thread ni_mem_pool_cache_t *g_mem_pool_thread_cache = NULL;
+
+#define NI_MEM_POOL_STAT_ADD(field, n)                                         \
+    __atomic_fetch_add(&g_mem_pool_stats.field, (n), __ATOMIC_RELAXED)
+#define NI_MEM_POOL_STAT_SUB(field, n)                                         \
+    __atomic_fetch_sub(&g_mem_pool_stats.field, (n), __ATOMIC_RELAXED)
+
+// classes 0-3 are 1-4 pages, then 4 classes per power of two:
+// 5, 6, 7, 8, 10, 12, 14, 16, 20 ... 65536 pages
+static int ni_mem_pool_class(size_t size)
+{
+    size_t pages = (size + NI_MEM_PAGE_ALIGNMENT - 1) / NI_MEM_PAGE_ALIGNMENT;
+    size_t m;
+    int k;
+
+    if (pages <= 4)
+    {
+        return pages ? (int)pages - 1 : 0;
+    }
+    m = pages - 1;
+    k = 63 - __builtin_clzll((unsigned long long)m);
+    return 4 + (k - 2) * 4 + (int)((m >> (k - 2)) - 4);
+}
+
+static size_t ni_mem_pool_class_size(int cls)
+{
+    if (cls < 4)
+    {
+        return (size_t)(cls + 1) * NI_MEM_PAGE_ALIGNMENT;
+    }
+    return ((size_t)(5 + (cls - 4) % 4) << ((cls - 4) / 4)) *
+        NI_MEM_PAGE_ALIGNMENT;
+}
+
+// put a block in the depot, or free it if the depot is full
+static void ni_mem_pool_depot_put(void *p_buf, int cls, size_t class_size)
+{
+    pthread_mutex_lock(&g_mem_pool_mutex);
+    if (g_mem_pool_depot_bytes + class_size <= NI_MEM_POOL_DEPOT_BYTES)
+    {
+        *(void **)p_buf = g_mem_pool_depot[cls];
+        g_mem_pool_depot[cls] = p_buf;
+        g_mem_pool_depot_bytes += class_size;
+        pthread_mutex_unlock(&g_mem_pool_mutex);
+        NI_MEM_POOL_STAT_ADD(bytes_cached, class_size);
+        return;
+    }
+    pthread_mutex_unlock(&g_mem_pool_mutex);
+    ni_mem_arena_free(p_buf, class_size);
+    NI_MEM_POOL_STAT_ADD(system_frees, 1);
+}
+
+// move all blocks of a thread cache to the depot
+static void ni_mem_pool_cache_flush(ni_mem_pool_cache_t *p_cache)
+{
+    void *p_buf;
+    size_t class_size;
+    int cls;
+
+    for (cls = 0; cls < NI_MEM_POOL_NUM_CLASSES; cls++)
+    {
+        class_size = ni_mem_pool_class_size(cls);
+        while ((p_buf = p_cache->p_head[cls]) != NULL)
+        {
+            p_cache->p_head[cls] = *(void **)p_buf;
+            NI_MEM_POOL_STAT_SUB(bytes_cached, class_size);
+            ni_mem_pool_depot_put(p_buf, cls, class_size);
+        }
+        p_cache->count[cls] = 0;
+    }
+    p_cache->bytes = 0;
+}
+
+static void ni_mem_pool_cache_release(void *p_cache)
+{
+    ni_mem_pool_cache_flush((ni_mem_pool_cache_t *)p_cache);
+    free(p_cache);
+    g_mem_pool_thread_cache = NULL;
+}
+
+static void ni_mem_pool_cache_key_init(void)
+{
+    if (0 == pthread_key_create(&g_mem_pool_cache_key,
+                                ni_mem_pool_cache_release))
+    {
+        __atomic_store_n(&g_mem_pool_cache_key_valid, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/*!*****************************************************************************
+ *  \brief Run when the library is unloaded or the process exits. Deletes the
+ *         cache key, otherwise threads exiting after a dlclose() would call
+ *         its destructor in unmapped code, and gives the calling thread's
+ *         cache and the depot back to the system. Caches of other threads
+ *         that are still running are left alone, they may be in use.
+ ******************************************************************************/
+__attribute__((destructor)) static void ni_mem_pool_unload(void)
+{
+    if (!__atomic_exchange_n(&g_mem_pool_cache_key_valid, 0, __ATOMIC_ACQ_REL))
+    {
+        return;
+    }
+    pthread_key_delete(g_mem_pool_cache_key);
+    ni_mem_pool_trim(0);
+    if (g_mem_pool_thread_cache)
+    {
+        free(g_mem_pool_thread_cache);
+        g_mem_pool_thread_cache = NULL;
+    }
+}
+
+static ni_mem_pool_cache_t *ni_mem_pool_get_thread_cache(void)
+{
+    ni_mem_pool_cache_t *p_cache = g_mem_pool_thread_cache;
+
+    if (p_cache)
+    {
+        return p_cache;
+    }
+
+    pthread_once(&g_mem_pool_cache_key_once, ni_mem_pool_cache_key_init);
+    if (!__atomic_load_n(&g_mem_pool_cache_key_valid, __ATOMIC_ACQUIRE))
+    {
+        // no key, or deleted at unload: nothing would free a new cache
+        return NULL;
+    }
+    p_cache = (ni_mem_pool_cache_t *)calloc(1, sizeof(ni_mem_pool_cache_t));
+    if (!p_cache)
+    {
+        return NULL;
+    }
+    // the key destructor empties the cache into the depot at thread exit
+    pthread_setspecific(g_mem_pool_cache_key, p_cache);
+    g_mem_pool_thread_cache = p_cache;
+    return p_cache;
+}
+#endif
+
+#if defined(__linux__) && defined(NI_MEM_POOL_SUPPORTED)
+#define NI_MEM_HUGE_PAGES_SUPPORTED
+#endif
+
+#ifdef NI_MEM_HUGE_PAGES_SUPPORTED
+// the mode may only change while no block of NI_MEM_HUGE_PAGE_SIZE or more
+// exists, so a block is always freed the way it was allocated
+static pthread_mutex_t g_mem_arena_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int g_mem_huge_mode = -1;    // -1: environment not read yet
+static uint64_t g_mem_arena_blocks = 0;
+
+static int ni_mem_arena_mode_locked(void)
+{
+    const char *p_env;
+
+    if (g_mem_huge_mode < 0)
+    {
+        g_mem_huge_mode = NI_MEM_HUGE_PAGES_OFF;
+        p_env = getenv(NI_MEM_HUGE_PAGES_ENV);
+        if (p_env && !strcmp(p_env, "thp"))
+        {
+            g_mem_huge_mode = NI_MEM_HUGE_PAGES_THP;
+        } else if (p_env && !strcmp(p_env, "hugetlb"))
+        {
+            g_mem_huge_mode = NI_MEM_HUGE_PAGES_HUGETLB;
+        }
+    }
+    return g_mem_huge_mode;
+}
+
+static size_t ni_mem_arena_map_size(size_t size)
+{
+    return (size + NI_MEM_HUGE_PAGE_SIZE - 1) &
+        ~((size_t)NI_MEM_HUGE_PAGE_SIZE - 1);
+}
+
+// map len bytes of huge pages, len a multiple of NI_MEM_HUGE_PAGE_SIZE
+static void *ni_mem_arena_map(size_t len, int mode)
+{
+    uint8_t *p_map;
+    uint8_t *p_aligned;
+    size_t head;
+
+#ifdef MAP_HUGETLB
+    if (NI_MEM_HUGE_PAGES_HUGETLB == mode)
+    {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+        flags |= 21 << MAP_HUGE_SHIFT;   // 2 MiB pages
+#endif
+        p_map = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (MAP_FAILED != p_map)
+        {
+            return p_map;
+        }
+        NI_MEM_POOL_STAT_ADD(hugetlb_fallbacks, 1);
+        ni_log(NI_LOG_DEBUG, "%s: MAP_HUGETLB %zu failed: %s\n", __func__,
+               len, strerror(NI_ERRNO));
+    }
+#else
+    (void)mode;
+#endif
+
+    // over-map by one huge page so a 2 MiB aligned range can be kept,
+    // otherwise the kernel can not back it with transparent huge pages
+    p_map = mmap(NULL, len + NI_MEM_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == p_map)
+    {
+        return NULL;
+    }
+    p_aligned = (uint8_t *)(((uintptr_t)p_map + NI_MEM_HUGE_PAGE_SIZE - 1) &
+                            ~((uintptr_t)NI_MEM_HUGE_PAGE_SIZE - 1));
+    head = p_aligned - p_map;
+    if (head)
+    {
+        munmap(p_map, head);
+    }
+    munmap(p_aligned + len, NI_MEM_HUGE_PAGE_SIZE - head);
+#ifdef MADV_HUGEPAGE
+    madvise(p_aligned, len, MADV_HUGEPAGE);
+#endif
+    return p_aligned;
+}
+#endif
+
+/*!*****************************************************************************
+ *  \brief Select how buffers of NI_MEM_HUGE_PAGE_SIZE or more are backed,
+ *         only while no such buffer is allocated
+ *
+ *  \param[in] mode  NI_MEM_HUGE_PAGES_OFF, _THP or _HUGETLB
+ *
+ *  \return 0 for success, EBUSY if buffers are allocated, ENOTSUP if huge
+ *          pages are not supported on this platform, EINVAL for bad mode
+ ******************************************************************************/
+int ni_mem_set_huge_pages(ni_mem_huge_pages_t mode)
+{
+    if (mode < NI_MEM_HUGE_PAGES_OFF || mode > NI_MEM_HUGE_PAGES_HUGETLB)
+    {
+        return EINVAL;
+    }
+#ifdef NI_MEM_HUGE_PAGES_SUPPORTED
+    pthread_mutex_lock(&g_mem_arena_mutex);
+    if (g_mem_arena_blocks && (int)mode != ni_mem_arena_mode_locked())
+    {
+        pthread_mutex_unlock(&g_mem_arena_mutex);
+        ni_log(NI_LOG_ERROR, "ERROR: %s: %" PRIu64 " buffers allocated, can "
+               "not change mode\n", __func__, g_mem_arena_blocks);
+        return EBUSY;
+    }
+    g_mem_huge_mode = (int)mode;
+    pthread_mutex_unlock(&g_mem_arena_mutex);
+    return 0;
+#else
+    return NI_MEM_HUGE_PAGES_OFF == mode ? 0 : ENOTSUP;
+#endif
+}
+
+/*!*****************************************************************************
+ *  \brief Allocate a page aligned buffer directly from the system, from the
+ *         huge page arena if it is enabled and the buffer is large enough
+ *
+ *  \param[out] pp_buf  address of the buffer, NULL on failure
+ *  \param[in]  size    size in bytes
+ *
+ *  \return 0 for success, ENOMEM for error
+ ******************************************************************************/
+int ni_mem_arena_alloc(void **pp_buf, size_t size)
+{
+#ifdef NI_MEM_HUGE_PAGES_SUPPORTED
+    void *p_buf;
+    int mode;
+
+    if (size < NI_MEM_HUGE_PAGE_SIZE)
+    {
+        return ni_posix_memalign(pp_buf, sysconf(_SC_PAGESIZE), size);
+    }
+
+    pthread_mutex_lock(&g_mem_arena_mutex);
+    mode = ni_mem_arena_mode_locked();
+    g_mem_arena_blocks++;
+    pthread_mutex_unlock(&g_mem_arena_mutex);
+
+    if (NI_MEM_HUGE_PAGES_OFF == mode)
+    {
+        if (!ni_posix_memalign(pp_buf, sysconf(_SC_PAGESIZE), size))
+        {
+            return 0;
+        }
     } else
     {
-        HANDLE timer = NULL;
-        LARGE_INTEGER ft = {0};
-        BOOL retval;
+        p_buf = ni_mem_arena_map(ni_mem_arena_map_size(size), mode);
+        if (p_buf)
+        {
+            NI_MEM_POOL_STAT_ADD(huge_bytes, ni_mem_arena_map_size(size));
+            *pp_buf = p_buf;
+            return 0;
+        }
+    }
 
-        ft.QuadPart = -(
-            10 *
-            usec);   // Convert to 100 nanosecond interval, negative value indicates relative time
+    pthread_mutex_lock(&g_mem_arena_mutex);
+    g_mem_arena_blocks--;
+    pthread_mutex_unlock(&g_mem_arena_mutex);
+    *pp_buf = NULL;
+    return ENOMEM;
+#else
+    return ni_posix_memalign(pp_buf, sysconf(_SC_PAGESIZE), size);
+#endif
+}
 
-        timer = CreateWaitableTimer(NULL, TRUE, NULL);
-        if (NULL != timer)
+/*!*****************************************************************************
+ *  \brief Free a buffer from ni_mem_arena_alloc
+ *
+ *  \param[in] p_buf  buffer, may be NULL
+ *  \param[in] size   size it was allocated with
+ *
+ *  \return
+ ******************************************************************************/
+void ni_mem_arena_free(void *p_buf, size_t size)
+{
+#ifdef NI_MEM_HUGE_PAGES_SUPPORTED
+    int mode;
+
+    if (!p_buf)
+    {
+        return;
+    }
+    if (size < NI_MEM_HUGE_PAGE_SIZE)
+    {
+        ni_aligned_free(p_buf);
+        return;
+    }
+
+    pthread_mutex_lock(&g_mem_arena_mutex);
+    mode = ni_mem_arena_mode_locked();
+    g_mem_arena_blocks--;
+    pthread_mutex_unlock(&g_mem_arena_mutex);
+
+    if (NI_MEM_HUGE_PAGES_OFF == mode)
+    {
+        ni_aligned_free(p_buf);
+    } else
+    {
+        munmap(p_buf, ni_mem_arena_map_size(size));
+        NI_MEM_POOL_STAT_SUB(huge_bytes, ni_mem_arena_map_size(size));
+    }
+#else
+    (void)size;
+    ni_aligned_free(p_buf);
+#endif
+}
+
+/*!*****************************************************************************
+ *  \brief Allocate a page aligned buffer from the size-class pool. The
+ *         content is not initialized.
+ *
+ *  \param[out] pp_buf  address of the buffer, NULL on failure
+ *  \param[in]  size    requested size in bytes
+ *
+ *  \return 0 for success, ENOMEM for error
+ ******************************************************************************/
+int ni_mem_pool_alloc(void **pp_buf, size_t size)
+{
+#ifdef NI_MEM_POOL_SUPPORTED
+    ni_mem_pool_cache_t *p_cache;
+    void *p_buf = NULL;
+    size_t class_size;
+    int cls;
+
+    NI_MEM_POOL_STAT_ADD(allocs, 1);
+    if (size > NI_MEM_POOL_MAX_SIZE)
+    {
+        NI_MEM_POOL_STAT_ADD(unpooled, 1);
+        return ni_mem_arena_alloc(pp_buf, size);
+    }
+    cls = ni_mem_pool_class(size);
+    class_size = ni_mem_pool_class_size(cls);
+
+    p_cache = ni_mem_pool_get_thread_cache();
+    if (p_cache && p_cache->p_head[cls])
+    {
+        p_buf = p_cache->p_head[cls];
+        p_cache->p_head[cls] = *(void **)p_buf;
+        p_cache->count[cls]--;
+        p_cache->bytes -= class_size;
+        NI_MEM_POOL_STAT_ADD(thread_hits, 1);
+        NI_MEM_POOL_STAT_SUB(bytes_cached, class_size);
+    } else
+    {
+        pthread_mutex_lock(&g_mem_pool_mutex);
+        p_buf = g_mem_pool_depot[cls];
+        if (p_buf)
         {
-            retval = SetWaitableTimer(timer, &ft, 0, NULL, NULL, 0);
-            if (retval)
-            {
-                WaitForSingleObject(timer, INFINITE);
-            }
-            CloseHandle(timer);
+            g_mem_pool_depot[cls] = *(void **)p_buf;
+            g_mem_pool_depot_bytes -= class_size;
+        }
+        pthread_mutex_unlock(&g_mem_pool_mutex);
+
+        if (p_buf)
+        {
+            NI_MEM_POOL_STAT_ADD(depot_hits, 1);
+            NI_MEM_POOL_STAT_SUB(bytes_cached, class_size);
         } else
         {
-            ni_log(NI_LOG_ERROR, "failed to create waitable timer\n");
-            LARGE_INTEGER StartCount;
-            LARGE_INTEGER StopCount;
+            // blocks of other classes may be what is holding the memory
+            if (ni_mem_arena_alloc(&p_buf, class_size) &&
+                (!ni_mem_pool_trim(0) ||
+                 ni_mem_arena_alloc(&p_buf, class_size)))
+            {
+                *pp_buf = NULL;
+                return ENOMEM;
+            }
+            NI_MEM_POOL_STAT_ADD(system_allocs, 1);
+        }
+    }
+    NI_MEM_POOL_STAT_ADD(bytes_in_use, class_size);
+    *pp_buf = p_buf;
+    return 0;
+#else
+    return ni_posix_memalign(pp_buf, sysconf(_SC_PAGESIZE), size);
+#endif
+}
+
+/*!*****************************************************************************
+ *  \brief Give a buffer from ni_mem_pool_alloc back to the pool
+ *
+ *  \param[in] p_buf  buffer, may be NULL
+ *  \param[in] size   size it was allocated with
+ *
+ *  \return
+ ******************************************************************************/
+void ni_mem_pool_free(void *p_buf, size_t size)
+{
+#ifdef NI_MEM_POOL_SUPPORTED
+    ni_mem_pool_cache_t *p_cache;
+    size_t class_size;
+    int cls;
+
+    if (!p_buf)
+    {
+        return;
+    }
+    if (size > NI_MEM_POOL_MAX_SIZE)
+    {
+        ni_mem_arena_free(p_buf, size);
+        return;
+    }
+    cls = ni_mem_pool_class(size);
+    class_size = ni_mem_pool_class_size(cls);
+    NI_MEM_POOL_STAT_SUB(bytes_in_use, class_size);
+
+    p_cache = ni_mem_pool_get_thread_cache();
+    if (p_cache && p_cache->count[cls] < NI_MEM_POOL_THREAD_CACHE_DEPTH &&
+        p_cache->bytes + class_size <= NI_MEM_POOL_THREAD_CACHE_BYTES)
+    {
+        *(void **)p_buf = p_cache->p_head[cls];
+        p_cache->p_head[cls] = p_buf;
+        p_cache->count[cls]++;
+        p_cache->bytes += class_size;
+        NI_MEM_POOL_STAT_ADD(bytes_cached, class_size);
+        return;
+    }
+    ni_mem_pool_depot_put(p_buf, cls, class_size);
+#else
+    (void)size;
+    ni_aligned_free(p_buf);
+#endif
+}
+
+/*!*****************************************************************************
+ *  \brief Release cached pool blocks to the system. The calling thread's
+ *         cache is emptied into the depot, then depot blocks are freed,
+ *         largest classes first, until at most keep_bytes remain. Caches of
+ *         other threads are released when those threads exit.
+ *
+ *  \param[in] keep_bytes  depot bytes to keep, 0 to free all
+ *
+ *  \return bytes released
+ ******************************************************************************/
+uint64_t ni_mem_pool_trim(uint64_t keep_bytes)
+{
+#ifdef NI_MEM_POOL_SUPPORTED
+    uint64_t released = 0;
+    size_t class_size;
+    void *p_buf;
+    int cls;
+
+    if (g_mem_pool_thread_cache)
+    {
+        ni_mem_pool_cache_flush(g_mem_pool_thread_cache);
+    }
+
+    pthread_mutex_lock(&g_mem_pool_mutex);
+    for (cls = NI_MEM_POOL_NUM_CLASSES - 1;
+         cls >= 0 && g_mem_pool_depot_bytes > keep_bytes; cls--)
+    {
+        class_size = ni_mem_pool_class_size(cls);
+        while ((p_buf = g_mem_pool_depot[cls]) != NULL &&
+               g_mem_pool_depot_bytes > keep_bytes)
+        {
+            g_mem_pool_depot[cls] = *(void **)p_buf;
+            g_mem_pool_depot_bytes -= class_size;
+            ni_mem_arena_free(p_buf, class_size);
+            released += class_size;
+            NI_MEM_POOL_STAT_ADD(system_frees, 1);
+        }
+    }
+    pthread_mutex_unlock(&g_mem_pool_mutex);
+    NI_MEM_POOL_STAT_SUB(bytes_cached, released);
+
+    ni_log(NI_LOG_DEBUG, "%s: released %" PRIu64 " bytes\n", __func__,
+           released);
+    return released;
+#else
+    (void)keep_bytes;
+    return 0;
+#endif
+}
+
+/*!*****************************************************************************
+ *  \brief Get the size-class pool counters of this process
+ *
+ *  \param[out] p_stats  counters
+ *
+ *  \return
+ ******************************************************************************/
+void ni_mem_pool_get_stats(ni_mem_pool_stats_t *p_stats)
+{
+    if (!p_stats)
+    {
+        return;
+    }
+#ifdef NI_MEM_POOL_SUPPORTED
+    p_stats->allocs = __atomic_load_n(&g_mem_pool_stats.allocs, __ATOMIC_RELAXED);
+    p_stats->thread_hits =
+        __atomic_load_n(&g_mem_pool_stats.thread_hits, __ATOMIC_RELAXED);
+    p_stats->depot_hits =
+        __atomic_load_n(&g_mem_pool_stats.depot_hits, __ATOMIC_RELAXED);
+    p_stats->system_allocs =
+        __atomic_load_n(&g_mem_pool_stats.system_allocs, __ATOMIC_RELAXED);
+    p_stats->system_frees =
+        __atomic_load_n(&g_mem_pool_stats.system_frees, __ATOMIC_RELAXED);
+    p_stats->unpooled =
+        __atomic_load_n(&g_mem_pool_stats.unpooled, __ATOMIC_RELAXED);
+    p_stats->bytes_in_use =
+        __atomic_load_n(&g_mem_pool_stats.bytes_in_use, __ATOMIC_RELAXED);
+    p_stats->bytes_cached =
+        __atomic_load_n(&g_mem_pool_stats.bytes_cached, __ATOMIC_RELAXED);
+    p_stats->huge_bytes =
+        __atomic_load_n(&g_mem_pool_stats.huge_bytes, __ATOMIC_RELAXED);
+    p_stats->hugetlb_fallbacks =
+        __atomic_load_n(&g_mem_pool_stats.hugetlb_fallbacks, __ATOMIC_RELAXED);
+#else
+    memset(p_stats, 0, sizeof(*p_stats));
+#endif
+}
+
+// host memory accounting
+static ni_mem_account_t g_mem_account;
+
+#ifdef _WIN32
+#define NI_MEM_ACCOUNT_LOAD(p) \
+    ((uint64_t)InterlockedCompareExchange64((volatile LONG64 *)(p), 0, 0))
+#define NI_MEM_ACCOUNT_ADD(p, n) \
+    ((uint64_t)InterlockedExchangeAdd64((volatile LONG64 *)(p), (LONG64)(n)) + (n))
+#define NI_MEM_ACCOUNT_SUB(p, n) \
+    ((uint64_t)InterlockedExchangeAdd64((volatile LONG64 *)(p), -(LONG64)(n)) - (n))
+#define NI_MEM_ACCOUNT_REF_ADD(p, n) \
+    ((int32_t)InterlockedExchangeAdd((volatile LONG *)(p), (LONG)(n)) + (n))
+static int ni_mem_account_cas(volatile uint64_t *p, uint64_t *p_expected,
+                              uint64_t desired)
+{
+    uint64_t prev = (uint64_t)InterlockedCompareExchange64(
+        (volatile LONG64 *)p, (LONG64)desired, (LONG64)*p_expected);
+    if (prev == *p_expected)
+    {
+        return 1;
+    }
+    *p_expected = prev;
+    return 0;
+}
+#else
+#define NI_MEM_ACCOUNT_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define NI_MEM_ACCOUNT_ADD(p, n) __atomic_add_fetch((p), (n), __ATOMIC_RELAXED)
+#define NI_MEM_ACCOUNT_SUB(p, n) __atomic_sub_fetch((p), (n), __ATOMIC_RELAXED)
+#define NI_MEM_ACCOUNT_REF_ADD(p, n) \
+    __atomic_add_fetch((p), (n), __ATOMIC_ACQ_REL)
+static int ni_mem_account_cas(volatile uint64_t *p, uint64_t *p_expected,
+                              uint64_t desired)
+{
+    return __atomic_compare_exchange_n(p, p_expected, desired, 1,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+#endif
+
+// raise *p_peak to value unless it is higher already
+static void ni_mem_account_raise_peak(volatile uint64_t *p_peak,
+                                      uint64_t value)
+{
+    uint64_t peak = NI_MEM_ACCOUNT_LOAD(p_peak);
+
+    while (value > peak && !ni_mem_account_cas(p_peak, &peak, value))
+    {
+    }
+}
+
+// charge one account, failing if it would go above its cap
+static int ni_mem_account_add(ni_mem_account_t *p_account,
+                              ni_mem_category_t cat, uint64_t size)
+{
+    uint64_t total = NI_MEM_ACCOUNT_LOAD(&p_account->total_bytes);
+    uint64_t current;
+
+    do
+    {
+        if (p_account->cap_bytes && total + size > p_account->cap_bytes)
+        {
+            NI_MEM_ACCOUNT_ADD(&p_account->cap_failures, 1);
+            return ENOMEM;
+        }
+    } while (!ni_mem_account_cas(&p_account->total_bytes, &total,
+                                 total + size));
+    ni_mem_account_raise_peak(&p_account->total_peak_bytes, total + size);
+    current = NI_MEM_ACCOUNT_ADD(&p_account->current_bytes[cat], size);
+    ni_mem_account_raise_peak(&p_account->peak_bytes[cat], current);
+    return 0;
+}
+
+static void ni_mem_account_sub(ni_mem_account_t *p_account,
+                               ni_mem_category_t cat, uint64_t size)
+{
+    NI_MEM_ACCOUNT_SUB(&p_account->current_bytes[cat], size);
+    NI_MEM_ACCOUNT_SUB(&p_account->total_bytes, size);
+}
+
+/*!*****************************************************************************
+ *  \brief Create the memory account of a session, holding one reference
+ *
+ *  \param[in] cap_bytes  most bytes that may be charged, 0 for no cap
+ *
+ *  \return the account, NULL on failure
+ ******************************************************************************/
+ni_mem_account_t *ni_mem_account_create(uint64_t cap_bytes)
+{
+    ni_mem_account_t *p_account =
+        (ni_mem_account_t *)calloc(1, sizeof(ni_mem_account_t));
+
+    if (p_account)
+    {
+        p_account->cap_bytes = cap_bytes;
+        p_account->ref_count = 1;
+    }
+    return p_account;
+}
+
+/*!*****************************************************************************
+ *  \brief Take a reference to a memory account, for an object that may
+ *         outlive the session
+ *
+ *  \param[in] p_account  account, may be NULL
+ *
+ *  \return
+ ******************************************************************************/
+void ni_mem_account_ref(ni_mem_account_t *p_account)
+{
+    if (p_account)
+    {
+        NI_MEM_ACCOUNT_REF_ADD(&p_account->ref_count, 1);
+    }
+}
+
+/*!*****************************************************************************
+ *  \brief Drop a reference to a memory account, freeing it with the last one
+ *
+ *  \param[in] p_account  account, may be NULL
+ *
+ *  \return
+ ******************************************************************************/
+void ni_mem_account_unref(ni_mem_account_t *p_account)
+{
+    if (p_account && !NI_MEM_ACCOUNT_REF_ADD(&p_account->ref_count, -1))
+    {
+        free(p_account);
+    }
+}
+
+/*!*****************************************************************************
+ *  \brief Charge an allocation to a session and to the process
+ *
+ *  \param[in] p_account  session account, NULL to charge the process only
+ *  \param[in] cat        category
+ *  \param[in] size       bytes
+ *
+ *  \return 0 for success, ENOMEM if the session cap would be exceeded; the
+ *          allocation should then fail
+ ******************************************************************************/
+int ni_mem_account_charge(ni_mem_account_t *p_account, ni_mem_category_t cat,
+                          uint64_t size)
+{
+    if (p_account && ni_mem_account_add(p_account, cat, size))
+    {
+        return ENOMEM;
+    }
+    ni_mem_account_add(&g_mem_account, cat, size);
+    return 0;
+}
+
+/*!*****************************************************************************
+ *  \brief Uncharge an allocation charged with ni_mem_account_charge
+ *
+ *  \param[in] p_account  session account it was charged to, may be NULL
+ *  \param[in] cat        category
+ *  \param[in] size       bytes
+ *
+ *  \return
+ ******************************************************************************/
+void ni_mem_account_uncharge(ni_mem_account_t *p_account,
+                             ni_mem_category_t cat, uint64_t size)
+{
+    if (p_account)
+    {
+        ni_mem_account_sub(p_account, cat, size);
+    }
+    ni_mem_account_sub(&g_mem_account, cat, size);
+}
+
+/*!*****************************************************************************
+ *  \brief Uncharge everything a session has charged to a category, for
+ *         allocations all freed together at session close
+ *
+ *  \param[in] p_account  session account, may be NULL
+ *  \param[in] cat        category
+ *
+ *  \return
+ ******************************************************************************/
+void ni_mem_account_uncharge_all(ni_mem_account_t *p_account,
+                                 ni_mem_category_t cat)
+{
+    if (p_account)
+    {
+        ni_mem_account_uncharge(
+            p_account, cat, NI_MEM_ACCOUNT_LOAD(&p_account->current_bytes[cat]));
+    }
+}
+
+/*!*****************************************************************************
+ *  \brief Whether charging size bytes to a session would exceed its cap
+ *
+ *  \param[in] p_account  session account, may be NULL
+ *  \param[in] size       bytes
+ *
+ *  \return 1 if at the cap, 0 otherwise
+ ******************************************************************************/
+int ni_mem_account_at_cap(ni_mem_account_t *p_account, uint64_t size)
+{
+    return p_account && p_account->cap_bytes &&
+        NI_MEM_ACCOUNT_LOAD(&p_account->total_bytes) + size >
+        p_account->cap_bytes;
+}
+
+/*!*****************************************************************************
+ *  \brief Read the counters of a memory account
+ *
+ *  \param[in]  p_account  account, NULL for the process
+ *  \param[out] p_usage    current and peak bytes per category
+ *
+ *  \return
+ ******************************************************************************/
+void ni_mem_account_get_usage(ni_mem_account_t *p_account,
+                              ni_mem_usage_t *p_usage)
+{
+    int i;
+
+    if (!p_account)
+    {
+        p_account = &g_mem_account;
+    }
+    for (i = 0; i < NI_MEM_CAT_COUNT; i++)
+    {
+        p_usage->current_bytes[i] =
+            NI_MEM_ACCOUNT_LOAD(&p_account->current_bytes[i]);
+        p_usage->peak_bytes[i] = NI_MEM_ACCOUNT_LOAD(&p_account->peak_bytes[i]);
+    }
+    p_usage->total_bytes = NI_MEM_ACCOUNT_LOAD(&p_account->total_bytes);
+    p_usage->total_peak_bytes =
+        NI_MEM_ACCOUNT_LOAD(&p_account->total_peak_bytes);
+    p_usage->cap_bytes = p_account->cap_bytes;
+    p_usage->cap_failures = NI_MEM_ACCOUNT_LOAD(&p_account->cap_failures);
+}
+
+/*!*****************************************************************************
+ *  \brief Get the host memory libxcoder holds in this process, per category,
+ *         for all sessions and allocations not tied to a session
+ *
+ *  \param[out] p_usage  current and peak bytes per category
+ *
+ *  \return
+ ******************************************************************************/
+void ni_mem_get_usage(ni_mem_usage_t *p_usage)
+{
+    if (p_usage)
+    {
+        ni_mem_account_get_usage(NULL, p_usage);
+    }
+}
+
+/*!*****************************************************************************
+ *  \brief Get the host memory libxcoder holds for a session, per category.
+ *         Memory of session buffers still held by the application after
+ *         close (decoded frames, borrowed encoder buffers) stays counted.
+ *
+ *  \param[in]  p_ctx    session context, opened at least once
+ *  \param[out] p_usage  current and peak bytes per category
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+ni_retcode_t ni_device_session_get_mem_usage(ni_session_context_t *p_ctx,
+                                             ni_mem_usage_t *p_usage)
+{
+    if (!p_ctx || !p_usage || !p_ctx->p_mem_account)
+    {
+        return NI_RETCODE_INVALID_PARAM;
+    }
+    ni_mem_account_get_usage((ni_mem_account_t *)p_ctx->p_mem_account,
+                             p_usage);
+    return NI_RETCODE_SUCCESS;
+}
+
+static const char *g_perf_counter_names[NI_PERF_CTR_MAX] = {
+    "nvme_read_data",  "nvme_read_ctrl",    "nvme_write_data",
+    "nvme_write_ctrl", "nvme_admin",        "nvme_errors",
+    "bytes_read",      "bytes_written",     "queries",
+    "query_hits",      "bounce_copies",     "bounce_bytes",
+    "buf_pool_expand", "ts_queue_overflow", "write_buffer_full",
+    "nvme_io",
+};
+
+#ifdef NI_PERF_COUNTERS_SUPPORTED
+static ni_perf_counters_table_t *g_perf_table = NULL;
+static int g_perf_fd = -1;    // kept open, it carries the slot locks
+static ni_perf_counters_t *g_perf_slot = NULL;
+static int g_perf_state = 0;  // 0 not attached yet, 1 attached, -1 unavailable
+static pthread_mutex_t g_perf_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*!*****************************************************************************
+ *  \brief Map the shared performance counters table (NI_PERF_SHM_NAME),
+ *         creating it if it does not exist yet. Called with g_perf_mutex held.
+ *
+ *  \return pointer to the mapped table, NULL on failure or if the table was
+ *          created by an incompatible library version
+ ******************************************************************************/
+static ni_perf_counters_table_t *ni_perf_map_table(void)
+{
+    const mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    ni_perf_counters_table_t *p_table;
+    struct stat st;
+    int shm_fd;
+
+    if (g_perf_table)
+    {
+        return g_perf_table;
+    }
+
+    shm_fd = shm_open(NI_PERF_SHM_NAME, O_CREAT | O_RDWR, mode);
+    if (shm_fd < 0)
+    {
+        ni_log(NI_LOG_DEBUG, "%s: shm_open() %s: %s\n", __func__,
+               NI_PERF_SHM_NAME, strerror(NI_ERRNO));
+        return NULL;
+    }
+    if (fstat(shm_fd, &st) != 0 ||
+        (st.st_size < (off_t)sizeof(ni_perf_counters_table_t) &&
+         ftruncate(shm_fd, sizeof(ni_perf_counters_table_t)) != 0))
+    {
+        ni_log(NI_LOG_DEBUG, "%s: sizing %s: %s\n", __func__,
+               NI_PERF_SHM_NAME, strerror(NI_ERRNO));
+        close(shm_fd);
+        return NULL;
+    }
+    p_table = (ni_perf_counters_table_t *)mmap(
+        0, sizeof(ni_perf_counters_table_t), PROT_READ | PROT_WRITE,
+        MAP_SHARED, shm_fd, 0);
+    if (MAP_FAILED == p_table)
+    {
+        ni_log(NI_LOG_DEBUG, "%s: mmap() %s: %s\n", __func__,
+               NI_PERF_SHM_NAME, strerror(NI_ERRNO));
+        close(shm_fd);
+        return NULL;
+    }
+
+    // concurrent creators write identical header values, the magic goes last
+    if (!__atomic_load_n(&p_table->magic, __ATOMIC_ACQUIRE))
+    {
+        p_table->version = NI_PERF_VERSION;
+        p_table->num_slots = NI_PERF_MAX_PROCESSES;
+        p_table->slot_size = sizeof(ni_perf_counters_t);
+        __sync_bool_compare_and_swap(&p_table->magic, 0, NI_PERF_MAGIC);
+    }
+    if (p_table->magic != NI_PERF_MAGIC || p_table->version != NI_PERF_VERSION ||
+        p_table->slot_size != sizeof(ni_perf_counters_t))
+    {
+        ni_log(NI_LOG_INFO, "%s: %s has an incompatible layout, performance "
+               "counters disabled\n", __func__, NI_PERF_SHM_NAME);
+        munmap(p_table, sizeof(ni_perf_counters_table_t));
+        close(shm_fd);
+        return NULL;
+    }
+    g_perf_fd = shm_fd;
+    g_perf_table = p_table;
+    return p_table;
+}
+
+// a forked child must claim its own slot, the mapping itself is inherited
+static void ni_perf_atfork_child(void)
+{
+    pthread_mutex_init(&g_perf_mutex, NULL);
+    g_perf_slot = NULL;
+    g_perf_state = 0;
+}
+
+/*!*****************************************************************************
+ *  \brief A process owns a slot while it holds a write lock on the first byte
+ *         of the slot in NI_PERF_SHM_NAME. The kernel drops the lock when the
+ *         process exits, which unlike the pid also works for processes in
+ *         other PID namespaces sharing /dev/shm (e.g. docker --ipc=host).
+ *
+ *  \param[in] i    slot index
+ *  \param[in] cmd  F_SETLK to claim the slot, F_GETLK to test it
+ *
+ *  \return for F_SETLK 1 if the slot was claimed; for F_GETLK 1 if another
+ *          process owns the slot; 0 otherwise
+ ******************************************************************************/
+static int ni_perf_slot_lock(int i, int cmd)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = (off_t)((uint8_t *)&g_perf_table->slot[i] -
+                         (uint8_t *)g_perf_table);
+    fl.l_len = 1;
+    if (fcntl(g_perf_fd, cmd, &fl) != 0)
+    {
+        return 0;
+    }
+    return (F_SETLK == cmd) ? 1 : (F_UNLCK != fl.l_type);
+}
+
+/*!*****************************************************************************
+ *  \brief Claim a counters slot for this process on first use
+ *
+ *  \return the slot, NULL if performance counters are unavailable
+ ******************************************************************************/
+static ni_perf_counters_t *ni_perf_attach(void)
+{
+    static int atfork_registered = 0;
+    ni_perf_counters_table_t *p_table;
+    ni_perf_counters_t *p_slot;
+    int32_t pid = (int32_t)getpid();
+    int i;
+
+    pthread_mutex_lock(&g_perf_mutex);
+    if (g_perf_state)
+    {
+        pthread_mutex_unlock(&g_perf_mutex);
+        return g_perf_slot;
+    }
+    g_perf_state = -1;
+
+    p_table = ni_perf_map_table();
+    if (p_table && !atfork_registered)
+    {
+        pthread_atfork(NULL, NULL, ni_perf_atfork_child);
+        atfork_registered = 1;
+    }
+    for (i = 0; p_table && i < NI_PERF_MAX_PROCESSES; i++)
+    {
+        p_slot = &p_table->slot[i];
+        if (ni_perf_slot_lock(i, F_SETLK))
+        {
+            // readers skip the slot until start_time is set again
+            __atomic_store_n(&p_slot->start_time, 0, __ATOMIC_RELEASE);
+            __atomic_store_n(&p_slot->pid, pid, __ATOMIC_RELAXED);
+            memset(p_slot->value, 0, sizeof(p_slot->value));
+            p_slot->num_counters = NI_PERF_CTR_MAX;
+            __atomic_store_n(&p_slot->start_time, ni_gettime_ns(),
+                             __ATOMIC_RELEASE);
+            __atomic_store_n(&g_perf_slot, p_slot, __ATOMIC_RELEASE);
+            g_perf_state = 1;
+            break;
+        }
+    }
+    if (p_table && g_perf_state < 0)
+    {
+        ni_log(NI_LOG_INFO, "%s: no free slot in %s, performance counters "
+               "disabled for pid %d\n", __func__, NI_PERF_SHM_NAME, pid);
+    }
+    pthread_mutex_unlock(&g_perf_mutex);
+    return g_perf_slot;
+}
+#endif
+
+/*!*****************************************************************************
+ *  \brief Add to a performance counter of this process. Lock-free, a no-op on
+ *         platforms without POSIX shared memory or if the segment can not be
+ *         mapped.
+ *
+ *  \param[in] counter  counter to add to
+ *  \param[in] n        amount
+ *
+ *  \return
+ ******************************************************************************/
+void ni_perf_count(ni_perf_counter_t counter, uint64_t n)
+{
+#ifdef NI_PERF_COUNTERS_SUPPORTED
+    ni_perf_counters_t *p_slot = __atomic_load_n(&g_perf_slot, __ATOMIC_ACQUIRE);
+
+    if (!p_slot)
+    {
+        if (__atomic_load_n(&g_perf_state, __ATOMIC_RELAXED) < 0 ||
+            !(p_slot = ni_perf_attach()))
+        {
+            return;
+        }
+    }
+    __atomic_fetch_add(&p_slot->value[counter], n, __ATOMIC_RELAXED);
+#else
+    (void)counter;
+    (void)n;
+#endif
+}
+
+/*!*****************************************************************************
+ *  \brief Read the performance counters of every live process using
+ *         libxcoder and their sum
+ *
+ *  \param[out] p_procs    per process counters, may be NULL
+ *  \param[in]  max_procs  number of entries p_procs can hold
+ *  \param[out] p_total    sum over live processes, may be NULL; pid is the
+ *                         number of processes summed
+ *
+ *  \return number of live processes, which may exceed max_procs, or -1 if the
+ *          counters are not available
+ ******************************************************************************/
+int ni_perf_counters_read(ni_perf_counters_t *p_procs, int max_procs,
+                          ni_perf_counters_t *p_total)
+{
+    int count = 0;
+
+    if (p_total)
+    {
+        memset(p_total, 0, sizeof(*p_total));
+        p_total->num_counters = NI_PERF_CTR_MAX;
+    }
+#ifdef NI_PERF_COUNTERS_SUPPORTED
+    ni_perf_counters_table_t *p_table;
+    ni_perf_counters_t snapshot;
+    uint32_t j, num_counters;
+    int i;
+
+    pthread_mutex_lock(&g_perf_mutex);
+    p_table = ni_perf_map_table();
+    pthread_mutex_unlock(&g_perf_mutex);
+    if (!p_table)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < NI_PERF_MAX_PROCESSES; i++)
+    {
+        const ni_perf_counters_t *p_slot = &p_table->slot[i];
+
+        snapshot.pid = __atomic_load_n(&p_slot->pid, __ATOMIC_ACQUIRE);
+        snapshot.start_time =
+            __atomic_load_n(&p_slot->start_time, __ATOMIC_ACQUIRE);
+        if (!snapshot.start_time ||
+            (p_slot != g_perf_slot && !ni_perf_slot_lock(i, F_GETLK)))
+        {
+            continue;
+        }
+        snapshot.num_counters = p_slot->num_counters;
+        for (j = 0; j < NI_PERF_COUNTER_SLOTS; j++)
+        {
+            snapshot.value[j] =
+                __atomic_load_n(&p_slot->value[j], __ATOMIC_RELAXED);
+        }
+
+        if (p_procs && count < max_procs)
+        {
+            p_procs[count] = snapshot;
+        }
+        if (p_total)
+        {
+            num_counters = snapshot.num_counters < NI_PERF_COUNTER_SLOTS ?
+                snapshot.num_counters : NI_PERF_COUNTER_SLOTS;
+            for (j = 0; j < num_counters; j++)
+            {
+                p_total->value[j] += snapshot.value[j];
+            }
+            p_total->pid++;
+        }
+        count++;
+    }
+    return count;
+#else
+    (void)p_procs;
+    (void)max_procs;
+    return -1;
+#endif
+}
+
+/*!*****************************************************************************
+ *  \brief Get the name of a performance counter
+ *
+ *  \param[in] counter  counter
+ *
+ *  \return lower case name, e.g. "nvme_read_data", or "unknown"
+ ******************************************************************************/
+const char *ni_perf_counter_name(ni_perf_counter_t counter)
+{
+    if (counter < NI_PERF_CTR_NVME_READ_DATA || counter >= NI_PERF_CTR_MAX)
+    {
+        return "unknown";
+    }
+    return g_perf_counter_names[counter];
+}
+
+void ni_usleep(int64_t usec)
+{
+#ifdef _WIN32
+    if (usec < 5000)   //this will be more accurate when less than 5000
+    {
+        LARGE_INTEGER StartCount;
+        LARGE_INTEGER StopCount;
+        LARGE_INTEGER Frequency;
+        QueryPerformanceCounter(&StartCount);
+        QueryPerformanceFrequency(&Frequency);
+        StopCount.QuadPart =
+            StartCount.QuadPart + usec * (Frequency.QuadPart / 1000000);
+        do
+        {
+            QueryPerformanceCounter(&StartCount);
+        } while (StartCount.QuadPart < StopCount.QuadPart);
+    } else
+    {
+        HANDLE timer = NULL;
+        LARGE_INTEGER ft = {0};
+        BOOL retval;
+
+        ft.QuadPart = -(
+            10 *
+            usec);   // Convert to 100 nanosecond interval, negative value indicates relative time
+
+        timer = CreateWaitableTimer(NULL, TRUE, NULL);
+        if (NULL != timer)
+        {
+            retval = SetWaitableTimer(timer, &ft, 0, NULL, NULL, 0);
+            if (retval)
+            {
+                WaitForSingleObject(timer, INFINITE);
+            }
+            CloseHandle(timer);
+        } else
+        {
+            ni_log(NI_LOG_ERROR, "failed to create waitable timer\n");
+            LARGE_INTEGER StartCount;
+            LARGE_INTEGER StopCount;
             LARGE_INTEGER Frequency;
             QueryPerformanceCounter(&StartCount);
             QueryPerformanceFrequency(&Frequency);
@@ -388,121 +1668,515 @@ void ni_usleep(int64_t usec)
             } while (StartCount.QuadPart < StopCount.QuadPart);
         }
     }
-#else
-    if (usec < 0xFFFFFFFF)   // to avoid overflow
+#else
+    if (usec < 0xFFFFFFFF)   // to avoid overflow
+    {
+        usleep(usec);
+    } else
+    {
+        sleep(usec >> 32);
+    }
+#endif
+}
+
+char *ni_strtok(char *s, const char *delim, char **saveptr)
+{
+    char *tok;
+
+    if (!s && !(s = *saveptr))
+        return NULL;
+
+    /* skip leading delimiters */
+    s += strspn(s, delim);
+
+    /* s now points to the first non delimiter char, or to the end of the string */
+    if (!*s) {
+        *saveptr = NULL;
+        return NULL;
+    }
+    tok = s++;
+
+    /* skip non delimiters */
+    s += strcspn(s, delim);
+    if (*s) {
+        *s = '\0';
+        *saveptr = s+1;
+    } else {
+        *saveptr = NULL;
+    }
+
+    return tok;
+}
+
+// memory buffer pool operations (one use is for decoder frame buffer pool)
+// Free buffers are kept in a lock-free stack (Treiber stack) whose top holds
+// the index of the first free buffer plus a tag that changes on every push
+// and pop, so a stale top can not be swapped in (ABA). Buffers are never
+// freed while the pool exists, so a popping thread may always read them.
+#ifdef _WIN32
+#define NI_BUF_POOL_LOAD(p) (*(p))
+#define NI_BUF_POOL_STORE(p, v) (*(p) = (v))
+#else
+#define NI_BUF_POOL_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define NI_BUF_POOL_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#endif
+
+static int ni_buf_pool_cas_top(ni_buf_pool_t *p_pool, uint64_t *p_expected,
+                               uint64_t desired)
+{
+#ifdef _WIN32
+    uint64_t prev = (uint64_t)InterlockedCompareExchange64(
+        (volatile LONG64 *)&p_pool->free_top, (LONG64)desired,
+        (LONG64)*p_expected);
+    if (prev == *p_expected)
+    {
+        return 1;
+    }
+    *p_expected = prev;
+    return 0;
+#else
+    return __atomic_compare_exchange_n(&p_pool->free_top, p_expected, desired,
+                                       1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static uint64_t ni_buf_pool_load_top(ni_buf_pool_t *p_pool)
+{
+#ifdef _WIN32
+    return (uint64_t)InterlockedCompareExchange64(
+        (volatile LONG64 *)&p_pool->free_top, 0, 0);
+#else
+    return __atomic_load_n(&p_pool->free_top, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static void ni_buf_pool_push(ni_buf_pool_t *p_pool, ni_buf_t *buf)
+{
+    uint64_t top = ni_buf_pool_load_top(p_pool);
+    uint64_t new_top;
+
+    do
+    {
+        NI_BUF_POOL_STORE(&buf->next_free, (uint32_t)top);
+        new_top = (((top >> 32) + 1) << 32) | (buf->index + 1);
+    } while (!ni_buf_pool_cas_top(p_pool, &top, new_top));
+}
+
+static ni_buf_t *ni_buf_pool_pop(ni_buf_pool_t *p_pool)
+{
+    uint64_t top = ni_buf_pool_load_top(p_pool);
+    uint64_t new_top;
+    ni_buf_t *buf;
+
+    do
+    {
+        if (!(uint32_t)top)
+        {
+            return NULL;
+        }
+        buf = p_pool->p_bufs[(uint32_t)top - 1];
+        // next_free may be stale if buf was taken meanwhile, the tag of
+        // top has changed then and the exchange fails
+        new_top = (((top >> 32) + 1) << 32) |
+            NI_BUF_POOL_LOAD(&buf->next_free);
+    } while (!ni_buf_pool_cas_top(p_pool, &top, new_top));
+    return buf;
+}
+
+#ifdef _WIN32
+#define NI_BUF_POOL_ADD(p, n) \
+    ((uint32_t)InterlockedExchangeAdd((volatile LONG *)(p), (LONG)(n)) + (n))
+#define NI_BUF_POOL_SUB(p, n) \
+    ((uint32_t)InterlockedExchangeAdd((volatile LONG *)(p), -(LONG)(n)) - (n))
+#else
+#define NI_BUF_POOL_ADD(p, n) __atomic_add_fetch((p), (n), __ATOMIC_RELAXED)
+#define NI_BUF_POOL_SUB(p, n) __atomic_sub_fetch((p), (n), __ATOMIC_RELAXED)
+#endif
+
+// allocate a memory buffer that is not in any pool yet
+static ni_buf_t *ni_buf_pool_new_buffer(ni_buf_pool_t *p_buffer_pool,
+                                        int buffer_size)
+{
+    ni_buf_t *p_buffer;
+    void *p_buf = NULL;
+
+    if (ni_mem_account_charge((ni_mem_account_t *)p_buffer_pool->p_mem_account,
+                              NI_MEM_CAT_FRAME_POOL, buffer_size))
+    {
+        ni_log(NI_LOG_DEBUG, "%s: pool %p at session memory cap\n", __func__,
+               p_buffer_pool);
+        return NULL;
+    }
+    p_buffer = (ni_buf_t *)malloc(sizeof(ni_buf_t));
+    if (NULL == p_buffer)
+    {
+        ni_mem_account_uncharge(
+            (ni_mem_account_t *)p_buffer_pool->p_mem_account,
+            NI_MEM_CAT_FRAME_POOL, buffer_size);
+        return NULL;
+    }
+    memset(p_buffer, 0, sizeof(ni_buf_t));
+
+    if (ni_mem_arena_alloc(&p_buf, buffer_size))
+    {
+        ni_mem_account_uncharge(
+            (ni_mem_account_t *)p_buffer_pool->p_mem_account,
+            NI_MEM_CAT_FRAME_POOL, buffer_size);
+        free(p_buffer);
+        return NULL;
+    }
+    if (p_buffer_pool->numa_node >= 0)
+    {
+        ni_numa_bind_buffer(p_buf, buffer_size, p_buffer_pool->numa_node);
+    }
+    ni_log(NI_LOG_DEBUG, "%s ptr %p  buf %p\n", __func__, p_buf, p_buffer);
+    p_buffer->buf = p_buf;
+    p_buffer->size = buffer_size;
+    p_buffer->pool = p_buffer_pool;
+    p_buffer->p_mem_account = p_buffer_pool->p_mem_account;
+    return p_buffer;
+}
+
+// free a memory buffer of a pool, or left in use when its pool was freed
+static void ni_buf_pool_free_buffer(ni_buf_t *p_buffer)
+{
+    ni_mem_arena_free(p_buffer->buf, p_buffer->size);
+    ni_mem_account_uncharge((ni_mem_account_t *)p_buffer->p_mem_account,
+                            NI_MEM_CAT_FRAME_POOL, p_buffer->size);
+    free(p_buffer);
+}
+
+// register a new buffer with the pool and add it to the free stack, called
+// with pool->mutex held or before the pool is shared
+static void ni_buf_pool_add_buffer(ni_buf_pool_t *p_buffer_pool,
+                                   ni_buf_t *p_buffer)
+{
+    p_buffer->index = p_buffer_pool->number_of_buffers;
+    p_buffer_pool->p_bufs[p_buffer->index] = p_buffer;
+    NI_BUF_POOL_STORE(&p_buffer_pool->number_of_buffers,
+                      p_buffer_pool->number_of_buffers + 1);
+    ni_buf_pool_push(p_buffer_pool, p_buffer);
+}
+
+// One worker thread pre-allocates buffers for every decoder frame pool of the
+// process, so sessions do not cost a thread each. Pools asking to grow are
+// queued and served one grow step at a time, in order.
+#ifdef _WIN32
+static ni_pthread_mutex_t g_buf_pool_grow_mutex;
+static ni_pthread_cond_t g_buf_pool_grow_cond;
+static INIT_ONCE g_buf_pool_grow_once = INIT_ONCE_STATIC_INIT;
+#else
+static ni_pthread_mutex_t g_buf_pool_grow_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ni_pthread_cond_t g_buf_pool_grow_cond = PTHREAD_COND_INITIALIZER;
+#endif
+// fields below are protected by g_buf_pool_grow_mutex
+static ni_pthread_t g_buf_pool_grow_thread;
+static int g_buf_pool_grow_started = 0;
+static int g_buf_pool_grow_exit = 0;
+static ni_buf_pool_t *g_buf_pool_grow_head = NULL;
+static ni_buf_pool_t *g_buf_pool_grow_tail = NULL;
+static ni_buf_pool_t *g_buf_pool_grow_current = NULL;  // pool being grown
+
+#ifdef _WIN32
+static BOOL CALLBACK ni_buf_pool_grow_init_once_callback(PINIT_ONCE InitOnce,
+                                                         PVOID Parameter,
+                                                         PVOID *Context)
+{
+    ni_pthread_mutex_init(&g_buf_pool_grow_mutex);
+    ni_pthread_cond_init(&g_buf_pool_grow_cond, NULL);
+    return true;
+}
+#endif
+
+static void ni_buf_pool_grow_lock(void)
+{
+#ifdef _WIN32
+    InitOnceExecuteOnce(&g_buf_pool_grow_once,
+                        ni_buf_pool_grow_init_once_callback, NULL, NULL);
+#endif
+    ni_pthread_mutex_lock(&g_buf_pool_grow_mutex);
+}
+
+// take the pool off the grow queue, called with g_buf_pool_grow_mutex held
+static void ni_buf_pool_grow_dequeue(ni_buf_pool_t *pool)
+{
+    ni_buf_pool_t **pp = &g_buf_pool_grow_head;
+
+    if (!pool->grow_queued)
+    {
+        return;
+    }
+    while (*pp != pool)
+    {
+        pp = &(*pp)->grow_next;
+    }
+    *pp = pool->grow_next;
+    if (g_buf_pool_grow_tail == pool)
+    {
+        g_buf_pool_grow_tail = NULL;
+        for (pool = g_buf_pool_grow_head; pool; pool = pool->grow_next)
+        {
+            g_buf_pool_grow_tail = pool;
+        }
+    }
+}
+
+// one grow step: add half the pool size (at least
+// NI_DEC_FRAME_BUF_POOL_GROW_MIN) up to max_buffers. Memory is allocated
+// without pool->mutex so readers may still grow the pool by one buffer
+// meanwhile. The step ends early when the library is unloaded.
+static void ni_buf_pool_grow_step(ni_buf_pool_t *pool)
+{
+    ni_buf_t *p_buffer;
+    uint32_t step, room;
+
+    ni_pthread_mutex_lock(&pool->mutex);
+    pool->grow_request = 0;
+    if (pool->grow_stop)
     {
-        usleep(usec);
-    } else
+        ni_pthread_mutex_unlock(&pool->mutex);
+        return;
+    }
+
+    room = pool->max_buffers - pool->number_of_buffers - pool->grow_pending;
+    step = pool->number_of_buffers / 2;
+    if (step < NI_DEC_FRAME_BUF_POOL_GROW_MIN)
     {
-        sleep(usec >> 32);
+        step = NI_DEC_FRAME_BUF_POOL_GROW_MIN;
     }
-#endif
+    if (step > room)
+    {
+        step = room;
+    }
+    if (!step)
+    {
+        ni_pthread_mutex_unlock(&pool->mutex);
+        return;
+    }
+    ni_log(NI_LOG_INFO, "Growing dec fme buffer_pool %p from %u to %u "
+           "(max %u)\n", pool, pool->number_of_buffers,
+           pool->number_of_buffers + step, pool->max_buffers);
+    pool->grow_pending += step;
+
+    while (step && !pool->grow_stop &&
+           !NI_BUF_POOL_LOAD(&g_buf_pool_grow_exit))
+    {
+        ni_pthread_mutex_unlock(&pool->mutex);
+        p_buffer = ni_buf_pool_new_buffer(pool, pool->buf_size);
+        ni_pthread_mutex_lock(&pool->mutex);
+        pool->grow_pending--;
+        step--;
+        if (NULL == p_buffer)
+        {
+            if (ni_mem_account_at_cap((ni_mem_account_t *)pool->p_mem_account,
+                                      pool->buf_size))
+            {
+                ni_log(NI_LOG_DEBUG, "ni_buf_pool %p at session memory "
+                       "cap, size: %u\n", pool, pool->number_of_buffers);
+            } else
+            {
+                ni_log(NI_LOG_ERROR, "ERROR: Failed to grow ni_buf_pool "
+                       "%p, current size: %u\n", pool,
+                       pool->number_of_buffers);
+            }
+            break;
+        }
+        ni_buf_pool_add_buffer(pool, p_buffer);
+    }
+    pool->grow_pending -= step;
+    ni_pthread_mutex_unlock(&pool->mutex);
+    ni_perf_count(NI_PERF_CTR_BUF_POOL_EXPAND, 1);
 }
 
-char *ni_strtok(char *s, const char *delim, char **saveptr)
+// the grow worker: serve queued pools until the library is unloaded
+static void *ni_buf_pool_grow_thread(void *arg)
 {
-    char *tok;
+    ni_buf_pool_t *pool;
 
-    if (!s && !(s = *saveptr))
-        return NULL;
+    (void)arg;
+    ni_buf_pool_grow_lock();
+    while (!g_buf_pool_grow_exit)
+    {
+        pool = g_buf_pool_grow_head;
+        if (!pool)
+        {
+            ni_pthread_cond_wait(&g_buf_pool_grow_cond,
+                                 &g_buf_pool_grow_mutex);
+            continue;
+        }
+        ni_buf_pool_grow_dequeue(pool);
+        pool->grow_queued = 0;
+        // the pool is not freed while it is the current one
+        g_buf_pool_grow_current = pool;
+        ni_pthread_mutex_unlock(&g_buf_pool_grow_mutex);
 
-    /* skip leading delimiters */
-    s += strspn(s, delim);
+        ni_buf_pool_grow_step(pool);
 
-    /* s now points to the first non delimiter char, or to the end of the string */
-    if (!*s) {
-        *saveptr = NULL;
-        return NULL;
+        ni_pthread_mutex_lock(&g_buf_pool_grow_mutex);
+        g_buf_pool_grow_current = NULL;
+        ni_pthread_cond_broadcast(&g_buf_pool_grow_cond);
     }
-    tok = s++;
+    ni_pthread_mutex_unlock(&g_buf_pool_grow_mutex);
+    return NULL;
+}
 
-    /* skip non delimiters */
-    s += strcspn(s, delim);
-    if (*s) {
-        *s = '\0';
-        *saveptr = s+1;
-    } else {
-        *saveptr = NULL;
+// take the pool off the grow worker for good, waiting out a grow step in
+// progress; grow_stop must be set already so it is not queued again
+static void ni_buf_pool_grow_detach(ni_buf_pool_t *pool)
+{
+    ni_buf_pool_grow_lock();
+    ni_buf_pool_grow_dequeue(pool);
+    pool->grow_queued = 0;
+    while (g_buf_pool_grow_current == pool)
+    {
+        ni_pthread_cond_wait(&g_buf_pool_grow_cond, &g_buf_pool_grow_mutex);
     }
+    ni_pthread_mutex_unlock(&g_buf_pool_grow_mutex);
+}
 
-    return tok;
+#ifndef _WIN32
+/*!*****************************************************************************
+ *  \brief Run when the library is unloaded or the process exits. Signals the
+ *         grow worker to stop; pools left open are not grown any more.
+ *         An idle worker exits without touching any pool and is joined, so
+ *         it does not run in unmapped code after a dlclose(). A worker in a
+ *         grow step may be waiting for the mutex of a pool a decoder thread
+ *         still holds at exit: it is detached rather than waited for.
+ ******************************************************************************/
+__attribute__((destructor)) static void ni_buf_pool_grow_unload(void)
+{
+    int started;
+    int busy;
+
+    ni_pthread_mutex_lock(&g_buf_pool_grow_mutex);
+    NI_BUF_POOL_STORE(&g_buf_pool_grow_exit, 1);
+    started = g_buf_pool_grow_started;
+    g_buf_pool_grow_started = 0;
+    busy = (NULL != g_buf_pool_grow_current);
+    ni_pthread_cond_broadcast(&g_buf_pool_grow_cond);
+    ni_pthread_mutex_unlock(&g_buf_pool_grow_mutex);
+    if (started && busy)
+    {
+        pthread_detach(g_buf_pool_grow_thread);
+    } else if (started)
+    {
+        ni_pthread_join(g_buf_pool_grow_thread, NULL);
+    }
 }
+#endif
 
-// memory buffer pool operations (one use is for decoder frame buffer pool)
-// expand buffer pool by a pre-defined size
-ni_buf_t *ni_buf_pool_expand(ni_buf_pool_t *pool)
+// ask the grow worker to grow the pool, called with pool->mutex held
+static void ni_buf_pool_request_grow(ni_buf_pool_t *pool)
 {
-  int32_t i;
-  for (i = 0; i < NI_DEC_FRAME_BUF_POOL_SIZE_EXPAND; i++)
-  {
-    if( NULL == ni_buf_pool_allocate_buffer(pool, pool->buf_size) )
+    if (pool->grow_stop ||
+        pool->number_of_buffers + pool->grow_pending >= pool->max_buffers)
     {
-        ni_log(NI_LOG_FATAL, "FATAL: Failed to expand ni_buf_pool buffer: %p, "
-               "current size: %u\n", pool, pool->number_of_buffers);
-        return NULL;
+        return;
     }
-  }
-  pool->number_of_buffers += NI_DEC_FRAME_BUF_POOL_SIZE_EXPAND;
-  return pool->p_free_head;
+    ni_buf_pool_grow_lock();
+    if (g_buf_pool_grow_exit)
+    {
+        ni_pthread_mutex_unlock(&g_buf_pool_grow_mutex);
+        return;
+    }
+    if (!g_buf_pool_grow_started)
+    {
+        if (ni_pthread_create(&g_buf_pool_grow_thread, NULL,
+                              ni_buf_pool_grow_thread, NULL))
+        {
+            ni_pthread_mutex_unlock(&g_buf_pool_grow_mutex);
+            ni_log(NI_LOG_ERROR, "ERROR: %s cannot create grow thread\n",
+                   __func__);
+            return;
+        }
+        g_buf_pool_grow_started = 1;
+    }
+    if (!pool->grow_queued)
+    {
+        pool->grow_next = NULL;
+        if (g_buf_pool_grow_tail)
+        {
+            g_buf_pool_grow_tail->grow_next = pool;
+        } else
+        {
+            g_buf_pool_grow_head = pool;
+        }
+        g_buf_pool_grow_tail = pool;
+        pool->grow_queued = 1;
+        ni_pthread_cond_broadcast(&g_buf_pool_grow_cond);
+    }
+    ni_pthread_mutex_unlock(&g_buf_pool_grow_mutex);
+    pool->grow_request = 1;
 }
 
 // get a free memory buffer from the pool
 ni_buf_t *ni_buf_pool_get_buffer(ni_buf_pool_t *p_buffer_pool)
 {
     ni_buf_t *buf = NULL;
+    uint32_t in_use, high_water;
 
     if (NULL == p_buffer_pool)
     {
         return NULL;
     }
 
-    ni_pthread_mutex_lock(&p_buffer_pool->mutex);
-    buf = p_buffer_pool->p_free_head;
+    buf = ni_buf_pool_pop(p_buffer_pool);
 
-    // find and return a free buffer
+    // no free buffer: add a single one now (the grow worker adds the
+    // rest), unless another thread just did or the pool is at its cap
     if (NULL == buf)
     {
-        ni_log(NI_LOG_INFO, "Expanding dec fme buffer_pool from %u to %u\n",
-               p_buffer_pool->number_of_buffers,
-               p_buffer_pool->number_of_buffers +
-                   NI_DEC_FRAME_BUF_POOL_SIZE_EXPAND);
-
-        buf = ni_buf_pool_expand(p_buffer_pool);
+        ni_pthread_mutex_lock(&p_buffer_pool->mutex);
+        buf = ni_buf_pool_pop(p_buffer_pool);
+        if (NULL == buf &&
+            p_buffer_pool->number_of_buffers + p_buffer_pool->grow_pending <
+                p_buffer_pool->max_buffers)
+        {
+            buf = ni_buf_pool_new_buffer(p_buffer_pool,
+                                         p_buffer_pool->buf_size);
+            if (buf)
+            {
+                ni_buf_pool_add_buffer(p_buffer_pool, buf);
+                buf = ni_buf_pool_pop(p_buffer_pool);
+            }
+        }
+        if (NULL == buf &&
+            p_buffer_pool->number_of_buffers + p_buffer_pool->grow_pending >=
+                p_buffer_pool->max_buffers)
+        {
+            NI_BUF_POOL_ADD(&p_buffer_pool->backpressure_count, 1);
+            ni_log(NI_LOG_DEBUG, "%s: pool %p all %u buffers in use\n",
+                   __func__, p_buffer_pool, p_buffer_pool->number_of_buffers);
+        }
+        ni_buf_pool_request_grow(p_buffer_pool);
+        ni_pthread_mutex_unlock(&p_buffer_pool->mutex);
         if (NULL == buf)
         {
-            ni_pthread_mutex_unlock(&p_buffer_pool->mutex);
             return NULL;
         }
     }
 
-    // remove it from free list head; reconnect the linked list, the p_next
-    // will become the new head now
-    p_buffer_pool->p_free_head = buf->p_next_buffer;
-
-    if (NULL != buf->p_next_buffer)
-    {
-        buf->p_next_buffer->p_previous_buffer = NULL;
-    } else
+    NI_BUF_POOL_STORE(&buf->in_use, 1);
+    in_use = NI_BUF_POOL_ADD(&p_buffer_pool->in_use_count, 1);
+    high_water = NI_BUF_POOL_LOAD(&p_buffer_pool->high_water);
+    if (in_use > high_water)
     {
-        p_buffer_pool->p_free_tail = NULL;
-    }
+        // a racing get may lower it by one, it is a statistic only
+        NI_BUF_POOL_STORE(&p_buffer_pool->high_water, in_use);
 
-    // add it to the used list tail
-    buf->p_previous_buffer = p_buffer_pool->p_used_tail;
-    buf->p_next_buffer = NULL;
-
-    if (NULL != p_buffer_pool->p_used_tail)
-    {
-        p_buffer_pool->p_used_tail->p_next_buffer = buf;
-    } else
-    {
-        p_buffer_pool->p_used_head = buf;
+        // pre-allocate before the pool runs dry
+        if (in_use * 100 >= NI_BUF_POOL_LOAD(&p_buffer_pool->number_of_buffers) *
+                NI_DEC_FRAME_BUF_POOL_GROW_PCT)
+        {
+            ni_pthread_mutex_lock(&p_buffer_pool->mutex);
+            if (!p_buffer_pool->grow_request)
+            {
+                ni_buf_pool_request_grow(p_buffer_pool);
+            }
+            ni_pthread_mutex_unlock(&p_buffer_pool->mutex);
+        }
     }
 
-    p_buffer_pool->p_used_tail = buf;
-
-    ni_pthread_mutex_unlock(&p_buffer_pool->mutex);
-
     ni_log(NI_LOG_DEBUG, "%s ptr %p  buf %p\n", __func__, buf->buf, buf);
     return buf;
 }
@@ -522,45 +2196,35 @@ void ni_buf_pool_return_buffer(ni_buf_t *buf, ni_buf_pool_t *p_buffer_pool)
   if (!p_buffer_pool)
   {
       ni_log(NI_LOG_DEBUG, "%s: pool already freed, self destroy\n", __func__);
-      ni_aligned_free(buf->buf);
-      free(buf);
+      ni_mem_account_t *p_account = (ni_mem_account_t *)buf->p_mem_account;
+      ni_buf_pool_free_buffer(buf);
+      ni_mem_account_unref(p_account);
       return;
   }
 
-  ni_pthread_mutex_lock(&p_buffer_pool->mutex);
-
-  // remove buf from the used list
-  if (NULL != buf->p_previous_buffer)
-  {
-      buf->p_previous_buffer->p_next_buffer = buf->p_next_buffer;
-  } else
-  {
-      p_buffer_pool->p_used_head = buf->p_next_buffer;
-  }
-
-  if (NULL != buf->p_next_buffer)
-  {
-      buf->p_next_buffer->p_previous_buffer = buf->p_previous_buffer;
-  } else
-  {
-      p_buffer_pool->p_used_tail = buf->p_previous_buffer;
-  }
-
-  // put it on the tail of free buffers list
-  buf->p_previous_buffer = p_buffer_pool->p_free_tail;
-  buf->p_next_buffer = NULL;
-
-  if (NULL != p_buffer_pool->p_free_tail)
-  {
-      p_buffer_pool->p_free_tail->p_next_buffer = buf;
-  } else
-  {
-      p_buffer_pool->p_free_head = buf;
-  }
+  NI_BUF_POOL_STORE(&buf->in_use, 0);
+  NI_BUF_POOL_SUB(&p_buffer_pool->in_use_count, 1);
+  ni_buf_pool_push(p_buffer_pool, buf);
+}
 
-  p_buffer_pool->p_free_tail = buf;
+// whether getting a buffer failed because all the buffers the pool may have
+// are in use or being allocated, or the session is at its memory cap, rather
+// than for lack of memory
+int ni_buf_pool_at_cap(ni_buf_pool_t *p_buffer_pool)
+{
+    int at_cap;
 
-  ni_pthread_mutex_unlock(&p_buffer_pool->mutex);
+    if (NULL == p_buffer_pool)
+    {
+        return 0;
+    }
+    ni_pthread_mutex_lock(&p_buffer_pool->mutex);
+    at_cap = p_buffer_pool->number_of_buffers + p_buffer_pool->grow_pending >=
+        p_buffer_pool->max_buffers ||
+        ni_mem_account_at_cap((ni_mem_account_t *)p_buffer_pool->p_mem_account,
+                              p_buffer_pool->buf_size);
+    ni_pthread_mutex_unlock(&p_buffer_pool->mutex);
+    return at_cap;
 }
 
 // allocate a memory buffer and place it in the pool
@@ -568,39 +2232,23 @@ ni_buf_t *ni_buf_pool_allocate_buffer(ni_buf_pool_t *p_buffer_pool,
                                       int buffer_size)
 {
     ni_buf_t *p_buffer = NULL;
-    void *p_buf = NULL;
 
-    if (NULL != p_buffer_pool &&
-        (p_buffer = (ni_buf_t *)malloc(sizeof(ni_buf_t))) != NULL)
+    if (NULL == p_buffer_pool)
     {
-        // init the struct
-        memset(p_buffer, 0, sizeof(ni_buf_t));
-
-        if (ni_posix_memalign(&p_buf, sysconf(_SC_PAGESIZE), buffer_size))
-        {
-            ni_aligned_free(p_buffer);
-            return NULL;
-        }
-        ni_log(NI_LOG_DEBUG, "%s ptr %p  buf %p\n", __func__, p_buf, p_buffer);
-        p_buffer->buf = p_buf;
-        p_buffer->pool = p_buffer_pool;
-
-        // add buffer to the buf pool list
-        p_buffer->p_prev = NULL;
-        p_buffer->p_next = NULL;
-        p_buffer->p_previous_buffer = p_buffer_pool->p_free_tail;
-
-        if (p_buffer_pool->p_free_tail != NULL)
-        {
-            p_buffer_pool->p_free_tail->p_next_buffer = p_buffer;
-        } else
-        {
-            p_buffer_pool->p_free_head = p_buffer;
-        }
-
-        p_buffer_pool->p_free_tail = p_buffer;
+        return NULL;
+    }
+    if (p_buffer_pool->number_of_buffers >= NI_BUF_POOL_MAX_BUFFERS)
+    {
+        ni_log(NI_LOG_ERROR, "ERROR: %s pool %p has %u buffers already\n",
+               __func__, p_buffer_pool, p_buffer_pool->number_of_buffers);
+        return NULL;
     }
 
+    p_buffer = ni_buf_pool_new_buffer(p_buffer_pool, buffer_size);
+    if (p_buffer)
+    {
+        ni_buf_pool_add_buffer(p_buffer_pool, p_buffer);
+    }
     return p_buffer;
 }
 
@@ -611,6 +2259,7 @@ int32_t ni_dec_fme_buffer_pool_initialize(ni_session_context_t* p_ctx,
                                           int height_align, int factor)
 {
     int32_t i;
+    uint32_t max_buffers;
     int width_aligned;
     int height_aligned;
 
@@ -691,12 +2340,38 @@ int32_t ni_dec_fme_buffer_pool_initialize(ni_session_context_t* p_ctx,
     // init the struct
     memset(p_ctx->dec_fme_buf_pool, 0, sizeof(ni_buf_pool_t));
     ni_pthread_mutex_init(&p_ctx->dec_fme_buf_pool->mutex);
-    p_ctx->dec_fme_buf_pool->number_of_buffers = number_of_buffers;
+    p_ctx->dec_fme_buf_pool->numa_node =
+        p_ctx->numa_bind_buffers ? p_ctx->numa_node : -1;
+    p_ctx->dec_fme_buf_pool->p_mem_account = p_ctx->p_mem_account;
+    ni_mem_account_ref((ni_mem_account_t *)p_ctx->p_mem_account);
+
+    // cap the pool at the session's budget, but at one buffer at least
+    max_buffers = NI_BUF_POOL_MAX_BUFFERS;
+    if (p_ctx->dec_fme_buf_pool_budget &&
+        p_ctx->dec_fme_buf_pool_budget / buffer_size < max_buffers)
+    {
+        max_buffers = (uint32_t)(p_ctx->dec_fme_buf_pool_budget / buffer_size);
+        if (!max_buffers)
+        {
+            max_buffers = 1;
+        }
+    }
+    p_ctx->dec_fme_buf_pool->max_buffers = max_buffers;
+    if ((uint32_t)number_of_buffers > max_buffers)
+    {
+        number_of_buffers = (int32_t)max_buffers;
+    }
+    // frames come from the caller's memory, the pool is only a fallback
+    p_ctx->dec_fme_buf_pool->allocator = p_ctx->dec_buffer_allocator;
+    if (p_ctx->dec_buffer_allocator.alloc_buffer)
+    {
+        number_of_buffers = 0;
+    }
 
     ni_log2(p_ctx, NI_LOG_DEBUG, 
-           "ni_dec_fme_buffer_pool_initialize: entries %d  entry size "
-           "%d\n",
-           number_of_buffers, buffer_size);
+           "ni_dec_fme_buffer_pool_initialize: entries %d (max %u) entry "
+           "size %d\n",
+           number_of_buffers, max_buffers, buffer_size);
 
     p_ctx->dec_fme_buf_pool->buf_size = buffer_size;
     for (i = 0; i < number_of_buffers; i++)
@@ -716,40 +2391,45 @@ int32_t ni_dec_fme_buffer_pool_initialize(ni_session_context_t* p_ctx,
 
 void ni_dec_fme_buffer_pool_free(ni_buf_pool_t *p_buffer_pool)
 {
-    ni_buf_t *buf, *p_next;
+    ni_buf_t *buf;
+    uint32_t i;
 
     if (p_buffer_pool)
     {
         ni_log(NI_LOG_TRACE, "%s: enter.\n", __func__);
 
+        // stop background growth first, it may be allocating a buffer
+        ni_pthread_mutex_lock(&p_buffer_pool->mutex);
+        p_buffer_pool->grow_stop = 1;
+        ni_pthread_mutex_unlock(&p_buffer_pool->mutex);
+        ni_buf_pool_grow_detach(p_buffer_pool);
+        ni_log(NI_LOG_DEBUG, "%s: %u buffers, high water %u, %u gets at cap\n",
+               __func__, p_buffer_pool->number_of_buffers,
+               p_buffer_pool->high_water, p_buffer_pool->backpressure_count);
+
         // mark used buf not returned at pool free time by setting pool ptr in used
-        // buf to NULL, so they will self-destroy when time is due eventually
+        // buf to NULL, so they will self-destroy when time is due eventually;
+        // free all the others
+        int32_t count_free = 0;
         ni_pthread_mutex_lock(&p_buffer_pool->mutex);
-        buf = p_buffer_pool->p_used_head;
-        if (buf)
+        for (i = 0; i < p_buffer_pool->number_of_buffers; i++)
         {
-            while (buf)
+            buf = p_buffer_pool->p_bufs[i];
+            if (NI_BUF_POOL_LOAD(&buf->in_use))
             {
-                p_next = buf->p_next_buffer;
                 ni_log(NI_LOG_DEBUG, "Release ownership of ptr %p buf %p\n",
                        buf->buf, buf);
+                // stays charged to the session until it self-destroys
+                ni_mem_account_ref((ni_mem_account_t *)buf->p_mem_account);
                 buf->pool = NULL;
-                buf = p_next;
+            } else
+            {
+                ni_buf_pool_free_buffer(buf);
+                count_free++;
             }
         }
         ni_pthread_mutex_unlock(&p_buffer_pool->mutex);
 
-        buf = p_buffer_pool->p_free_head;
-        // free all the buffers in the free list
-        int32_t count_free = 0;
-        while (buf)
-        {
-            p_next = buf->p_next_buffer;
-            ni_aligned_free(buf->buf);
-            free(buf);
-            buf = p_next;
-            count_free++;
-        }
         // NOLINTNEXTLINE(bugprone-branch-clone)
         if (count_free != p_buffer_pool->number_of_buffers)
         {
@@ -760,6 +2440,8 @@ void ni_dec_fme_buffer_pool_free(ni_buf_pool_t *p_buffer_pool)
             ni_log(NI_LOG_DEBUG, "%s all buffers freed: %d.\n", __func__,
                    count_free);
         }
+        ni_pthread_mutex_destroy(&p_buffer_pool->mutex);
+        ni_mem_account_unref((ni_mem_account_t *)p_buffer_pool->p_mem_account);
         free(p_buffer_pool);
     }
     else
@@ -770,40 +2452,18 @@ void ni_dec_fme_buffer_pool_free(ni_buf_pool_t *p_buffer_pool)
 
 void ni_buffer_pool_free(ni_queue_buffer_pool_t *p_buffer_pool)
 {
-    ni_queue_node_t *buf, *p_next;
-
     ni_log(NI_LOG_TRACE, "%s: enter.\n", __func__);
 
     if (p_buffer_pool)
     {
-        buf = p_buffer_pool->p_free_head;
-        // free all the buffers in the free and used list
-        int32_t count = 0;
-        while (buf)
-        {
-            p_next = buf->p_next_buffer;
-            free(buf);
-            buf = p_next;
-            count++;
-        }
-
-        buf = p_buffer_pool->p_used_head;
-        while (buf)
-        {
-            p_next = buf->p_next_buffer;
-            free(buf);
-            buf = p_next;
-            count++;
-        }
-
-        if (count != p_buffer_pool->number_of_buffers)
-        {
-            ni_log(NI_LOG_ERROR, "??? freed %d != number_of_buffers %u\n",
-                   count, p_buffer_pool->number_of_buffers);
-        } else
-        {
-            ni_log(NI_LOG_DEBUG, "p_buffer_pool freed %d buffers.\n", count);
-        }
+        // nodes of every queue of the pool go with the one array
+        free(p_buffer_pool->p_nodes);
+        ni_mem_account_uncharge(
+            (ni_mem_account_t *)p_buffer_pool->p_mem_account,
+            NI_MEM_CAT_TIMESTAMP,
+            (uint64_t)p_buffer_pool->number_of_buffers * sizeof(ni_queue_node_t));
+        ni_log(NI_LOG_DEBUG, "p_buffer_pool freed %u buffers.\n",
+               p_buffer_pool->number_of_buffers);
         free(p_buffer_pool);
     }
     else
@@ -812,38 +2472,53 @@ void ni_buffer_pool_free(ni_queue_buffer_pool_t *p_buffer_pool)
     }
 }
 
-ni_queue_node_t *ni_buffer_pool_allocate_buffer(ni_queue_buffer_pool_t *p_buffer_pool)
+/*!*****************************************************************************
+ *  \brief  Grow the node array of a timestamp buffer pool, putting the new
+ *          nodes on its free list. Nodes are linked by index so the array
+ *          may move; node pointers held by the caller do not survive this.
+ *
+ *  \param[in] p_buffer_pool  pool
+ *  \param[in] count          number of nodes to add
+ *
+ *  \return 0 on success, -1 on failure
+ ******************************************************************************/
+static int ni_buffer_pool_grow(ni_queue_buffer_pool_t *p_buffer_pool,
+                               uint32_t count)
 {
-    ni_queue_node_t *p_buffer = NULL;
+    uint32_t number_of_buffers = p_buffer_pool->number_of_buffers;
+    ni_queue_node_t *p_nodes;
+    uint32_t i;
 
-    if (NULL != p_buffer_pool &&
-        (p_buffer = (ni_queue_node_t *)malloc(sizeof(ni_queue_node_t))) != NULL)
+    if (ni_mem_account_charge((ni_mem_account_t *)p_buffer_pool->p_mem_account,
+                              NI_MEM_CAT_TIMESTAMP,
+                              (uint64_t)count * sizeof(ni_queue_node_t)))
     {
-        //Inititalise the struct
-        memset(p_buffer, 0, sizeof(ni_queue_node_t));
-        // add buffer to the buf pool list
-        p_buffer->p_prev = NULL;
-        p_buffer->p_next = NULL;
-        p_buffer->p_previous_buffer = p_buffer_pool->p_free_tail;
-
-        if (p_buffer_pool->p_free_tail != NULL)
-        {
-            p_buffer_pool->p_free_tail->p_next_buffer = p_buffer;
-        } else
-        {
-            p_buffer_pool->p_free_head = p_buffer;
-        }
-
-        p_buffer_pool->p_free_tail = p_buffer;
+        return -1;
     }
-
-    return p_buffer;
+    p_nodes = (ni_queue_node_t *)realloc(
+        p_buffer_pool->p_nodes,
+        (size_t)(number_of_buffers + count) * sizeof(ni_queue_node_t));
+    if (NULL == p_nodes)
+    {
+        ni_mem_account_uncharge(
+            (ni_mem_account_t *)p_buffer_pool->p_mem_account,
+            NI_MEM_CAT_TIMESTAMP, (uint64_t)count * sizeof(ni_queue_node_t));
+        return -1;
+    }
+    memset(&p_nodes[number_of_buffers], 0, count * sizeof(ni_queue_node_t));
+    // lowest index on top of the free list
+    for (i = number_of_buffers + count; i > number_of_buffers; i--)
+    {
+        p_nodes[i - 1].next = p_buffer_pool->free_head;
+        p_buffer_pool->free_head = i;
+    }
+    p_buffer_pool->p_nodes = p_nodes;
+    p_buffer_pool->number_of_buffers = number_of_buffers + count;
+    return 0;
 }
 
 int32_t ni_buffer_pool_initialize(ni_session_context_t* p_ctx, int32_t number_of_buffers)
 {
-    int i;
-
     ni_log2(p_ctx, NI_LOG_TRACE,  "%s: enter\n", __func__);
 
     if (p_ctx->buffer_pool != NULL)
@@ -862,20 +2537,14 @@ int32_t ni_buffer_pool_initialize(ni_session_context_t* p_ctx, int32_t number_of
 
     //initialise the struct
     memset(p_ctx->buffer_pool, 0, sizeof(ni_queue_buffer_pool_t));
-    p_ctx->buffer_pool->number_of_buffers = number_of_buffers;
-    //p_buffer_pool->p_free_head = NULL;
-    //p_buffer_pool->p_free_tail = NULL;
-    //p_buffer_pool->p_used_head = NULL;
-    //p_buffer_pool->p_used_tail = NULL;
+    p_ctx->buffer_pool->p_mem_account = p_ctx->p_mem_account;
 
-    for (i = 0; i < number_of_buffers; i++)
+    if (ni_buffer_pool_grow(p_ctx->buffer_pool, (uint32_t)number_of_buffers))
     {
-        if (NULL == ni_buffer_pool_allocate_buffer(p_ctx->buffer_pool))
-        {
-            //Release everything we have allocated so far and exit
-            ni_buffer_pool_free(p_ctx->buffer_pool);
-            return -1;
-        }
+        //Release everything we have allocated so far and exit
+        ni_buffer_pool_free(p_ctx->buffer_pool);
+        p_ctx->buffer_pool = NULL;
+        return -1;
     }
 
     return 0;
@@ -883,22 +2552,25 @@ int32_t ni_buffer_pool_initialize(ni_session_context_t* p_ctx, int32_t number_of
 
 ni_queue_node_t *ni_buffer_pool_expand(ni_queue_buffer_pool_t *pool)
 {
-    int i;
-
-    for (i = 0; i < 200; i++)
+    if (ni_buffer_pool_grow(pool, 200))
     {
-        if (NULL == ni_buffer_pool_allocate_buffer(pool))
-        {
-            ni_log(NI_LOG_FATAL,
-                   "FATAL ERROR: Failed to allocate pool buffer for pool :%p\n",
-                   pool);
-            return NULL;
-        }
+        ni_log(NI_LOG_FATAL,
+               "FATAL ERROR: Failed to allocate pool buffer for pool :%p\n",
+               pool);
+        return NULL;
     }
-    pool->number_of_buffers += 200;
-    return pool->p_free_head;
+    return NI_QUEUE_NODE(pool, pool->free_head);
 }
 
+/*!*****************************************************************************
+ *  \brief  Take a node off the free list of a timestamp buffer pool,
+ *          growing the pool when it is empty. The pointer is valid until the
+ *          next call, which may move the node array.
+ *
+ *  \param[in] p_buffer_pool  pool
+ *
+ *  \return pointer to the node, NULL on failure
+ ******************************************************************************/
 ni_queue_node_t *ni_buffer_pool_get_queue_buffer(ni_queue_buffer_pool_t *p_buffer_pool)
 {
     ni_queue_node_t *buf = NULL;
@@ -909,45 +2581,22 @@ ni_queue_node_t *ni_buffer_pool_get_queue_buffer(ni_queue_buffer_pool_t *p_buffe
     }
 
     // find and return a free buffer
-    buf = p_buffer_pool->p_free_head;
-    if (NULL == buf)
+    if (!p_buffer_pool->free_head)
     {
         ni_log(NI_LOG_INFO, "Expanding p_buffer_pool from %u to %u \n",
                p_buffer_pool->number_of_buffers,
                p_buffer_pool->number_of_buffers + 200);
-        buf = ni_buffer_pool_expand(p_buffer_pool);
-        if (NULL == buf)
+        if (NULL == ni_buffer_pool_expand(p_buffer_pool))
         {
             return NULL;   //return null otherwise there will be null derefferencing later
         }
     }
 
+    buf = NI_QUEUE_NODE(p_buffer_pool, p_buffer_pool->free_head);
+    p_buffer_pool->free_head = buf->next;
     buf->checkout_timestamp = time(NULL);
-    // remove it from free list head; reconnect the linked list, the p_next
-    // will become the new head now
-    p_buffer_pool->p_free_head = buf->p_next_buffer;
-
-    if (NULL != buf->p_next_buffer)
-    {
-        buf->p_next_buffer->p_previous_buffer = NULL;
-    } else
-    {
-        p_buffer_pool->p_free_tail = NULL;
-    }
-
-    // add it to the used list tail
-    buf->p_previous_buffer = p_buffer_pool->p_used_tail;
-    buf->p_next_buffer = NULL;
-
-    if (NULL != p_buffer_pool->p_used_tail)
-    {
-        p_buffer_pool->p_used_tail->p_next_buffer = buf;
-    } else
-    {
-        p_buffer_pool->p_used_head = buf;
-    }
-
-    p_buffer_pool->p_used_tail = buf;
+    buf->prev = 0;
+    buf->next = 0;
 
     return buf;
 }
@@ -960,36 +2609,9 @@ void ni_buffer_pool_return_buffer(ni_queue_node_t *buf,
         return;
     }
 
-    // remove buf from the used list
-    if (NULL != buf->p_previous_buffer)
-    {
-        buf->p_previous_buffer->p_next_buffer = buf->p_next_buffer;
-    } else
-    {
-        p_buffer_pool->p_used_head = buf->p_next_buffer;
-    }
-
-    if (NULL != buf->p_next_buffer)
-    {
-        buf->p_next_buffer->p_previous_buffer = buf->p_previous_buffer;
-    } else
-    {
-        p_buffer_pool->p_used_tail = buf->p_previous_buffer;
-    }
-
-    // put it on the tail of free buffers list
-    buf->p_previous_buffer = p_buffer_pool->p_free_tail;
-    buf->p_next_buffer = NULL;
-
-    if (NULL != p_buffer_pool->p_free_tail)
-    {
-        p_buffer_pool->p_free_tail->p_next_buffer = buf;
-    } else
-    {
-        p_buffer_pool->p_free_head = buf;
-    }
-
-    p_buffer_pool->p_free_tail = buf;
+    // put it on top of the free list, to be reused while still in cache
+    buf->next = p_buffer_pool->free_head;
+    p_buffer_pool->free_head = NI_QUEUE_LINK(p_buffer_pool, buf);
 }
 
 /*!******************************************************************************
@@ -1414,7 +3036,7 @@ void ni_timestamp_scan_cleanup(ni_timestamp_table_t *pts_list,
                                ni_timestamp_table_t *dts_list,
                                ni_queue_buffer_pool_t *p_buffer_pool)
 {
-    if (!pts_list || !dts_list)
+    if (!pts_list || !dts_list || !p_buffer_pool)
     {
         return;
     }
@@ -1422,7 +3044,7 @@ void ni_timestamp_scan_cleanup(ni_timestamp_table_t *pts_list,
     // currently, only have dts list.
     // if pts list is added back, this should be modified.
     ni_queue_t *p_queue = &dts_list->list;
-    ni_queue_node_t *p = p_queue->p_first;
+    ni_queue_node_t *p = NI_QUEUE_NODE(p_buffer_pool, p_queue->first);
     time_t now = time(NULL);
 
     while (p)
@@ -1431,19 +3053,18 @@ void ni_timestamp_scan_cleanup(ni_timestamp_table_t *pts_list,
         {
             break;
         }
-        if (p_queue->p_first == p_queue->p_last)
+        p_queue->first = p->next;
+        ni_buffer_pool_return_buffer(p, p_buffer_pool);
+        p_queue->count--;
+
+        p = NI_QUEUE_NODE(p_buffer_pool, p_queue->first);
+        if (p)
         {
-            ni_buffer_pool_return_buffer(p_queue->p_first, p_buffer_pool);
-            p = p_queue->p_first = p_queue->p_last = NULL;
+            p->prev = 0;
         } else
         {
-            p_queue->p_first = p->p_next;
-            p->p_next->p_prev = NULL;
-            ni_buffer_pool_return_buffer(p, p_buffer_pool);
-
-            p = p_queue->p_first;
+            p_queue->last = 0;
         }
-        p_queue->count--;
     }
 }
 
@@ -1503,8 +3124,8 @@ ni_retcode_t ni_queue_init(ni_session_context_t* p_ctx, ni_queue_t *p_queue, con
     strcpy(p_queue->name, name);
     ni_buffer_pool_initialize(p_ctx, BUFFER_POOL_SZ_PER_CONTEXT);
 
-    p_queue->p_first = NULL;
-    p_queue->p_last = NULL;
+    p_queue->first = 0;
+    p_queue->last = 0;
     p_queue->count = 0;
 
     ni_log2(p_ctx, NI_LOG_TRACE,  "%s: exit\n", __func__);
@@ -1525,6 +3146,7 @@ ni_retcode_t ni_queue_push(ni_queue_buffer_pool_t *p_buffer_pool,
 {
     ni_retcode_t err = NI_RETCODE_SUCCESS;
     ni_queue_node_t *temp = NULL;
+    uint32_t link;
 
     if (!p_queue)
     {
@@ -1543,23 +3165,19 @@ ni_retcode_t ni_queue_push(ni_queue_buffer_pool_t *p_buffer_pool,
         LRETURN;
     }
 
-    //ni_log(NI_LOG_TRACE, "%s enter: p_first=%"PRId64", p_last=%"PRId64", count=%d\n", __func__, p_queue->p_first, p_queue->p_last, p_queue->count);
-
     temp->timestamp = timestamp;
     temp->frame_info = frame_info;
+    link = NI_QUEUE_LINK(p_buffer_pool, temp);
 
-    temp->p_next = NULL;
-
-    if (!p_queue->p_first)
+    if (!p_queue->first)
     {
-        p_queue->p_first = p_queue->p_last = temp;
-        p_queue->p_first->p_prev = NULL;
+        p_queue->first = p_queue->last = link;
         p_queue->count++;
     } else
     {
-        p_queue->p_last->p_next = temp;
-        temp->p_prev = p_queue->p_last;
-        p_queue->p_last = temp;
+        NI_QUEUE_NODE(p_buffer_pool, p_queue->last)->next = link;
+        temp->prev = p_queue->last;
+        p_queue->last = link;
         p_queue->count++;
 
         // Assume the oldest one is useless when reaching this situation.
@@ -1568,12 +3186,12 @@ ni_retcode_t ni_queue_push(ni_queue_buffer_pool_t *p_buffer_pool,
             ni_log(NI_LOG_DEBUG,
                    "%s: queue overflow, remove oldest entry, count=%u\n",
                    __func__, p_queue->count);
+            ni_perf_count(NI_PERF_CTR_TS_QUEUE_OVERFLOW, 1);
             //Remove oldest one
-            temp = p_queue->p_first->p_next;
-            // free(p_queue->p_first);
-            ni_buffer_pool_return_buffer(p_queue->p_first, p_buffer_pool);
-            p_queue->p_first = temp;
-            p_queue->p_first->p_prev = NULL;
+            temp = NI_QUEUE_NODE(p_buffer_pool, p_queue->first);
+            p_queue->first = temp->next;
+            ni_buffer_pool_return_buffer(temp, p_buffer_pool);
+            NI_QUEUE_NODE(p_buffer_pool, p_queue->first)->prev = 0;
             p_queue->count--;
         }
     }
@@ -1608,39 +3226,39 @@ ni_retcode_t ni_queue_pop(ni_queue_t *p_queue, uint64_t frame_info,
         LRETURN;
     }
 
-    if (NULL == p_queue->p_first)
+    if (!p_queue->first || !p_buffer_pool)
     {
         ni_log(NI_LOG_DEBUG, "%s: queue is empty...\n", __func__);
         retval = NI_RETCODE_FAILURE;
         LRETURN;
     }
 
-    if (p_queue->p_first == p_queue->p_last)
+    if (p_queue->first == p_queue->last)
     {
         /*! If only one entry, retrieve timestamp without checking */
-        *p_timestamp = p_queue->p_first->timestamp;
-        // free(p_queue->p_first);
-        ni_buffer_pool_return_buffer(p_queue->p_first, p_buffer_pool);
+        temp = NI_QUEUE_NODE(p_buffer_pool, p_queue->first);
+        *p_timestamp = temp->timestamp;
+        ni_buffer_pool_return_buffer(temp, p_buffer_pool);
 
-        p_queue->p_first = NULL;
-        p_queue->p_last = NULL;
+        p_queue->first = 0;
+        p_queue->last = 0;
         p_queue->count--;
         ni_assert(p_queue->count == 0);
         found = 1;
     } else
     {
-        temp = p_queue->p_first;
+        temp = NI_QUEUE_NODE(p_buffer_pool, p_queue->first);
         while (temp && !found)
         {
             if (frame_info < temp->frame_info)
             {
-                if (!temp->p_prev)
+                if (!temp->prev)
                 {
                     ni_log(NI_LOG_DEBUG, "First in ts list, return it\n");
                     *p_timestamp = temp->timestamp;
 
-                    p_queue->p_first = temp->p_next;
-                    temp->p_next->p_prev = NULL;
+                    p_queue->first = temp->next;
+                    NI_QUEUE_NODE(p_buffer_pool, temp->next)->prev = 0;
 
                     ni_buffer_pool_return_buffer(temp, p_buffer_pool);
                     p_queue->count--;
@@ -1648,33 +3266,33 @@ ni_retcode_t ni_queue_pop(ni_queue_t *p_queue, uint64_t frame_info,
                     break;
                 }
 
-                // retrieve from p_prev and delete p_prev !
-                *p_timestamp = temp->p_prev->timestamp;
-                temp = temp->p_prev;
-                temp_prev = temp->p_prev;
+                // retrieve from prev and delete prev !
+                temp = NI_QUEUE_NODE(p_buffer_pool, temp->prev);
+                *p_timestamp = temp->timestamp;
+                temp_prev = NI_QUEUE_NODE(p_buffer_pool, temp->prev);
 
                 if (temp_prev)
                 {
-                    temp_prev->p_next = temp->p_next;
-                    if (temp->p_next)
+                    temp_prev->next = temp->next;
+                    if (temp->next)
                     {
-                        temp->p_next->p_prev = temp_prev;
+                        NI_QUEUE_NODE(p_buffer_pool, temp->next)->prev =
+                            temp->prev;
                     } else
                     {
-                        p_queue->p_last = temp_prev;
+                        p_queue->last = temp->prev;
                     }
                 } else
                 {
-                    p_queue->p_first = temp->p_next;
-                    temp->p_next->p_prev = NULL;
+                    p_queue->first = temp->next;
+                    NI_QUEUE_NODE(p_buffer_pool, temp->next)->prev = 0;
                 }
-                //free(temp);
                 ni_buffer_pool_return_buffer(temp, p_buffer_pool);
                 p_queue->count--;
                 found = 1;
                 break;
             }
-            temp = temp->p_next;
+            temp = NI_QUEUE_NODE(p_buffer_pool, temp->next);
             count++;
       }
     }
@@ -1714,27 +3332,27 @@ ni_retcode_t ni_queue_pop_threshold(ni_queue_t *p_queue, uint64_t frame_info,
         LRETURN;
     }
 
-    if (p_queue->p_first == NULL)
+    if (!p_queue->first || !p_buffer_pool)
     {
         ni_log(NI_LOG_DEBUG, "%s: queue is empty...\n", __func__);
         retval = NI_RETCODE_FAILURE;
         LRETURN;
     }
 
-    if (p_queue->p_first == p_queue->p_last)
+    if (p_queue->first == p_queue->last)
     {
         /*! If only one entry, retrieve timestamp without checking */
-        *p_timestamp = p_queue->p_first->timestamp;
-        // free(p_queue->p_first);
-        ni_buffer_pool_return_buffer(p_queue->p_first, p_buffer_pool);
+        temp = NI_QUEUE_NODE(p_buffer_pool, p_queue->first);
+        *p_timestamp = temp->timestamp;
+        ni_buffer_pool_return_buffer(temp, p_buffer_pool);
 
-        p_queue->p_first = NULL;
-        p_queue->p_last = NULL;
+        p_queue->first = 0;
+        p_queue->last = 0;
         p_queue->count--;
         found = 1;
     } else
     {
-        temp = p_queue->p_first;
+        temp = NI_QUEUE_NODE(p_buffer_pool, p_queue->first);
         while ((temp) && (!found))
         {
             if (llabs((int)frame_info - (int)temp->frame_info) <= threshold)
@@ -1742,27 +3360,27 @@ ni_retcode_t ni_queue_pop_threshold(ni_queue_t *p_queue, uint64_t frame_info,
                 *p_timestamp = temp->timestamp;
                 if (temp_prev)
                 {
-                    temp_prev->p_next = temp->p_next;
-                    if (temp->p_next)
+                    temp_prev->next = temp->next;
+                    if (temp->next)
                     {
-                        temp->p_next->p_prev = temp_prev;
+                        NI_QUEUE_NODE(p_buffer_pool, temp->next)->prev =
+                            temp->prev;
                     } else
                     {
-                        p_queue->p_last = temp_prev;
+                        p_queue->last = temp->prev;
                     }
                 } else
                 {
-                    p_queue->p_first = temp->p_next;
-                    temp->p_next->p_prev = NULL;
+                    p_queue->first = temp->next;
+                    NI_QUEUE_NODE(p_buffer_pool, temp->next)->prev = 0;
                 }
-                // free(temp);
                 ni_buffer_pool_return_buffer(temp, p_buffer_pool);
                 p_queue->count--;
                 found = 1;
                 break;
             }
             temp_prev = temp;
-            temp = temp->p_next;
+            temp = NI_QUEUE_NODE(p_buffer_pool, temp->next);
             count++;
         }
     }
@@ -1802,13 +3420,12 @@ ni_retcode_t ni_queue_free(ni_queue_t *p_queue, ni_queue_buffer_pool_t *p_buffer
     }
 
     ni_log(NI_LOG_DEBUG, "Entries before clean up: \n");
-    ni_queue_print(p_queue);
+    ni_queue_print(p_queue, p_buffer_pool);
 
-    temp = p_queue->p_first;
+    temp = p_buffer_pool ? NI_QUEUE_NODE(p_buffer_pool, p_queue->first) : NULL;
     while (temp)
     {
-        temp_next = temp->p_next;
-        //free(temp);
+        temp_next = NI_QUEUE_NODE(p_buffer_pool, temp->next);
         ni_buffer_pool_return_buffer(temp, p_buffer_pool);
         temp = temp_next;
         left++;
@@ -1816,8 +3433,8 @@ ni_retcode_t ni_queue_free(ni_queue_t *p_queue, ni_queue_buffer_pool_t *p_buffer
     ni_log(NI_LOG_DEBUG, "Entries cleaned up at ni_queue_free: %d, count: %u\n",
            left, p_queue->count);
 
-    //ni_queue_print(p_queue);
-
+    p_queue->first = 0;
+    p_queue->last = 0;
     p_queue->count = 0;
 
     return NI_RETCODE_SUCCESS;
@@ -1830,13 +3447,14 @@ ni_retcode_t ni_queue_free(ni_queue_t *p_queue, ni_queue_buffer_pool_t *p_buffer
  *
  *  \return
  *******************************************************************************/
-ni_retcode_t ni_queue_print(ni_queue_t *p_queue)
+ni_retcode_t ni_queue_print(ni_queue_t *p_queue,
+                            ni_queue_buffer_pool_t *p_buffer_pool)
 {
     ni_queue_node_t *temp = NULL;
     struct tm *ltime = NULL;
     char buff[20] = {0};
 
-    if (!p_queue)
+    if (!p_queue || !p_buffer_pool)
     {
         return NI_RETCODE_SUCCESS;
     }
@@ -1846,12 +3464,10 @@ ni_retcode_t ni_queue_print(ni_queue_t *p_queue)
 
     ni_log(NI_LOG_DEBUG, "\nForward:\n");
 
-    temp = p_queue->p_first;
-
-    ni_log(NI_LOG_DEBUG, "%s enter: p_first=%p, p_last=%p, count=%u, temp=%p\n",
-           __func__, p_queue->p_first, p_queue->p_last, p_queue->count, temp);
+    temp = NI_QUEUE_NODE(p_buffer_pool, p_queue->first);
 
-    //  ni_log(NI_LOG_TRACE, "%s enter: p_first=%" PRId64 ", p_last=%" PRId64 ", count=%d, temp=%" PRId64 "\n", __func__, p_queue->p_first, p_queue->p_last, p_queue->count, temp);
+    ni_log(NI_LOG_DEBUG, "%s enter: first=%u, last=%u, count=%u\n",
+           __func__, p_queue->first, p_queue->last, p_queue->count);
 
     while (temp)
     {
@@ -1862,17 +3478,17 @@ ni_retcode_t ni_queue_print(ni_queue_t *p_queue)
             ni_log(NI_LOG_TRACE, " %s [%" PRId64 ", %" PRId64 "]", buff,
                    temp->timestamp, temp->frame_info);
         }
-        temp = temp->p_next;
+        temp = NI_QUEUE_NODE(p_buffer_pool, temp->next);
     }
 
     ni_log(NI_LOG_DEBUG, "\nBackward:");
 
-    temp = p_queue->p_last;
+    temp = NI_QUEUE_NODE(p_buffer_pool, p_queue->last);
     while (temp)
     {
         ni_log(NI_LOG_TRACE, " [%" PRId64 ", %" PRId64 "]\n", temp->timestamp,
                temp->frame_info);
-        temp = temp->p_prev;
+        temp = NI_QUEUE_NODE(p_buffer_pool, temp->prev);
     }
     ni_log(NI_LOG_DEBUG, "\n");
 
@@ -89,7 +89,10 @@ static inline float clip3f(float min, float max, float a)
 #define XCODER_MAX_ENC_PIC_HEIGHT 8192
 
 #define NI_DEC_FRAME_BUF_POOL_SIZE_INIT   20
-#define NI_DEC_FRAME_BUF_POOL_SIZE_EXPAND 20
+// the pool grows in the background by half its size, at least GROW_MIN
+// buffers, once GROW_PCT percent of its buffers are in use
+#define NI_DEC_FRAME_BUF_POOL_GROW_MIN    4
+#define NI_DEC_FRAME_BUF_POOL_GROW_PCT    75
 
 
 // memory buffer pool operations (one use is for decoder frame buffer pool)
@@ -97,6 +100,8 @@ ni_buf_t *ni_buf_pool_get_buffer(ni_buf_pool_t *p_buffer_pool);
 
 void ni_buf_pool_return_buffer(ni_buf_t *buf, ni_buf_pool_t *p_buffer_pool);
 
+int ni_buf_pool_at_cap(ni_buf_pool_t *p_buffer_pool);
+
 ni_buf_t *ni_buf_pool_allocate_buffer(ni_buf_pool_t *p_buffer_pool, int buffer_size);
 
 // decoder frame buffer pool init & free
@@ -125,7 +130,7 @@ ni_retcode_t ni_queue_push(ni_queue_buffer_pool_t *p_buffer_pool, ni_queue_t *p_
 ni_retcode_t ni_queue_pop(ni_queue_t *p_queue, uint64_t frame_offset, int64_t *p_timestamp, int32_t threshold, int32_t print, ni_queue_buffer_pool_t *p_buffer_pool);
 ni_retcode_t ni_queue_pop_threshold(ni_queue_t *p_queue, uint64_t frame_offset, int64_t *p_timestamp, int32_t threshold, int32_t print, ni_queue_buffer_pool_t *p_buffer_pool);
 ni_retcode_t ni_queue_free(ni_queue_t *p_queue, ni_queue_buffer_pool_t *p_buffer_pool);
-ni_retcode_t ni_queue_print(ni_queue_t *p_queue);
+ni_retcode_t ni_queue_print(ni_queue_t *p_queue, ni_queue_buffer_pool_t *p_buffer_pool);
 
 int32_t ni_atobool(const char *p_str, bool *b_error);
 int32_t ni_atoi(const char *p_str, bool *b_error);
@@ -372,6 +377,398 @@ uint32_t ni_round_up(uint32_t number_to_round, uint32_t multiple);
 uint32_t ni_get_kernel_max_io_size(const char * p_dev);
 #endif
 
+/*!*****************************************************************************
+ *  \brief Get the NUMA node an NVMe block device is attached to
+ *
+ *  \param[in] p_dev   device name, e.g. /dev/nvme0n1
+ *
+ *  \return NUMA node number, -1 if unknown or not supported on this platform
+ ******************************************************************************/
+LIB_API int ni_get_device_numa_node(const char *p_dev);
+
+/*!*****************************************************************************
+ *  \brief Get the NUMA node of the CPU the calling thread is running on
+ *
+ *  \return NUMA node number, -1 if unknown or not supported on this platform
+ ******************************************************************************/
+LIB_API int ni_get_current_numa_node(void);
+
+/*!*****************************************************************************
+ *  \brief Set a preferred NUMA node memory policy on a range of host memory
+ *         so its pages are placed on (or migrated to) the given node. Best
+ *         called right after allocation, before the buffer is first touched.
+ *
+ *  \param[in] p_buf      start of the memory range
+ *  \param[in] size       size of the memory range in bytes
+ *  \param[in] numa_node  NUMA node to bind to
+ *
+ *  \return 0 on success, -1 on failure or if not supported on this platform
+ ******************************************************************************/
+LIB_API int ni_numa_bind_buffer(void *p_buf, size_t size, int numa_node);
+
+// Huge page arena for DMA sized buffers (Linux only): size-class pool blocks,
+// unpooled buffers and decoder frame buffers of NI_MEM_HUGE_PAGE_SIZE or more
+// can be mapped from 2 MiB pages, either transparent huge pages advised with
+// madvise() or pages reserved in hugetlbfs (falling back to transparent huge
+// pages when none are free). Selected with ni_mem_set_huge_pages() or the
+// NI_MEM_HUGE_PAGES environment variable ("off", "thp" or "hugetlb").
+#define NI_MEM_HUGE_PAGE_SIZE           (2 * 1024 * 1024)
+#define NI_MEM_HUGE_PAGES_ENV           "NI_MEM_HUGE_PAGES"
+
+typedef enum _ni_mem_huge_pages
+{
+    NI_MEM_HUGE_PAGES_OFF = 0,  // posix_memalign() as for smaller buffers
+    NI_MEM_HUGE_PAGES_THP,      // mmap() 2 MiB aligned, MADV_HUGEPAGE
+    NI_MEM_HUGE_PAGES_HUGETLB   // mmap() with MAP_HUGETLB, else as THP
+} ni_mem_huge_pages_t;
+
+/*!*****************************************************************************
+ *  \brief Select how buffers of NI_MEM_HUGE_PAGE_SIZE or more are backed.
+ *         Can only be changed while no such buffer is allocated, i.e. before
+ *         sessions are opened, or after they are closed and
+ *         ni_mem_pool_trim(0) was called.
+ *
+ *  \param[in] mode  NI_MEM_HUGE_PAGES_OFF, _THP or _HUGETLB
+ *
+ *  \return 0 for success, EBUSY if buffers are allocated, ENOTSUP if huge
+ *          pages are not supported on this platform, EINVAL for bad mode
+ ******************************************************************************/
+LIB_API int ni_mem_set_huge_pages(ni_mem_huge_pages_t mode);
+
+/*!*****************************************************************************
+ *  \brief Allocate a page aligned buffer directly from the system, from the
+ *         huge page arena if it is enabled and the buffer is large enough.
+ *         Used for blocks of the size-class pool and of the decoder frame
+ *         buffer pool; most callers want ni_mem_pool_alloc() instead.
+ *
+ *  \param[out] pp_buf  address of the buffer, NULL on failure
+ *  \param[in]  size    size in bytes
+ *
+ *  \return 0 for success, ENOMEM for error
+ ******************************************************************************/
+LIB_API int ni_mem_arena_alloc(void **pp_buf, size_t size);
+
+/*!*****************************************************************************
+ *  \brief Free a buffer from ni_mem_arena_alloc
+ *
+ *  \param[in] p_buf  buffer, may be NULL
+ *  \param[in] size   size it was allocated with
+ *
+ *  \return
+ ******************************************************************************/
+LIB_API void ni_mem_arena_free(void *p_buf, size_t size);
+
+// Process wide size-class pool for page aligned frame, packet and metadata
+// buffers. Sizes are rounded up to one of 4 classes per power of two (at
+// most 25% slack); freed blocks are kept in a small per-thread cache first,
+// then in a depot shared by all threads, and are only given back to the
+// system by ni_mem_pool_trim() or when a cache limit is exceeded.
+#define NI_MEM_POOL_MAX_SIZE            (256 * 1024 * 1024) // larger: unpooled
+#define NI_MEM_POOL_NUM_CLASSES         60
+#define NI_MEM_POOL_THREAD_CACHE_DEPTH  4                   // blocks per class
+#define NI_MEM_POOL_THREAD_CACHE_BYTES  (64 * 1024 * 1024)
+#define NI_MEM_POOL_DEPOT_BYTES         (512 * 1024 * 1024)
+
+typedef struct _ni_mem_pool_stats
+{
+    uint64_t allocs;          // ni_mem_pool_alloc calls
+    uint64_t thread_hits;     // served from the calling thread's cache
+    uint64_t depot_hits;      // served from the shared depot
+    uint64_t system_allocs;   // blocks taken from the system allocator
+    uint64_t system_frees;    // blocks given back to the system allocator
+    uint64_t unpooled;        // requests above NI_MEM_POOL_MAX_SIZE
+    uint64_t bytes_in_use;    // class bytes handed out and not yet freed
+    uint64_t bytes_cached;    // class bytes held in thread caches and depot
+    uint64_t huge_bytes;      // bytes mapped for the huge page arena
+    uint64_t hugetlb_fallbacks;  // MAP_HUGETLB failures, mapped as THP
+} ni_mem_pool_stats_t;
+
+/*!*****************************************************************************
+ *  \brief Allocate a page aligned buffer from the size-class pool. The
+ *         content is not initialized.
+ *
+ *  \param[out] pp_buf  address of the buffer, NULL on failure
+ *  \param[in]  size    requested size in bytes
+ *
+ *  \return 0 for success, ENOMEM for error
+ ******************************************************************************/
+LIB_API int ni_mem_pool_alloc(void **pp_buf, size_t size);
+
+/*!*****************************************************************************
+ *  \brief Give a buffer from ni_mem_pool_alloc back to the pool
+ *
+ *  \param[in] p_buf  buffer, may be NULL
+ *  \param[in] size   size it was allocated with
+ *
+ *  \return
+ ******************************************************************************/
+LIB_API void ni_mem_pool_free(void *p_buf, size_t size);
+
+/*!*****************************************************************************
+ *  \brief Release cached pool blocks to the system. The calling thread's
+ *         cache is emptied into the depot, then depot blocks are freed,
+ *         largest classes first, until at most keep_bytes remain. Caches of
+ *         other threads are released when those threads exit.
+ *
+ *  \param[in] keep_bytes  depot bytes to keep, 0 to free all
+ *
+ *  \return bytes released
+ ******************************************************************************/
+LIB_API uint64_t ni_mem_pool_trim(uint64_t keep_bytes);
+
+/*!*****************************************************************************
+ *  \brief Get the size-class pool counters of this process
+ *
+ *  \param[out] p_stats  counters
+ *
+ *  \return
+ ******************************************************************************/
+LIB_API void ni_mem_pool_get_stats(ni_mem_pool_stats_t *p_stats);
+
+// Host memory accounting: libxcoder allocations that grow with the work a
+// session does are charged to a category, to the process and, where the
+// session is known, to the session, which may be capped (mem_cap in the
+// session context)
+typedef enum _ni_mem_category
+{
+    NI_MEM_CAT_FRAME_POOL = 0,  // decoder frame buffer pool
+    NI_MEM_CAT_TIMESTAMP,       // pts/dts queue nodes, decoder packet fifo
+    NI_MEM_CAT_BOUNCE,          // aligned copies of unaligned NVMe I/O buffers
+    NI_MEM_CAT_KEEP_ALIVE,      // keep alive thread arguments and buffer
+    NI_MEM_CAT_CUSTOM_SEI,      // custom SEI sets waiting for their frame
+    NI_MEM_CAT_ROI,             // encoder ROI maps
+    NI_MEM_CAT_ENC_INPUT,       // encoder metadata/start slab, staging planes
+    NI_MEM_CAT_COUNT
+} ni_mem_category_t;
+
+typedef struct _ni_mem_usage
+{
+    uint64_t current_bytes[NI_MEM_CAT_COUNT];
+    uint64_t peak_bytes[NI_MEM_CAT_COUNT];
+    uint64_t total_bytes;       // sum of current_bytes
+    uint64_t total_peak_bytes;  // highest total_bytes
+    uint64_t cap_bytes;         // session cap, 0 if none
+    uint64_t cap_failures;      // allocations refused at the cap
+} ni_mem_usage_t;
+
+// counters of a session (or of the process), shared with the frame buffer
+// pool and encoder slab which may outlive the session
+typedef struct _ni_mem_account
+{
+    volatile uint64_t current_bytes[NI_MEM_CAT_COUNT];
+    volatile uint64_t peak_bytes[NI_MEM_CAT_COUNT];
+    volatile uint64_t total_bytes;
+    volatile uint64_t total_peak_bytes;
+    uint64_t cap_bytes;
+    volatile uint64_t cap_failures;
+    volatile int32_t ref_count;
+} ni_mem_account_t;
+
+ni_mem_account_t *ni_mem_account_create(uint64_t cap_bytes);
+void ni_mem_account_ref(ni_mem_account_t *p_account);
+void ni_mem_account_unref(ni_mem_account_t *p_account);
+int ni_mem_account_charge(ni_mem_account_t *p_account, ni_mem_category_t cat,
+                          uint64_t size);
+void ni_mem_account_uncharge(ni_mem_account_t *p_account,
+                             ni_mem_category_t cat, uint64_t size);
+void ni_mem_account_uncharge_all(ni_mem_account_t *p_account,
+                                 ni_mem_category_t cat);
+int ni_mem_account_at_cap(ni_mem_account_t *p_account, uint64_t size);
+void ni_mem_account_get_usage(ni_mem_account_t *p_account,
+                              ni_mem_usage_t *p_usage);
+
+/*!*****************************************************************************
+ *  \brief Get the host memory libxcoder holds in this process, per category,
+ *         for all sessions and allocations not tied to a session
+ *
+ *  \param[out] p_usage  current and peak bytes per category
+ *
+ *  \return
+ ******************************************************************************/
+LIB_API void ni_mem_get_usage(ni_mem_usage_t *p_usage);
+
+/*!*****************************************************************************
+ *  \brief Get the host memory libxcoder holds for a session, per category.
+ *         Memory of session buffers still held by the application after
+ *         close (decoded frames, borrowed encoder buffers) stays counted.
+ *
+ *  \param[in]  p_ctx    session context, opened at least once
+ *  \param[out] p_usage  current and peak bytes per category
+ *
+ *  \return On success
+ *                          NI_RETCODE_SUCCESS
+ *          On failure
+ *                          NI_RETCODE_INVALID_PARAM
+ ******************************************************************************/
+LIB_API ni_retcode_t ni_device_session_get_mem_usage(ni_session_context_t *p_ctx,
+                                                     ni_mem_usage_t *p_usage);
+
+// NVMe command trace ring file, see ni_nvme_trace_start()
+#define NI_NVME_TRACE_MAGIC           0x4E49545A // "NITZ"
+#define NI_NVME_TRACE_VERSION         1
+#define NI_NVME_TRACE_DEFAULT_RECORDS 65536
+#define NI_NVME_TRACE_ENV             "NI_NVME_TRACE_FILE"
+
+typedef enum _ni_nvme_trace_op
+{
+    NI_NVME_TRACE_OP_READ = 1,
+    NI_NVME_TRACE_OP_WRITE = 2,
+} ni_nvme_trace_op_t;
+
+// which part of the instance LBA space a command addressed
+typedef enum _ni_nvme_trace_lba_class
+{
+    NI_NVME_TRACE_LBA_CTRL = 0,  // control command, op/subtype/option valid
+    NI_NVME_TRACE_LBA_READ = 1,  // receive frame/packet
+    NI_NVME_TRACE_LBA_WRITE = 2, // send frame/packet
+} ni_nvme_trace_lba_class_t;
+
+typedef struct _ni_nvme_trace_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t record_size;
+    uint32_t capacity;     // number of records in the ring
+    uint32_t reserved0;
+    uint64_t write_index;  // total records claimed since the file was created
+    uint64_t create_time;  // ni_gettime_ns() when the file was created
+    uint8_t reserved[24];
+} ni_nvme_trace_header_t;
+
+typedef struct _ni_nvme_trace_record
+{
+    uint64_t seq;          // write index + 1 once complete, else record is torn
+    uint64_t timestamp;    // command start, ni_gettime_ns()
+    uint32_t duration;     // ns, saturated at UINT32_MAX
+    uint32_t lba;          // 4K aligned
+    uint32_t data_len;
+    int32_t rc;            // ni_retcode_t of the command
+    uint32_t pid;
+    uint32_t tid;
+    uint16_t session_id;
+    uint8_t opcode;        // ni_nvme_trace_op_t
+    uint8_t device_type;   // ni_device_type_t decoded from lba
+    uint8_t lba_class;     // ni_nvme_trace_lba_class_t
+    uint8_t lba_op;        // decoded from lba, control commands only
+    uint8_t lba_subtype;
+    uint8_t lba_option;
+} ni_nvme_trace_record_t;
+
+/*!*****************************************************************************
+ *  \brief Start recording every NVMe read/write command of this process as a
+ *         fixed-size binary record in a memory-mapped ring file. Processes
+ *         that open the same file share the ring. Tracing is also started on
+ *         the first command if the NI_NVME_TRACE_FILE environment variable
+ *         names a file. Decode the file with ni_trace_dump.
+ *         The file is created readable by its owner only. A file of another
+ *         trace version is unlinked and replaced, processes still mapping it
+ *         keep writing to the old one.
+ *
+ *  \param[in] p_path       ring file path
+ *  \param[in] num_records  ring capacity if the file is created, 0 for
+ *                          NI_NVME_TRACE_DEFAULT_RECORDS
+ *
+ *  \return NI_RETCODE_SUCCESS on success, NI_RETCODE_ERROR_UNSUPPORTED_FEATURE
+ *          on platforms without mmap, other ni_retcode_t on failure
+ ******************************************************************************/
+LIB_API ni_retcode_t ni_nvme_trace_start(const char *p_path,
+                                         uint32_t num_records);
+
+/*!*****************************************************************************
+ *  \brief Stop NVMe command tracing. No new records are written once this
+ *         returns, but the ring file stays mapped: commands in flight on
+ *         other threads may still be writing their record. The mapping is
+ *         released by the next ni_nvme_trace_start(), or at process exit.
+ *
+ *  \return
+ ******************************************************************************/
+LIB_API void ni_nvme_trace_stop(void);
+
+// Per process performance counters, published in a shared memory segment
+// with one slot per process so that ni_rsrc_mon can read and aggregate them
+#define NI_PERF_SHM_NAME        "NI_SHM_PERF_COUNTERS"
+#define NI_PERF_MAGIC           0x4E495043 // "NIPC"
+#define NI_PERF_VERSION         2          // 2: slots owned by record locks
+#define NI_PERF_MAX_PROCESSES   256
+#define NI_PERF_COUNTER_SLOTS   30         // room for new counters
+
+typedef enum _ni_perf_counter
+{
+    NI_PERF_CTR_NVME_READ_DATA = 0,  // frame/packet reads
+    NI_PERF_CTR_NVME_READ_CTRL,      // control reads (queries, status)
+    NI_PERF_CTR_NVME_WRITE_DATA,     // frame/packet writes
+    NI_PERF_CTR_NVME_WRITE_CTRL,     // control writes (config, open, close)
+    NI_PERF_CTR_NVME_ADMIN,          // admin commands
+    NI_PERF_CTR_NVME_ERRORS,         // failed read/write commands
+    NI_PERF_CTR_BYTES_READ,
+    NI_PERF_CTR_BYTES_WRITTEN,
+    NI_PERF_CTR_QUERIES,             // buffer/output query loop iterations
+    NI_PERF_CTR_QUERY_HITS,          // query loops that found the device ready,
+                                     // QUERIES - QUERY_HITS are retries
+    NI_PERF_CTR_BOUNCE_COPIES,       // unaligned buffers copied for NVMe I/O
+    NI_PERF_CTR_BOUNCE_BYTES,
+    NI_PERF_CTR_BUF_POOL_EXPAND,     // dec frame buffer pool growth steps
+    NI_PERF_CTR_TS_QUEUE_OVERFLOW,   // timestamp queue entries dropped
+    NI_PERF_CTR_WRITE_BUFFER_FULL,   // NI_RETCODE_NVME_SC_WRITE_BUFFER_FULL
+    NI_PERF_CTR_NVME_IO,             // io pass-through commands
+    NI_PERF_CTR_MAX,
+} ni_perf_counter_t;
+
+typedef struct _ni_perf_counters
+{
+    int32_t pid;           // owning process in its own PID namespace
+    uint32_t num_counters; // NI_PERF_CTR_MAX of the library that owns it
+    uint64_t start_time;   // ni_gettime_ns() when the slot was claimed
+    uint64_t value[NI_PERF_COUNTER_SLOTS];  // indexed by ni_perf_counter_t
+} ni_perf_counters_t;      // 256 bytes, whole cache lines
+
+typedef struct _ni_perf_counters_table
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_slots;
+    uint32_t slot_size;
+    uint8_t reserved[48];
+    ni_perf_counters_t slot[NI_PERF_MAX_PROCESSES];
+} ni_perf_counters_table_t;
+
+/*!*****************************************************************************
+ *  \brief Add to a performance counter of this process. Lock-free, a no-op on
+ *         platforms without POSIX shared memory or if the segment can not be
+ *         mapped.
+ *
+ *  \param[in] counter  counter to add to
+ *  \param[in] n        amount
+ *
+ *  \return
+ ******************************************************************************/
+void ni_perf_count(ni_perf_counter_t counter, uint64_t n);
+
+/*!*****************************************************************************
+ *  \brief Read the performance counters of every live process using
+ *         libxcoder and their sum
+ *
+ *  \param[out] p_procs    per process counters, may be NULL
+ *  \param[in]  max_procs  number of entries p_procs can hold
+ *  \param[out] p_total    sum over live processes, may be NULL; pid is the
+ *                         number of processes summed
+ *
+ *  \return number of live processes, which may exceed max_procs, or -1 if the
+ *          counters are not available
+ ******************************************************************************/
+LIB_API int ni_perf_counters_read(ni_perf_counters_t *p_procs, int max_procs,
+                                  ni_perf_counters_t *p_total);
+
+/*!*****************************************************************************
+ *  \brief Get the name of a performance counter
+ *
+ *  \param[in] counter  counter
+ *
+ *  \return lower case name, e.g. "nvme_read_data", or "unknown"
+ ******************************************************************************/
+LIB_API const char *ni_perf_counter_name(ni_perf_counter_t counter);
+
 LIB_API uint64_t ni_gettime_ns(void);
 LIB_API void ni_usleep(int64_t usec);
 LIB_API char *ni_strtok(char *s, const char *delim, char **saveptr);
@@ -0,0 +1,391 @@
+/*******************************************************************************
+ *
+ * Copyright (C) 2022 NETINT Technologies
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+/*!*****************************************************************************
+ *  \file   test_rsrc_broker.c
+ *
+ *  \brief  Self test of the local resource broker. Builds a resource pool of
+ *          mocked devices in shared memory, runs ni_rsrc_broker_run() without
+ *          load polling (so no device is opened) and checks the devices
+ *          ni_rsrc_allocate_auto() and ni_rsrc_release_resource() get from it.
+ *          Refuses to run on a host where init_rsrc has created a pool.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if __linux__ || __APPLE__
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#include "ni_rsrc_api.h"
+#include "ni_rsrc_priv.h"
+#include "ni_util.h"
+
+#if (__linux__ || __APPLE__) && !defined(_ANDROID)
+
+#define MOCK_DEVICE_CNT 3
+#define MOCK_MAX_INSTANCES 4
+
+static const mode_t g_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+static ni_device_queue_t *g_p_queue = NULL;
+static int g_load_table_created = 0;
+static int g_failures = 0;
+
+#define CHECK(cond, ...)                                                       \
+    do                                                                         \
+    {                                                                          \
+        if (!(cond))                                                           \
+        {                                                                      \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__);               \
+            fprintf(stderr, __VA_ARGS__);                                      \
+            fprintf(stderr, "\n");                                             \
+            g_failures++;                                                      \
+        }                                                                      \
+    } while (0)
+
+/*!*****************************************************************************
+ *  \brief  Create the mocked resource pool: the device queue and one record
+ *          per mocked decoder and encoder
+ *
+ *  \return 0 on success, 1 if a pool already exists, -1 on failure
+ ******************************************************************************/
+static int create_mock_pool(void)
+{
+    ni_device_info_t info;
+    int shm_fd;
+    int type, guid, i;
+
+    shm_fd = shm_open(CODERS_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, g_mode);
+    if (shm_fd < 0)
+    {
+        return (EEXIST == errno) ? 1 : -1;
+    }
+    if (ftruncate(shm_fd, sizeof(ni_device_queue_t)) < 0)
+    {
+        close(shm_fd);
+        shm_unlink(CODERS_SHM_NAME);
+        return -1;
+    }
+    g_p_queue = (ni_device_queue_t *)mmap(0, sizeof(ni_device_queue_t),
+                                          PROT_READ | PROT_WRITE, MAP_SHARED,
+                                          shm_fd, 0);
+    close(shm_fd);
+    if (MAP_FAILED == g_p_queue)
+    {
+        g_p_queue = NULL;
+        shm_unlink(CODERS_SHM_NAME);
+        return -1;
+    }
+
+    shm_fd = shm_open(CODERS_LOAD_SHM_NAME, O_RDWR, g_mode);
+    if (shm_fd >= 0)
+    {
+        close(shm_fd);
+    } else
+    {
+        g_load_table_created = 1;
+    }
+
+    memset(g_p_queue->xcoders, -1, sizeof(g_p_queue->xcoders));
+    for (type = NI_DEVICE_TYPE_DECODER; type <= NI_DEVICE_TYPE_ENCODER; type++)
+    {
+        for (guid = 0; guid < MOCK_DEVICE_CNT; guid++)
+        {
+            memset(&info, 0, sizeof(info));
+            snprintf(info.dev_name, sizeof(info.dev_name), "/dev/mock%d", guid);
+            snprintf(info.blk_name, sizeof(info.blk_name), "/dev/mock%d", guid);
+            info.device_type = (ni_device_type_t)type;
+            info.module_id = guid;
+            info.hw_id = guid;
+            info.numa_node = -1;
+            info.topology_magic = NI_DEVICE_INFO_TOPOLOGY_MAGIC;
+            info.max_instance_cnt = MOCK_MAX_INSTANCES;
+            // H.264 only
+            for (i = 0; i < EN_CODEC_MAX; i++)
+            {
+                info.dev_cap[i].supports_codec = EN_INVALID;
+            }
+            info.dev_cap[0].supports_codec = EN_H264;
+            ni_rsrc_get_one_device_info(&info);
+            g_p_queue->xcoders[type][guid] = guid;
+        }
+        g_p_queue->xcoder_cnt[type] = MOCK_DEVICE_CNT;
+    }
+    return 0;
+}
+
+static void set_mock_load(ni_device_type_t type, int guid, int load,
+                          int model_load, uint32_t active_num_inst)
+{
+    ni_device_info_t info;
+    ni_device_load_t device_load;
+
+    memset(&info, 0, sizeof(info));
+    info.device_type = type;
+    info.module_id = guid;
+    device_load.load = load;
+    device_load.model_load = model_load;
+    device_load.active_num_inst = active_num_inst;
+    ni_rsrc_set_device_load(ni_rsrc_get_load_table(), &info, &device_load);
+}
+
+static void destroy_mock_pool(void)
+{
+    char name[32];
+    int type, guid;
+
+    for (type = NI_DEVICE_TYPE_DECODER; type <= NI_DEVICE_TYPE_ENCODER; type++)
+    {
+        for (guid = 0; guid < MOCK_DEVICE_CNT; guid++)
+        {
+            set_mock_load((ni_device_type_t)type, guid, 0, 0, 0);
+            ni_rsrc_get_shm_name((ni_device_type_t)type, guid, name,
+                                 sizeof(name));
+            shm_unlink(name);
+            ni_rsrc_get_lock_name((ni_device_type_t)type, guid, name,
+                                  sizeof(name));
+            unlink(name);
+        }
+    }
+    munmap(g_p_queue, sizeof(ni_device_queue_t));
+    shm_unlink(CODERS_SHM_NAME);
+    unlink(CODERS_LCK_NAME);
+    if (g_load_table_created)
+    {
+        shm_unlink(CODERS_LOAD_SHM_NAME);
+    }
+}
+
+static void *broker_thread(void *arg)
+{
+    (void)arg;
+    // no load polling: serve the mocked load table, never open a device
+    return (void *)(intptr_t)ni_rsrc_broker_run(0);
+}
+
+static ni_device_context_t *allocate_codec(ni_device_type_t type,
+                                           ni_codec_t codec, int *p_guid)
+{
+    ni_device_context_t *p_ctx;
+    uint64_t load = 0;
+
+    p_ctx = ni_rsrc_allocate_auto(type, EN_ALLOC_LEAST_LOAD, codec, 1920, 1080,
+                                  30, &load);
+    *p_guid = p_ctx ? p_ctx->p_device_info->module_id : -1;
+    return p_ctx;
+}
+
+static ni_device_context_t *allocate(ni_device_type_t type, int *p_guid)
+{
+    return allocate_codec(type, EN_H264, p_guid);
+}
+
+/*!*****************************************************************************
+ *  \brief  Connect to the broker and send nothing, like a hung client
+ *
+ *  \return socket, -1 on failure
+ ******************************************************************************/
+static int connect_idle_client(void)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
+             NI_RSRC_BROKER_SOCK_NAME);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void run_tests(void)
+{
+    ni_device_context_t *p_ctx[4];
+    ni_device_context_t *p_direct;
+    uint64_t start_ns;
+    int idle_fd;
+    int guid;
+
+    // least loaded decoder
+    set_mock_load(NI_DEVICE_TYPE_DECODER, 0, 50, 0, 1);
+    set_mock_load(NI_DEVICE_TYPE_DECODER, 1, 10, 0, 1);
+    set_mock_load(NI_DEVICE_TYPE_DECODER, 2, 30, 0, 1);
+    p_ctx[0] = allocate(NI_DEVICE_TYPE_DECODER, &guid);
+    CHECK(p_ctx[0] && p_ctx[0]->broker_granted,
+          "decoder not allocated by the broker");
+    CHECK(1 == guid, "least loaded decoder: got guid %d, expected 1", guid);
+    ni_rsrc_release_resource(p_ctx[0], 0);
+    CHECK(p_ctx[0] && !p_ctx[0]->broker_granted, "grant not released");
+    ni_rsrc_free_device_context(p_ctx[0]);
+
+    // a burst on equally loaded decoders is spread by pending allocations
+    set_mock_load(NI_DEVICE_TYPE_DECODER, 0, 20, 0, 1);
+    set_mock_load(NI_DEVICE_TYPE_DECODER, 1, 20, 0, 1);
+    set_mock_load(NI_DEVICE_TYPE_DECODER, 2, 90, 0, 1);
+    p_ctx[0] = allocate(NI_DEVICE_TYPE_DECODER, &guid);
+    CHECK(0 == guid, "burst 1: got guid %d, expected 0", guid);
+    p_ctx[1] = allocate(NI_DEVICE_TYPE_DECODER, &guid);
+    CHECK(1 == guid, "burst 2: got guid %d, expected 1", guid);
+
+    // releasing the first makes guid 0 the better choice again
+    ni_rsrc_release_resource(p_ctx[0], 0);
+    p_ctx[2] = allocate(NI_DEVICE_TYPE_DECODER, &guid);
+    CHECK(0 == guid, "after release: got guid %d, expected 0", guid);
+
+    // releasing a context the broker did not grant must not touch its
+    // counters: guid 0 keeps its pending allocation
+    ni_rsrc_release_resource(p_ctx[1], 0);
+    p_direct = ni_rsrc_get_device_context(NI_DEVICE_TYPE_DECODER, 0);
+    CHECK(p_direct && !p_direct->broker_granted, "direct context granted");
+    ni_rsrc_release_resource(p_direct, 0);
+    ni_rsrc_free_device_context(p_direct);
+    p_ctx[3] = allocate(NI_DEVICE_TYPE_DECODER, &guid);
+    CHECK(1 == guid, "ungranted release: got guid %d, expected 1", guid);
+
+    ni_rsrc_release_resource(p_ctx[2], 0);
+    ni_rsrc_release_resource(p_ctx[3], 0);
+    ni_rsrc_free_device_context(p_ctx[0]);
+    ni_rsrc_free_device_context(p_ctx[1]);
+    ni_rsrc_free_device_context(p_ctx[2]);
+    ni_rsrc_free_device_context(p_ctx[3]);
+
+    // encoders are compared by model load
+    set_mock_load(NI_DEVICE_TYPE_ENCODER, 0, 10, 80, 1);
+    set_mock_load(NI_DEVICE_TYPE_ENCODER, 1, 90, 20, 1);
+    set_mock_load(NI_DEVICE_TYPE_ENCODER, 2, 10, 60, 1);
+    p_ctx[0] = allocate(NI_DEVICE_TYPE_ENCODER, &guid);
+    CHECK(1 == guid, "least model load encoder: got guid %d, expected 1",
+          guid);
+    ni_rsrc_release_resource(p_ctx[0], 0);
+    ni_rsrc_free_device_context(p_ctx[0]);
+
+    // a decoder running its maximum of instances is skipped
+    set_mock_load(NI_DEVICE_TYPE_DECODER, 0, 0, 0, MOCK_MAX_INSTANCES);
+    set_mock_load(NI_DEVICE_TYPE_DECODER, 1, 40, 0, 1);
+    set_mock_load(NI_DEVICE_TYPE_DECODER, 2, 20, 0, 1);
+    p_ctx[0] = allocate(NI_DEVICE_TYPE_DECODER, &guid);
+    CHECK(p_ctx[0] && p_ctx[0]->broker_granted && 2 == guid,
+          "full decoder: got guid %d, expected 2", guid);
+    ni_rsrc_release_resource(p_ctx[0], 0);
+    ni_rsrc_free_device_context(p_ctx[0]);
+
+    // so is one without room for the model load of the new job
+    set_mock_load(NI_DEVICE_TYPE_DECODER, 0, 0, 99, 1);
+    set_mock_load(NI_DEVICE_TYPE_DECODER, 1, 40, 0, 1);
+    set_mock_load(NI_DEVICE_TYPE_DECODER, 2, 20, 0, 1);
+    p_ctx[0] = allocate(NI_DEVICE_TYPE_DECODER, &guid);
+    CHECK(p_ctx[0] && p_ctx[0]->broker_granted && 2 == guid,
+          "loaded decoder: got guid %d, expected 2", guid);
+    ni_rsrc_release_resource(p_ctx[0], 0);
+    ni_rsrc_free_device_context(p_ctx[0]);
+
+    // no mocked device supports H.265: the broker refuses and the fallback
+    // sweep cannot open the mocked devices
+    p_ctx[0] = allocate_codec(NI_DEVICE_TYPE_ENCODER, EN_H265, &guid);
+    CHECK(!p_ctx[0], "unsupported codec: got guid %d, expected none", guid);
+    ni_rsrc_free_device_context(p_ctx[0]);
+
+    // a client that never sends its request does not hold up others
+    idle_fd = connect_idle_client();
+    CHECK(idle_fd >= 0, "cannot connect to the broker");
+    start_ns = ni_gettime_ns();
+    p_ctx[0] = allocate(NI_DEVICE_TYPE_DECODER, &guid);
+    CHECK(p_ctx[0] && p_ctx[0]->broker_granted &&
+              ni_gettime_ns() - start_ns <
+                  (uint64_t)NI_RSRC_BROKER_TIMEOUT_MS * 1000000 / 2,
+          "allocation waited for an idle client");
+    ni_rsrc_release_resource(p_ctx[0], 0);
+    ni_rsrc_free_device_context(p_ctx[0]);
+    if (idle_fd >= 0)
+    {
+        close(idle_fd);
+    }
+}
+
+int main(void)
+{
+    pthread_t thread;
+    void *thread_ret = NULL;
+    int ret;
+    int i;
+
+    ret = create_mock_pool();
+    if (ret)
+    {
+        fprintf(stderr, "%s\n", (ret > 0) ?
+                "A resource pool exists (init_rsrc was run), not touching it" :
+                "Cannot create the mocked resource pool");
+        return 2;
+    }
+
+    if (pthread_create(&thread, NULL, broker_thread, NULL))
+    {
+        fprintf(stderr, "Cannot start the resource broker\n");
+        destroy_mock_pool();
+        return 2;
+    }
+    for (i = 0; i < 200 && access(NI_RSRC_BROKER_SOCK_NAME, F_OK); i++)
+    {
+        ni_usleep(10000);
+    }
+    CHECK(i < 200, "resource broker did not start");
+    if (!g_failures)
+    {
+        run_tests();
+    }
+
+    g_xcoder_stop_process = 1;
+    pthread_join(thread, &thread_ret);
+    CHECK(NULL == thread_ret, "resource broker exited with %d",
+          (int)(intptr_t)thread_ret);
+    destroy_mock_pool();
+
+    printf("%s\n", g_failures ? "FAILED" : "PASSED");
+    return g_failures ? 1 : 0;
+}
+
+#else
+
+int main(void)
+{
+    fprintf(stderr, "The resource broker is only supported on Linux and MacOS\n");
+    return 0;
+}
+
+#endif